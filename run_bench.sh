@@ -0,0 +1,99 @@
+#!/usr/bin/env bash
+# Throughput benchmarks (make bench)
+# The datasets are generated by src/fastq_synth (same seed => same
+# files) and each program is run with --stats. The results (one line
+# per benchmark) are written to $BENCH_DIR/results.tsv:
+# benchmark, program, reads (fastq entries or alignments read from all
+# the input files), input MB, wall time (s), reads/s, MB/s (input),
+# peak RSS (KB), user and system time (s).
+#
+# Environment variables:
+#  BENCH_READS   number of reads in the short read datasets (1000000)
+#  BENCH_ONT_READS  number of long reads (20000)
+#  BENCH_SEED    seed used to generate the data (1)
+#  BENCH_THREADS value of --threads (1)
+#  BENCH_DIR     directory for the data and the results (bench)
+#  BENCH_DS_KEYS number of keys in the hash table benchmarks of
+#                src/ds_bench (1000000,10000000)
+#
+# The benchmarks of the data structures (hash table and range lists)
+# are written to $BENCH_DIR/ds_results.tsv.
+
+BENCH_READS=${BENCH_READS:-1000000}
+BENCH_ONT_READS=${BENCH_ONT_READS:-20000}
+BENCH_SEED=${BENCH_SEED:-1}
+BENCH_THREADS=${BENCH_THREADS:-1}
+BENCH_DIR=${BENCH_DIR:-bench}
+BENCH_DS_KEYS=${BENCH_DS_KEYS:-1000000,10000000}
+
+SRC=$PWD/src
+DATA=$BENCH_DIR/data_${BENCH_READS}_${BENCH_ONT_READS}_${BENCH_SEED}
+OUT=$BENCH_DIR/out
+RESULTS=$BENCH_DIR/results.tsv
+
+set -o pipefail
+mkdir -p $DATA $OUT || exit 1
+
+let num_failed=0
+
+# value of a field in the --stats file
+function stats_field {
+    sed -n "s/^  \"$2\": \(.*\),\$/\1/p" $1
+}
+
+function gen_data {
+    type=$1
+    reads=$2
+    if [ ! -e $DATA/$type.done ]; then
+	echo "Generating $type data ($reads reads)"
+	$SRC/fastq_synth --type $type --reads $reads --seed $BENCH_SEED --out $DATA/$type > /dev/null 2> $DATA/$type.log && touch $DATA/$type.done || { cat $DATA/$type.log; exit 1; }
+    fi
+}
+
+# bench name "input files" program args...
+function bench {
+    name=$1
+    inputs=$2
+    shift 2
+    stats=$OUT/$name.stats.json
+    rm -f $stats
+    "$@" --stats $stats > $OUT/$name.log 2>&1
+    if [ 0 -ne $? ] || [ ! -s $stats ]; then
+	echo "FAILED $name: $*"
+	tail -n 5 $OUT/$name.log
+	let num_failed=num_failed+1
+	return
+    fi
+    bytes=$(cat $inputs | wc -c)
+    wall=$(stats_field $stats wall_s)
+    reads=$(stats_field $stats records)
+    awk -v n=$name -v t=$(basename $1) -v r=$reads -v b=$bytes -v w=$wall -v rss=$(stats_field $stats max_rss_kb) -v u=$(stats_field $stats user_s) -v s=$(stats_field $stats sys_s) 'BEGIN{if (w<=0) w=1e-6; printf("%s\t%s\t%d\t%.1f\t%.3f\t%.0f\t%.1f\t%d\t%.3f\t%.3f\n",n,t,r,b/1e6,w,r/w,b/1e6/w,rss,u,s);}' >> $RESULTS
+    tail -n 1 $RESULTS
+}
+
+#############################################
+gen_data se $BENCH_READS
+gen_data pe $BENCH_READS
+gen_data 10x $BENCH_READS
+gen_data bam $BENCH_READS
+gen_data ont $BENCH_ONT_READS
+
+printf "benchmark\tprogram\treads\tinput_mb\twall_s\treads_per_s\tmb_per_s\tmax_rss_kb\tuser_s\tsys_s\n" > $RESULTS
+T="--threads $BENCH_THREADS"
+
+bench fastq_info_se "$DATA/se.fastq.gz" $SRC/fastq_info $T $DATA/se.fastq.gz
+bench fastq_info_pe "$DATA/pe_1.fastq.gz $DATA/pe_2.fastq.gz" $SRC/fastq_info $T $DATA/pe_1.fastq.gz $DATA/pe_2.fastq.gz
+bench fastq_info_ont "$DATA/ont.fastq.gz" $SRC/fastq_info $T $DATA/ont.fastq.gz
+bench fastq_filterpair "$DATA/pe_1.fastq.gz $DATA/pe_2.fastq.gz" $SRC/fastq_filterpair $T $DATA/pe_1.fastq.gz $DATA/pe_2.fastq.gz $OUT/fp_1.fastq.gz $OUT/fp_2.fastq.gz $OUT/fp_up.fastq.gz
+bench fastq_pre_barcodes "$DATA/10x_R1.fastq.gz $DATA/10x_R2.fastq.gz $DATA/10x_I1.fastq.gz" $SRC/fastq_pre_barcodes $T --read1 $DATA/10x_R2.fastq.gz --index1 $DATA/10x_R1.fastq.gz --umi_read index1 --umi_offset 16 --umi_size 12 --cell_read index1 --cell_offset 0 --cell_size 16 --index2 $DATA/10x_I1.fastq.gz --sample_read index2 --sample_offset 0 --sample_size 8 --outfile1 $OUT/pre.fastq.gz
+bench bam_add_tags "$DATA/bam.bam" $SRC/bam_add_tags --inbam $DATA/bam.bam --outbam $OUT/tags.bam --tx --tx_2_gx $DATA/bam_tx2gene.tsv
+bench bam_umi_count "$OUT/tags.bam" $SRC/bam_umi_count --bam $OUT/tags.bam --ucounts $OUT/umi_counts.mtx --min_reads 1 -x GX
+bench bam2fastq "$OUT/tags.bam" $SRC/bam2fastq $T --bam $OUT/tags.bam --out $OUT/b2f
+
+rm -f $OUT/*.fastq.gz $OUT/*.bam
+
+echo "Data structures"
+$SRC/ds_bench --keys $BENCH_DS_KEYS --seed $BENCH_SEED --check 0 > $BENCH_DIR/ds_results.tsv 2> $OUT/ds_bench.log || { echo "FAILED ds_bench"; tail -n 5 $OUT/ds_bench.log; let num_failed=num_failed+1; }
+echo "Results: $RESULTS"
+echo Failed benchmarks: $num_failed
+exit $num_failed
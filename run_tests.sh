@@ -38,6 +38,13 @@ must_fail 	./src/fastq_split_interleaved tests/test_e1.fastq.gz
 must_fail        ./src/fastq_split_interleaved 
 must_fail      ./src/fastq_split_interleaved   tests/test_21_2.fastq.gz xxx
 must_succeed "./src/fastq_split_interleaved tests/inter.fastq.gz tests/xxx && [ -e tests/xxx_1.fastq.gz ] && [ -e tests/xxx_2.fastq.gz ]"
+must_succeed "./src/fastq_split_interleaved --threads 3 tests/inter.fastq.gz tests/yyy && diff <(zcat tests/xxx_1.fastq.gz) <(zcat tests/yyy_1.fastq.gz) && diff <(zcat tests/xxx_2.fastq.gz) <(zcat tests/yyy_2.fastq.gz)"
+must_fail "./src/fastq_split_interleaved --threads 0 tests/inter.fastq.gz tests/yyy"
+zcat tests/c18_10000_1.fastq.gz | paste - - - - | awk -F'\t' '{print; sub(/ 1:/," 2:",$1); print $1"\t"$2"\t"$3"\t"$4}' | tr '\t' '\n' > inter_big.fastq
+must_succeed "./src/fastq_split_interleaved inter_big.fastq big1 && ./src/fastq_split_interleaved --threads 3 inter_big.fastq big3 && diff <(zcat big1_1.fastq.gz) <(zcat big3_1.fastq.gz) && diff <(zcat big1_2.fastq.gz) <(zcat big3_2.fastq.gz)"
+must_fail "sed '30002s/A/Z/' inter_big.fastq | ./src/fastq_split_interleaved --threads 3 - big3"
+must_fail "head -n 30004 inter_big.fastq | ./src/fastq_split_interleaved --threads 3 - big3"
+rm -f inter_big.fastq big[13]_[12].fastq.gz
 
 ##
 echo "*** bam2fastq"
@@ -102,6 +109,7 @@ must_fail  " ./src/bam_umi_count --min_reads 1 --bam tests/test_annot.bam --ucou
 must_succeed  " ./src/bam_umi_count --min_reads 1 --bam tests/test_annot5.bam --ucounts xx  -x TX --not_sorted_by_cell"
 
 must_succeed  " ./src/bam_umi_count --min_reads 1 --bam tests/test_annot5.bam --ucounts xx  -x GX --not_sorted_by_cell"
+must_succeed  " ./src/bam_umi_count --stats tmp_stats.json --min_reads 1 --bam tests/test_annot5.bam --ucounts xx  -x GX --not_sorted_by_cell && grep -q '\"bam_read\": {\"calls\": [0-9]*, \"records\": [1-9]' tmp_stats.json"
 
 must_fail  " ./src/bam_umi_count --min_reads 1 --bam tests/test_annot5.bam --ucounts /xx  -x GX --not_sorted_by_cell"
 
@@ -203,6 +211,9 @@ must_succeed "./src/fastq_trim_poly_at --file tests/poly_at.fastq.gz --outfile t
 must_succeed "zcat tests/poly_at.fastq.gz | ./src/fastq_trim_poly_at --file - --outfile tmp.fastq.gz --min_poly_at_len 300 --min_len 1 && diff <(zcat tests/poly_at.fastq.gz) <(zcat tmp.fastq.gz) " 
 
 must_succeed "diff <(zcat tests/poly_at.fastq.gz | ./src/fastq_trim_poly_at --file - --outfile -  --min_poly_at_len 300 --min_len 1|zcat ) <(zcat tests/poly_at.fastq.gz) "
+must_succeed "./src/fastq_trim_poly_at --threads 2 --file tests/poly_at.fastq.gz --outfile tmp.fastq.gz --min_poly_at_len 3 && gzip -t tmp.fastq.gz && diff <(zcat tests/poly_at_len3.fastq.gz) <(zcat tmp.fastq.gz) "
+must_fail "./src/fastq_trim_poly_at --file tests/poly_at.fastq.gz --outfile tmp.fastq.gz --threads"
+must_succeed "./src/fastq_trim_poly_at --file tests/c18_10000_1.fastq.gz --outfile tmp.fastq.gz --min_poly_at_len 3 --min_len 40 > tmp1.txt && ./src/fastq_trim_poly_at --threads 3 --file tests/c18_10000_1.fastq.gz --outfile tmp2.fastq.gz --min_poly_at_len 3 --min_len 40 > tmp2.txt && diff tmp1.txt tmp2.txt && diff <(zcat tmp.fastq.gz) <(zcat tmp2.fastq.gz)"
 
 #gcov src/fastq_trim_poly_at
 
@@ -212,6 +223,7 @@ must_succeed "./src/fastq_filter_n tests/test_21_2.fastq.gz > tmp && diff /dev/n
 must_fail "./src/fastq_filter_n -n 100 tests/test_21_2.fastq.gz > tmp && diff -q /dev/null tmp"
 must_fail "./src/fastq_filter_n tests/test_21_2.fastq.gz > tmp && diff  tests/test_21_2.fastq.gz tmp"
 must_succeed "./src/fastq_filter_n tests/test_1.fastq.gz > tmp && diff -q <(zcat tests/test_1.fastq.gz) tmp"
+must_succeed "./src/fastq_filter_n -n 2 tests/c18_10000_1.fastq.gz > tmp && ./src/fastq_filter_n --threads 3 -n 2 tests/c18_10000_1.fastq.gz | cmp - tmp"
 must_fail "./src/fastq_filter_n --help"
 must_fail "./src/fastq_filter_n"
 
@@ -224,8 +236,18 @@ must_fail "[ `./src/fastq_num_reads tests/test_21_2.fastq.gz` -ne 2 ]"
 must_succeed "[ `./src/fastq_num_reads tests/c18_10000_1.fastq.gz` -eq 10000 ]"
 must_fail "[ `./src/fastq_num_reads tests/c18_10000_1.fastq.gz` -ne 10000 ]"
 must_succeed "[ `./src/fastq_num_reads tests/one.fastq.gz` -eq 1 ]"
+must_succeed "[ `zcat tests/c18_10000_1.fastq.gz | ./src/fastq_num_reads -` -eq 10000 ]"
+must_succeed "[ `zcat tests/one.fastq.gz | head -c -1 | ./src/fastq_num_reads -` -eq 1 ]"
+must_succeed "[ `./src/fastq_num_reads tests/a_1.fastq.bz2` -eq `./src/fastq_num_reads tests/a_1.fastq.gz` ]"
+must_succeed "[ `cat tests/a_1.fastq.bz2 | ./src/fastq_num_reads -` -eq `./src/fastq_num_reads tests/a_1.fastq.gz` ]"
+must_succeed "zcat tests/c18_10000_1.fastq.gz | xz -c > c18_10000_1.fastq.xz && [ \`./src/fastq_num_reads c18_10000_1.fastq.xz\` -eq 10000 ]"
+must_succeed "zcat tests/c18_10000_1.fastq.gz > c18_10000_1.fastq && [ \`./src/fastq_num_reads c18_10000_1.fastq\` -eq 10000 ]"
+must_succeed "(zcat tests/c18_10000_1.fastq.gz | head -n 20000 | bzip2 -c; zcat tests/c18_10000_1.fastq.gz | tail -n +20001 | bzip2 -c) > c18_10000_1.cat.fastq.bz2 && [ \`./src/fastq_num_reads c18_10000_1.cat.fastq.bz2\` -eq 10000 ]"
+must_fail "head -c 100000 c18_10000_1.fastq.xz > c18_10000_1.trunc.fastq.xz && ./src/fastq_num_reads c18_10000_1.trunc.fastq.xz"
+must_fail "./src/fastq_num_reads tests/a_1.fastq.err.bz2"
 must_fail "./src/fastq_num_reads --help"
 must_fail "./src/fastq_num_reads"
+rm -f c18_10000_1.fastq c18_10000_1.*fastq.xz c18_10000_1.cat.fastq.bz2
 
 #gcov src/fastq_num_reads
 
@@ -234,6 +256,7 @@ echo "*** fastq_truncate"
 must_succeed "[ `./src/fastq_truncate tests/test_21_2.fastq.gz 1|wc -l` -eq 4 ]"
 must_succeed "[ `./src/fastq_truncate tests/test_21_2.fastq.gz 0|wc -l` -eq 0 ]"
 must_succeed "[ `./src/fastq_truncate tests/test_21_2.fastq.gz 2|wc -l` -eq 8 ]"
+must_succeed "./src/fastq_truncate --threads 3 tests/c18_10000_1.fastq.gz 5000 | cmp - <(zcat tests/c18_10000_1.fastq.gz | head -n 20000)"
 must_fail "./src/fastq_truncate tests/test_21_2.fastq.gz"
 must_fail "./src/fastq_truncate --help"
 
@@ -267,6 +290,33 @@ must_fail ./src/fastq_info tests/test_e21.fastq.gz
 must_succeed  ./src/fastq_info -q tests/test_e20.fastq.gz
 must_succeed  ./src/fastq_info -q tests/test_e21.fastq.gz
 must_succeed ./src/fastq_info  tests/test_33.fastq.gz
+## reads longer than 2.5Mb
+must_succeed "(echo @r1; head -c 3000000 /dev/zero | tr '\\0' A; echo; echo +; head -c 3000000 /dev/zero | tr '\\0' I; echo; echo @r2; echo ACGT; echo +; echo IIII) | gzip -c > long_read.fastq.gz && ./src/fastq_info long_read.fastq.gz 2>&1 | grep -q 'Read length: 4 3000000'"
+must_succeed "./src/fastq_info --threads 2 long_read.fastq.gz 2>&1 | grep -q 'Read length: 4 3000000'"
+must_succeed "./src/fastq_truncate long_read.fastq.gz 2 | cmp - <(zcat long_read.fastq.gz)"
+must_succeed "./src/fastq_info --threads 2 tests/pbmc8k_S1_L007_R1_001.fastq.gz tests/pbmc8k_S1_L007_R2_001.fastq.gz"
+must_fail "zcat tests/c18_10000_1.fastq.gz | head -n 21 | ./src/fastq_info --threads 2 -"
+## run time statistics
+must_succeed "./src/fastq_info --stats tmp_stats.json tests/pbmc8k_S1_L007_R1_001.fastq.gz tests/pbmc8k_S1_L007_R2_001.fastq.gz && grep -q '\"tool\": \"fastq_info\"' tmp_stats.json && grep -q '\"parse\": {\"calls\": [0-9]*, \"records\": [1-9]' tmp_stats.json"
+must_succeed "./src/fastq_filter_n -n 2 tests/c18_10000_1.fastq.gz > tmp && ./src/fastq_filter_n --threads 3 --stats=tmp_stats.json -n 2 tests/c18_10000_1.fastq.gz | cmp - tmp && grep -q '\"write\": {\"calls\": [1-9]' tmp_stats.json"
+must_fail "./src/fastq_info tests/c18_10000_1.fastq.gz --stats"
+must_fail "./src/fastq_info --stats folder/does/not/exist/tmp_stats.json tests/c18_10000_1.fastq.gz"
+## progress: no control characters when stderr is not a terminal
+must_succeed "! ./src/fastq_info tests/pbmc8k_S1_L007_R1_001.fastq.gz tests/pbmc8k_S1_L007_R2_001.fastq.gz 2>&1 >/dev/null | grep -q -P '[\\x08\\x0d]'"
+## validation kernels (the messages should be the same for all)
+must_succeed "for f in tests/test_e*.fastq.gz tests/test_33.fastq.gz; do FASTQ_SIMD=scalar ./src/fastq_info \$f > tmp1.txt 2>&1; FASTQ_SIMD=avx2 ./src/fastq_info \$f > tmp2.txt 2>&1; diff -q tmp1.txt tmp2.txt || exit 1; done"
+# -m: same results keeping only the fingerprints of the read names
+must_succeed "for f in tests/test_e*.fastq.gz tests/test_33.fastq.gz 'tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz' 'tests/pbmc8k_S1_L007_R1_001.fastq.gz tests/pbmc8k_S1_L007_R2_001.fastq.gz' 'tests/c18_10000_1.fastq.gz tests/pbmc8k_S1_L007_R2_001.fastq.gz'; do ./src/fastq_info \$f > tmp1.txt 2>&1; r1=\$?; ./src/fastq_info -m \$f > tmp2.txt 2>&1; [ \$r1 == \$? ] && diff -q <(grep -v Memory tmp1.txt) <(grep -v Memory tmp2.txt) || exit 1; done"
+must_succeed "zcat tests/c18_10000_1.fastq.gz > tmp_dup.fastq && zcat tests/c18_10000_1.fastq.gz | head -n 400 >> tmp_dup.fastq && ./src/fastq_info -m tmp_dup.fastq 2>&1 | grep -q 'duplicated sequence'"
+must_succeed "zcat tests/c18_10000_1.fastq.gz | paste - - - - | sort -r | tr '\t' '\n' > tmp_rev2.fastq && ./src/fastq_info tmp_rev2.fastq tests/c18_10000_1.fastq.gz > tmp1.txt 2>&1 && ./src/fastq_info -m tmp_rev2.fastq tests/c18_10000_1.fastq.gz > tmp2.txt 2>&1 && diff -q <(grep -v Memory tmp1.txt) <(grep -v Memory tmp2.txt)"
+must_succeed "zcat tests/c18_10000_1.fastq.gz | ./src/fastq_info -m - 2>&1 | grep -q 'ignored'"
+# --max-mem: same results with the read names partitioned in temporary files
+must_succeed "for f in tests/test_e*.fastq.gz tests/test_33.fastq.gz tmp_dup.fastq 'tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz' 'tests/pbmc8k_S1_L007_R1_001.fastq.gz tests/pbmc8k_S1_L007_R2_001.fastq.gz' 'tests/pbmc8k_S1_L007_R2_001.fastq.gz tests/pbmc8k_S1_L007_R1_001.fastq.gz' 'tests/casava.1.8_readname_trunc_1.err.fastq.gz tests/casava.1.8_readname_trunc_2.fastq.gz'; do ./src/fastq_info \$f > tmp1.txt 2>&1; r1=\$?; ./src/fastq_info --max-mem 1K \$f > tmp2.txt 2>&1; [ \$r1 == \$? ] && diff -q <(grep -v 'Memory\\|partitioned' tmp1.txt) <(grep -v 'Memory\\|partitioned' tmp2.txt) || exit 1; done"
+must_succeed "./src/fastq_info --max-mem=1K tmp_dup.fastq 2>&1 | grep -q 'partitioned'"
+must_succeed "./src/fastq_info -m --max-mem=1K tmp_dup.fastq 2>&1 | grep -q 'ignored'"
+# --threads: same results with the read names indexed and checked by several threads
+must_succeed "zcat tests/c18_10000_2.fastq.gz > tmp_dup2.fastq && zcat tests/c18_10000_2.fastq.gz | head -n 400 >> tmp_dup2.fastq && for f in tests/test_e*.fastq.gz tests/test_33.fastq.gz tmp_dup.fastq 'tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz' 'tests/c18_10000_1.fastq.gz tmp_dup2.fastq' 'tests/pbmc8k_S1_L007_R2_001.fastq.gz tests/pbmc8k_S1_L007_R1_001.fastq.gz' 'tests/casava.1.8_readname_trunc_1.err.fastq.gz tests/casava.1.8_readname_trunc_2.fastq.gz'; do ./src/fastq_info \$f > tmp1.txt 2>&1; r1=\$?; ./src/fastq_info --threads 3 \$f > tmp2.txt 2>&1; [ \$r1 == \$? ] && diff -q <(grep -v Memory tmp1.txt) <(grep -v Memory tmp2.txt) || exit 1; done"
+must_fail ./src/fastq_info --max-mem 1X tests/test_1.fastq.gz
 must_succeed ./src/fastq_info -q  tests/test_33.fastq.gz
 must_fail ./src/fastq_info tests/test_e13.fastq.gz 
 must_fail ./src/fastq_info tests/test_e14.fastq.gz 
@@ -364,6 +414,29 @@ must_succeed "./src/fastq_filterpair tests/casava.1.8_2.fastq.gz tests/casava.1.
 must_succeed "./src/fastq_filterpair tests/casava.1.8_1.fastq.gz tests/casava.1.8_1.fastq.gz  f1.fastq.gz f2.fastq.gz up.fastq.gz"
 must_succeed ./src/fastq_filterpair tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz  f1.fastq.gz f2.fastq.gz up.fastq.gz
 must_succeed ./src/fastq_filterpair tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz  f1.fastq.gz f2.fastq.gz up.fastq.gz sorted
+must_succeed "./src/fastq_filterpair --threads 4 tests/a_1.fastq.gz tests/a_2.fastq.gz  f1.fastq.gz f2.fastq.gz up.fastq.gz && diff <(zcat f2.fastq.gz) <(zcat tests/a_2.fastq.gz) && diff <(zcat f1.fastq.gz) <(zcat tests/a_1.fastq.gz)"
+must_succeed "./src/fastq_filterpair tests/a_1.fastq.bz2 tests/a_2.fastq.bz2 bz2_1.fastq.gz bz2_2.fastq.gz up.fastq.gz && ./src/fastq_filterpair tests/a_1.fastq.gz tests/a_2.fastq.gz gz_1.fastq.gz gz_2.fastq.gz up.fastq.gz && diff <(zcat bz2_1.fastq.gz) <(zcat gz_1.fastq.gz) && diff <(zcat bz2_2.fastq.gz) <(zcat gz_2.fastq.gz)"
+## uncompressed (memory mapped) input
+must_succeed "zcat tests/c18_10000_1.fastq.gz > m_1.fastq && zcat tests/c18_10000_2.fastq.gz > m_2.fastq && ./src/fastq_filterpair m_1.fastq m_2.fastq m1.fastq.gz m2.fastq.gz mup.fastq.gz && ./src/fastq_filterpair tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz f1.fastq.gz f2.fastq.gz up.fastq.gz && diff <(zcat m1.fastq.gz) <(zcat f1.fastq.gz) && diff <(zcat m2.fastq.gz) <(zcat f2.fastq.gz) && diff <(zcat mup.fastq.gz) <(zcat up.fastq.gz)"
+must_succeed "printf '@r1\\nACGTACGTAC\\n+\\nIIIIIIIIII' > m_3.fastq && [ \`./src/fastq_num_reads m_3.fastq\` -eq 1 ] && ./src/fastq_info m_3.fastq"
+rm -f m_1.fastq m_2.fastq m_3.fastq m1.fastq.gz m2.fastq.gz mup.fastq.gz
+## gzip index (random access to the first file)
+must_succeed "cp tests/c18_10000_1.fastq.gz gzi_1.fastq.gz && zcat tests/c18_10000_2.fastq.gz | paste - - - - | sort -r | tr '\\t' '\\n' | gzip -c > gzi_2.fastq.gz && zcat gzi_1.fastq.gz > gzi_1.fastq && ./src/fastq_filterpair gzi_1.fastq gzi_2.fastq.gz p1.fastq.gz p2.fastq.gz pu.fastq.gz && ./src/fastq_filterpair --gz_index gzi_1.fastq.gz gzi_2.fastq.gz i1.fastq.gz i2.fastq.gz iu.fastq.gz && [ -s gzi_1.fastq.gz.fqi ] && diff <(zcat p1.fastq.gz) <(zcat i1.fastq.gz) && diff <(zcat p2.fastq.gz) <(zcat i2.fastq.gz)"
+must_succeed "./src/fastq_filterpair gzi_1.fastq.gz gzi_2.fastq.gz i1.fastq.gz i2.fastq.gz iu.fastq.gz && diff <(zcat p1.fastq.gz) <(zcat i1.fastq.gz) && diff <(zcat pu.fastq.gz) <(zcat iu.fastq.gz)"
+# all the unpaired reads (922 from each file)
+must_succeed "[ \`zcat pu.fastq.gz | wc -l\` -eq 7376 ]"
+# --max-mem: same results with the read names partitioned in temporary files
+must_succeed "./src/fastq_filterpair --max-mem 1K gzi_1.fastq.gz gzi_2.fastq.gz i1.fastq.gz i2.fastq.gz iu.fastq.gz && diff <(zcat p1.fastq.gz) <(zcat i1.fastq.gz) && diff <(zcat p2.fastq.gz) <(zcat i2.fastq.gz) && diff <(zcat pu.fastq.gz) <(zcat iu.fastq.gz)"
+must_succeed "./src/fastq_filterpair tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz p1.fastq.gz p2.fastq.gz pu.fastq.gz sorted && ./src/fastq_filterpair --max-mem 1K tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz i1.fastq.gz i2.fastq.gz iu.fastq.gz sorted && diff <(zcat p1.fastq.gz) <(zcat i1.fastq.gz) && diff <(zcat p2.fastq.gz) <(zcat i2.fastq.gz) && diff <(zcat pu.fastq.gz) <(zcat iu.fastq.gz)"
+must_fail ./src/fastq_filterpair --max-mem 1K tmp_dup.fastq tests/c18_10000_2.fastq.gz i1.fastq.gz i2.fastq.gz iu.fastq.gz
+rm -f gzi_1.fastq gzi_1.fastq.gz gzi_1.fastq.gz.fqi gzi_2.fastq.gz p1.fastq.gz p2.fastq.gz pu.fastq.gz i1.fastq.gz i2.fastq.gz iu.fastq.gz
+rm -f bz2_?.fastq.gz gz_?.fastq.gz
+must_succeed "./src/fastq_filterpair --threads 2 tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz  bgzf_1.fastq.gz bgzf_2.fastq.gz up.fastq.gz && ./src/fastq_info --threads 3 bgzf_1.fastq.gz bgzf_2.fastq.gz && [ \`./src/fastq_num_reads --threads 2 bgzf_2.fastq.gz\` -eq 9078 ]"
+must_succeed "./src/fastq_filterpair --threads 3 bgzf_1.fastq.gz tests/c18_10000_2.fastq.gz  f1.fastq.gz f2.fastq.gz up.fastq.gz && diff <(zcat f1.fastq.gz) <(zcat bgzf_1.fastq.gz) && diff <(zcat f2.fastq.gz) <(zcat bgzf_2.fastq.gz)"
+## BGZF block with an extra field longer than a block
+must_succeed "(printf '\\037\\213\\010\\004\\0\\0\\0\\0\\0\\377\\377\\377BC\\002\\0\\377\\377'; head -c 70000 /dev/zero) > tmp_xlen.fastq.gz && ./src/fastq_info --threads 2 tmp_xlen.fastq.gz 2>&1 | grep -q 'invalid BGZF block'"
+must_succeed "./src/fastq_filterpair tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz f1.fastq.gz f2.fastq.gz up.fastq.gz sorted && ./src/fastq_filterpair --threads 3 tests/c18_10000_1.fastq.gz tests/c18_10000_2.fastq.gz t1.fastq.gz t2.fastq.gz tup.fastq.gz sorted && diff <(zcat f1.fastq.gz) <(zcat t1.fastq.gz) && diff <(zcat f2.fastq.gz) <(zcat t2.fastq.gz) && diff <(zcat up.fastq.gz) <(zcat tup.fastq.gz)"
+rm -f t1.fastq.gz t2.fastq.gz tup.fastq.gz
 
 must_fail ./src/fastq_filterpair tests/c18_10000_1.fastq.gz tests/casava.1.8_2.fastq.gz  f1.fastq.gz f2.fastq.gz up.fastq.gz
 
@@ -393,6 +466,7 @@ must_fail "./src/fastq_pre_barcodes --index1 tests/barcode_test2_1.fastq.gz  --p
 must_succeed "./src/fastq_pre_barcodes --index1 tests/barcode_test2_1.fastq.gz  --phred_encoding 33 --min_qual 10 --umi_read index1  --umi_offset 0 --umi_size 16 --read1_offset 0 --read1_size -1 --cell_read index1 --cell_offset 0 --cell_size 8 --read1 tests/barcode_test2_2.fastq.gz --outfile1 test.fastq.gz && diff -q  <(zcat test.fastq.gz)  <(zcat tests/pre2.fastq.gz)"
 
 must_succeed "./src/fastq_pre_barcodes --index1 tests/barcode_test2_1.fastq.gz  --phred_encoding 33 --min_qual 1 --umi_read index1  --umi_offset 0 --umi_size 16 --read1_offset 0 --read1_size -1 --cell_read index1 --cell_offset 0 --cell_size 8 --sample_read read1 --sample_offset 0  --sample_size 4 --read1 tests/barcode_test2_2.fastq.gz --outfile1 test.fastq.gz && diff -q  <(zcat test.fastq.gz)  <(zcat tests/pre3.fastq.gz)"
+must_succeed "./src/fastq_pre_barcodes --threads 2 --index1 tests/barcode_test2_1.fastq.gz  --phred_encoding 33 --min_qual 1 --umi_read index1  --umi_offset 0 --umi_size 16 --read1_offset 0 --read1_size -1 --cell_read index1 --cell_offset 0 --cell_size 8 --sample_read read1 --sample_offset 0  --sample_size 4 --read1 tests/barcode_test2_2.fastq.gz --outfile1 test.fastq.gz && diff -q  <(zcat test.fastq.gz)  <(zcat tests/pre3.fastq.gz)"
 
 must_succeed "./src/fastq_pre_barcodes --index1 tests/barcode_test2_1.fastq.gz --index2 tests/barcode_test2_1.fastq.gz --index3 tests/barcode_test2_1.fastq.gz  --phred_encoding 33 --min_qual 1 --umi_read index1  --umi_offset 0 --umi_size 16 --read1_offset 0 --read1_size -1 --cell_read index2 --cell_offset 0 --cell_size 8 --sample_read index3 --sample_offset 0  --sample_size 4 --read1 tests/barcode_test2_2.fastq.gz --outfile1 test.fastq.gz"
 
@@ -485,6 +559,7 @@ rm -f tmpf tmpf2
 echo "*** bam_add_tags"
 
 must_succeed "./src/bam_add_tags --inbam tests/trans_small.bam --outbam tmp.bam"
+must_succeed "./src/bam_add_tags --stats tmp_stats.json --inbam tests/trans_small.bam --outbam tmp.bam && grep -q '\"bam_write\": {\"calls\": [1-9]' tmp_stats.json"
 must_succeed "./src/bam_add_tags --inbam tests/trans_small.bam --outbam tmp.10.bam --10x"
 must_succeed "samtools view tmp.10.bam | grep -c 'UB:Z' > tmp.10 && samtools view tmp.bam | grep -c 'RX:Z' > tmp && diff tmp tmp.10"
 
@@ -505,10 +580,23 @@ must_fail "./src/bam_add_tags --inbam tests/trans_small.bam --outbam /tmp.bam --
 
 
 
-rm -f out_prefix_*.fastq.gz tmp.*.bam
+rm -f out_prefix_*.fastq.gz tmp.*.bam tmp_stats.json tmp_dup.fastq tmp_dup2.fastq tmp_rev2.fastq tmp_xlen.fastq.gz
 
 #gcov src/fastq_split_interleaved
 
+echo "*** fastq_synth"
+must_fail "./src/fastq_synth --out tmp_synth"
+must_fail "./src/fastq_synth --type xx --out tmp_synth"
+must_succeed "./src/fastq_synth --type pe --reads 2000 --seed 3 --out tmp_synth && ./src/fastq_info tmp_synth_1.fastq.gz tmp_synth_2.fastq.gz && ./src/fastq_synth --type pe --reads 2000 --seed 3 --out tmp_synth2 && cmp tmp_synth_1.fastq.gz tmp_synth2_1.fastq.gz"
+must_succeed "./src/fastq_synth --type ont --reads 100 --out tmp_synth && ./src/fastq_info tmp_synth.fastq.gz"
+must_succeed "./src/fastq_synth --type 10x --reads 2000 --out tmp_synth && ./src/fastq_pre_barcodes --read1 tmp_synth_R2.fastq.gz --index1 tmp_synth_R1.fastq.gz --umi_read index1 --umi_offset 16 --umi_size 12 --cell_read index1 --cell_offset 0 --cell_size 16 --index2 tmp_synth_I1.fastq.gz --sample_read index2 --sample_offset 0 --sample_size 8 --outfile1 tmp_synth.fastq.gz && [ \`zcat tmp_synth.fastq.gz | wc -l\` -eq 8000 ]"
+must_succeed "./src/fastq_synth --type bam --reads 20000 --out tmp_synth && ./src/bam_add_tags --inbam tmp_synth.bam --outbam tmp_synth2.bam --tx --tx_2_gx tmp_synth_tx2gene.tsv && ./src/bam_umi_count --bam tmp_synth2.bam --ucounts tmp_synth.mtx --min_reads 1 -x GX"
+rm -f tmp_synth*
+
+echo "*** ds_bench"
+must_fail "./src/ds_bench --keys 0"
+must_succeed "./src/ds_bench --keys 1,1000,10000 --umis 20000 --check 100000"
+
 must_succeed ./src/fastq_tests
 gcov src/fastq_tests
 make -B -C src gcov
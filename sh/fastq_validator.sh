@@ -136,22 +136,16 @@ else
 	fi
 	if [ "-$ext" == "-bz2" ] || [ "-$ext" == "-bzip2" ] ; then
 	    echo BZIP file
-	    # check integrity
+	    # check integrity (fastq_info reads bzip2 files directly)
 	    set +e
 	    echo "Checking integrity of $f..."
-	    set -o pipefail
-	    tmp_file=$(mktemp  --suffix `basename .$f`.tmp.gz -p .)
-	    rm -f $named_pipe
-	    echo "Creating a temporary gzip version of $f as $tmp_file..."
-	    bunzip2 -c $f | gzip -c > $tmp_file
+	    bzip2 -t $f
 	    if [ $? -ne 0 ]; then
 		echo "ERROR: $f: error uncompressing bzip2 file"
 		exit 2
 	    fi
-	    echo "Creating a temporary gzip version of $f...done."
 	    echo "Checking integrity of $f...complete."
-	    FILES2PROCESS="$FILES2PROCESS $tmp_file"
-	    FILES2DELETE="$FILES2DELETE $tmp_file"
+	    FILES2PROCESS="$FILES2PROCESS $f"
 	else
 	    FILES2PROCESS="$FILES2PROCESS $f"
 	fi
@@ -0,0 +1,99 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+struct arena_chunk {
+  struct arena_chunk *prev;
+  size_t size;
+};
+
+#define ARENA_ALIGN 8
+#define ARENA_HDR ((sizeof(struct arena_chunk)+ARENA_ALIGN-1)&~(size_t)(ARENA_ALIGN-1))
+
+ARENA* arena_new(void) {
+  ARENA *a=(ARENA*)calloc(1,sizeof(ARENA));
+  if ( a==NULL ) return NULL;
+  a->chunk_size=ARENA_MIN_CHUNK;
+  return a;
+}
+
+// new chunk with at least len bytes free
+static int arena_grow(ARENA *a,size_t len) {
+  size_t size=a->chunk_size;
+  if ( size<ARENA_MAX_CHUNK ) a->chunk_size*=2;
+  if ( size<len+ARENA_HDR ) size=len+ARENA_HDR;
+  struct arena_chunk *c=(struct arena_chunk*)malloc(size);
+  if ( c==NULL ) return 0;
+  c->prev=a->chunks;
+  c->size=size;
+  a->chunks=c;
+  a->next=(char*)c+ARENA_HDR;
+  a->end=(char*)c+size;
+  a->size+=size;
+  return 1;
+}
+
+void* arena_alloc(ARENA *a,size_t len) {
+  char *p=(char*)(((size_t)a->next+ARENA_ALIGN-1)&~(size_t)(ARENA_ALIGN-1));
+  if ( a->next==NULL || p+len>a->end ) {
+    if ( !arena_grow(a,len) ) return NULL;
+    p=a->next;
+  }
+  a->next=p+len;
+  a->used+=len;
+  return p;
+}
+
+char* arena_strndup(ARENA *a,const char *s,size_t len) {
+  if ( a->next==NULL || a->next+len+1>a->end ) {
+    if ( !arena_grow(a,len+1) ) return NULL;
+  }
+  char *p=a->next;
+  memcpy(p,s,len);
+  p[len]='\0';
+  a->next=p+len+1;
+  a->used+=len+1;
+  return p;
+}
+
+void arena_reset(ARENA *a) {
+  struct arena_chunk *c=a->chunks;
+  while ( c!=NULL ) {
+    struct arena_chunk *prev=c->prev;
+    free(c);
+    c=prev;
+  }
+  a->chunks=NULL;
+  a->next=a->end=NULL;
+  a->chunk_size=ARENA_MIN_CHUNK;
+  a->used=a->size=0;
+}
+
+void arena_free(ARENA *a) {
+  if ( a==NULL ) return;
+  arena_reset(a);
+  free(a);
+}
@@ -0,0 +1,59 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Arena (bump) allocator for many small objects that are freed all at
+// once: the objects are carved out of large chunks, without the
+// per-allocation header of malloc, and arena_free releases the
+// chunks (not the objects one by one). The chunks grow from
+// ARENA_MIN_CHUNK to ARENA_MAX_CHUNK bytes, so a few hundred chunks
+// are enough for several GB of objects.
+
+#define ARENA_MIN_CHUNK (64*1024)
+#define ARENA_MAX_CHUNK (64*1024*1024)
+
+struct arena_chunk;
+
+struct arena {
+  struct arena_chunk *chunks; // last chunk allocated
+  char *next;                 // free space in the last chunk
+  char *end;
+  size_t chunk_size;          // size of the next chunk
+  size_t used;                // bytes allocated (objects)
+  size_t size;                // bytes allocated (chunks)
+};
+typedef struct arena ARENA;
+
+ARENA* arena_new(void);
+// memory aligned to 8 bytes (NULL if out of memory)
+void* arena_alloc(ARENA *a,size_t len);
+// copy of the first len characters of s (\0 terminated, not aligned)
+char* arena_strndup(ARENA *a,const char *s,size_t len);
+// frees all the objects (the arena can be reused)
+void arena_reset(ARENA *a);
+void arena_free(ARENA *a);
+
+#endif
@@ -35,6 +35,7 @@
 
 #include "sam_tags.h"
 #include "fastq.h"
+#include "stats.h"
 
 
 #define BUF_SIZE 10000
@@ -54,19 +55,20 @@ char *get_tag(bam1_t *aln,const char tagname[2]) {
   return(s2);
 }
 
-void QWRITE(gzFile fd,FILE_LOC type, char*s1,char*s2,char*s3,int add_suffix) {
+void QWRITE(FASTQ_FILE* fd,FILE_LOC type, char*s1,char*s2,char*s3,int add_suffix) {
   char rn_suf[4]="";
+  int suf_len=0;
   if (add_suffix && type!=SE ) // add a suffix
-    sprintf(&rn_suf[0],"/%u",(short)type+1);
-  GZ_WRITE(fd,"@");
-  GZ_WRITE(fd,s1);
-  GZ_WRITE(fd,rn_suf);
-  GZ_WRITE(fd,"\n");
-  GZ_WRITE(fd,s2);
-  GZ_WRITE(fd,"\n+\n");
+    suf_len=sprintf(&rn_suf[0],"/%u",(short)type+1);
+  fastq_write(fd,"@",1);
+  fastq_puts(fd,s1);
+  fastq_write(fd,rn_suf,suf_len);
+  fastq_write(fd,"\n",1);
+  fastq_puts(fd,s2);
+  fastq_write(fd,"\n+\n",3);
   if (s3!=NULL)
-    GZ_WRITE(fd,s3);
-  GZ_WRITE(fd,"\n");
+    fastq_puts(fd,s3);
+  fastq_write(fd,"\n",1);
 }
 
 // 
@@ -79,47 +81,48 @@ void QWRITE(gzFile fd,FILE_LOC type, char*s1,char*s2,char*s3,int add_suffix) {
 // b) suffix is added after the space
 // e.g.
 // read1@1:N:0:ATTGGACG->read1 SUFFIX:N:0:ATTGGACG
-void QWRITE2(gzFile fd,FILE_LOC type, char*s1,char*s2,char*s3,char *s4, char *s5,int add_suffix) {
+void QWRITE2(FASTQ_FILE* fd,FILE_LOC type, char*s1,char*s2,char*s3,char *s4, char *s5,int add_suffix) {
   char rn_suf[4]="";
+  int suf_len=0;
   if (add_suffix) // add a suffix
-    sprintf(&rn_suf[0],"/%u",(short)type+1);
-  GZ_WRITE(fd,"@");
-  GZ_WRITE(fd,s1);
-  GZ_WRITE(fd,rn_suf);
-  GZ_WRITE(fd,"\n");
-  GZ_WRITE(fd,s2);
+    suf_len=sprintf(&rn_suf[0],"/%u",(short)type+1);
+  fastq_write(fd,"@",1);
+  fastq_puts(fd,s1);
+  fastq_write(fd,rn_suf,suf_len);
+  fastq_write(fd,"\n",1);
+  fastq_puts(fd,s2);
   // part 2
-  GZ_WRITE(fd,s4);
-  GZ_WRITE(fd,"\n+\n");
+  fastq_puts(fd,s4);
+  fastq_write(fd,"\n+\n",3);
   if (s3!=NULL && s5!=NULL) {
-    GZ_WRITE(fd,s3);
-    GZ_WRITE(fd,s5);
+    fastq_puts(fd,s3);
+    fastq_puts(fd,s5);
   }
-  GZ_WRITE(fd,"\n");
+  fastq_write(fd,"\n",1);
 }
 
-gzFile get_10x_fp(gzFile *fps, FILE_LOC type, const char *file_prefix) {
+FASTQ_FILE* get_10x_fp(FASTQ_FILE **fps, FILE_LOC type, const char *file_prefix) {
   
   if ( fps[type]==NULL ) {
     // open file
     char buf[BUF_SIZE];
     char *ext[]={"_R1","_R2","_I1",""};
     sprintf(buf,"%s%s.fastq.gz",file_prefix,ext[type]);
-    fps[type]=fastq_open(buf,"wb");
+    fps[type]=fastq_new(buf,FALSE,"wb");
     fprintf(stderr,"opening %s\n",buf);
   }
   return(fps[type]);
 }
 
 
-gzFile get_fp(gzFile *fps, FILE_LOC type, const char *file_prefix) {
+FASTQ_FILE* get_fp(FASTQ_FILE **fps, FILE_LOC type, const char *file_prefix) {
   
   if ( fps[type]==NULL ) {
     // open file
     char buf[BUF_SIZE];
     char *ext[]={"_1","_2","_cell","_sample","_umi",""};
     sprintf(buf,"%s%s.fastq.gz",file_prefix,ext[type]);
-    fps[type]=fastq_open(buf,"wb");
+    fps[type]=fastq_new(buf,FALSE,"wb");
     fprintf(stderr,"opening %s\n",buf);
   }
   return(fps[type]);
@@ -163,7 +166,7 @@ char* get_qual(bam1_t *aln,char *buf) {
 
 
 void print_usage(int exit_status) {
-    PRINT_ERROR("Usage: bam2fastq --bam in.bam --out fastq_prefix [--verbose --10x|-X]");
+    PRINT_ERROR("Usage: bam2fastq --bam in.bam --out fastq_prefix [--verbose --10x|-X --threads N]");
     if ( exit_status>=0) exit(exit_status);
 }
 
@@ -188,6 +191,7 @@ int main(int argc, char *argv[])
   };
   
   fprintf(stderr,"bam2fastq version %s\n",VERSION);
+  argc=fastq_parse_common_options(argc,argv);
   // process arguments
   while (1) {
     /* getopt_long stores the option index here. */
@@ -229,7 +233,7 @@ int main(int argc, char *argv[])
     FATAL_ERROR(PARAMS_ERROR_EXIT_STATUS,"Failed to open BAM file %s", bam_file);  
 
   
-  gzFile fd[6]={NULL,NULL,NULL,NULL,NULL,NULL};
+  FASTQ_FILE* fd[6]={NULL,NULL,NULL,NULL,NULL,NULL};
   
   //
   // 
@@ -246,12 +250,13 @@ int main(int argc, char *argv[])
   int is_pe=-1;
   unsigned long long num_alns=0;
   short printed_warning=FALSE;  
-  while( bam_read1(in,aln)>=0 ) {
+  unsigned long long in_size=progress_file_size(bam_file);
+  while( STATS_RECORD_IO(STATS_BAM_READ,bam_read1(in,aln))>=0 ) {
     if ( num_alns == ULLONG_MAX )
       FATAL_ERROR(3,"counter overflow (number of alignments) - %llu\n",num_alns);
      
     ++num_alns;
-    if (num_alns%100000==0) { fprintf(stderr,"\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b%llu",num_alns); fflush(stderr); }
+    if ( progress_due(num_alns) ) progress_report("alignments",num_alns,bam_tell(in)>>16,in_size);
     
     // exclude non-primary alignments
     if ( aln->core.flag & BAM_FSECONDARY) 
@@ -355,9 +360,9 @@ int main(int argc, char *argv[])
   }
   // TODO: catch errors
   for (i=0;i<=5;i++)
-    if (fd[i]!=NULL) gzclose(fd[i]);
+    if (fd[i]!=NULL) fastq_destroy(fd[i]);
   
-  fprintf(stderr,"\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\n");fflush(stderr);
+  progress_done();
   bam_destroy1(aln);
   // write output
   fprintf(stderr,"Alignments processed: %llu\n",num_alns);
@@ -31,6 +31,7 @@
 #include "fastq.h"
 #include "hash.h"
 #include "sam_tags.h"
+#include "stats.h"
 
 #define MAX_FEAT_LEN 50
 typedef struct trans_gene_map {
@@ -156,6 +157,7 @@ int main(int argc, char *argv[])   {
 
 
   // process arguments
+  argc=stats_parse_options(argc,argv);
   while (1) {
     /* getopt_long stores the option index here. */
     int option_index = 0;
@@ -257,7 +259,7 @@ int main(int argc, char *argv[])   {
   char cell[MAX_BARCODE_LENGTH];
   int sample_len, umi_len,cell_len;
   num_alns=0;
-  while(bam_read1(in,aln)>=0) {
+  while(STATS_RECORD_IO(STATS_BAM_READ,bam_read1(in,aln))>=0) {
     //if (aln->core.tid < 0) continue;//ignore unaligned reads
     //if (aln->core.flag & BAM_FUNMAP) continue; // the mate is unmapped
     ++num_alns;
@@ -289,7 +291,7 @@ int main(int argc, char *argv[])   {
 	}
       }
     }
-    bam_write1(out,aln);
+    STATS_RECORD_IO(STATS_BAM_WRITE,bam_write1(out,aln));
   }
 
   //bam_close(in); 
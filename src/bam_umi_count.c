@@ -36,6 +36,7 @@
 #include "fastq.h"
 #include "sam_tags.h"
 #include "range_list.h"
+#include "stats.h"
 
 #define FEAT_ID_MAX_LEN 25
 #define MAX_BARCODE_LEN 19
@@ -139,6 +140,10 @@ LABELS* init_labels(uint hashsize) {
   new->ht=new_hashtable(hashsize);
   return(new);
 }
+static int label_match(__ptr_t obj,void *data) {
+  return !strcmp(((LABEL2ID*)obj)->label,(const char*)data);
+}
+
 // feature to id
 uint_64 label_str2id(const char* lab,LABELS* lm) {
   //
@@ -148,16 +153,15 @@ uint_64 label_str2id(const char* lab,LABELS* lm) {
     return(lm->last_query->id);
   }
   ulong ikey=hash_str(lab);
-  
-  LABEL2ID *e=(LABEL2ID*)get_object(lm->ht,ikey);
-  
-  // look for the match
-  while (e!=NULL) {
-    if ( !strcmp(e->label,lab)) break;
-    e=e->next;
+  int found;
+  // lookup or add an entry
+  LABEL2ID **ptr=(LABEL2ID**)upsert(lm->ht,ikey,label_match,(void*)lab,&found);
+  if ( ptr==NULL ) {
+    fprintf(stderr,"ERROR: unable to add entry to hash table");
+    exit(1);
   }
-
-  if ( e==NULL ) {
+  LABEL2ID *e=*ptr;
+  if ( !found ) {
     uint len=strlen(lab);
     LABEL2ID *new=(LABEL2ID*)malloc(sizeof(LABEL2ID)+len+1);
     lm->ctr++;
@@ -170,10 +174,7 @@ uint_64 label_str2id(const char* lab,LABELS* lm) {
     new->next=NULL;
     new->label=(char*)&(*new)+sizeof(LABEL2ID);
     strncpy(new->label,lab,len+1);
-    if(insere(lm->ht,ikey,new)<0) {
-      fprintf(stderr,"ERROR: unable to add entry to hash table");
-      exit(1);
-    }
+    *ptr=new;
     e=new;
   }
   lm->last_query=e; // cache
@@ -230,15 +231,15 @@ uint_64 blabel2id(const uint_64 lab,BLABELS* lm ) {
   if (lm->last_query!=NULL && lab==lm->last_query->label ) {
     return(lm->last_query->id);
   }
-  BLABEL2ID *e=(BLABEL2ID*)get_object(lm->ht,ikey);
-  
-  // look for the match
-  while (e!=NULL) {
-    if ( e->label==lab ) break;
-    e=e->next;
+  int found;
+  // lookup or add an entry (the key is the label)
+  BLABEL2ID **ptr=(BLABEL2ID**)upsert(lm->ht,ikey,NULL,NULL,&found);
+  if ( ptr==NULL ) {
+    fprintf(stderr,"ERROR: unable to add entry to hash table");
+    exit(1);
   }
-  
-  if ( e==NULL ) {
+  BLABEL2ID *e=*ptr;
+  if ( !found ) {
     BLABEL2ID *new=(BLABEL2ID*)malloc(sizeof(BLABEL2ID));
     lm->ctr++;
     if ( lm->last==NULL ) {
@@ -249,10 +250,7 @@ uint_64 blabel2id(const uint_64 lab,BLABELS* lm ) {
     new->id=lm->ctr;
     new->next=NULL;
     new->label=lab;
-    if(insere(lm->ht,ikey,new)<0) {
-      fprintf(stderr,"ERROR: unable to add entry to hash table");
-      exit(1);
-    }
+    *ptr=new;
     e=new;
   }
   lm->last_query=e; // cache
@@ -682,12 +680,12 @@ void cell2MM(DB*db, FILE *fd,int UMI,uint min_num_reads,uint min_num_umis,uint_6
 	  if ( UMI==TRUE && (uint)fe->tot_umi_obs>=1 ) {
 	    fprintf(fd,"%u%s%u%s%u\n",cf,MM_SEP,cell_id,MM_SEP,(uint)round(fe->tot_umi_obs));
 	    *tot_ctr+=(uint)fe->tot_umi_obs;
-	    ++tot_feat_cells;
+	    ++*tot_feat_cells;
 	    db->n_entries_reads++;
 	  } else if ( (uint)fe->tot_reads_obs>=1)  {
 	    fprintf(fd,"%u%s%u%s%u\n",cf,MM_SEP,cell_id,MM_SEP,(uint)round(fe->tot_reads_obs));
 	    *tot_ctr+=(uint)fe->tot_reads_obs;
-	    ++tot_feat_cells;
+	    ++*tot_feat_cells;
 	    db->n_entries_umis++;
 	  }
 	}	    
@@ -696,7 +694,6 @@ void cell2MM(DB*db, FILE *fd,int UMI,uint min_num_reads,uint min_num_umis,uint_6
       ++cf;
       if (pr>=db->samples[sample].cells[cell_idx].tot_umi_obs) break;
     }    
-    ++*tot_feat_cells;
   }/*  else if ( (uint)fe->tot_reads_obs >= 1 )  { */
   /*   fprintf(fd,"%u%s%u%s%u\n",fe->feat_id,MM_SEP,cell_id,MM_SEP,(uint)round(fe->tot_reads_obs)); */
   /*   *tot_ctr+=(uint)fe->tot_reads_obs; */
@@ -749,7 +746,6 @@ int main(int argc, char *argv[])
   ulong max_cells=MAX_CELLS;
   ulong max_samples=MAX_SAMPLES;
   ulong features_cell=4000;
-  ulong ncells=0;
   
   char *bam_file=NULL;
   char *ucounts_file=NULL;
@@ -794,6 +790,7 @@ int main(int argc, char *argv[])
 
   fprintf(stderr,"bam_umi_count version %sb\n",VERSION);
   // process arguments
+  argc=stats_parse_options(argc,argv);
   while (1) {
     /* getopt_long stores the option index here. */
     int option_index = 0;
@@ -938,14 +935,14 @@ int main(int argc, char *argv[])
 
   // TODO: change alns to entries
   num_alns=0;
-  if ( bam_sorted_by_cell ) fprintf(stderr,"Cells processed\n");
-  while(bam_read1(in,aln)>=0) { // read alignment
+  unsigned long long in_size=progress_file_size(bam_file);
+  while(STATS_RECORD_IO(STATS_BAM_READ,bam_read1(in,aln))>=0) { // read alignment
     if ( num_alns == ULLONG_MAX ) {
       PRINT_ERROR("counter overflow (number of alignments) - %llu\n",num_alns);
       exit(3);
     }
     ++num_alns;
-    if ( ! bam_sorted_by_cell && num_alns%100000==0) { fprintf(stderr,"\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b%llu",num_alns); fflush(stderr); }
+    if ( progress_due(num_alns) ) progress_report("alignments",num_alns,bam_tell(in)>>16,in_size);
 
     if (aln->core.tid < 0) continue;//ignore unaligned reads
     if (aln->core.flag & BAM_FUNMAP) continue;
@@ -1007,9 +1004,6 @@ int main(int argc, char *argv[])
 	  }
 	  
 	  if ( prev_cell_id!=0 ) {
-	    ++ncells;
-	    if (ncells%10000==0)
-	      fprintf(stderr,"\b\b\b\b\b\b\b\b\b\b\b\b\b\b%-10llu",ncells);
 	    cell2MM(db,counts_fd,TRUE,min_num_reads,min_num_umis,&tot_umi_ctr,&tot_feat_cells,prev_cell_id,sample_id);
 	    if ( rcounts_fd!=NULL )
 	      cell2MM(db,rcounts_fd,FALSE,min_num_reads,min_num_umis,&tot_reads_ctr,&tot_feat_cells,prev_cell_id,sample_id);
@@ -1061,16 +1055,13 @@ fprintf(stderr,">>>>%u-->%f\n",cell_id,incr);
   if ( bam_sorted_by_cell ) {
     // last cell
     if ( cell_id!=0 ) {
-      ++ncells;
-      if (ncells%10000==0)
-	fprintf(stderr,"\b\b\b\b\b\b\b\b\b\b\b\b\b\b%-10llu",ncells);
       cell2MM(db,counts_fd,TRUE,min_num_reads,min_num_umis,&tot_umi_ctr,&tot_feat_cells,cell_id,sample_id);
       if ( rcounts_fd!=NULL ) 
 	cell2MM(db,rcounts_fd,FALSE,min_num_reads,min_num_umis,&tot_reads_ctr,&tot_feat_cells,cell_id,sample_id);
     }
   }
 
-  fprintf(stderr,"\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\n");fflush(stderr);
+  progress_done();
   bam_destroy1(aln);
   // write output
   fprintf(stderr,"Alignments processed: %llu\n",num_alns);
@@ -0,0 +1,547 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "bgzf_mt.h"
+#include "stats.h"
+
+#define BGZF_MT_HEADER_SIZE 18
+#define BGZF_MT_FOOTER_SIZE 8
+// number of blocks that may be in flight per worker
+#define BGZF_MT_JOBS_PER_THREAD 4
+
+typedef enum { JOB_FREE=0, JOB_TODO=1, JOB_RUNNING=2, JOB_DONE=3 } JOB_STATE;
+
+// a block
+// write mode: in=data, out=BGZF block
+// read mode: in=BGZF block, out=data
+struct bgzf_mt_job {
+  JOB_STATE state;
+  unsigned long in_len;
+  unsigned long out_len;
+  unsigned long data_start; // read mode: offset of the deflate data in in
+  int error;
+  unsigned char in[BGZF_MT_MAX_BLOCK_SIZE];
+  unsigned char out[BGZF_MT_MAX_BLOCK_SIZE];
+};
+
+struct bgzf_mt_s {
+  int fd;
+  int level;
+  int nthreads;
+  int error;
+  int done;          // no more jobs will be submitted
+  int is_write;
+  // ring of jobs: blocks are submitted and consumed in the ring order
+  struct bgzf_mt_job *jobs;
+  unsigned long njobs;
+  unsigned long next_fill;   // next job to be filled by the main thread
+  unsigned long next_out;    // next job to be written/consumed
+  unsigned long next_todo;   // next job to be picked by a worker
+  pthread_t *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t todo_cond;  // signaled when a job is submitted
+  pthread_cond_t done_cond;  // signaled when a job is processed
+  // read mode
+  int src_eof;               // no more blocks to read from fd
+  int src_error;             // invalid block found while reading ahead
+  unsigned long out_pos;     // bytes consumed from jobs[next_out]
+  unsigned long long skip;   // bytes to discard (seek)
+  off_t start;               // file offset of the first block
+  off_t coffset;             // compressed offset of the next block to read
+  unsigned long long uoffset;// uncompressed offset of the next block to read
+  // blocks seen so far (compressed and uncompressed offsets)
+  off_t *idx_coff;
+  unsigned long long *idx_uoff;
+  unsigned long idx_n;
+  unsigned long idx_size;
+};
+
+static const unsigned char bgzf_mt_eof[28]={
+  0x1f,0x8b,0x08,0x04,0x00,0x00,0x00,0x00,0x00,0xff,0x06,0x00,0x42,0x43,
+  0x02,0x00,0x1b,0x00,0x03,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00
+};
+
+static inline void put_u16(unsigned char *p,unsigned int v) {
+  p[0]=v&0xff; p[1]=(v>>8)&0xff;
+}
+static inline void put_u32(unsigned char *p,unsigned long v) {
+  p[0]=v&0xff; p[1]=(v>>8)&0xff; p[2]=(v>>16)&0xff; p[3]=(v>>24)&0xff;
+}
+static inline unsigned int get_u16(const unsigned char *p) {
+  return p[0]|(p[1]<<8);
+}
+static inline unsigned long get_u32(const unsigned char *p) {
+  return (unsigned long)p[0]|((unsigned long)p[1]<<8)|((unsigned long)p[2]<<16)|((unsigned long)p[3]<<24);
+}
+
+// compress the data of a job into a BGZF block
+static int bgzf_mt_deflate(z_stream *zs,struct bgzf_mt_job *job) {
+  unsigned char *out=job->out;
+  unsigned long clen;
+
+  if ( deflateReset(zs)!=Z_OK ) return -1;
+  zs->next_in=job->in;
+  zs->avail_in=job->in_len;
+  zs->next_out=out+BGZF_MT_HEADER_SIZE;
+  zs->avail_out=BGZF_MT_MAX_BLOCK_SIZE-BGZF_MT_HEADER_SIZE-BGZF_MT_FOOTER_SIZE;
+  if ( deflate(zs,Z_FINISH)!=Z_STREAM_END ) return -1;
+  clen=zs->total_out;
+  // gzip header with the BC extra subfield
+  out[0]=0x1f; out[1]=0x8b; out[2]=Z_DEFLATED; out[3]=4;
+  put_u32(&out[4],0);
+  out[8]=0; out[9]=0xff;
+  put_u16(&out[10],6);
+  out[12]='B'; out[13]='C';
+  put_u16(&out[14],2);
+  put_u16(&out[16],clen+BGZF_MT_HEADER_SIZE+BGZF_MT_FOOTER_SIZE-1);
+  put_u32(&out[BGZF_MT_HEADER_SIZE+clen],crc32(crc32(0L,Z_NULL,0),job->in,job->in_len));
+  put_u32(&out[BGZF_MT_HEADER_SIZE+clen+4],job->in_len);
+  job->out_len=clen+BGZF_MT_HEADER_SIZE+BGZF_MT_FOOTER_SIZE;
+  return 0;
+}
+
+// decompress a BGZF block and check the crc and size
+static int bgzf_mt_inflate(z_stream *zs,struct bgzf_mt_job *job) {
+  const unsigned char *footer=&job->in[job->in_len-BGZF_MT_FOOTER_SIZE];
+  unsigned long isize=get_u32(&footer[4]);
+
+  if ( isize>BGZF_MT_MAX_BLOCK_SIZE ) return -1;
+  if ( inflateReset(zs)!=Z_OK ) return -1;
+  zs->next_in=&job->in[job->data_start];
+  zs->avail_in=job->in_len-job->data_start-BGZF_MT_FOOTER_SIZE;
+  zs->next_out=job->out;
+  zs->avail_out=BGZF_MT_MAX_BLOCK_SIZE;
+  if ( inflate(zs,Z_FINISH)!=Z_STREAM_END ) return -1;
+  job->out_len=zs->total_out;
+  if ( job->out_len!=isize ) return -1;
+  if ( crc32(crc32(0L,Z_NULL,0),job->out,job->out_len)!=get_u32(footer) ) return -1;
+  return 0;
+}
+
+static void* bgzf_mt_worker(void *arg) {
+  BGZF_MT *bz=(BGZF_MT*)arg;
+  z_stream zs;
+  int zerr;
+
+  memset(&zs,0,sizeof(z_stream));
+  if ( bz->is_write )
+    zerr=deflateInit2(&zs,bz->level,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY);
+  else
+    zerr=inflateInit2(&zs,-15);
+  pthread_mutex_lock(&bz->lock);
+  while (1) {
+    struct bgzf_mt_job *job;
+    while ( !bz->done && bz->jobs[bz->next_todo].state!=JOB_TODO )
+      pthread_cond_wait(&bz->todo_cond,&bz->lock);
+    if ( bz->jobs[bz->next_todo].state!=JOB_TODO ) break;
+    job=&bz->jobs[bz->next_todo];
+    job->state=JOB_RUNNING;
+    bz->next_todo=(bz->next_todo+1)%bz->njobs;
+    pthread_mutex_unlock(&bz->lock);
+    if ( zerr!=Z_OK ) job->error=1;
+    else if ( bz->is_write ) job->error=(bgzf_mt_deflate(&zs,job)!=0);
+    else job->error=(bgzf_mt_inflate(&zs,job)!=0);
+    pthread_mutex_lock(&bz->lock);
+    job->state=JOB_DONE;
+    pthread_cond_broadcast(&bz->done_cond);
+  }
+  pthread_mutex_unlock(&bz->lock);
+  if ( zerr==Z_OK ) {
+    if ( bz->is_write ) deflateEnd(&zs);
+    else inflateEnd(&zs);
+  }
+  return NULL;
+}
+
+static BGZF_MT* bgzf_mt_new(int fd,int level,int nthreads,int is_write) {
+  BGZF_MT* bz;
+  int i;
+
+  if ( nthreads<1 ) nthreads=1;
+  if ( (bz=(BGZF_MT*)calloc(1,sizeof(BGZF_MT)))==NULL ) return NULL;
+  bz->fd=fd;
+  bz->level=level;
+  bz->is_write=is_write;
+  bz->nthreads=nthreads;
+  bz->njobs=nthreads*BGZF_MT_JOBS_PER_THREAD;
+  bz->jobs=(struct bgzf_mt_job*)calloc(bz->njobs,sizeof(struct bgzf_mt_job));
+  bz->workers=(pthread_t*)malloc(sizeof(pthread_t)*nthreads);
+  if ( bz->jobs==NULL || bz->workers==NULL ) {
+    free(bz->jobs);
+    free(bz->workers);
+    free(bz);
+    return NULL;
+  }
+  pthread_mutex_init(&bz->lock,NULL);
+  pthread_cond_init(&bz->todo_cond,NULL);
+  pthread_cond_init(&bz->done_cond,NULL);
+  for ( i=0; i<nthreads; ++i ) {
+    if ( pthread_create(&bz->workers[i],NULL,bgzf_mt_worker,bz) ) {
+      bz->nthreads=i;
+      bz->error=1;
+      bgzf_mt_close(bz);
+      return NULL;
+    }
+  }
+  return bz;
+}
+
+// wait for the job being processed by the workers
+// should be called with the lock held
+static void bgzf_mt_wait_jobs(BGZF_MT *bz) {
+  unsigned long i;
+  for ( i=0; i<bz->njobs; ++i )
+    while ( bz->jobs[i].state==JOB_TODO || bz->jobs[i].state==JOB_RUNNING )
+      pthread_cond_wait(&bz->done_cond,&bz->lock);
+}
+
+/* ******************************************************************************* */
+/* Write                                                                           */
+static int write_all(int fd,const unsigned char *s,unsigned long len) {
+  while ( len>0 ) {
+    ssize_t n=write(fd,s,len);
+    if ( n<0 ) {
+      if ( errno==EINTR ) continue;
+      return -1;
+    }
+    s+=n;
+    len-=n;
+  }
+  return 0;
+}
+
+// write the compressed block of the next job (waits for it)
+// should be called with the lock held
+static void bgzf_mt_write_next(BGZF_MT *bz) {
+  struct bgzf_mt_job *job=&bz->jobs[bz->next_out];
+  while ( job->state!=JOB_DONE )
+    pthread_cond_wait(&bz->done_cond,&bz->lock);
+  pthread_mutex_unlock(&bz->lock);
+  if ( job->error ) bz->error=1;
+  if ( !bz->error && write_all(bz->fd,job->out,job->out_len) )
+    bz->error=1;
+  pthread_mutex_lock(&bz->lock);
+  job->state=JOB_FREE;
+  bz->next_out=(bz->next_out+1)%bz->njobs;
+}
+
+// submit the job being filled and get a free slot for the next one
+static void bgzf_mt_submit(BGZF_MT *bz) {
+  pthread_mutex_lock(&bz->lock);
+  bz->jobs[bz->next_fill].state=JOB_TODO;
+  pthread_cond_signal(&bz->todo_cond);
+  bz->next_fill=(bz->next_fill+1)%bz->njobs;
+  // write the blocks already compressed
+  while ( bz->next_out!=bz->next_fill &&
+	  bz->jobs[bz->next_out].state==JOB_DONE )
+    bgzf_mt_write_next(bz);
+  // ring full: wait for the oldest block
+  if ( bz->jobs[bz->next_fill].state!=JOB_FREE )
+    bgzf_mt_write_next(bz);
+  pthread_mutex_unlock(&bz->lock);
+  bz->jobs[bz->next_fill].in_len=0;
+}
+
+// fd should be open for writing
+// level: zlib compression level
+BGZF_MT* bgzf_mt_wopen(int fd,int level,int nthreads) {
+  return bgzf_mt_new(fd,level,nthreads,1);
+}
+
+// returns 0 on success, -1 on error
+int bgzf_mt_write(BGZF_MT* bz,const char *data,unsigned long len) {
+  while ( len>0 ) {
+    struct bgzf_mt_job *job=&bz->jobs[bz->next_fill];
+    unsigned long n=BGZF_MT_BLOCK_SIZE-job->in_len;
+    if ( n>len ) n=len;
+    memcpy(&job->in[job->in_len],data,n);
+    job->in_len+=n;
+    data+=n;
+    len-=n;
+    if ( job->in_len==BGZF_MT_BLOCK_SIZE ) bgzf_mt_submit(bz);
+  }
+  return (bz->error?-1:0);
+}
+
+/* ******************************************************************************* */
+/* Read                                                                            */
+
+// TRUE if the gzip header in hdr has the BGZF extra subfield
+int bgzf_mt_is_bgzf(const unsigned char *hdr,unsigned long len) {
+  if ( len<BGZF_MT_HEADER_SIZE ) return 0;
+  return(hdr[0]==0x1f && hdr[1]==0x8b && hdr[2]==Z_DEFLATED && (hdr[3]&4) &&
+	 get_u16(&hdr[10])>=6 && hdr[12]=='B' && hdr[13]=='C' && get_u16(&hdr[14])==2);
+}
+
+// returns the number of bytes read (<len only on EOF) or -1 on error
+static long read_all(int fd,unsigned char *s,unsigned long len) {
+  unsigned long tot=0;
+  while ( tot<len ) {
+    ssize_t n=read(fd,s+tot,len-tot);
+    if ( n<0 ) {
+      if ( errno==EINTR ) continue;
+      return -1;
+    }
+    if ( n==0 ) break;
+    tot+=n;
+  }
+  stats_count(STATS_READ,0,tot,0);
+  return tot;
+}
+
+static int bgzf_mt_index_add(BGZF_MT *bz,off_t coff,unsigned long long uoff) {
+  // only blocks after the last one seen
+  if ( bz->idx_n>0 && coff<=bz->idx_coff[bz->idx_n-1] ) return 0;
+  if ( bz->idx_n==bz->idx_size ) {
+    unsigned long size=(bz->idx_size==0?1024:bz->idx_size*2);
+    off_t *c=(off_t*)realloc(bz->idx_coff,sizeof(off_t)*size);
+    if ( c==NULL ) return -1;
+    bz->idx_coff=c;
+    unsigned long long *u=(unsigned long long*)realloc(bz->idx_uoff,sizeof(unsigned long long)*size);
+    if ( u==NULL ) return -1;
+    bz->idx_uoff=u;
+    bz->idx_size=size;
+  }
+  bz->idx_coff[bz->idx_n]=coff;
+  bz->idx_uoff[bz->idx_n]=uoff;
+  bz->idx_n++;
+  return 0;
+}
+
+// reads the next BGZF block from the file into job->in
+// returns 1 if a block was read, 0 on EOF, -1 on error
+static int bgzf_mt_read_block(BGZF_MT *bz,struct bgzf_mt_job *job) {
+  unsigned char *hdr=job->in;
+  unsigned long xlen,bsize=0,i;
+  long n;
+
+  n=read_all(bz->fd,hdr,12);
+  if ( n==0 ) return 0;
+  if ( n!=12 || hdr[0]!=0x1f || hdr[1]!=0x8b || hdr[2]!=Z_DEFLATED || hdr[3]!=4 )
+    return -1;
+  xlen=get_u16(&hdr[10]);
+  // the extra field must fit in a block (with the footer)
+  if ( xlen>BGZF_MT_MAX_BLOCK_SIZE-12-BGZF_MT_FOOTER_SIZE ) return -1;
+  if ( read_all(bz->fd,&hdr[12],xlen)!=xlen ) return -1;
+  // look for the BC subfield
+  for ( i=12; i+4<=12+xlen; i+=4+get_u16(&hdr[i+2]) ) {
+    if ( hdr[i]=='B' && hdr[i+1]=='C' && get_u16(&hdr[i+2])==2 && i+6<=12+xlen ) {
+      bsize=get_u16(&hdr[i+4])+1;
+      break;
+    }
+  }
+  if ( bsize<12+xlen+BGZF_MT_FOOTER_SIZE ) return -1;
+  if ( read_all(bz->fd,&hdr[12+xlen],bsize-12-xlen)!=bsize-12-xlen ) return -1;
+  job->in_len=bsize;
+  job->data_start=12+xlen;
+  if ( bgzf_mt_index_add(bz,bz->coffset,bz->uoffset) ) return -1;
+  bz->coffset+=bsize;
+  bz->uoffset+=get_u32(&hdr[bsize-4]);
+  return 1;
+}
+
+// fill the free slots of the ring with the next blocks
+static void bgzf_mt_readahead(BGZF_MT *bz) {
+  while ( !bz->src_eof && !bz->error ) {
+    struct bgzf_mt_job *job=&bz->jobs[bz->next_fill];
+    JOB_STATE state;
+    int r;
+    pthread_mutex_lock(&bz->lock);
+    state=job->state;
+    pthread_mutex_unlock(&bz->lock);
+    if ( state!=JOB_FREE ) break;
+    r=bgzf_mt_read_block(bz,job);
+    if ( r<=0 ) {
+      // errors are reported when the previous blocks are consumed
+      if ( r<0 ) bz->src_error=1;
+      bz->src_eof=1;
+      break;
+    }
+    pthread_mutex_lock(&bz->lock);
+    job->state=JOB_TODO;
+    pthread_cond_signal(&bz->todo_cond);
+    pthread_mutex_unlock(&bz->lock);
+    bz->next_fill=(bz->next_fill+1)%bz->njobs;
+  }
+}
+
+// fd should be open for reading and positioned at the start of a BGZF file
+BGZF_MT* bgzf_mt_ropen(int fd,int nthreads) {
+  BGZF_MT* bz=bgzf_mt_new(fd,0,nthreads,0);
+  if ( bz==NULL ) return NULL;
+  bz->start=lseek(fd,0,SEEK_CUR);
+  if ( bz->start<0 ) bz->start=0;
+  bz->coffset=bz->start;
+  return bz;
+}
+
+// reads up to len bytes of (uncompressed) data
+// returns the number of bytes read, 0 on EOF, or -1 on error
+long bgzf_mt_read(BGZF_MT* bz,char *buf,unsigned long len) {
+  unsigned long n=0;
+
+  bgzf_mt_readahead(bz);
+  while ( n<len && !bz->error ) {
+    struct bgzf_mt_job *job=&bz->jobs[bz->next_out];
+    unsigned long k;
+    pthread_mutex_lock(&bz->lock);
+    if ( job->state==JOB_FREE ) {
+      // nothing in flight
+      pthread_mutex_unlock(&bz->lock);
+      if ( bz->src_error ) bz->error=1;
+      break;
+    }
+    while ( job->state!=JOB_DONE )
+      pthread_cond_wait(&bz->done_cond,&bz->lock);
+    pthread_mutex_unlock(&bz->lock);
+    if ( job->error ) {
+      bz->error=1;
+      break;
+    }
+    if ( bz->skip>0 ) {
+      k=job->out_len-bz->out_pos;
+      if ( k>bz->skip ) k=bz->skip;
+      bz->out_pos+=k;
+      bz->skip-=k;
+    }
+    k=job->out_len-bz->out_pos;
+    if ( k>len-n ) k=len-n;
+    memcpy(&buf[n],&job->out[bz->out_pos],k);
+    n+=k;
+    bz->out_pos+=k;
+    if ( bz->out_pos==job->out_len ) {
+      // block consumed
+      pthread_mutex_lock(&bz->lock);
+      job->state=JOB_FREE;
+      pthread_mutex_unlock(&bz->lock);
+      bz->next_out=(bz->next_out+1)%bz->njobs;
+      bz->out_pos=0;
+      bgzf_mt_readahead(bz);
+    }
+  }
+  if ( bz->error ) return -1;
+  return n;
+}
+
+long long bgzf_mt_coffset(BGZF_MT* bz) {
+  return bz->coffset-bz->start;
+}
+
+// move to the given uncompressed offset
+// the blocks already seen are located using the index, the others
+// are read (but not decompressed) until the offset is reached
+// returns 0 on success, -1 on error
+int bgzf_mt_seek(BGZF_MT* bz,long long offset) {
+  unsigned long lo,hi,i;
+
+  if ( bz->error || offset<0 ) return -1;
+  // discard the blocks in flight
+  pthread_mutex_lock(&bz->lock);
+  bgzf_mt_wait_jobs(bz);
+  for ( i=0; i<bz->njobs; ++i )
+    bz->jobs[i].state=JOB_FREE;
+  bz->next_fill=bz->next_out=bz->next_todo=0;
+  pthread_mutex_unlock(&bz->lock);
+  bz->out_pos=0;
+  bz->src_eof=0;
+  bz->src_error=0;
+  // last block starting at or before offset
+  if ( bz->idx_n==0 || bz->idx_uoff[0]>offset ) {
+    bz->coffset=bz->start;
+    bz->uoffset=0;
+  } else {
+    lo=0; hi=bz->idx_n;
+    while ( hi-lo>1 ) {
+      unsigned long mid=(lo+hi)/2;
+      if ( bz->idx_uoff[mid]<=offset ) lo=mid;
+      else hi=mid;
+    }
+    bz->coffset=bz->idx_coff[lo];
+    bz->uoffset=bz->idx_uoff[lo];
+  }
+  if ( lseek(bz->fd,bz->coffset,SEEK_SET)<0 ) return -1;
+  // skip the blocks that end before the offset
+  while ( 1 ) {
+    struct bgzf_mt_job *job=&bz->jobs[0];
+    off_t coff=bz->coffset;
+    unsigned long long uoff=bz->uoffset;
+    int r=bgzf_mt_read_block(bz,job);
+    if ( r<0 ) return -1;
+    if ( r==0 ) {
+      // offset past the end of the file
+      bz->src_eof=1;
+      bz->skip=0;
+      return 0;
+    }
+    if ( bz->uoffset>offset ) {
+      // go back to the start of the block
+      if ( lseek(bz->fd,coff,SEEK_SET)<0 ) return -1;
+      bz->coffset=coff;
+      bz->uoffset=uoff;
+      break;
+    }
+  }
+  bz->skip=offset-bz->uoffset;
+  return 0;
+}
+
+// flushes the pending data (write mode), adds the EOF marker block
+// and closes the file descriptor
+// returns 0 on success, -1 on error
+int bgzf_mt_close(BGZF_MT* bz) {
+  int i,ret;
+
+  if ( bz->is_write && bz->nthreads>0 && !bz->error ) {
+    if ( bz->jobs[bz->next_fill].in_len>0 ) bgzf_mt_submit(bz);
+    pthread_mutex_lock(&bz->lock);
+    while ( bz->next_out!=bz->next_fill )
+      bgzf_mt_write_next(bz);
+    pthread_mutex_unlock(&bz->lock);
+    if ( !bz->error && write_all(bz->fd,bgzf_mt_eof,sizeof(bgzf_mt_eof)) )
+      bz->error=1;
+  }
+  pthread_mutex_lock(&bz->lock);
+  bz->done=1;
+  pthread_cond_broadcast(&bz->todo_cond);
+  pthread_mutex_unlock(&bz->lock);
+  for ( i=0; i<bz->nthreads; ++i )
+    pthread_join(bz->workers[i],NULL);
+  if ( close(bz->fd) && bz->is_write ) bz->error=1;
+  ret=((bz->error && bz->is_write)?-1:0);
+  pthread_mutex_destroy(&bz->lock);
+  pthread_cond_destroy(&bz->todo_cond);
+  pthread_cond_destroy(&bz->done_cond);
+  free(bz->idx_coff);
+  free(bz->idx_uoff);
+  free(bz->jobs);
+  free(bz->workers);
+  free(bz);
+  return ret;
+}
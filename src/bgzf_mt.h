@@ -0,0 +1,47 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#ifndef BGZF_MT_H
+#define BGZF_MT_H
+
+// BGZF (blocked gzip) compression and decompression using a pool of threads
+// Each block is a gzip member with at most BGZF_MT_BLOCK_SIZE bytes of
+// (uncompressed) data. The blocks are compressed (or decompressed)
+// independently by the worker threads and written (or returned) in order.
+
+// maximum number of bytes of data in a block (as in samtools/htslib)
+#define BGZF_MT_BLOCK_SIZE 0xff00
+#define BGZF_MT_MAX_BLOCK_SIZE 0x10000
+
+typedef struct bgzf_mt_s BGZF_MT;
+
+BGZF_MT* bgzf_mt_wopen(int fd,int level,int nthreads);
+int bgzf_mt_write(BGZF_MT* bz,const char *data,unsigned long len);
+int bgzf_mt_is_bgzf(const unsigned char *hdr,unsigned long len);
+BGZF_MT* bgzf_mt_ropen(int fd,int nthreads);
+long bgzf_mt_read(BGZF_MT* bz,char *buf,unsigned long len);
+int bgzf_mt_seek(BGZF_MT* bz,long long offset);
+// compressed offset (from the start) of the blocks read so far
+long long bgzf_mt_coffset(BGZF_MT* bz);
+int bgzf_mt_close(BGZF_MT* bz);
+
+#endif
@@ -0,0 +1,453 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "fastq.h"
+#include "hash.h"
+#include "range_list.h"
+
+// Micro benchmarks and randomized checks of the data structures
+// used by the programs: the hash table (hash.c), used to pair reads
+// and to find duplicates, and the range lists (range_list.c), used to
+// keep the UMIs seen in bam_umi_count.
+// The results are written in TSV format (one line per operation):
+// structure, operation, pattern, n, number of operations, time (s),
+// operations/s and memory (bytes) per entry.
+
+#define MAX_SIZES 32
+
+struct params_s {
+  unsigned long keys[MAX_SIZES];
+  int nkeys;
+  unsigned long umis;
+  unsigned long long seed;
+  unsigned long checks;
+};
+typedef struct params_s Params;
+
+static unsigned long long rng_state;
+static unsigned long num_errors=0;
+
+static inline unsigned long long splitmix64(unsigned long long *s) {
+  unsigned long long z=(*s+=0x9E3779B97F4A7C15ULL);
+  z=(z^(z>>30))*0xBF58476D1CE4E5B9ULL;
+  z=(z^(z>>27))*0x94D049BB133111EBULL;
+  return z^(z>>31);
+}
+
+static inline unsigned long rng_n(unsigned long n) {
+  return (unsigned long)(splitmix64(&rng_state)%n);
+}
+
+// i-th key of a sequence: the keys can be generated again in any order
+static inline ulong nth_key(unsigned long long seed,unsigned long i) {
+  unsigned long long s=seed+i*0x9E3779B97F4A7C15ULL;
+  return splitmix64(&s);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+static unsigned long gcd(unsigned long a,unsigned long b) {
+  while ( b ) {
+    unsigned long t=a%b;
+    a=b;
+    b=t;
+  }
+  return a;
+}
+
+// resident memory (bytes)
+static unsigned long rss(void) {
+  unsigned long size=0,resident=0;
+  FILE *fd=fopen("/proc/self/statm","r");
+  if ( fd==NULL ) return 0;
+  if ( fscanf(fd,"%lu %lu",&size,&resident)!=2 ) resident=0;
+  fclose(fd);
+  return resident*sysconf(_SC_PAGESIZE);
+}
+
+static void report(const char *ds,const char *op,const char *pattern,unsigned long n,unsigned long ops,double t,double mem) {
+  printf("%s\t%s\t%s\t%lu\t%lu\t%.4f\t%.0f\t%.1f\n",ds,op,pattern,n,ops,t,(t>0?ops/t:0),mem);
+  fflush(stdout);
+}
+
+#define CHECK(cond,s...) { if (!(cond)) { ++num_errors; PRINT_ERROR(s); } }
+
+/* ******************************************************************************* */
+// hash table: n keys in a table with n buckets
+static void bench_hash(unsigned long n,unsigned long long seed) {
+  unsigned long i,j,found=0;
+  unsigned long step=n/2+1;
+  unsigned long mem0=rss();
+  double t;
+  hashtable ht;
+
+  // visit the keys in a different order than the inserts (step and
+  // n coprime so that all keys are visited)
+  while ( gcd(step,n)!=1 ) ++step;
+  t=now();
+  ht=new_hashtable(n);
+  if ( ht==NULL ) {
+    PRINT_ERROR("Unable to allocate memory");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  report("hash","new_hashtable","",n,1,now()-t,0);
+  t=now();
+  for(i=0;i<n;++i)
+    if ( insere(ht,nth_key(seed,i),(__ptr_t)(i+1))<0 ) {
+      PRINT_ERROR("Unable to allocate memory");
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+  t=now()-t;
+  report("hash","insere","random",n,n,t,(rss()-mem0)*1.0/n);
+  t=now();
+  for(i=0,j=0;i<n;++i,j=(j+step)%n)
+    found+=(get_object(ht,nth_key(seed,j))!=NULL);
+  report("hash","get_object","hit",n,n,now()-t,0);
+  CHECK(found==n,"hash: %lu of %lu keys found",found,n);
+  found=0;
+  t=now();
+  for(i=0;i<n;++i)
+    found+=(get_object(ht,nth_key(seed^0xFFFFULL,i))!=NULL);
+  report("hash","get_object","miss",n,n,now()-t,0);
+  t=now();
+  for(i=0,j=0;i<n;++i,j=(j+step)%n)
+    found+=(delete(ht,nth_key(seed,j),(__ptr_t)(j+1))==NULL);
+  report("hash","delete","hit",n,n,now()-t,0);
+  CHECK(found==0 && ht->n_entries==0,"hash: %lu deletes failed",found);
+  free_hashtable(ht);
+}
+
+// range lists: sets of UMIs (ids in 1..UMIS_MAX, as in bam_umi_count)
+#define UMIS_MAX 1048576
+
+// number of UMIs (in total, about umis) and sets of each pattern:
+//  sparse: a few UMIs per set (most features in a cell)
+//  dense: consecutive UMIs (highly expressed features)
+//  random: many UMIs spread in the whole range
+static void bench_rl(unsigned long umis,unsigned long long seed) {
+  static const char *patterns[]={"sparse","dense","random"};
+  static const unsigned long per_set[]={8,4096,65536};
+  int p;
+  for(p=0;p<3;++p) {
+    unsigned long nsets=umis/per_set[p]+1;
+    RL_Tree **sets=(RL_Tree**)malloc(sizeof(RL_Tree*)*nsets);
+    unsigned long i,k,found=0,mem=0;
+    unsigned long n=nsets*per_set[p];
+    double t;
+
+    if ( sets==NULL ) {
+      PRINT_ERROR("Unable to allocate memory");
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+    rng_state=seed;
+    t=now();
+    for(i=0;i<nsets;++i) {
+      NUM base=1+rng_n(UMIS_MAX-per_set[p]);
+      sets[i]=new_rl(UMIS_MAX);
+      for(k=0;k<per_set[p];++k) {
+	NUM u=(p==1?base+k:1+rng_n(UMIS_MAX));
+	set_in_rl(sets[i],u,IN);
+      }
+    }
+    t=now()-t;
+    for(i=0;i<nsets;++i) mem+=TREE_SIZE(sets[i]);
+    report("range_list","set_in_rl",patterns[p],per_set[p],n,t,mem*1.0/n);
+    rng_state=seed;
+    t=now();
+    for(i=0;i<nsets;++i) {
+      NUM base=1+rng_n(UMIS_MAX-per_set[p]);
+      for(k=0;k<per_set[p];++k) {
+	NUM u=(p==1?base+k:1+rng_n(UMIS_MAX));
+	found+=in_rl(sets[i],u);
+      }
+    }
+    report("range_list","in_rl",patterns[p],per_set[p],n,now()-t,0);
+    CHECK(found==n,"range_list: %lu of %lu numbers found",found,n);
+    t=now();
+    for(i=0;i<nsets;++i)
+      freeze_rl(sets[i]);
+    t=now()-t;
+    mem=0;
+    for(i=0;i<nsets;++i) mem+=TREE_SIZE(sets[i]);
+    report("range_list","freeze_rl",patterns[p],per_set[p],nsets,t,mem*1.0/n);
+    t=now();
+    for(i=0;i+1<nsets;i+=2)
+      minus_rl(sets[i],sets[i+1]);
+    report("range_list","minus_rl",patterns[p],per_set[p],nsets/2,now()-t,0);
+    for(i=0;i<nsets;++i) free_rl(sets[i]);
+    free(sets);
+  }
+}
+
+/* ******************************************************************************* */
+// Randomized differential checks against simple reference
+// implementations: each object inserted in the hash table is kept in
+// a list per key (in insertion order) and the range lists are
+// compared with bitmaps.
+#define CHECK_KEYS 512
+
+struct ref_entry {
+  unsigned long *objs;
+  unsigned long n;
+  unsigned long size;
+};
+
+static void check_hash(unsigned long iter) {
+  struct ref_entry ref[CHECK_KEYS];
+  unsigned long it,op,total=0,next_obj=1;
+  // small tables: long chains and empty buckets
+  ulong size=1+rng_n(CHECK_KEYS/2);
+  hashtable ht=new_hashtable(size);
+  memset(ref,0,sizeof(ref));
+
+  for(it=0;it<iter;++it) {
+    ulong key=rng_n(CHECK_KEYS);
+    struct ref_entry *r=&ref[key];
+    op=rng_n(10);
+    if ( op<4 ) {
+      // insert
+      if ( r->n==r->size ) {
+	r->size=r->size*2+4;
+	r->objs=(unsigned long*)realloc(r->objs,sizeof(unsigned long)*r->size);
+      }
+      r->objs[r->n++]=next_obj;
+      insere(ht,key,(__ptr_t)next_obj);
+      ++next_obj;
+      ++total;
+    } else if ( op<8 ) {
+      // lookup: all the objects with the key, in insertion order
+      unsigned long k=0;
+      __ptr_t o=get_object(ht,key);
+      while ( o!=NULL ) {
+	CHECK(k<r->n && (unsigned long)o==r->objs[k],"hash: key %llu: object %lu found, expected %lu",key,(unsigned long)o,(k<r->n?r->objs[k]:0));
+	++k;
+	o=get_next_object(ht,key);
+      }
+      CHECK(k==r->n,"hash: key %llu: %lu objects found, expected %lu",key,k,r->n);
+    } else {
+      // delete an object (or one that does not exist)
+      unsigned long k=(r->n>0?rng_n(r->n+1):0);
+      unsigned long obj=(k<r->n?r->objs[k]:next_obj+1);
+      __ptr_t o=delete(ht,key,(__ptr_t)obj);
+      if ( k<r->n ) {
+	CHECK((unsigned long)o==obj,"hash: key %llu: delete of object %lu failed",key,obj);
+	memmove(&r->objs[k],&r->objs[k+1],sizeof(unsigned long)*(r->n-k-1));
+	--r->n;
+	--total;
+      } else {
+	CHECK(o==NULL,"hash: key %llu: delete of a missing object succeeded",key);
+      }
+    }
+    CHECK(ht->n_entries==total,"hash: %llu entries, expected %lu",ht->n_entries,total);
+    // traversal: all objects are visited once
+    if ( it%1000==999 || it+1==iter ) {
+      unsigned long n=0;
+      init_hash_traversal(ht);
+      while ( next_hash_object(ht)!=NULL ) ++n;
+      CHECK(n==total,"hash: %lu objects visited in the traversal, expected %lu (size %llu)",n,total,size);
+    }
+  }
+  free_hashtable(ht);
+  for(it=0;it<CHECK_KEYS;++it) free(ref[it].objs);
+}
+
+static void check_rl_same(RL_Tree *t,const char *bitmap,NUM max,const char *what) {
+  NUM i,next=0;
+  for(i=1;i<=max;++i)
+    if ( (in_rl(t,i)!=0)!=bitmap[i] ) {
+      CHECK(0,"range_list: %s: max=%lu: in_rl(%lu)=%d, expected %d",what,max,i,in_rl(t,i),bitmap[i]);
+      return;
+    }
+  // the numbers in the set, in order
+  for(i=1;i<=max;++i) {
+    if ( !bitmap[i] ) continue;
+    next=rl_next_in_bigger(t,next);
+    if ( next!=i ) {
+      CHECK(0,"range_list: %s: max=%lu: next number %lu, expected %lu",what,max,next,i);
+      return;
+    }
+  }
+  next=rl_next_in_bigger(t,next);
+  CHECK(next==0,"range_list: %s: max=%lu: next number %lu, expected none",what,max,next);
+}
+
+static void rl_random_ops(RL_Tree *t,char *bitmap,NUM max,unsigned long nops) {
+  unsigned long k;
+  for(k=0;k<nops;++k) {
+    NUM start=1+rng_n(max);
+    // runs of consecutive numbers (dense) or single numbers
+    NUM len=(rng_n(4)==0?1+rng_n(100):1);
+    STATUS st=(rng_n(3)==0?OUT:IN);
+    NUM u;
+    for(u=start;u<=max && u<start+len;++u) {
+      set_in_rl(t,u,st);
+      bitmap[u]=(st==IN);
+    }
+  }
+}
+
+static void check_rl(unsigned long iter) {
+  unsigned long it;
+  for(it=0;it<iter;++it) {
+    NUM max=1+rng_n(rng_n(2)?100:20000);
+    char *b1=(char*)calloc(max+1,1),*b2=(char*)calloc(max+1,1);
+    RL_Tree *t1=new_rl(max),*t2=new_rl(max),*t3;
+    NUM i;
+
+    rl_random_ops(t1,b1,max,rng_n(max/2+2));
+    check_rl_same(t1,b1,max,"set_in_rl");
+    t3=copy_rl(t1);
+    check_rl_same(t3,b1,max,"copy_rl");
+    freeze_rl(t1);
+    check_rl_same(t1,b1,max,"freeze_rl");
+    // the frozen set can still be updated
+    rl_random_ops(t1,b1,max,rng_n(10));
+    check_rl_same(t1,b1,max,"set_in_rl after freeze_rl");
+    rl_random_ops(t2,b2,max,rng_n(max/2+2));
+    minus_rl(t1,t2);
+    for(i=1;i<=max;++i) b1[i]=b1[i]&&!b2[i];
+    check_rl_same(t1,b1,max,"minus_rl");
+    check_rl_same(t2,b2,max,"minus_rl (second set)");
+    free_rl(t1);
+    free_rl(t2);
+    free_rl(t3);
+    free(b1);
+    free(b2);
+  }
+}
+
+/* ******************************************************************************* */
+static void print_usage(int exit_status) {
+  fprintf(stderr,"Usage: ds_bench [--keys N[,N...]] [--umis N] [--seed N] [--check N] [--no_bench]\n\
+  --keys N,...  : number of keys in the hash table benchmarks (default 1000000)\n\
+  --umis N      : number of UMIs in the range list benchmarks (default 1000000)\n\
+  --seed N      : seed of the random keys, UMIs and checks (default 1)\n\
+  --check N     : number of iterations of the randomized checks (default 100000, 0 to skip them)\n\
+  --no_bench    : only run the checks\n");
+  exit(exit_status);
+}
+
+static unsigned long get_number(const char *opt,const char *val) {
+  char *end;
+  unsigned long long n=strtoull(val,&end,10);
+  if ( *val=='\0' || (*end!='\0' && *end!=',') ) {
+    PRINT_ERROR("Invalid value for --%s: %s",opt,val);
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  return (unsigned long)n;
+}
+
+int main(int argc, char **argv) {
+  Params p;
+  static int help=FALSE;
+  static int no_bench=FALSE;
+  static struct option long_options[] = {
+    {"help",   no_argument, &help, TRUE},
+    {"no_bench",   no_argument, &no_bench, TRUE},
+    {"keys",  required_argument, 0, 'k'},
+    {"umis",  required_argument, 0, 'u'},
+    {"seed",  required_argument, 0, 's'},
+    {"check",  required_argument, 0, 'c'},
+    {0,0,0,0}
+  };
+  int c,i;
+  char *s;
+
+  p.keys[0]=1000000;
+  p.nkeys=1;
+  p.umis=1000000;
+  p.seed=1;
+  p.checks=100000;
+  fastq_print_version();
+  argc=fastq_parse_common_options(argc,argv);
+  while (1) {
+    int option_index=0;
+    c=getopt_long(argc,argv,"k:u:s:c:h",long_options,&option_index);
+    if ( c==-1 ) break;
+    switch (c) {
+    case 0:
+      break;
+    case 'k':
+      p.nkeys=0;
+      for(s=optarg;s!=NULL;s=strchr(s,',')) {
+	if ( *s==',' ) ++s;
+	if ( p.nkeys==MAX_SIZES ) {
+	  PRINT_ERROR("Too many values in --keys (max. %d)",MAX_SIZES);
+	  exit(PARAMS_ERROR_EXIT_STATUS);
+	}
+	p.keys[p.nkeys]=get_number("keys",s);
+	if ( p.keys[p.nkeys]==0 ) {
+	  PRINT_ERROR("Invalid value for --keys: %s",optarg);
+	  exit(PARAMS_ERROR_EXIT_STATUS);
+	}
+	++p.nkeys;
+      }
+      break;
+    case 'u':
+      p.umis=get_number("umis",optarg);
+      break;
+    case 's':
+      p.seed=get_number("seed",optarg);
+      break;
+    case 'c':
+      p.checks=get_number("check",optarg);
+      break;
+    case 'h':
+      help=TRUE;
+      break;
+    default:
+      print_usage(PARAMS_ERROR_EXIT_STATUS);
+    }
+  }
+  if ( help ) print_usage(0);
+  if ( optind!=argc ) print_usage(PARAMS_ERROR_EXIT_STATUS);
+
+  rng_state=p.seed;
+  if ( p.checks ) {
+    fprintf(stderr,"Checking the hash table...\n");
+    for(i=0;i<10;++i) check_hash(p.checks/10+1);
+    fprintf(stderr,"Checking the range lists...\n");
+    check_rl(p.checks/1000+1);
+  }
+  if ( !no_bench ) {
+    printf("structure\toperation\tpattern\tn\tops\ttime_s\tops_per_s\tbytes_per_entry\n");
+    for(i=0;i<p.nkeys;++i)
+      bench_hash(p.keys[i],p.seed);
+    bench_rl(p.umis,p.seed);
+  }
+  if ( num_errors ) {
+    PRINT_ERROR("%lu errors found",num_errors);
+    exit(1);
+  }
+  return 0;
+}
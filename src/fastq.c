@@ -26,16 +26,24 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <stdlib.h>
 #include <regex.h> 
 #include <zlib.h> 
+#include <limits.h>
+#include <pthread.h>
+#include "stats.h"
+#include "arena.h"
 
 // Macros
 //static char read_buffer[MAX_READ_LENGTH+1];
 
 // public
 unsigned long index_mem=0;
+void (*fastq_format_error_hook)(void)=NULL;
+int fastq_threads=1;
+int fastq_gz_index=FALSE;
 char* encodings[]={"33","64","solexa","33 *","sanger"};
 
 #define READ_LINE(fd) gzgets(fd,&read_buffer[0],MAX_READ_LENGTH)
@@ -49,17 +57,35 @@ static int is_nosuffix_readname(const char *s);
 static READ_SPACE is_color_space(char *seq,FASTQ_FILE* f);
 
 void free_indexentry(INDEX_ENTRY *e);
-INDEX_ENTRY* new_indexentry(hashtable ht,char*hdr,int len,long start_pos);
+INDEX_ENTRY* new_indexentry(hashtable ht,const char*hdr,int len,long start_pos);
+static unsigned long index_pool_mem(hashtable ht);
+static int is_fp_index(hashtable ht);
+static int is_mt_index(hashtable ht);
+static inline HASH_MT* index_shards(hashtable ht);
+static void index_readnames_mt(FASTQ_FILE* fd,hashtable index);
+static void index_batch(hashtable index,FASTQ_SPAN *names,unsigned long n,INDEX_ENTRY **entries,int remove);
+static int fp_index_insert(hashtable index,FASTQ_FILE *fd,FASTQ_SPAN rn,long long offset);
+static void format_error(void);
 
-static inline int compare_headers(const char *hdr1,const char *hdr2); //?
+static inline int compare_headers(FASTQ_SPAN hdr1,FASTQ_SPAN hdr2);
 
 
-static inline char* GZ_READ(gzFile fd,char *s,long max);
 //void GZ_WRITE(gzFile fd,char *s);
 
 //
 gzFile fastq_open(const char* filename,const char *mode);
 static void fastq_close(gzFile fd);
+static BGZF_MT* fastq_bgzf_open(const char* filename,const char *mode);
+static ZFILE* fastq_zfile_open(const char* filename);
+static int fastq_mmap(FASTQ_FILE* fd);
+static WRITER* stdout_writer(void);
+static int fastq_gz_index_start(FASTQ_FILE* fd);
+static void fastq_gz_index_save(FASTQ_FILE* fd);
+static int fastq_sink(void *dest,const char *data,unsigned long len);
+static void fastq_munmap(FASTQ_FILE* fd);
+static long fastq_fill_buffer(FASTQ_FILE* fd);
+static void fastq_readahead_start(FASTQ_FILE* fd);
+static void fastq_readahead_stop(FASTQ_FILE* fd);
 
 void fastq_print_version() {
   fprintf(stderr,"fastq_utils %s\n",VERSION);
@@ -74,15 +100,69 @@ static FASTQ_ENTRY* get_tmp_entry() {
   return tmp_entry;
 }
 
+// called before reporting an error in the format of an input file
+static void format_error(void) {
+  void (*hook)(void)=fastq_format_error_hook;
+  // the hook may read files too
+  fastq_format_error_hook=NULL;
+  if ( hook!=NULL ) hook();
+}
+
 void fastq_rewind(FASTQ_FILE* fd) {
+  int readahead=(fd->ra!=NULL);
   fd->cline=1;
-  gzrewind(fd->fd);
+  if ( fd->map!=NULL ) {
+    fd->buf_pos=0;
+    return;
+  }
+  if ( readahead ) fastq_readahead_stop(fd);
+  if ( zfile_rewind(fd->zf) ) {
+    PRINT_ERROR("Error in file %s: unable to rewind",fd->filename);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  fd->buf_pos=fd->buf_end=0;
+  fd->buf_offset=0L;
+  fd->buf_eof=FALSE;
+  if ( readahead ) fastq_readahead_start(fd);
+}
+
+// move to the given (uncompressed) offset of the file
+void fastq_seek(FASTQ_FILE* fd,long long offset) {
+  // offset in the current block?
+  if ( offset>=fd->buf_offset && offset<=fd->buf_offset+fd->buf_end ) {
+    fd->buf_pos=offset-fd->buf_offset;
+    return;
+  }
+  // the whole file is mapped: offset is after the end of the file
+  if ( fd->map!=NULL ) {
+    fd->buf_pos=fd->buf_end;
+    return;
+  }
+  // random access: the file is read by this thread from now on
+  if ( fd->ra!=NULL ) fastq_readahead_stop(fd);
+  if ( zfile_seek(fd->zf,offset) ) {
+    PRINT_ERROR("Error in file %s: line %lu: seek failed",fd->filename,fd->cline);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  fd->buf_pos=fd->buf_end=0;
+  fd->buf_offset=offset;
+  fd->buf_eof=FALSE;
+  // only the data of a few entries is likely to be needed
+  fd->read_size=FASTQ_SEEK_BLOCK_SIZE;
+}
+
+// TRUE if there are no more entries to read
+int fastq_eof(FASTQ_FILE* fd) {
+  // the end of the file is only known after trying to read
+  if ( fd->buf_pos>=fd->buf_end && !fd->buf_eof ) fastq_fill_buffer(fd);
+  return(fd->buf_pos>=fd->buf_end);
 }
 void fastq_write_entry2stdout(FASTQ_ENTRY *e) {
-  fprintf(stdout,"%s",e->hdr1);
-  fprintf(stdout,"%s",e->seq);
-  fprintf(stdout,"%s",e->hdr2);
-  fprintf(stdout,"%s",e->qual);
+  WRITER *w=stdout_writer();
+  writer_write(w,e->hdr1,strlen(e->hdr1));
+  writer_write(w,e->seq,strlen(e->seq));
+  writer_write(w,e->hdr2,strlen(e->hdr2));
+  writer_write(w,e->qual,strlen(e->qual));
 }
 
 void fastq_is_pe(FASTQ_FILE* fd) {
@@ -94,10 +174,39 @@ unsigned long get_elength(FASTQ_ENTRY* m) {
   return(m->read_len-2);
 }
 
-void fastq_new_entry_stats(FASTQ_FILE *fd, FASTQ_ENTRY* entry) {
+// add one read with length len to the histogram
+static inline void fastq_rdlen_inc(FASTQ_FILE *fd,unsigned long len) {
+  FASTQ_RDLEN_HIST *h=&fd->rdlen_ctr;
+  unsigned long p=len>>FASTQ_RDLEN_PAGE_BITS;
+  if ( p>=h->npages ) {
+    unsigned long n=p+1;
+    h->pages=(unsigned long**)realloc(h->pages,sizeof(unsigned long*)*n);
+    if ( h->pages==NULL ) {
+      PRINT_ERROR("Error while processing file %s: unable to allocate %lu bytes of memory",fd->filename,sizeof(unsigned long*)*n);
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+    memset(&h->pages[h->npages],0,sizeof(unsigned long*)*(n-h->npages));
+    h->npages=n;
+  }
+  if ( h->pages[p]==NULL ) {
+    h->pages[p]=(unsigned long*)calloc(FASTQ_RDLEN_PAGE_SIZE,sizeof(unsigned long));
+    if ( h->pages[p]==NULL ) {
+      PRINT_ERROR("Error while processing file %s: unable to allocate %lu bytes of memory",fd->filename,sizeof(unsigned long)*FASTQ_RDLEN_PAGE_SIZE);
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+  }
+  h->pages[p][len&(FASTQ_RDLEN_PAGE_SIZE-1)]++;
+}
+
+// number of reads observed with length len
+unsigned long fastq_rdlen_count(FASTQ_FILE *fd,unsigned long len) {
+  unsigned long p=len>>FASTQ_RDLEN_PAGE_BITS;
+  if ( p>=fd->rdlen_ctr.npages || fd->rdlen_ctr.pages[p]==NULL ) return 0;
+  return fd->rdlen_ctr.pages[p][len&(FASTQ_RDLEN_PAGE_SIZE-1)];
+}
 
-  unsigned long slen=entry->read_len;
-  if (slen<fd->min_rl) {
+static inline void fastq_update_stats(FASTQ_FILE *fd, unsigned long slen) {
+  if (slen<fd->min_rl || fd->num_rds==0) {
     fd->min_rl=slen;
   }
   if (slen>fd->max_rl) {
@@ -105,10 +214,14 @@ void fastq_new_entry_stats(FASTQ_FILE *fd, FASTQ_ENTRY* entry) {
   }
   ++fd->num_rds;
   fd->last_rl=slen;
-  fd->rdlen_ctr[slen]++;
+  fastq_rdlen_inc(fd,slen);
   // update min/max quality
 }
 
+void fastq_new_entry_stats(FASTQ_FILE *fd, FASTQ_ENTRY* entry) {
+  fastq_update_stats(fd,entry->read_len);
+}
+
 FASTQ_ENTRY* fastq_new_entry(void) {
 
   FASTQ_ENTRY* new=(FASTQ_ENTRY*)malloc(sizeof(FASTQ_ENTRY));
@@ -116,46 +229,63 @@ FASTQ_ENTRY* fastq_new_entry(void) {
     PRINT_ERROR("unable to allocate %ld bytes of memory",sizeof(FASTQ_ENTRY));
     exit(SYS_INT_ERROR_EXIT_STATUS);
   }
+  new->hdr1=new->hdr2=new->seq=new->qual=NULL;
+  new->hdr_size=new->seq_size=0;
+  fastq_entry_reserve(new,FASTQ_ENTRY_INIT_SIZE,FASTQ_ENTRY_INIT_SIZE);
+  new->hdr1[0]=new->hdr2[0]=new->seq[0]=new->qual[0]='\0';
   new->read_len=0;
+  new->qual_len=0;
   new->offset=0;
   return(new);
 }
-unsigned long ctr_seek=0,ctr_noseek=0;
+
+static inline char* grow_buffer(char *buf,unsigned long size) {
+  buf=(char*)realloc(buf,size);
+  if (buf==NULL) {
+    PRINT_ERROR("unable to allocate %lu bytes of memory",size);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  return(buf);
+}
+
+// make sure that seq and qual have space for seq_size bytes and
+// hdr1 and hdr2 for hdr_size bytes (the contents are kept)
+void fastq_entry_reserve(FASTQ_ENTRY *e,unsigned long seq_size,unsigned long hdr_size) {
+  if ( seq_size>e->seq_size ) {
+    unsigned long size=(e->seq_size==0?FASTQ_ENTRY_INIT_SIZE:e->seq_size);
+    while ( size<seq_size ) size*=2;
+    e->seq=grow_buffer(e->seq,size);
+    e->qual=grow_buffer(e->qual,size);
+    e->seq_size=size;
+  }
+  if ( hdr_size>e->hdr_size ) {
+    unsigned long size=(e->hdr_size==0?FASTQ_ENTRY_INIT_SIZE:e->hdr_size);
+    while ( size<hdr_size ) size*=2;
+    e->hdr1=grow_buffer(e->hdr1,size);
+    e->hdr2=grow_buffer(e->hdr2,size);
+    e->hdr_size=size;
+  }
+}
 void fastq_quick_copy_entry(long offset,FASTQ_FILE* from,FASTQ_FILE* to) {
 
-  if ( gztell(from->fd)!=offset ) {
-    //fprintf(stderr,"miss %lu / %lu\n",offset, gztell(from->fd));
+  FASTQ_RECORD r;
+  if ( from->buf_offset+from->buf_pos!=offset ) {
     // we need to seek
-    if (gzseek(from->fd,offset,SEEK_SET)<0) {
-      PRINT_ERROR("Error in file %s: line %lu: gzseek failed",from->filename,from->cline);
-      exit(SYS_INT_ERROR_EXIT_STATUS);
-    }
-    ++ctr_seek;
-  } else     ++ctr_noseek;
-  fprintf(stderr,"%lu / %lu\n",ctr_seek, ctr_noseek);
-  FASTQ_ENTRY* e=get_tmp_entry();
-  if( gzeof(from->fd)) {
-    PRINT_ERROR("Error in file %s: line %lu: premature eof",from->filename,from->cline);
-    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+    fastq_seek(from,offset);
   }
-  GZ_READ(from->fd,&e->hdr1[0],MAX_LABEL_LENGTH);
-  if ( e->hdr1[0]=='\0') {
-    PRINT_ERROR("Error in file %s: line %lu: file truncated",from->filename,from->cline);
+  if( fastq_eof(from) ) {
+    PRINT_ERROR("Error in file %s: line %lu: premature eof",from->filename,from->cline);
     exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
   }
-  GZ_READ(from->fd,&e->seq[0],MAX_READ_LENGTH);
-  GZ_READ(from->fd,&e->hdr2[0],MAX_LABEL_LENGTH);
-  GZ_READ(from->fd,&e->qual[0],MAX_READ_LENGTH);
-  if (e->seq[0]=='\0' || e->hdr2[0]=='\0' || e->qual[0]=='\0' ) {
+  if ( fastq_read_record(from,&r)==0 ) {
     PRINT_ERROR("Error in file %s: line %lu: file truncated",from->filename,from->cline);
-
     exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
   }
-  GZ_WRITE(to->fd,&e->hdr1[0]);
-  GZ_WRITE(to->fd,&e->seq[0]);
-  GZ_WRITE(to->fd,&e->hdr2[0]);
-  GZ_WRITE(to->fd,&e->qual[0]);
-  from->cur_offset=gztell(from->fd);
+  // the lines of the entry are contiguous in the buffer
+  unsigned long len=&r.qual[r.qual_len]-r.hdr1;
+  if ( r.qual[r.qual_len]=='\n' ) ++len;
+  fastq_write(to,r.hdr1,len);
+  from->cur_offset=from->buf_offset+from->buf_pos;
 }
 /*
  *
@@ -168,6 +298,7 @@ FASTQ_FILE* fastq_new(const char* filename, const int fix_dot,const char *mode)
     exit(SYS_INT_ERROR_EXIT_STATUS);
   }
   new->cur_offset=0L;
+  new->cline=0;
   new->max_rl=0L;
   new->last_rl=0L;
   new->min_rl=MAX_READ_LENGTH;
@@ -178,39 +309,74 @@ FASTQ_FILE* fastq_new(const char* filename, const int fix_dot,const char *mode)
   new->fixed_dot=FALSE;
   new->is_pe=FALSE;
   new->readname_format=UNDEF;
+  new->readname=NULL;
   new->is_casava_18=UNDEF;
   new->space=UNDEFSPACE;
   strncpy(new->filename,filename,MAX_FILENAME_LENGTH-1);
   new->filename[MAX_FILENAME_LENGTH-1]='\0';
-  new->fd=fastq_open(filename,mode);
-  memset(new->rdlen_ctr,0,sizeof(long)*MAX_READ_LENGTH);
+  new->fd=NULL;
+  new->bgzf=NULL;
+  new->zf=NULL;
+  new->map=NULL;
+  new->map_size=0;
+  if ( mode[0]=='r' )
+    new->zf=fastq_zfile_open(filename);
+  else if ( fastq_threads>1 )
+    new->bgzf=fastq_bgzf_open(filename,mode);
+  else
+    new->fd=fastq_open(filename,mode);
+  new->out=NULL;
+  if ( mode[0]!='r' ) {
+    new->out=writer_new(fastq_sink,new,WRITER_BUFFER_SIZE);
+    if ( new->out==NULL ) {
+      PRINT_ERROR("Error while processing file %s: unable to allocate %lu bytes of memory",filename,(unsigned long)WRITER_BUFFER_SIZE);
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+  }
+  new->buf=NULL;
+  new->buf_size=0;
+  new->buf_pos=new->buf_end=0;
+  new->buf_offset=0L;
+  new->buf_eof=FALSE;
+  new->read_size=FASTQ_BLOCK_SIZE;
+  new->ra=NULL;
+  if ( mode[0]=='r' && zfile_format(new->zf)==ZFILE_PLAIN && fastq_mmap(new) ) {
+    zfile_close(new->zf);
+    new->zf=NULL;
+  } else if ( mode[0]=='r' ) {
+    new->buf_size=FASTQ_BLOCK_SIZE;
+    // +1: a \0 is always kept after the data
+    new->buf=(char*)malloc(new->buf_size+1);
+    if (new->buf==NULL) {
+      PRINT_ERROR("Error while processing file %s: unable to allocate %lu bytes of memory",filename,new->buf_size+1);
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+    new->buf[0]='\0';
+    if ( fastq_threads>1 )
+      fastq_readahead_start(new);
+  }
+  new->rdlen_ctr.pages=NULL;
+  new->rdlen_ctr.npages=0;
   return(new);
 }
 
 
 void fastq_seek_copy_read(long offset,FASTQ_FILE* from,FASTQ_FILE* to) {
-  if (gzseek(from->fd,offset,SEEK_SET)<0) {
-    PRINT_ERROR("Error in file %s: line %lu: gzseek failed",from->filename,from->cline);    
-    exit(SYS_INT_ERROR_EXIT_STATUS);
-  }
+  fastq_seek(from,offset);
   FASTQ_ENTRY* e=get_tmp_entry();
   fastq_read_entry(from,e);
   fastq_write_entry(to,e);
 }
 
 
-static inline char* GZ_READ(gzFile fd,char *s,long max) {
-  char *s2=gzgets(fd,s,max);
-  if ( s2!=Z_NULL ) return(s2);
-  s[0]='\0';
-  return(NULL);
-  //fprintf(stderr,"ERROR: read from file\n");
-  //exit(1);
-}
-
 void GZ_WRITE(gzFile fd,char *s) {
+  int prev=stats_enter(STATS_WRITE);
   int n=gzputs(fd,s);
-  if ( n>0 ) return;
+  stats_leave(prev);
+  if ( n>0 ) {
+    stats_count(STATS_WRITE,0,0,n);
+    return;
+  }
   if ( *s=='\0' ) return;
   const char *errmsg=gzerror(fd,&n);
   PRINT_ERROR("%s.\n",errmsg);
@@ -230,6 +396,233 @@ void GZ_WRITE(gzFile fd,char *s) {
   /* } */
   exit(SYS_INT_ERROR_EXIT_STATUS);
 }
+
+// Output buffers: the data written is passed to the compressor (or to
+// stdout) in chunks of WRITER_BUFFER_SIZE bytes. The sinks exit on error.
+static int fastq_sink(void *dest,const char *data,unsigned long len) {
+  FASTQ_FILE* fd=(FASTQ_FILE*)dest;
+  int prev;
+  if ( fd->bgzf==NULL ) {
+    GZ_WRITE_N(fd->fd,data,len);
+    return 0;
+  }
+  prev=stats_enter(STATS_WRITE);
+  if ( bgzf_mt_write(fd->bgzf,data,len) ) {
+    PRINT_ERROR("Error while writing to file %s",fd->filename);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  stats_leave(prev);
+  stats_count(STATS_WRITE,0,0,len);
+  return 0;
+}
+
+static int stdout_sink(void *dest,const char *data,unsigned long len) {
+  int prev=stats_enter(STATS_WRITE);
+  if ( fwrite(data,1,len,stdout)!=len ) {
+    PRINT_ERROR("Error while writing to the standard output");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  stats_leave(prev);
+  stats_count(STATS_WRITE,0,0,len);
+  return 0;
+}
+
+static WRITER* stdout_w=NULL;
+
+static void stdout_writer_flush(void) {
+  if ( stdout_w==NULL ) return;
+  writer_flush(stdout_w);
+  fflush(stdout);
+}
+
+// the buffer is flushed when the program exits
+static WRITER* stdout_writer(void) {
+  if ( stdout_w!=NULL ) return stdout_w;
+  stdout_w=writer_new(stdout_sink,NULL,WRITER_BUFFER_SIZE);
+  if ( stdout_w==NULL ) {
+    PRINT_ERROR("unable to allocate %lu bytes of memory",(unsigned long)WRITER_BUFFER_SIZE);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  atexit(stdout_writer_flush);
+  return stdout_w;
+}
+
+// write len bytes of s to a file opened in write mode
+void fastq_write(FASTQ_FILE* fd,const char *s,unsigned long len) {
+  writer_write(fd->out,s,len);
+}
+
+void fastq_puts(FASTQ_FILE* fd,const char *s) {
+  fastq_write(fd,s,strlen(s));
+}
+
+void GZ_WRITE_N(gzFile fd,const char *s,unsigned long len) {
+  int err,prev,n;
+  if ( len==0 ) return;
+  prev=stats_enter(STATS_WRITE);
+  n=gzwrite(fd,s,len);
+  stats_leave(prev);
+  if ( n>0 ) {
+    stats_count(STATS_WRITE,0,0,len);
+    return;
+  }
+  PRINT_ERROR("%s.\n",gzerror(fd,&err));
+  exit(SYS_INT_ERROR_EXIT_STATUS);
+}
+
+/* ******************************************************************************* */
+// Read-ahead: the file is read and split in batches of complete entries
+// by another thread and buf points to the batch being parsed
+static char empty_buf[1]="";
+
+static void fastq_readahead_start(FASTQ_FILE* fd) {
+  fd->ra=readahead_start(fd->zf,fd->buf_offset,FASTQ_BLOCK_SIZE);
+  // if the thread cannot be started the file is read as usual
+  if ( fd->ra==NULL ) return;
+  free(fd->buf);
+  fd->buf=empty_buf;
+  fd->buf_size=fd->buf_pos=fd->buf_end=0;
+}
+
+// the unparsed data is discarded
+static void fastq_readahead_stop(FASTQ_FILE* fd) {
+  readahead_stop(fd->ra);
+  fd->ra=NULL;
+  fd->buf_size=FASTQ_BLOCK_SIZE;
+  fd->buf=(char*)malloc(fd->buf_size+1);
+  if (fd->buf==NULL) {
+    PRINT_ERROR("Error while processing file %s: unable to allocate %lu bytes of memory",fd->filename,fd->buf_size+1);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  fd->buf[0]='\0';
+  fd->buf_pos=fd->buf_end=0;
+}
+
+// batches end at the end of an entry so there is nothing to keep from
+// the current batch (except at the end of the file)
+static long fastq_readahead_fill(FASTQ_FILE* fd) {
+  READAHEAD_BATCH *b;
+  const char *errmsg=readahead_error(fd->ra);
+  if ( errmsg!=NULL ) {
+    format_error();
+    PRINT_ERROR("Error in file %s: line %lu: %s",fd->filename,fd->cline,errmsg);
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  b=readahead_next(fd->ra);
+  fd->buf=b->data;
+  fd->buf_size=b->size;
+  fd->buf_pos=0;
+  fd->buf_end=b->len;
+  fd->buf_offset=b->offset;
+  fd->buf_eof=(b->eof && b->errmsg==NULL);
+  return(b->len);
+}
+
+// Reads the next block of (uncompressed) data into the buffer.
+// The bytes not parsed yet are moved to the beginning of the buffer.
+// Returns the number of bytes read (0 on EOF)
+static long fastq_fill_buffer(FASTQ_FILE* fd) {
+  unsigned long left=fd->buf_end-fd->buf_pos;
+  if ( fd->ra!=NULL ) return fastq_readahead_fill(fd);
+  if ( fd->buf_pos>0 ) {
+    memmove(fd->buf,&fd->buf[fd->buf_pos],left);
+    fd->buf_offset+=fd->buf_pos;
+    fd->buf_pos=0;
+    fd->buf_end=left;
+  }
+  if ( left==fd->buf_size ) {
+    // entry does not fit in the buffer
+    fd->buf_size*=2;
+    fd->buf=(char*)realloc(fd->buf,fd->buf_size+1);
+    if (fd->buf==NULL) {
+      PRINT_ERROR("Error while processing file %s: unable to allocate %lu bytes of memory",fd->filename,fd->buf_size+1);
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+  }
+  unsigned long avail=fd->buf_size-fd->buf_end;
+  if ( avail>fd->read_size ) avail=fd->read_size;
+  long n=zfile_read(fd->zf,&fd->buf[fd->buf_end],avail);
+  if ( n<0 ) {
+    format_error();
+    PRINT_ERROR("Error in file %s: line %lu: %s",fd->filename,fd->cline,zfile_error(fd->zf));
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  if ( n==0 ) fd->buf_eof=TRUE;
+  fd->buf_end+=n;
+  fd->buf[fd->buf_end]='\0';
+  return(n);
+}
+
+static inline int read_record(FASTQ_FILE* fd,FASTQ_RECORD *r) {
+  char *line[4];
+  unsigned long len[4];
+  unsigned long pos;
+  short k;
+ parse:
+  pos=fd->buf_pos;
+  for (k=0;k<4;++k) {
+    char *nl=(char*)memchr(&fd->buf[pos],'\n',fd->buf_end-pos);
+    if ( nl==NULL ) {
+      if ( !fd->buf_eof ) {
+	// the entry continues in the next block
+	fastq_fill_buffer(fd);
+	goto parse;
+      }
+      if ( pos==fd->buf_end ) {
+	if ( k==0 ) return 0;
+	format_error();
+	PRINT_ERROR("Error in file %s: line %lu: file truncated",fd->filename,fd->cline);
+	exit(1);
+      }
+      // last line without a newline
+      line[k]=&fd->buf[pos];
+      len[k]=fd->buf_end-pos;
+      pos=fd->buf_end;
+      continue;
+    }
+    line[k]=&fd->buf[pos];
+    len[k]=nl-line[k];
+    pos+=len[k]+1;
+  }
+  r->hdr1=line[0];  r->hdr1_len=len[0];
+  r->seq=line[1];   r->seq_len=len[1];
+  r->hdr2=line[2];  r->hdr2_len=len[2];
+  r->qual=line[3];  r->qual_len=len[3];
+  r->offset=fd->buf_offset+fd->buf_pos;
+  fd->buf_pos=pos;
+  fd->cline+=4;
+  return(1);
+}
+
+/*
+ * Reads the next entry and sets r to point to its lines in the
+ * block buffer (no data is copied).
+ * Returns 0 on EOF, 1 on success
+ */
+int fastq_read_record(FASTQ_FILE* fd,FASTQ_RECORD *r) {
+  int prev=stats_enter(STATS_PARSE);
+  int ret=read_record(fd,r);
+  stats_leave(prev);
+  if ( ret ) stats_count(STATS_PARSE,1,0,0);
+  return ret;
+}
+
+int fastq_read_next_record(FASTQ_FILE* fd,FASTQ_RECORD *r) {
+  if ( fastq_read_record(fd,r)==0 ) return 0;
+  // +1: the read length includes the newline
+  fastq_update_stats(fd,r->seq_len+1);
+  return(1);
+}
+
+// copy a line (and the newline, if present) to dest
+// dest should have space for len+2 bytes
+static inline unsigned long copy_line(char *dest,const char *line,unsigned long len) {
+  if ( line[len]=='\n' ) ++len;
+  memcpy(dest,line,len);
+  dest[len]='\0';
+  return(len);
+}
+
 /*
  * Reads one entry from the fastq file fd and places it in e
  * Returns 0 on failure, 1 on success
@@ -244,30 +637,161 @@ int fastq_read_next_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e) {
 /* read the next entry e from the fastq stream fd */
 int fastq_read_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e) {
 
-  e->offset=gztell(fd->fd);
-  if(gzeof(fd->fd)) return 0;
-  GZ_READ(fd->fd,&e->hdr1[0],MAX_LABEL_LENGTH);
-  if ( e->hdr1[0]=='\0') return 0;
-  GZ_READ(fd->fd,&e->seq[0],MAX_READ_LENGTH);
-  GZ_READ(fd->fd,&e->hdr2[0],MAX_LABEL_LENGTH);
-  GZ_READ(fd->fd,&e->qual[0],MAX_READ_LENGTH);
-  if (e->seq[0]=='\0' || e->hdr2[0]=='\0' || e->qual[0]=='\0' ) {
-    PRINT_ERROR("Error in file %s: line %lu: file truncated",fd->filename,fd->cline);
-    exit(1);
-  }
-  fd->cline+=4;
-  e->read_len=strlen(e->seq);
+  FASTQ_RECORD r;
+  if ( fastq_read_record(fd,&r)==0 ) return 0;
+  e->offset=r.offset;
+  fastq_entry_reserve(e,max(r.seq_len,r.qual_len)+2,max(r.hdr1_len,r.hdr2_len)+2);
+  copy_line(e->hdr1,r.hdr1,r.hdr1_len);
+  e->read_len=copy_line(e->seq,r.seq,r.seq_len);
+  copy_line(e->hdr2,r.hdr2,r.hdr2_len);
+  e->qual_len=copy_line(e->qual,r.qual,r.qual_len);
   return(1);
 }
 
 
+/* ******************************************************************************* */
+// Batches of entries
+static void* batch_alloc(void *p,unsigned long size) {
+  p=realloc(p,size);
+  if (p==NULL) {
+    PRINT_ERROR("unable to allocate %lu bytes of memory",size);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  return(p);
+}
+
+FASTQ_BATCH* fastq_new_batch(unsigned long max_entries) {
+  FASTQ_BATCH* b=(FASTQ_BATCH*)batch_alloc(NULL,sizeof(FASTQ_BATCH));
+  unsigned long asize=sizeof(unsigned long)*max_entries;
+  b->n=0;
+  b->max=max_entries;
+  b->seq_size=b->qual_size=max_entries*FASTQ_ENTRY_INIT_SIZE/4;
+  b->hdr_size=max_entries*FASTQ_ENTRY_INIT_SIZE/4;
+  b->seq=(char*)batch_alloc(NULL,b->seq_size);
+  b->qual=(char*)batch_alloc(NULL,b->qual_size);
+  b->hdr=(char*)batch_alloc(NULL,b->hdr_size);
+  b->seq_used=b->qual_used=b->hdr_used=0;
+  b->seq_off=(unsigned long*)batch_alloc(NULL,asize);
+  b->seq_len=(unsigned long*)batch_alloc(NULL,asize);
+  b->qual_off=(unsigned long*)batch_alloc(NULL,asize);
+  b->qual_len=(unsigned long*)batch_alloc(NULL,asize);
+  b->hdr1_off=(unsigned long*)batch_alloc(NULL,asize);
+  b->hdr1_len=(unsigned long*)batch_alloc(NULL,asize);
+  b->hdr2_off=(unsigned long*)batch_alloc(NULL,asize);
+  b->hdr2_len=(unsigned long*)batch_alloc(NULL,asize);
+  b->offset=(long long*)batch_alloc(NULL,sizeof(long long)*max_entries);
+  b->last_qual_nl=TRUE;
+  return(b);
+}
+
+void fastq_free_batch(FASTQ_BATCH* b) {
+  free(b->seq); free(b->qual); free(b->hdr);
+  free(b->seq_off); free(b->seq_len);
+  free(b->qual_off); free(b->qual_len);
+  free(b->hdr1_off); free(b->hdr1_len);
+  free(b->hdr2_off); free(b->hdr2_len);
+  free(b->offset);
+  free(b);
+}
+
+// append len bytes of line to a packed buffer and return their offset
+static inline unsigned long batch_append(char **buf,unsigned long *size,unsigned long *used,const char *line,unsigned long len) {
+  unsigned long off=*used;
+  if ( off+len>*size ) {
+    unsigned long nsize=*size*2;
+    while ( nsize<off+len ) nsize*=2;
+    *buf=(char*)batch_alloc(*buf,nsize);
+    *size=nsize;
+  }
+  memcpy(&(*buf)[off],line,len);
+  *used+=len;
+  return(off);
+}
+
+/*
+ * Reads up to b->max entries from fd into b (the previous contents
+ * of b are discarded).
+ * Returns the number of entries read (0 on EOF)
+ */
+unsigned long fastq_read_batch(FASTQ_FILE* fd,FASTQ_BATCH* b) {
+  FASTQ_RECORD r;
+  unsigned long i;
+  b->seq_used=b->qual_used=b->hdr_used=0;
+  b->last_qual_nl=TRUE;
+  for (i=0; i<b->max; ++i) {
+    if ( fastq_eof(fd) || fastq_read_record(fd,&r)==0 ) break;
+    b->offset[i]=r.offset;
+    b->hdr1_len[i]=r.hdr1_len;
+    b->hdr1_off[i]=batch_append(&b->hdr,&b->hdr_size,&b->hdr_used,r.hdr1,r.hdr1_len);
+    b->seq_len[i]=r.seq_len;
+    b->seq_off[i]=batch_append(&b->seq,&b->seq_size,&b->seq_used,r.seq,r.seq_len);
+    b->hdr2_len[i]=r.hdr2_len;
+    b->hdr2_off[i]=batch_append(&b->hdr,&b->hdr_size,&b->hdr_used,r.hdr2,r.hdr2_len);
+    b->qual_len[i]=r.qual_len;
+    b->qual_off[i]=batch_append(&b->qual,&b->qual_size,&b->qual_used,r.qual,r.qual_len);
+    b->last_qual_nl=(r.qual[r.qual_len]=='\n');
+  }
+  b->n=i;
+  return(i);
+}
+
+// as fastq_read_batch but the statistics of fd are also updated
+unsigned long fastq_read_next_batch(FASTQ_FILE* fd,FASTQ_BATCH* b) {
+  unsigned long i;
+  fastq_read_batch(fd,b);
+  for (i=0; i<b->n; ++i)
+    // +1: the read length includes the newline
+    fastq_update_stats(fd,b->seq_len[i]+1);
+  return(b->n);
+}
+
+static inline int batch_nl(FASTQ_BATCH* b,unsigned long i) {
+  return(i+1<b->n || b->last_qual_nl);
+}
+
+// copy entry i of the batch to e
+void fastq_batch_entry(FASTQ_BATCH* b,unsigned long i,FASTQ_ENTRY *e) {
+  FASTQ_RECORD r;
+  r.hdr1=&b->hdr[b->hdr1_off[i]];  r.hdr1_len=b->hdr1_len[i];
+  r.seq=&b->seq[b->seq_off[i]];    r.seq_len=b->seq_len[i];
+  r.hdr2=&b->hdr[b->hdr2_off[i]];  r.hdr2_len=b->hdr2_len[i];
+  r.qual=&b->qual[b->qual_off[i]]; r.qual_len=b->qual_len[i];
+  fastq_entry_reserve(e,max(r.seq_len,r.qual_len)+2,max(r.hdr1_len,r.hdr2_len)+2);
+  e->offset=b->offset[i];
+  memcpy(e->hdr1,r.hdr1,r.hdr1_len); strcpy(&e->hdr1[r.hdr1_len],"\n");
+  memcpy(e->seq,r.seq,r.seq_len); strcpy(&e->seq[r.seq_len],"\n");
+  memcpy(e->hdr2,r.hdr2,r.hdr2_len); strcpy(&e->hdr2[r.hdr2_len],"\n");
+  memcpy(e->qual,r.qual,r.qual_len);
+  strcpy(&e->qual[r.qual_len],(batch_nl(b,i)?"\n":""));
+  e->read_len=r.seq_len+1;
+  e->qual_len=r.qual_len+(batch_nl(b,i)?1:0);
+}
+
+static inline void batch_entry_write(WRITER* w,FASTQ_BATCH* b,unsigned long i) {
+  writer_write(w,&b->hdr[b->hdr1_off[i]],b->hdr1_len[i]);
+  writer_putc(w,'\n');
+  writer_write(w,&b->seq[b->seq_off[i]],b->seq_len[i]);
+  writer_putc(w,'\n');
+  writer_write(w,&b->hdr[b->hdr2_off[i]],b->hdr2_len[i]);
+  writer_putc(w,'\n');
+  writer_write(w,&b->qual[b->qual_off[i]],b->qual_len[i]);
+  if ( batch_nl(b,i) ) writer_putc(w,'\n');
+}
+
+void fastq_write_batch_entry(FASTQ_FILE* fd,FASTQ_BATCH* b,unsigned long i) {
+  batch_entry_write(fd->out,b,i);
+}
+
+void fastq_write_batch_entry2stdout(FASTQ_BATCH* b,unsigned long i) {
+  batch_entry_write(stdout_writer(),b,i);
+}
+
 /* read the next entry e from the fastq stream fd */
 void fastq_write_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e) {
-
-  GZ_WRITE(fd->fd,&e->hdr1[0]);
-  GZ_WRITE(fd->fd,&e->seq[0]);
-  GZ_WRITE(fd->fd,&e->hdr2[0]);
-  GZ_WRITE(fd->fd,&e->qual[0]);  
+  writer_write(fd->out,e->hdr1,strlen(e->hdr1));
+  writer_write(fd->out,e->seq,strlen(e->seq));
+  writer_write(fd->out,e->hdr2,strlen(e->hdr2));
+  writer_write(fd->out,e->qual,strlen(e->qual));
 }
 
 
@@ -296,56 +820,260 @@ char* fastq_qualRange2enc(unsigned int min_qual,unsigned int max_qual) {
   return encodings[enc];
 }
 
+/* ******************************************************************************* */
+// Validation kernels
+// The sequence and quality strings are checked a vector at a time when
+// the CPU supports it (AVX2 or SSE4.2). The kernels only deal with the
+// common case: if something is wrong the byte by byte checks in
+// fastq_validate_entry find (and report) the error.
+// The environment variable FASTQ_SIMD=scalar|sse4.2|avx2 forces a version.
+
+// classes of the characters in a sequence
+#define SEQ_VALID 1
+#define SEQ_T 2
+#define SEQ_U 4
+static const unsigned char seq_class[256]={
+  ['A']=SEQ_VALID,['C']=SEQ_VALID,['G']=SEQ_VALID,['T']=SEQ_VALID|SEQ_T,['U']=SEQ_VALID|SEQ_U,
+  ['a']=SEQ_VALID,['c']=SEQ_VALID,['g']=SEQ_VALID,['t']=SEQ_VALID|SEQ_T,['u']=SEQ_VALID|SEQ_U,
+  ['0']=SEQ_VALID,['1']=SEQ_VALID,['2']=SEQ_VALID,['3']=SEQ_VALID,
+  ['n']=SEQ_VALID,['N']=SEQ_VALID,['.']=SEQ_VALID
+};
+
+#define IS_EOL(c) ((c)=='\0' || (c)=='\n' || (c)=='\r')
+
+// check the sequence from position i
+// Returns 0 and sets *slen if all the characters are valid and U and T
+// are not both present, 1 otherwise
+static inline int seq_check_tail(const char *seq,unsigned long i,unsigned char cls,unsigned long *slen) {
+  unsigned char c;
+  while ( (c=seq_class[(unsigned char)seq[i]])&SEQ_VALID ) {
+    cls|=c;
+    ++i;
+  }
+  if ( !IS_EOL(seq[i]) ) return 1;
+  if ( (cls&(SEQ_T|SEQ_U))==(SEQ_T|SEQ_U) ) return 1;
+  *slen=i;
+  return 0;
+}
+
+// size: number of bytes that can be read from seq (the length of the
+// line): the vector versions only read whole blocks within size and
+// leave the rest of the line to seq_check_tail
+static int seq_check_scalar(const char *seq,unsigned long size,unsigned long *slen) {
+  return seq_check_tail(seq,0,0,slen);
+}
+
+// Returns the length of the quality string and updates min/max
+static inline unsigned long qual_scan_tail(const char *qual,unsigned long i,unsigned long *min,unsigned long *max) {
+  while ( !IS_EOL(qual[i]) ) {
+    // as in the byte by byte version (chars are signed)
+    unsigned int x=(unsigned int)qual[i];
+    if (x<*min) { *min=x; }
+    if (x>*max) { *max=x; }
+    ++i;
+  }
+  return(i);
+}
+
+static unsigned long qual_scan_scalar(const char *qual,unsigned long size,unsigned long *min,unsigned long *max) {
+  return qual_scan_tail(qual,0,min,max);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FASTQ_X86_SIMD 1
+
+// A character is valid if the bits given by the tables for its low and
+// high nibbles intersect:
+// bit 0: '.' bit 1: '0'-'3'  bit 2: ACGN/acgn  bit 3: TU/tu
+#define SEQ_LO_NIBBLE 2,6,2,6,8,8,0,4,0,0,0,0,0,0,5,0
+#define SEQ_HI_NIBBLE 0,0,1,2,4,8,4,8,0,0,0,0,0,0,0,0
+
+// find the first invalid (or end of line) character in a block of
+// positions given by the bitmask bad, the T/U masks are limited to the
+// positions before it
+#define SEQ_BLOCK_END(bad,tm,um,i,has_t,has_u) {		\
+    if ( bad ) {						\
+      unsigned int p=__builtin_ctz(bad);			\
+      unsigned long below=(1UL<<p)-1;				\
+      has_t|=((tm)&below)!=0;					\
+      has_u|=((um)&below)!=0;					\
+      i+=p;							\
+      break;							\
+    }								\
+    has_t|=(tm)!=0;						\
+    has_u|=(um)!=0;						\
+  }
+
+__attribute__((target("sse4.2")))
+static int seq_check_sse42(const char *seq,unsigned long size,unsigned long *slen) {
+  const __m128i lo_tab=_mm_setr_epi8(SEQ_LO_NIBBLE);
+  const __m128i hi_tab=_mm_setr_epi8(SEQ_HI_NIBBLE);
+  const __m128i m0f=_mm_set1_epi8(0x0f);
+  const __m128i lower=_mm_set1_epi8(0x20);
+  const __m128i t=_mm_set1_epi8('t');
+  const __m128i u=_mm_set1_epi8('u');
+  unsigned long i=0;
+  int has_t=0,has_u=0;
+  for ( ; i+16<=size; i+=16) {
+    __m128i v=_mm_loadu_si128((const __m128i*)&seq[i]);
+    __m128i lo=_mm_shuffle_epi8(lo_tab,_mm_and_si128(v,m0f));
+    __m128i hi=_mm_shuffle_epi8(hi_tab,_mm_and_si128(_mm_srli_epi16(v,4),m0f));
+    unsigned int bad=_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo,hi),_mm_setzero_si128()));
+    __m128i vl=_mm_or_si128(v,lower);
+    unsigned int tm=_mm_movemask_epi8(_mm_cmpeq_epi8(vl,t));
+    unsigned int um=_mm_movemask_epi8(_mm_cmpeq_epi8(vl,u));
+    SEQ_BLOCK_END(bad,tm,um,i,has_t,has_u);
+  }
+  return seq_check_tail(seq,i,(has_t?SEQ_T:0)|(has_u?SEQ_U:0),slen);
+}
+
+__attribute__((target("avx2")))
+static int seq_check_avx2(const char *seq,unsigned long size,unsigned long *slen) {
+  const __m256i lo_tab=_mm256_setr_epi8(SEQ_LO_NIBBLE,SEQ_LO_NIBBLE);
+  const __m256i hi_tab=_mm256_setr_epi8(SEQ_HI_NIBBLE,SEQ_HI_NIBBLE);
+  const __m256i m0f=_mm256_set1_epi8(0x0f);
+  const __m256i lower=_mm256_set1_epi8(0x20);
+  const __m256i t=_mm256_set1_epi8('t');
+  const __m256i u=_mm256_set1_epi8('u');
+  unsigned long i=0;
+  int has_t=0,has_u=0;
+  for ( ; i+32<=size; i+=32) {
+    __m256i v=_mm256_loadu_si256((const __m256i*)&seq[i]);
+    __m256i lo=_mm256_shuffle_epi8(lo_tab,_mm256_and_si256(v,m0f));
+    __m256i hi=_mm256_shuffle_epi8(hi_tab,_mm256_and_si256(_mm256_srli_epi16(v,4),m0f));
+    unsigned int bad=_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo,hi),_mm256_setzero_si256()));
+    __m256i vl=_mm256_or_si256(v,lower);
+    unsigned int tm=_mm256_movemask_epi8(_mm256_cmpeq_epi8(vl,t));
+    unsigned int um=_mm256_movemask_epi8(_mm256_cmpeq_epi8(vl,u));
+    SEQ_BLOCK_END(bad,tm,um,i,has_t,has_u);
+  }
+  return seq_check_tail(seq,i,(has_t?SEQ_T:0)|(has_u?SEQ_U:0),slen);
+}
+
+// min/max of the quality values
+// vectors with an end of line or a value >127 are left to qual_scan_tail
+__attribute__((target("sse4.2")))
+static unsigned long qual_scan_sse42(const char *qual,unsigned long size,unsigned long *min,unsigned long *max) {
+  const __m128i nl=_mm_set1_epi8('\n');
+  const __m128i cr=_mm_set1_epi8('\r');
+  const __m128i zero=_mm_setzero_si128();
+  __m128i vmin=_mm_set1_epi8((char)0xff);
+  __m128i vmax=zero;
+  unsigned char b[16];
+  unsigned long i=0;
+  int k;
+  for ( ; i+16<=size; i+=16) {
+    __m128i v=_mm_loadu_si128((const __m128i*)&qual[i]);
+    __m128i eol=_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v,nl),_mm_cmpeq_epi8(v,cr)),_mm_cmpeq_epi8(v,zero));
+    if ( _mm_movemask_epi8(_mm_or_si128(eol,v)) ) break;
+    vmin=_mm_min_epu8(vmin,v);
+    vmax=_mm_max_epu8(vmax,v);
+  }
+  if ( i>0 ) {
+    _mm_storeu_si128((__m128i*)b,vmin);
+    for (k=0;k<16;++k) if ( b[k]<*min ) *min=b[k];
+    _mm_storeu_si128((__m128i*)b,vmax);
+    for (k=0;k<16;++k) if ( b[k]>*max ) *max=b[k];
+  }
+  return qual_scan_tail(qual,i,min,max);
+}
+
+__attribute__((target("avx2")))
+static unsigned long qual_scan_avx2(const char *qual,unsigned long size,unsigned long *min,unsigned long *max) {
+  const __m256i nl=_mm256_set1_epi8('\n');
+  const __m256i cr=_mm256_set1_epi8('\r');
+  const __m256i zero=_mm256_setzero_si256();
+  __m256i vmin=_mm256_set1_epi8((char)0xff);
+  __m256i vmax=zero;
+  unsigned char b[32];
+  unsigned long i=0;
+  int k;
+  for ( ; i+32<=size; i+=32) {
+    __m256i v=_mm256_loadu_si256((const __m256i*)&qual[i]);
+    __m256i eol=_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v,nl),_mm256_cmpeq_epi8(v,cr)),_mm256_cmpeq_epi8(v,zero));
+    if ( _mm256_movemask_epi8(_mm256_or_si256(eol,v)) ) break;
+    vmin=_mm256_min_epu8(vmin,v);
+    vmax=_mm256_max_epu8(vmax,v);
+  }
+  if ( i>0 ) {
+    _mm256_storeu_si256((__m256i*)b,vmin);
+    for (k=0;k<32;++k) if ( b[k]<*min ) *min=b[k];
+    _mm256_storeu_si256((__m256i*)b,vmax);
+    for (k=0;k<32;++k) if ( b[k]>*max ) *max=b[k];
+  }
+  return qual_scan_tail(qual,i,min,max);
+}
+#endif
+
+static int (*seq_check)(const char*,unsigned long,unsigned long*)=seq_check_scalar;
+static unsigned long (*qual_scan)(const char*,unsigned long,unsigned long*,unsigned long*)=qual_scan_scalar;
+
+__attribute__((constructor))
+static void fastq_select_kernels(void) {
+#ifdef FASTQ_X86_SIMD
+  const char *force=getenv("FASTQ_SIMD");
+  __builtin_cpu_init();
+  if ( force!=NULL && !strcmp(force,"scalar") ) return;
+  if ( __builtin_cpu_supports("avx2") && (force==NULL || !strcmp(force,"avx2")) ) {
+    seq_check=seq_check_avx2;
+    qual_scan=qual_scan_avx2;
+  } else if ( __builtin_cpu_supports("sse4.2") ) {
+    seq_check=seq_check_sse42;
+    qual_scan=qual_scan_sse42;
+  }
+#endif
+}
+
+// report the error and leave the validation (when report is FALSE
+// nothing is printed)
+#define VALIDATE_ERROR(s...) { if (report) { format_error(); PRINT_ERROR(s); } return 1; }
+
 // return 0 on sucess, 1 otherwise
-inline int fastq_validate_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e) {
+// When report is FALSE the errors are not printed and the statistics of
+// fd are not updated: fd is only read
+static inline int validate_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e,int report) {
 //(char *hdr,char *hdr2,char *seq,char *qual,unsigned long linenum,const char* filename) {
-  char rname1[MAX_LABEL_LENGTH];
-  char rname2[MAX_LABEL_LENGTH];
-
   // Sequence identifier
   if ( e->hdr1[0]!='@' ) {
-    PRINT_ERROR("Error in file %s: line %lu: sequence identifier should start with an @ - %s",fd->filename,fd->cline,e->hdr1);
-    return 1;
+    VALIDATE_ERROR("Error in file %s: line %lu: sequence identifier should start with an @ - %s",fd->filename,fd->cline,e->hdr1);
   }  
   if ( e->hdr1[1]=='\0' || e->hdr1[1]=='\n' || e->hdr1[1]=='\r') {
-    PRINT_ERROR("Error in file %s: line %lu: sequence identifier should be longer than 1",fd->filename,fd->cline);	   
-    return 1;
+    VALIDATE_ERROR("Error in file %s: line %lu: sequence identifier should be longer than 1",fd->filename,fd->cline);
   }
   // sequence
   unsigned long slen=0;
-  short found_T=FALSE, found_U=FALSE;
-  while ( e->seq[slen]!='\0' && e->seq[slen]!='\n' && e->seq[slen]!='\r' ) {
-    // check content: ACGT acgt nN 0123....include the .?
-    if ( e->seq[slen]!='A' && e->seq[slen]!='C' && e->seq[slen]!='G' && e->seq[slen]!='T' && e->seq[slen]!='U' &&
-	 e->seq[slen]!='a' && e->seq[slen]!='c' && e->seq[slen]!='g' && e->seq[slen]!='t' && e->seq[slen]!='u' &&
-	 e->seq[slen]!='0' && e->seq[slen]!='1' && e->seq[slen]!='2' && e->seq[slen]!='3' &&
-	 e->seq[slen]!='n' && e->seq[slen]!='N' && e->seq[slen]!='.' ) {      
-      PRINT_ERROR("Error in file %s: line %lu: invalid character '%c' (hex. code:'%x'), expected ACGTUacgtu0123nN.",fd->filename,fd->cline+1,e->seq[slen],e->seq[slen]);
-      return 1;
-    }
-    // soft check - this should probably be enforced on all reads in the file
-    if ( e->seq[slen]=='U' || e->seq[slen]=='u') {
-      found_U=TRUE;
-      if (found_T) {
-	PRINT_ERROR("Error in file %s: line %lu: read contains both U and T bases",fd->filename,fd->cline-2);
-	return 1;
+  if ( seq_check(e->seq,e->read_len,&slen) ) {
+    short found_T=FALSE, found_U=FALSE;
+    while ( e->seq[slen]!='\0' && e->seq[slen]!='\n' && e->seq[slen]!='\r' ) {
+      // check content: ACGT acgt nN 0123....include the .?
+      if ( e->seq[slen]!='A' && e->seq[slen]!='C' && e->seq[slen]!='G' && e->seq[slen]!='T' && e->seq[slen]!='U' &&
+  	 e->seq[slen]!='a' && e->seq[slen]!='c' && e->seq[slen]!='g' && e->seq[slen]!='t' && e->seq[slen]!='u' &&
+  	 e->seq[slen]!='0' && e->seq[slen]!='1' && e->seq[slen]!='2' && e->seq[slen]!='3' &&
+  	 e->seq[slen]!='n' && e->seq[slen]!='N' && e->seq[slen]!='.' ) {      
+        VALIDATE_ERROR("Error in file %s: line %lu: invalid character '%c' (hex. code:'%x'), expected ACGTUacgtu0123nN.",fd->filename,fd->cline+1,e->seq[slen],e->seq[slen]);
       }
-    } else {
-      if ( e->seq[slen]=='T' || e->seq[slen]=='t') {
-	found_T=TRUE;
-	if (found_U) {
-	  PRINT_ERROR("Error in file %s: line %lu: read contains both U and T bases",fd->filename,fd->cline-2);
-	  return 1;
-	}
-      }	
+      // soft check - this should probably be enforced on all reads in the file
+      if ( e->seq[slen]=='U' || e->seq[slen]=='u') {
+        found_U=TRUE;
+        if (found_T) {
+  	VALIDATE_ERROR("Error in file %s: line %lu: read contains both U and T bases",fd->filename,fd->cline-2);
+        }
+      } else {
+        if ( e->seq[slen]=='T' || e->seq[slen]=='t') {
+  	found_T=TRUE;
+  	if (found_U) {
+  	  VALIDATE_ERROR("Error in file %s: line %lu: read contains both U and T bases",fd->filename,fd->cline-2);
+  	}
+        }	
+      }
+      slen++;
     }
-    slen++;
-  }  
-  fastq_new_entry_stats(fd,e);  
+  }
+  if ( report ) fastq_new_entry_stats(fd,e);
   // check len
   if (slen < MIN_READ_LENGTH ) {
-    PRINT_ERROR("Error in file %s: line %lu: read length too small - %lu",fd->filename,fd->cline+1,slen);
-    return 1;
+    VALIDATE_ERROR("Error in file %s: line %lu: read length too small - %lu",fd->filename,fd->cline+1,slen);
   }
   // be tolerant
   //if (hdr2[1]!='\0' && hdr2[1]!='\n' && hdr2[1]!='\r') {
@@ -353,165 +1081,651 @@ inline int fastq_validate_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e) {
   //  return 1;
   //}  
   if (e->hdr2[0]!='+') {
-    PRINT_ERROR("Error in file %s: line %lu:  header2 wrong. The line should contain only '+' followed by a newline or read name (header1).",fd->filename,fd->cline+2);
-    return 1;
+    VALIDATE_ERROR("Error in file %s: line %lu:  header2 wrong. The line should contain only '+' followed by a newline or read name (header1).",fd->filename,fd->cline+2);
   }
   // length of hdr2 should be 1 or be the same has the hdr1
   // ignore the + sign
   //get_readname(&hdr2[1]);
-  unsigned long len;
   if (e->hdr2[0]!='\0' && e->hdr2[0]!='\r' ) {    
-    char *rn1=fastq_get_readname(fd,e,&rname1[0],&len,TRUE);
-    char *rn2=fastq_get_readname(fd,e,&rname2[0],&len,FALSE);
+    FASTQ_SPAN rn1=fastq_readname_span(fd,e,TRUE);
+    FASTQ_SPAN rn2=fastq_readname_span(fd,e,FALSE);
     if ( !compare_headers(rn1,rn2) ) {
-      PRINT_ERROR("Error in file %s: line %lu:  header2 differs from header1\nheader 1 \"%s\"\nheader 2 \"%s\"",fd->filename,fd->cline,e->hdr1,e->hdr2);
-      return 1;
+      VALIDATE_ERROR("Error in file %s: line %lu:  header2 differs from header1\nheader 1 \"%s\"\nheader 2 \"%s\"",fd->filename,fd->cline,e->hdr1,e->hdr2);
     }
   }
   // qual length==slen
-  unsigned long qlen=0;
-  while ( e->qual[qlen]!='\0' && e->qual[qlen]!='\n' && e->qual[qlen]!='\r') {
-    unsigned int x=(unsigned int)e->qual[qlen];
-    if (x<fd->min_qual) { fd->min_qual=x; }
-    if (x>fd->max_qual) { fd->max_qual=x; }
-    qlen++;    
-  }  
+  unsigned long min_qual=MAX_PHRED_QUAL,max_qual=0;
+  unsigned long qlen=qual_scan(e->qual,e->qual_len,
+			       report?&fd->min_qual:&min_qual,
+			       report?&fd->max_qual:&max_qual);
 
   if ( fd->space==SEQSPACE && qlen!=slen ) {
-    PRINT_ERROR("Error in file %s: line %lu: sequence and quality don't have the same length %lu!=%lu",fd->filename,fd->cline,slen,qlen);
-    return 1;
+    VALIDATE_ERROR("Error in file %s: line %lu: sequence and quality don't have the same length %lu!=%lu",fd->filename,fd->cline,slen,qlen);
   }
   
   if ( fd->space==COLORSPACE &&  qlen==(slen-1) ) return(0);
   if ( fd->space==COLORSPACE &&  qlen==slen ) return(0);
   if ( fd->space==COLORSPACE ) {
-    PRINT_ERROR("Error in file %s: line %lu: sequence and quality length don't match %lu!=%lu",fd->filename,fd->cline,slen,qlen);
-    return 1;
+    VALIDATE_ERROR("Error in file %s: line %lu: sequence and quality length don't match %lu!=%lu",fd->filename,fd->cline,slen,qlen);
   }
   return 0;
 }
 
 
-// add option to replace dots
-void fastq_index_readnames(FASTQ_FILE* fd1,hashtable index,long long start_offset,int replace_dots) {
+int fastq_validate_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e) {
+  return validate_entry(fd,e,TRUE);
+}
 
-  // replace dots not used anymore
-  fd1->fix_dot=replace_dots;
-  FASTQ_ENTRY *m1=fastq_new_entry();
-  char rname[MAX_LABEL_LENGTH];
+int fastq_check_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e) {
+  return validate_entry(fd,e,FALSE);
+}
 
-  if (fd1->fd==NULL) {
-    PRINT_ERROR("Unable to open %s",fd1->filename);
-    exit(PARAMS_ERROR_EXIT_STATUS);
+/* ******************************************************************************* */
+// Parallel map (fastq_map)
+/* ******************************************************************************* */
+// The calling thread reads the chunks, and calls done and writes the
+// records of the chunks mapped, in order. The worker threads map the
+// chunks in the order they were read. An error in the format of the
+// file found while reading a chunk is only reported after the records
+// read before are done (map_format_error), as in a sequential program.
+
+struct fastq_map_chunk {
+  FASTQ_ENTRY **e;        // entries (entries_per_record per record)
+  int *status;            // status of each record
+  unsigned long n;        // number of records
+  unsigned long nentries; // number of entries read
+  unsigned long first;    // number of entries read before the chunk
+  int mapped;
+};
+
+struct fastq_map_s {
+  FASTQ_FILE *fd;
+  int k;                  // entries per record
+  FASTQ_MAP_FN map;
+  FASTQ_DONE_FN done;
+  FASTQ_FILE **out;
+  void *data;
+  int stats;              // update the statistics of fd (fastq_read_next_entry)
+  unsigned long cline;    // fd->cline before the first entry
+  struct fastq_map_chunk *chunks;
+  unsigned long nchunks;
+  unsigned long nread;    // chunks read
+  unsigned long ntaken;   // chunks taken by the workers
+  unsigned long nwritten; // chunks done
+  struct fastq_map_chunk *reading; // chunk being read
+  void (*format_error_hook)(void); // fastq_format_error_hook of the caller
+  int stop;
+  pthread_mutex_t lock;
+  pthread_cond_t todo_cond;  // signaled when a chunk is read
+  pthread_cond_t done_cond;  // signaled when a chunk is mapped
+};
+typedef struct fastq_map_s FASTQ_MAP;
+
+// reads the next record
+// Returns the number of entries read (less than m->k at the end of the file)
+static int map_read_record(FASTQ_MAP *m,FASTQ_ENTRY **e) {
+  int j;
+  for (j=0;j<m->k;++j) {
+    if ( (m->stats?fastq_read_next_entry(m->fd,e[j]):fastq_read_entry(m->fd,e[j]))==0 ) break;
   }
-  // move to the right position
-  if(start_offset>0) {
-    PRINT_ERROR(" Not implemented");
-    exit(SYS_INT_ERROR_EXIT_STATUS);
+  return(j);
+}
+
+// calls done and writes the record
+// entries: number of entries read up to the end of the record
+static void map_finish_record(FASTQ_MAP *m,FASTQ_ENTRY **e,int status,unsigned long entries) {
+  int j;
+  if ( m->done!=NULL ) {
+    unsigned long cline=m->fd->cline;
+    m->fd->cline=m->cline+entries*4;
+    status=m->done(m->fd,e,status,m->data);
+    m->fd->cline=cline;
   }
-  unsigned long len;
-  // index creation could be done in parallel...
-  while(!gzeof(fd1->fd)) {
-    if ( fastq_read_next_entry(fd1,m1)==0) break;
+  if ( status!=FASTQ_MAP_KEEP ) return;
+  for (j=0;j<m->k;++j) {
+    if ( m->out==NULL || m->out[j]==NULL )
+      fastq_write_entry2stdout(e[j]);
+    else
+      fastq_write_entry(m->out[j],e[j]);
+  }
+}
 
-    char* readname=fastq_get_readname(fd1,m1,&rname[0],&len,TRUE);
-    //fprintf(stderr,"4---%s\n",readname);fflush(stderr);
-    // TODO: replace dots() -> needs a new file
-    //    replace_dots(start_pos,seq,hdr,hdr2,qual,fdf);    
-    // check for duplicates
-    if ( fastq_index_lookup_header(index,readname)!=NULL ) {
-      PRINT_ERROR("Error in file %s: line %lu: duplicated sequence %s",fd1->filename,fd1->cline,readname);
-      exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+// processes up to max records one at a time
+// Returns the number of records processed
+static unsigned long map_sequential(FASTQ_MAP *m,FASTQ_ENTRY **e,unsigned long max,unsigned long *entries,int *eof) {
+  unsigned long n=0;
+  while ( n<max ) {
+    int status;
+    int ne=map_read_record(m,e);
+    if ( ne==0 ) {
+      *eof=TRUE;
+      break;
     }
+    *entries+=ne;
+    ++n;
+    if ( ne<m->k ) {
+      *eof=TRUE;
+      status=FASTQ_MAP_TRUNCATED;
+    } else
+      status=m->map(m->fd,e,m->data);
+    map_finish_record(m,e,status,*entries);
+    if ( *eof ) break;
+  }
+  return(n);
+}
 
-    if ( new_indexentry(index,readname,len,m1->offset)==NULL) {
-      PRINT_ERROR("Error in file %s: line %lu: malloc failed?",fd1->filename,fd1->cline-4);
-      exit(SYS_INT_ERROR_EXIT_STATUS);
+static FASTQ_ENTRY** map_new_entries(unsigned long n) {
+  unsigned long i;
+  FASTQ_ENTRY **e=(FASTQ_ENTRY**)malloc(sizeof(FASTQ_ENTRY*)*n);
+  if ( e==NULL ) {
+    PRINT_ERROR("unable to allocate %lu bytes of memory",sizeof(FASTQ_ENTRY*)*n);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  for (i=0;i<n;++i) e[i]=fastq_new_entry();
+  return(e);
+}
+
+static void map_free_entries(FASTQ_ENTRY **e,unsigned long n) {
+  unsigned long i;
+  for (i=0;i<n;++i) {
+    free(e[i]->hdr1);
+    free(e[i]->hdr2);
+    free(e[i]->seq);
+    free(e[i]->qual);
+    free(e[i]);
+  }
+  free(e);
+}
+
+// reads up to max records to c
+static void map_read_chunk(FASTQ_MAP *m,struct fastq_map_chunk *c,unsigned long max,unsigned long *entries,int *eof) {
+  c->n=0;
+  c->first=*entries;
+  c->nentries=0;
+  c->mapped=FALSE;
+  while ( c->n<max ) {
+    int ne=map_read_record(m,&c->e[c->n*m->k]);
+    if ( ne==0 ) {
+      *eof=TRUE;
+      break;
     }
-    // TODO validate option
-    if (fastq_validate_entry(fd1,m1)!=0) {
-      exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+    c->nentries+=ne;
+    if ( ne<m->k ) {
+      *eof=TRUE;
+      c->status[c->n++]=FASTQ_MAP_TRUNCATED;
+      break;
     }
-    PRINT_READS_PROCESSED(fd1->cline/4,100000);
-  }  
-  //fastq_close(fd1->fd);
-  return;
+    c->status[c->n++]=FASTQ_MAP_KEEP;
+  }
+  *entries+=c->nentries;
 }
 
-			  
-char* fastq_get_readname(FASTQ_FILE* fd, FASTQ_ENTRY* e,char* rn,unsigned long *len_p,int is_header1) {
-  unsigned long len=0;
-  char *hdr;
-  if ( is_header1) hdr=e->hdr1;
-  else  hdr=e->hdr2;
+static void* map_worker(void *arg) {
+  FASTQ_MAP *m=(FASTQ_MAP*)arg;
+  pthread_mutex_lock(&m->lock);
+  while (1) {
+    struct fastq_map_chunk *c;
+    unsigned long i;
+    while ( m->ntaken==m->nread && !m->stop )
+      pthread_cond_wait(&m->todo_cond,&m->lock);
+    if ( m->ntaken==m->nread ) break;
+    c=&m->chunks[m->ntaken%m->nchunks];
+    ++m->ntaken;
+    pthread_mutex_unlock(&m->lock);
+    for (i=0;i<c->n;++i)
+      if ( c->status[i]!=FASTQ_MAP_TRUNCATED )
+	c->status[i]=m->map(m->fd,&c->e[i*m->k],m->data);
+    pthread_mutex_lock(&m->lock);
+    c->mapped=TRUE;
+    pthread_cond_broadcast(&m->done_cond);
+  }
+  pthread_mutex_unlock(&m->lock);
+  return(NULL);
+}
 
-  if ( is_header1==TRUE && hdr[0]!='@' ) {
-    PRINT_ERROR("Error in file %s: line %lu: wrong header %s",fd->filename,fd->cline,hdr);
-    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+// calls done for the records of the oldest chunk (once it is mapped)
+static void map_finish_chunk(FASTQ_MAP *m) {
+  struct fastq_map_chunk *c=&m->chunks[m->nwritten%m->nchunks];
+  unsigned long r;
+  pthread_mutex_lock(&m->lock);
+  while ( !c->mapped )
+    pthread_cond_wait(&m->done_cond,&m->lock);
+  pthread_mutex_unlock(&m->lock);
+  for (r=0;r<c->n;++r)
+    map_finish_record(m,&c->e[r*m->k],c->status[r],c->first+min((r+1)*m->k,c->nentries));
+  ++m->nwritten;
+}
+
+// the map running in parallel (the format errors are found by the
+// calling thread)
+static FASTQ_MAP *map_active=NULL;
+
+// fastq_format_error_hook while a chunk is read: finishes the chunks
+// read before and the records of the chunk read so far (done may exit
+// with an error in a previous record)
+static void map_format_error(void) {
+  FASTQ_MAP *m=map_active;
+  struct fastq_map_chunk *c=m->reading;
+  unsigned long r;
+  while ( m->nwritten<m->nread ) map_finish_chunk(m);
+  for (r=0;r<c->n;++r) {
+    if ( c->status[r]!=FASTQ_MAP_TRUNCATED )
+      c->status[r]=m->map(m->fd,&c->e[r*m->k],m->data);
+    map_finish_record(m,&c->e[r*m->k],c->status[r],c->first+min((r+1)*m->k,c->nentries));
   }
+  if ( m->format_error_hook!=NULL ) m->format_error_hook();
+}
 
-  // rn=&rn[1];// ignore/discard @
-  if ( strncpy(rn,&hdr[1],MAX_LABEL_LENGTH-1)==NULL ) {
-    PRINT_ERROR("Error in strcpy");
+// records processed in parallel (the first FASTQ_MAP_CHUNK_SIZE records
+// are processed sequentially)
+static unsigned long map_parallel(FASTQ_MAP *m,unsigned long max,unsigned long *entries,int *eof) {
+  unsigned long i,n=0,nrecs=0;
+  pthread_t *workers;
+  int nworkers=0;
+
+  m->nchunks=2*fastq_threads+2;
+  m->chunks=(struct fastq_map_chunk*)calloc(m->nchunks,sizeof(struct fastq_map_chunk));
+  workers=(pthread_t*)malloc(sizeof(pthread_t)*fastq_threads);
+  if ( m->chunks==NULL || workers==NULL ) {
+    PRINT_ERROR("unable to allocate memory");
     exit(SYS_INT_ERROR_EXIT_STATUS);
   }
-  // executed only once
-  if ( fd->readname_format == UNDEF ) {
-      fd->is_casava_18=is_casava_1_8_readname(rn);
-      if (fd->is_casava_18) {
-        fprintf(stderr,"CASAVA=1.8\n");
-        fd->readname_format=CASAVA18;
-      } else {
-	int is_int_name=is_int_readname(rn);
-	if ( is_int_name ) {
-	  fprintf(stderr,"Read name provided as an integer\n");
-	  fd->readname_format=INTEGERNAME;
-	} else {
-	  int no_suffix=is_nosuffix_readname(rn);
-	  if ( no_suffix ) {
-	    fprintf(stderr,"Read name provided with no suffix\n");
-	    fd->readname_format=NOP;
-	  } else 
-	    fd->readname_format=DEFAULT;
-	}
-      }
+  for (i=0;i<m->nchunks;++i) {
+    m->chunks[i].e=map_new_entries(FASTQ_MAP_CHUNK_SIZE*m->k);
+    m->chunks[i].status=(int*)malloc(sizeof(int)*FASTQ_MAP_CHUNK_SIZE);
+    if ( m->chunks[i].status==NULL ) {
+      PRINT_ERROR("unable to allocate %lu bytes of memory",sizeof(int)*FASTQ_MAP_CHUNK_SIZE);
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
   }
-  
-  if ( fd->space==UNDEFSPACE ) {
-    fd->space=is_color_space(e->seq,fd);
-    if ( fd->space==COLORSPACE ) {
-      fprintf(stderr,"Color space\n");
+  m->nread=m->ntaken=m->nwritten=0;
+  m->stop=FALSE;
+  pthread_mutex_init(&m->lock,NULL);
+  pthread_cond_init(&m->todo_cond,NULL);
+  pthread_cond_init(&m->done_cond,NULL);
+  for (nworkers=0;nworkers<fastq_threads;++nworkers)
+    if ( pthread_create(&workers[nworkers],NULL,map_worker,m) ) break;
+  if ( nworkers==0 ) {
+    PRINT_ERROR("unable to create a thread");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  while (1) {
+    struct fastq_map_chunk *c;
+    // read as many chunks as possible
+    while ( !*eof && nrecs<max && m->nread-m->nwritten<m->nchunks ) {
+      c=&m->chunks[m->nread%m->nchunks];
+      m->reading=c;
+      m->format_error_hook=fastq_format_error_hook;
+      map_active=m;
+      fastq_format_error_hook=map_format_error;
+      map_read_chunk(m,c,min(FASTQ_MAP_CHUNK_SIZE,max-nrecs),entries,eof);
+      fastq_format_error_hook=m->format_error_hook;
+      map_active=NULL;
+      if ( c->n==0 ) break;
+      nrecs+=c->n;
+      pthread_mutex_lock(&m->lock);
+      ++m->nread;
+      pthread_cond_signal(&m->todo_cond);
+      pthread_mutex_unlock(&m->lock);
     }
+    if ( m->nwritten==m->nread ) break;
+    // write the oldest chunk
+    n+=m->chunks[m->nwritten%m->nchunks].n;
+    map_finish_chunk(m);
   }
-  
-  
+  pthread_mutex_lock(&m->lock);
+  m->stop=TRUE;
+  pthread_cond_broadcast(&m->todo_cond);
+  pthread_mutex_unlock(&m->lock);
+  for (i=0;i<nworkers;++i)
+    pthread_join(workers[i],NULL);
+  free(workers);
+  for (i=0;i<m->nchunks;++i) {
+    map_free_entries(m->chunks[i].e,FASTQ_MAP_CHUNK_SIZE*m->k);
+    free(m->chunks[i].status);
+  }
+  free(m->chunks);
+  pthread_cond_destroy(&m->todo_cond);
+  pthread_cond_destroy(&m->done_cond);
+  pthread_mutex_destroy(&m->lock);
+  return(n);
+}
+
+// Returns the number of records processed
+static unsigned long map_records(FASTQ_FILE* fd,int entries_per_record,unsigned long max_records,FASTQ_MAP_FN map,FASTQ_DONE_FN done,FASTQ_FILE** out,void *data,int stats) {
+  FASTQ_MAP m;
+  FASTQ_ENTRY **e;
+  unsigned long n,entries=0;
+  int eof=FALSE;
+
+  m.fd=fd;
+  m.k=entries_per_record;
+  m.map=map;
+  m.done=done;
+  m.out=out;
+  m.data=data;
+  m.stats=stats;
+  m.cline=fd->cline;
+  e=map_new_entries(m.k);
+  n=map_sequential(&m,e,(fastq_threads>1?min(FASTQ_MAP_CHUNK_SIZE,max_records):max_records),&entries,&eof);
+  map_free_entries(e,m.k);
+  if ( !eof && n<max_records )
+    n+=map_parallel(&m,max_records-n,&entries,&eof);
+  return(n);
+}
+
+unsigned long fastq_map(FASTQ_FILE* fd,int entries_per_record,unsigned long max_records,FASTQ_MAP_FN map,FASTQ_DONE_FN done,FASTQ_FILE** out,void *data) {
+  return map_records(fd,entries_per_record,max_records,map,done,out,data,TRUE);
+}
+
+unsigned long long fastq_data_size(FASTQ_FILE* fd) {
+  unsigned long long size=fastq_input_size(fd);
+  if ( fd->map==NULL && zfile_format(fd->zf)!=ZFILE_PLAIN )
+    size*=FASTQ_COMPRESSION_RATIO;
+  return size;
+}
+
+// number of reads in a file estimated from the offset of read
+// reads+1 (0 if the size of the file is not known)
+static unsigned long long fastq_estimate_reads(FASTQ_FILE* fd,unsigned long long reads,long long offset) {
+  unsigned long long size=fastq_data_size(fd);
+  if ( size==0 || offset<=0 ) return 0;
+  return size/((unsigned long long)offset/reads+1);
+}
+
+// add option to replace dots
+void fastq_index_readnames(FASTQ_FILE* fd1,hashtable index,long long start_offset,int replace_dots) {
+
+  // replace dots not used anymore
+  fd1->fix_dot=replace_dots;
+  FASTQ_ENTRY *m1=fastq_new_entry();
+
+  if (fd1->zf==NULL && fd1->map==NULL) {
+    PRINT_ERROR("Unable to open %s",fd1->filename);
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  // move to the right position
+  if(start_offset>0) {
+    PRINT_ERROR(" Not implemented");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  // gzip files: the index for fastq_seek is built in the same pass
+  int new_gz_index=fastq_gz_index_start(fd1);
+  unsigned long mem0=index_pool_mem(index);
+  int fingerprints=is_fp_index(index);
+  if ( fingerprints && !fastq_fp_index_ok(fd1) ) {
+    PRINT_ERROR("Error in file %s: the index of fingerprints needs a file that can be read again",fd1->filename);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  if ( is_mt_index(index) )
+    index_readnames_mt(fd1,index);
+  else while(!fastq_eof(fd1)) {
+    if ( fastq_read_next_entry(fd1,m1)==0) break;
+
+    FASTQ_SPAN readname=fastq_readname_span(fd1,m1,TRUE);
+    // TODO: replace dots() -> needs a new file
+    //    replace_dots(start_pos,seq,hdr,hdr2,qual,fdf);    
+    if ( index->n_entries==FASTQ_ESTIMATE_READS && start_offset==0 )
+      hash_reserve(index,fastq_estimate_reads(fd1,index->n_entries,m1->offset));
+    if ( fingerprints ) {
+      int r=fp_index_insert(index,fd1,readname,m1->offset);
+      if ( r>0 ) {
+	PRINT_ERROR("Error in file %s: line %lu: duplicated sequence %.*s",fd1->filename,fd1->cline,(int)readname.len,readname.s);
+	exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+      }
+      if ( r<0 ) {
+	PRINT_ERROR("Error in file %s: line %lu: malloc failed?",fd1->filename,fd1->cline-4);
+	exit(SYS_INT_ERROR_EXIT_STATUS);
+      }
+    } else {
+      // check for duplicates
+      if ( fastq_index_lookup_span(index,readname)!=NULL ) {
+	PRINT_ERROR("Error in file %s: line %lu: duplicated sequence %.*s",fd1->filename,fd1->cline,(int)readname.len,readname.s);
+	exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+      }
+      if ( new_indexentry(index,readname.s,readname.len,m1->offset)==NULL) {
+	PRINT_ERROR("Error in file %s: line %lu: malloc failed?",fd1->filename,fd1->cline-4);
+	exit(SYS_INT_ERROR_EXIT_STATUS);
+      }
+    }
+    // TODO validate option
+    if (fastq_validate_entry(fd1,m1)!=0) {
+      exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+    }
+    fastq_progress(fd1,fd1->cline/4);
+  }  
+  progress_done();
+  index_mem+=index_pool_mem(index)-mem0;
+  if ( new_gz_index ) fastq_gz_index_save(fd1);
+  //fastq_close(fd1->fd);
+  return;
+}
+
+void fastq_scan(FASTQ_FILE* fd,FASTQ_ENTRY *e,int stats,int gz_index,FASTQ_ENTRY_FN fn,void *data) {
+  int new_gz_index=(gz_index?fastq_gz_index_start(fd):FALSE);
+  while(!fastq_eof(fd)) {
+    if ( (stats?fastq_read_next_entry(fd,e):fastq_read_entry(fd,e))==0 ) break;
+    fn(fd,e,data);
+    fastq_progress(fd,fd->cline/4);
+  }
+  progress_done();
+  if ( new_gz_index ) fastq_gz_index_save(fd);
+}
+
+// a batch of entries of fastq_index_scan
+struct index_scan {
+  FASTQ_FILE *fd;
+  hashtable index;
+  int remove;
+  FASTQ_INDEX_FN fn;
+  void *data;
+  FASTQ_ENTRY **e;
+  FASTQ_SPAN rn[FASTQ_INDEX_BATCH];
+  INDEX_ENTRY *ie[FASTQ_INDEX_BATCH];
+  unsigned long n;     // entries read
+  unsigned long cline; // fd->cline before the batch
+  int stop;
+  void (*format_error_hook)(void);
+};
+
+static struct index_scan *scan_active=NULL;
+
+// looks up the names of the entries read and calls fn for each entry,
+// with fd->cline as if the entries were read one at a time
+static void index_scan_batch(struct index_scan *s) {
+  FASTQ_FILE *fd=s->fd;
+  unsigned long i,cline=fd->cline;
+  for (i=0;i<s->n;++i) {
+    // a wrong header is reported when its entry is reached
+    if ( s->e[i]->hdr1[0]!='@' ) s->rn[i].s=NULL;
+    else s->rn[i]=fastq_readname_span(fd,s->e[i],TRUE);
+  }
+  index_batch(s->index,s->rn,s->n,s->ie,s->remove);
+  for (i=0;i<s->n && !s->stop;++i) {
+    fd->cline=s->cline+4*(i+1);
+    if ( s->rn[i].s==NULL ) fastq_readname_span(fd,s->e[i],TRUE);
+    if ( !s->fn(fd,s->e[i],s->rn[i],s->ie[i],s->data) ) s->stop=TRUE;
+    fastq_progress(fd,fd->cline/4);
+  }
+  fd->cline=cline;
+  s->n=0;
+}
+
+// fastq_format_error_hook while a batch is read: the entries read
+// before the error are processed first (fn may exit with an error in
+// one of them)
+static void index_scan_format_error(void) {
+  struct index_scan *s=scan_active;
+  scan_active=NULL;
+  index_scan_batch(s);
+  if ( s->format_error_hook!=NULL ) s->format_error_hook();
+}
+
+void fastq_index_scan(FASTQ_FILE* fd,hashtable index,int remove,int stats,FASTQ_INDEX_FN fn,void *data) {
+  struct index_scan s;
+  s.fd=fd;
+  s.index=index;
+  s.remove=remove;
+  s.fn=fn;
+  s.data=data;
+  s.e=map_new_entries(FASTQ_INDEX_BATCH);
+  s.n=0;
+  s.stop=FALSE;
+  while ( !s.stop ) {
+    s.cline=fd->cline;
+    s.format_error_hook=fastq_format_error_hook;
+    scan_active=&s;
+    fastq_format_error_hook=index_scan_format_error;
+    while ( s.n<FASTQ_INDEX_BATCH && !fastq_eof(fd) ) {
+      if ( (stats?fastq_read_next_entry(fd,s.e[s.n]):fastq_read_entry(fd,s.e[s.n]))==0 ) break;
+      ++s.n;
+    }
+    fastq_format_error_hook=s.format_error_hook;
+    scan_active=NULL;
+    if ( s.n==0 ) break;
+    index_scan_batch(&s);
+  }
+  map_free_entries(s.e,FASTQ_INDEX_BATCH);
+  progress_done();
+}
+
+			  
+// Read name parsers
+// A parser returns the length of the read name at the start of rn (the
+// header without the @). The parser of the format detected in the first
+// read name is used for all the reads of the file. The parsers only
+// deal with the common case (e.g., a header shorter than
+// MAX_LABEL_LENGTH) and use readname_generic otherwise.
+
+// length of the header considered: only the first MAX_LABEL_LENGTH-3
+// characters of longer headers are used (as if followed by a newline)
+static inline unsigned long readname_header_len(const char *rn,int *truncated) {
+  unsigned long len=strlen(rn);
+  *truncated=FALSE;
+  if ( len>=MAX_LABEL_LENGTH-1 ) {
+    len=MAX_LABEL_LENGTH-3;
+    *truncated=TRUE;
+  }
+  return(len);
+}
+
+static unsigned long readname_generic(FASTQ_FILE* fd,const char *rn) {
+  int truncated;
+  unsigned long n,len=readname_header_len(rn,&truncated);
+
   switch(fd->readname_format) {
   case DEFAULT:
-    // discard last character if PE && not casava 1.8
-    len=strlen(rn);
-    if (fd->is_pe) 
-      len--;
-    rn[len-1]='\0';
-    break;
-    
   case INTEGERNAME: // == NOP
-    // keep the sequence unchanged
-    len=strlen(rn);
-    rn[len-1]='\0';
-    break;
+    // len includes the newline
+    if ( truncated ) ++len;
+    // discard last character if PE && not casava 1.8
+    n=1+(fd->readname_format==DEFAULT && fd->is_pe?1:0);
+    return(len>n?len-n:0);
   case CASAVA18:
-    len=0;
-    while (rn[len]!=' ' && rn[len]!='\0') ++len;
-    rn[len]='\0';
-    if  ( rn[len-2] == '/' ) {
+    n=0;
+    while (n<len && rn[n]!=' ') ++n;
+    if  ( n>=2 && rn[n-2] == '/' ) {
       // discard /[12]
-      rn[len-2]='\0';
-      len=len-2;
+      n=n-2;
     }
-    break;
+    return(n);
   }
-  *len_p=len;
-  //fprintf(stderr,"read=%s=\n",s);
+  return(len);
+}
+
+// name followed by the suffix (/1, /2, ...) if PE and the newline
+static unsigned long readname_default(FASTQ_FILE* fd,const char *rn) {
+  unsigned long len=strlen(rn);
+  unsigned long n=(fd->is_pe?2:1);
+  if ( len<n || len>=MAX_LABEL_LENGTH-1 ) return(readname_generic(fd,rn));
+  return(len-n);
+}
+
+// the read name is kept unchanged (only the newline is discarded)
+static unsigned long readname_nop(FASTQ_FILE* fd,const char *rn) {
+  unsigned long len=strlen(rn);
+  if ( len<1 || len>=MAX_LABEL_LENGTH-1 ) return(readname_generic(fd,rn));
+  return(len-1);
+}
+
+// name (optionally ending in /1 or /2) followed by a space
+static unsigned long readname_casava18(FASTQ_FILE* fd,const char *rn) {
+  unsigned long n=strcspn(rn," ");
+  // no space (in the part of the header considered)
+  if ( rn[n]!=' ' || n>=MAX_LABEL_LENGTH-3 ) return(readname_generic(fd,rn));
+  // discard /[12]
+  if  ( n>=2 && rn[n-2] == '/' ) n=n-2;
+  return(n);
+}
+
+// detect the format of the read names from the first read name (rn)
+// executed only once
+static void readname_detect(FASTQ_FILE* fd,const char *rn) {
+  char name[MAX_LABEL_LENGTH];
+  int truncated;
+  unsigned long len=readname_header_len(rn,&truncated);
+  memcpy(name,rn,len);
+  if ( truncated ) name[len++]='\n';
+  name[len]='\0';
+  fd->is_casava_18=is_casava_1_8_readname(name);
+  if (fd->is_casava_18) {
+    fprintf(stderr,"CASAVA=1.8\n");
+    fd->readname_format=CASAVA18;
+    fd->readname=readname_casava18;
+  } else {
+    int is_int_name=is_int_readname(name);
+    if ( is_int_name ) {
+      fprintf(stderr,"Read name provided as an integer\n");
+      fd->readname_format=INTEGERNAME;
+      fd->readname=readname_nop;
+    } else {
+      int no_suffix=is_nosuffix_readname(name);
+      if ( no_suffix ) {
+	fprintf(stderr,"Read name provided with no suffix\n");
+	fd->readname_format=NOP;
+	fd->readname=readname_nop;
+      } else {
+	fd->readname_format=DEFAULT;
+	fd->readname=readname_default;
+      }
+    }
+  }
+}
+
+// Read name of an entry: a span of header 1 (is_header1=TRUE) or
+// header 2 (nothing is copied)
+FASTQ_SPAN fastq_readname_span(FASTQ_FILE* fd, FASTQ_ENTRY* e,int is_header1) {
+  FASTQ_SPAN rn;
+  char *hdr;
+  if ( is_header1) hdr=e->hdr1;
+  else  hdr=e->hdr2;
+
+  if ( is_header1==TRUE && hdr[0]!='@' ) {
+    format_error();
+    PRINT_ERROR("Error in file %s: line %lu: wrong header %s",fd->filename,fd->cline,hdr);
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  // ignore/discard @
+  rn.s=&hdr[1];
+  if ( fd->readname == NULL )
+    readname_detect(fd,rn.s);
+  
+  if ( fd->space==UNDEFSPACE ) {
+    fd->space=is_color_space(e->seq,fd);
+    if ( fd->space==COLORSPACE ) {
+      fprintf(stderr,"Color space\n");
+    }
+  }
+  rn.len=fd->readname(fd,rn.s);
+  return(rn);
+}
+
+// copies the read name to rn (\0 terminated)
+char* fastq_get_readname(FASTQ_FILE* fd, FASTQ_ENTRY* e,char* rn,unsigned long *len_p,int is_header1) {
+  FASTQ_SPAN s=fastq_readname_span(fd,e,is_header1);
+  memcpy(rn,s.s,s.len);
+  rn[s.len]='\0';
+  *len_p=s.len;
   return(rn);
 }
 
@@ -526,98 +1740,616 @@ the actual function is hash(i) = hash(i - 1) * 65599 + str[i]; what is included
 [there is even a faster, duff-device version] the magic constant 65599 was picked out of thin air while experimenting with
 different constants, and turns out to be a prime. this is one of the algorithms used in berkeley db (see sleepycat) and elsewhere.
 */
-static ulong hashit(char *str) {
+// (of a string that is not \0 terminated)
+static inline ulong hashit_span(FASTQ_SPAN s) {
 
   ulong hash = 0;
-  int c;
-  
-  while ((c = *str++))
-    hash = c + (hash << 6) + (hash << 16) - hash;
-  
+  unsigned long i;
+
+  for (i=0;i<s.len;++i)
+    hash = s.s[i] + (hash << 6) + (hash << 16) - hash;
+
   return(hash);
 }
 
+static inline FASTQ_SPAN span(const char *s) {
+  FASTQ_SPAN r={s,strlen(s)};
+  return(r);
+}
+
+// return 1 if the read names are equal, 0 otherwise
+int fastq_span_eq(FASTQ_SPAN a,FASTQ_SPAN b) {
+  return(a.len==b.len && !memcmp(a.s,b.s,a.len));
+}
+
 
 
 // return 1 if the headers are the same...0 otherwise
-static inline int compare_headers(const char *hdr1,const char *hdr2) {
+static inline int compare_headers(FASTQ_SPAN hdr1,FASTQ_SPAN hdr2) {
 
-  unsigned int slen=0;
-  //fprintf(stderr,">%s<\n>%s<\n",hdr1,hdr2);
+  unsigned long slen=0;
   // no readname in header2
-  if ( hdr2[0]=='\n' || hdr2[0]=='\r' || hdr2[0]=='\0' ) {
+  if ( hdr2.len==0 || hdr2.s[0]=='\n' || hdr2.s[0]=='\r' ) {
     return 1;
   }
-  while ( hdr1[slen]!='\0' && hdr2[slen]!='\0' ) {
-    if ( hdr1[slen]!=hdr2[slen] ) break;
+  while ( slen<hdr1.len && slen<hdr2.len ) {
+    if ( hdr1.s[slen]!=hdr2.s[slen] ) break;
     slen++;
   }
   // ignore white spaces
-  unsigned int slen2=slen;
-  while ( hdr1[slen]!='\0' ) {
-    if ( hdr1[slen]!='\r'  &&  hdr1[slen]!='\n' ) return 0;
+  unsigned long slen2=slen;
+  while ( slen<hdr1.len ) {
+    if ( hdr1.s[slen]!='\r'  &&  hdr1.s[slen]!='\n' ) return 0;
     ++slen;
   }
-  while ( hdr2[slen2]!='\0' ) {
-    if ( hdr2[slen2]!='\r'  &&  hdr2[slen2]!='\n' ) return 0;
+  while ( slen2<hdr2.len ) {
+    if ( hdr2.s[slen2]!='\r'  &&  hdr2.s[slen2]!='\n' ) return 0;
     ++slen2;
   }
   return 1;
 }
 
-void fastq_index_delete(char *rname,hashtable index) {
-  unsigned long key=hashit(rname);
-  INDEX_ENTRY* e=fastq_index_lookup_header(index,rname);
-  if (delete(index,key,e)!=e) {
+static int index_entry_match(__ptr_t obj,void *data) {
+  INDEX_ENTRY *e=(INDEX_ENTRY*)obj;
+  FASTQ_SPAN *hdr=(FASTQ_SPAN*)data;
+  return !strncmp(hdr->s,e->hdr,hdr->len) && e->hdr[hdr->len]=='\0';
+}
+
+static INDEX_ENTRY* index_remove_key(hashtable index,ulong key,FASTQ_SPAN rname) {
+  INDEX_ENTRY* e;
+  if ( !is_mt_index(index) )
+    return (INDEX_ENTRY*)find_delete(index,key,index_entry_match,&rname);
+  e=(INDEX_ENTRY*)hash_mt_find_delete(index_shards(index),key,index_entry_match,&rname);
+  if ( e!=NULL ) index->n_entries--;
+  return e;
+}
+
+INDEX_ENTRY* fastq_index_remove_span(hashtable index,FASTQ_SPAN rname) {
+  return index_remove_key(index,hashit_span(rname),rname);
+}
+
+void fastq_index_delete_span(FASTQ_SPAN rname,hashtable index) {
+  INDEX_ENTRY* e=fastq_index_remove_span(index,rname);
+  if (e==NULL) {
     PRINT_ERROR("Unable to delete entry from index");
     exit(SYS_INT_ERROR_EXIT_STATUS);
   }
   free_indexentry(e);  
 }
-INDEX_ENTRY* fastq_index_lookup_header(hashtable sn_index,char *hdr) {
+
+void fastq_index_delete(char *rname,hashtable index) {
+  fastq_index_delete_span(span(rname),index);
+}
+
+static INDEX_ENTRY* index_lookup_key(hashtable sn_index,ulong key,FASTQ_SPAN hdr) {
+  if ( is_mt_index(sn_index) )
+    return (INDEX_ENTRY*)hash_mt_lookup(index_shards(sn_index),key,index_entry_match,&hdr);
+  return (INDEX_ENTRY*)hash_lookup(sn_index,key,index_entry_match,&hdr);
+}
+
+INDEX_ENTRY* fastq_index_lookup_span(hashtable sn_index,FASTQ_SPAN hdr) {
   // lookup hdr in sn_index
-  ulong key=hashit(hdr);
-  //printf("looking for %s: key=%lu\n",hdr,key);
-  INDEX_ENTRY* e=(INDEX_ENTRY*)get_object(sn_index,key);
-  while (e!=NULL) {      // confirm that hdr are equal
-    if ( !strcmp(hdr,e->hdr)) break;
-    e=(INDEX_ENTRY*)get_next_object(sn_index,key);
+  return index_lookup_key(sn_index,hashit_span(hdr),hdr);
+}
+
+INDEX_ENTRY* fastq_index_lookup_header(hashtable sn_index,char *hdr) {
+  return fastq_index_lookup_span(sn_index,span(hdr));
+}
+
+// table of the index with the key
+static inline hashtable index_table(hashtable index,ulong key) {
+  HASH_MT *mt;
+  if ( !is_mt_index(index) ) return index;
+  mt=index_shards(index);
+  return mt->shards[hash_mt_shard(mt,key)].table;
+}
+
+// hashes the names of a batch and prefetches, for all the names, the
+// slots, then the entry in the home slot (usually the entry of the
+// name) and then the name of the entry: each stage only waits for the
+// slowest miss of the previous one. The names are only probed when
+// they are looked up (removed) afterwards
+static void index_prefetch(hashtable index,FASTQ_SPAN *names,unsigned long n,ulong *keys) {
+  INDEX_ENTRY *home[FASTQ_INDEX_BATCH];
+  unsigned long i;
+  for (i=0;i<n;++i) {
+    if ( names[i].s==NULL ) continue;
+    keys[i]=hashit_span(names[i]);
+    hash_prefetch(index_table(index,keys[i]),keys[i]);
   }
-  return e;
+  for (i=0;i<n;++i) {
+    home[i]=NULL;
+    if ( names[i].s==NULL ) continue;
+    home[i]=(INDEX_ENTRY*)hash_home_obj(index_table(index,keys[i]),keys[i]);
+    if ( home[i]!=NULL ) __builtin_prefetch(home[i]);
+  }
+  for (i=0;i<n;++i)
+    if ( home[i]!=NULL ) __builtin_prefetch(home[i]->hdr);
 }
 
-//long collisions[HASHSIZE+1];
-INDEX_ENTRY* new_indexentry(hashtable ht,char*hdr,int len,long start_pos) {
-  
-  // Memory chunck: |[index_entry]len bytes+1|
-  char *mem_block=(char*)malloc(sizeof(INDEX_ENTRY)+len+1);
-  if (mem_block==NULL) { return(NULL);}  
-  INDEX_ENTRY *e=(INDEX_ENTRY*)&mem_block[0];
+// the names are looked up (removed) in order, so a name repeated in a
+// batch is found (removed) as with one lookup at a time
+static void index_batch(hashtable index,FASTQ_SPAN *names,unsigned long n,INDEX_ENTRY **entries,int remove) {
+  ulong keys[FASTQ_INDEX_BATCH];
+  unsigned long i,j,m;
+  for (i=0;i<n;i+=m) {
+    m=min(n-i,FASTQ_INDEX_BATCH);
+    index_prefetch(index,&names[i],m,keys);
+    for (j=0;j<m;++j) {
+      entries[i+j]=NULL;
+      if ( names[i+j].s==NULL ) continue;
+      entries[i+j]=(remove?index_remove_key:index_lookup_key)(index,keys[j],names[i+j]);
+    }
+  }
+}
+
+void fastq_index_lookup_batch(hashtable index,FASTQ_SPAN *names,unsigned long n,INDEX_ENTRY **entries) {
+  index_batch(index,names,n,entries,FALSE);
+}
+
+void fastq_index_remove_batch(hashtable index,FASTQ_SPAN *names,unsigned long n,INDEX_ENTRY **entries) {
+  index_batch(index,names,n,entries,TRUE);
+}
+
+// Memory of the entries of an index (index->data): the INDEX_ENTRYs
+// and the read names are allocated from two arenas, a slab of
+// fixed size entries and a pool of \0 terminated names, so a read
+// costs sizeof(INDEX_ENTRY)+len+1 bytes and the whole index is freed
+// at once by fastq_index_free
+//
+// Fingerprint indexes (fastq_fp_index_new) only keep a 64 bit
+// fingerprint of each read name (the key) and the offset+1 of its entry
+// (the object). The names of two reads with the same fingerprint are
+// compared by reading the entry at the offset from fd, a second reader
+// of the (seekable) file indexed, so duplicates are still detected
+// exactly.
+//
+// Sharded indexes (fastq_index_mt_new) keep the entries in the tables
+// of a HASH_MT, each one with its own pool, so the threads of fastq_map
+// add and look up the read names of different shards at the same time
+// (fastq_index_readnames and fastq_index_pair). index->n_entries is the
+// number of entries of all the shards.
+struct index_pool {
+  ARENA *entries;
+  ARENA *names;
+  int fingerprints;
+  FASTQ_FILE *fd;
+  HASH_MT *mt;
+};
+
+static struct index_pool* index_pool(hashtable ht) {
+  struct index_pool *pool=(struct index_pool*)ht->data;
+  if ( pool!=NULL ) return pool;
+  pool=(struct index_pool*)malloc(sizeof(struct index_pool));
+  if ( pool==NULL ) return NULL;
+  pool->entries=arena_new();
+  pool->names=arena_new();
+  if ( pool->entries==NULL || pool->names==NULL ) {
+    arena_free(pool->entries);
+    arena_free(pool->names);
+    free(pool);
+    return NULL;
+  }
+  pool->fingerprints=FALSE;
+  pool->fd=NULL;
+  pool->mt=NULL;
+  ht->data=pool;
+  return pool;
+}
+
+// 64 bit fingerprint of a read name
+static inline ulong span_fingerprint(FASTQ_SPAN rn) {
+  ulong h=0x9e3779b97f4a7c15ULL*(rn.len+1),w;
+  unsigned long i;
+  for(i=0;i+8<=rn.len;i+=8) {
+    memcpy(&w,rn.s+i,8);
+    h=(h^w)*0xff51afd7ed558ccdULL;
+    h^=h>>29;
+  }
+  w=0;
+  memcpy(&w,rn.s+i,rn.len-i);
+  h=(h^w)*0xc4ceb9fe1a85ec53ULL;
+  h^=h>>32;
+  h*=0x9e3779b97f4a7c15ULL;
+  h^=h>>29;
+  return h;
+}
+
+// TRUE if the read in fd at offset has the name rn
+static int fp_index_same_name(struct index_pool *pool,FASTQ_FILE *fd,long long offset,FASTQ_SPAN rn) {
+  FASTQ_ENTRY *e=get_tmp_entry();
+  if ( pool->fd==NULL ) {
+    pool->fd=fastq_new(fd->filename,FALSE,"r");
+    pool->fd->is_pe=fd->is_pe;
+    // the format of the read names (and the space) detected in fd
+    pool->fd->is_casava_18=fd->is_casava_18;
+    pool->fd->readname_format=fd->readname_format;
+    pool->fd->readname=fd->readname;
+    pool->fd->space=fd->space;
+    // the reads are read out of order: access points of gzip files
+    fastq_gz_index_start(pool->fd);
+  }
+  fastq_seek(pool->fd,offset);
+  if ( fastq_read_entry(pool->fd,e)==0 ) {
+    PRINT_ERROR("Error in file %s: unable to read the entry at offset %lld",fd->filename,offset);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  return fastq_span_eq(fastq_readname_span(pool->fd,e,TRUE),rn);
+}
+
+static int is_fp_index(hashtable ht) {
+  struct index_pool *pool=(struct index_pool*)ht->data;
+  return pool!=NULL && pool->fingerprints;
+}
+
+static int is_mt_index(hashtable ht) {
+  struct index_pool *pool=(struct index_pool*)ht->data;
+  return pool!=NULL && pool->mt!=NULL;
+}
+
+static inline HASH_MT* index_shards(hashtable ht) {
+  return ((struct index_pool*)ht->data)->mt;
+}
 
-  e->hdr=(char*)&mem_block[sizeof(INDEX_ENTRY)];
+// a read name of fd looked up in an index of fingerprints
+struct fp_index_name {
+  struct index_pool *pool;
+  FASTQ_FILE *fd;
+  FASTQ_SPAN rn;
+};
+
+// the fingerprints are the same: compares the read names
+static int fp_index_match(__ptr_t obj,void *data) {
+  struct fp_index_name *n=(struct fp_index_name*)data;
+  return fp_index_same_name(n->pool,n->fd,(long long)(size_t)obj-1,n->rn);
+}
+
+// adds the read rn at offset of file fd: returns 1 if a read with the
+// same name was indexed before (not added), -1 if out of memory
+static int fp_index_insert(hashtable index,FASTQ_FILE *fd,FASTQ_SPAN rn,long long offset) {
+  struct index_pool *pool=(struct index_pool*)index->data;
+  ulong fp=span_fingerprint(rn);
+  __ptr_t o=get_object(index,fp);
+  while ( o!=NULL ) {
+    if ( fp_index_same_name(pool,fd,(long long)(size_t)o-1,rn) ) return 1;
+    o=get_next_object(index,fp);
+  }
+  return (insere(index,fp,(__ptr_t)(size_t)(offset+1))<0?-1:0);
+}
+
+// bytes used by the table and the entries
+static unsigned long index_pool_mem(hashtable ht) {
+  unsigned long mem=sizeof(struct hashtable_s)+(sizeof(hashnode)+1)*(ht->size+ht->old_size);
+  struct index_pool *pool=(struct index_pool*)ht->data;
+  if ( pool!=NULL ) {
+    mem+=sizeof(struct index_pool)+pool->entries->size+pool->names->size;
+    if ( pool->mt!=NULL ) {
+      unsigned int i;
+      for(i=0;i<pool->mt->nshards;++i)
+	mem+=sizeof(struct hash_mt_shard)+index_pool_mem(pool->mt->shards[i].table);
+    }
+  }
+  return mem;
+}
+
+unsigned long fastq_index_mem(hashtable index) {
+  return index_pool_mem(index);
+}
+
+hashtable fastq_index_new(ulong n_reads) {
+  hashtable index=new_hashtable(FASTQ_INDEX_MIN_SIZE);
+  if ( index==NULL || index_pool(index)==NULL || hash_reserve(index,n_reads) ) {
+    PRINT_ERROR("Unable to allocate memory for the index");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  index_mem+=index_pool_mem(index);
+  return index;
+}
+
+hashtable fastq_index_mt_new(ulong n_reads) {
+  hashtable index=new_hashtable(0);
+  struct index_pool *pool;
+  unsigned int i;
+  if ( index==NULL || (pool=index_pool(index))==NULL ||
+       (pool->mt=new_hash_mt(FASTQ_INDEX_MIN_SIZE,FASTQ_INDEX_SHARDS))==NULL ) {
+    PRINT_ERROR("Unable to allocate memory for the index");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  for(i=0;i<pool->mt->nshards;++i)
+    if ( index_pool(pool->mt->shards[i].table)==NULL ) {
+      PRINT_ERROR("Unable to allocate memory for the index");
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+  if ( hash_mt_reserve(pool->mt,n_reads) ) {
+    PRINT_ERROR("Unable to allocate memory for the index");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  index_mem+=index_pool_mem(index);
+  return index;
+}
+
+hashtable fastq_fp_index_new(ulong n_reads) {
+  hashtable index=fastq_index_new(n_reads);
+  ((struct index_pool*)index->data)->fingerprints=TRUE;
+  return index;
+}
+
+int fastq_fp_index_ok(FASTQ_FILE *fd) {
+  return fd->map!=NULL || (fd->zf!=NULL && zfile_seekable(fd->zf));
+}
+
+int fastq_index_remove_read(hashtable index,FASTQ_FILE *fd,FASTQ_SPAN rname) {
+  struct index_pool *pool=(struct index_pool*)index->data;
+  if ( pool!=NULL && pool->fingerprints ) {
+    struct fp_index_name n={pool,fd,rname};
+    return find_delete(index,span_fingerprint(rname),fp_index_match,&n)!=NULL;
+  }
+  INDEX_ENTRY* e=fastq_index_remove_span(index,rname);
+  if ( e==NULL ) return FALSE;
+  free_indexentry(e);
+  return TRUE;
+}
+
+void fastq_index_free(hashtable index) {
+  if ( index==NULL ) return;
+  struct index_pool *pool=(struct index_pool*)index->data;
+  if ( pool!=NULL ) {
+    arena_free(pool->entries);
+    arena_free(pool->names);
+    if ( pool->fd!=NULL ) fastq_destroy(pool->fd);
+    if ( pool->mt!=NULL ) {
+      unsigned int i;
+      for(i=0;i<pool->mt->nshards;++i) {
+	fastq_index_free(pool->mt->shards[i].table);
+	pool->mt->shards[i].table=NULL;
+      }
+      free_hash_mt(pool->mt);
+    }
+    free(pool);
+  }
+  free_hashtable(index);
+}
+
+// adds an entry with the key to the table ht (of an index or of a shard)
+static INDEX_ENTRY* index_add(hashtable ht,ulong key,const char*hdr,int len,long start_pos) {
+  struct index_pool *pool=index_pool(ht);
+  if ( pool==NULL ) return(NULL);
+  INDEX_ENTRY *e=(INDEX_ENTRY*)arena_alloc(pool->entries,sizeof(INDEX_ENTRY));
+  if ( e==NULL ) return(NULL);
+  e->hdr=arena_strndup(pool->names,hdr,len);
+  if ( e->hdr==NULL ) return(NULL);
   e->entry_start=start_pos;
-  
-  strncpy(e->hdr,hdr,len);
-  e->hdr[len]='\0';
   // add to hash table
-  ulong key=hashit(e->hdr);
   //collisions[key%HASHSIZE]++;
   if(insere(ht,key,e)<0) {
-    PRINT_ERROR("Error while adding %s to index",hdr);
+    PRINT_ERROR("Error while adding %s to index",e->hdr);
     return(NULL);
   }
-  index_mem+=sizeof(INDEX_ENTRY)+len+1+sizeof(hashnode);
   return(e);
 }
 
+//long collisions[HASHSIZE+1];
+INDEX_ENTRY* new_indexentry(hashtable ht,const char*hdr,int len,long start_pos) {
+  FASTQ_SPAN rn={hdr,len};
+  ulong key=hashit_span(rn);
+  INDEX_ENTRY *e;
+  if ( !is_mt_index(ht) ) return index_add(ht,key,hdr,len,start_pos);
+  e=index_add(hash_mt_lock(index_shards(ht),key),key,hdr,len,start_pos);
+  hash_mt_unlock(index_shards(ht),key);
+  if ( e!=NULL ) ht->n_entries++;
+  return(e);
+}
+
+// the memory of the entry is only released by fastq_index_free
 void free_indexentry(INDEX_ENTRY *e) {
-  free(e);
-  // remove entry from hash table
   return;
 }
 
+// Sharded indexes: fastq_index_readnames and fastq_index_pair with
+// fastq_map. The read names are added/looked up by the threads (map)
+// and done checks the entries, in order, with the messages and
+// statistics of the sequential loops. The duplicated/unpaired read
+// reported is the first one in the file: when two reads have the same
+// name the one with the largest offset is the duplicate, whichever is
+// mapped first, and the reads before a read are all mapped before it is
+// done.
+struct index_mt {
+  hashtable index;
+  HASH_MT *mt;
+  FASTQ_FILE *vfd;      // file of the entries validated
+  long long first;      // offset of the first duplicated/unpaired read (-1)
+  unsigned long long n; // reads done
+};
+// status of a record whose name could not be added to the index
+#define INDEX_MT_NOMEM 4
+
+static void index_mt_error(struct index_mt *d,long long offset) {
+  long long first=__atomic_load_n(&d->first,__ATOMIC_RELAXED);
+  while ( (first<0 || offset<first) && !__atomic_compare_exchange_n(&d->first,&first,offset,FALSE,__ATOMIC_RELAXED,__ATOMIC_RELAXED) );
+}
+
+// adds the read name (the entry keeps the smallest offset)
+static int index_mt_add(FASTQ_FILE* fd,FASTQ_ENTRY** e,void *data) {
+  struct index_mt *d=(struct index_mt*)data;
+  long long dup=-1;
+  // the wrong header is reported by done
+  if ( e[0]->hdr1[0]!='@' ) return FASTQ_MAP_ERROR;
+  FASTQ_SPAN rn=fastq_readname_span(fd,e[0],TRUE);
+  ulong key=hashit_span(rn);
+  hashtable t=hash_mt_lock(d->mt,key);
+  INDEX_ENTRY *ie=(INDEX_ENTRY*)hash_lookup(t,key,index_entry_match,&rn);
+  if ( ie==NULL ) {
+    ie=index_add(t,key,rn.s,rn.len,e[0]->offset);
+  } else if ( ie->entry_start>e[0]->offset ) {
+    dup=ie->entry_start;
+    ie->entry_start=e[0]->offset;
+  } else
+    dup=e[0]->offset;
+  hash_mt_unlock(d->mt,key);
+  if ( ie==NULL ) return INDEX_MT_NOMEM;
+  if ( dup>=0 ) index_mt_error(d,dup);
+  return FASTQ_MAP_DISCARD;
+}
+
+static int index_mt_add_done(FASTQ_FILE* fd,FASTQ_ENTRY** e,int status,void *data) {
+  struct index_mt *d=(struct index_mt*)data;
+  if ( status==FASTQ_MAP_ERROR ) fastq_readname_span(fd,e[0],TRUE);
+  if ( d->n==FASTQ_ESTIMATE_READS )
+    hash_mt_reserve(d->mt,fastq_estimate_reads(fd,d->n,e[0]->offset));
+  if ( e[0]->offset==__atomic_load_n(&d->first,__ATOMIC_RELAXED) ) {
+    FASTQ_SPAN readname=fastq_readname_span(fd,e[0],TRUE);
+    PRINT_ERROR("Error in file %s: line %lu: duplicated sequence %.*s",fd->filename,fd->cline,(int)readname.len,readname.s);
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  if ( status==INDEX_MT_NOMEM ) {
+    PRINT_ERROR("Error in file %s: line %lu: malloc failed?",fd->filename,fd->cline-4);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  if (fastq_validate_entry(fd,e[0])!=0) {
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  ++d->n;
+  fastq_progress(fd,fd->cline/4);
+  return FASTQ_MAP_DISCARD;
+}
+
+// the loop of fastq_index_readnames
+static void index_readnames_mt(FASTQ_FILE* fd,hashtable index) {
+  struct index_mt d={index,index_shards(index),fd,-1,0};
+  map_records(fd,1,FASTQ_MAP_ALL,index_mt_add,index_mt_add_done,NULL,&d,TRUE);
+  index->n_entries=hash_mt_entries(d.mt);
+}
+
+// marks the entry of the read name as paired with the read: the
+// entry_start of an entry found is -1-(offset of the read in fd2) and
+// the read with the smallest offset keeps it (the others are unpaired)
+static int index_mt_pair(FASTQ_FILE* fd,FASTQ_ENTRY** e,void *data) {
+  struct index_mt *d=(struct index_mt*)data;
+  long long unpaired=-1;
+  if ( e[0]->hdr1[0]!='@' ) return FASTQ_MAP_ERROR;
+  FASTQ_SPAN rn=fastq_readname_span(fd,e[0],TRUE);
+  ulong key=hashit_span(rn);
+  hashtable t=hash_mt_lock(d->mt,key);
+  INDEX_ENTRY *ie=(INDEX_ENTRY*)hash_lookup(t,key,index_entry_match,&rn);
+  if ( ie==NULL )
+    unpaired=e[0]->offset;
+  else if ( ie->entry_start>=0 )
+    ie->entry_start=-1-e[0]->offset;
+  else if ( -1-ie->entry_start<e[0]->offset )
+    unpaired=e[0]->offset;
+  else {
+    unpaired=-1-ie->entry_start;
+    ie->entry_start=-1-e[0]->offset;
+  }
+  hash_mt_unlock(d->mt,key);
+  if ( unpaired>=0 ) index_mt_error(d,unpaired);
+  return FASTQ_MAP_DISCARD;
+}
+
+static int index_mt_pair_done(FASTQ_FILE* fd,FASTQ_ENTRY** e,int status,void *data) {
+  struct index_mt *d=(struct index_mt*)data;
+  if ( status==FASTQ_MAP_ERROR ) fastq_readname_span(fd,e[0],TRUE);
+  if ( e[0]->offset==__atomic_load_n(&d->first,__ATOMIC_RELAXED) ) {
+    FASTQ_SPAN readname=fastq_readname_span(fd,e[0],TRUE);
+    PRINT_ERROR("Error in file %s: line %lu: unpaired read - %.*s",fd->filename,fd->cline,(int)readname.len,readname.s);
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  if (fastq_validate_entry(d->vfd,e[0])) {
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  fastq_progress(fd,fd->cline/4);
+  return FASTQ_MAP_DISCARD;
+}
+
+// a read of fd2 removed from the index (the entries are freed with the
+// index)
+static int index_pair_read(FASTQ_FILE* fd,FASTQ_ENTRY *e,FASTQ_SPAN rn,INDEX_ENTRY *ie,void *data) {
+  if ( ie==NULL ) {
+    // complain and exit if not found
+    PRINT_ERROR("Error in file %s: line %lu: unpaired read - %.*s",fd->filename,fd->cline,(int)rn.len,rn.s);
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  if (fastq_validate_entry((FASTQ_FILE*)data,e)) {
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  return TRUE;
+}
+
+unsigned long long fastq_index_pair(FASTQ_FILE* fd2,hashtable index,FASTQ_FILE* vfd) {
+  FASTQ_ENTRY *m2;
+  if ( is_mt_index(index) ) {
+    struct index_mt d={index,index_shards(index),vfd,-1,0};
+    HASH_MT_ITER it;
+    hashnode *node;
+    unsigned long long left=0;
+    map_records(fd2,1,FASTQ_MAP_ALL,index_mt_pair,index_mt_pair_done,NULL,&d,FALSE);
+    progress_done();
+    hash_mt_iter_init(d.mt,&it);
+    while ( (node=hash_mt_iter_next(d.mt,&it))!=NULL )
+      if ( ((INDEX_ENTRY*)node->obj)->entry_start>=0 ) ++left;
+    index->n_entries=left;
+    return left;
+  }
+  if ( !is_fp_index(index) ) {
+    fastq_index_scan(fd2,index,TRUE,FALSE,index_pair_read,vfd);
+    return index->n_entries;
+  }
+  m2=fastq_new_entry();
+  while(!fastq_eof(fd2)) {
+    // read entry
+    if (fastq_read_entry(fd2,m2)==0) break;
+    FASTQ_SPAN readname=fastq_readname_span(fd2,m2,TRUE);
+    if ( !fastq_index_remove_read(index,vfd,readname) ) {
+      // complain and exit if not found
+      PRINT_ERROR("Error in file %s: line %lu: unpaired read - %.*s",fd2->filename,fd2->cline,(int)readname.len,readname.s);
+      exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+    }
+    if (fastq_validate_entry(vfd,m2)) {
+      exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+    }
+    fastq_progress(fd2,fd2->cline/4);
+  }
+  progress_done();
+  return index->n_entries;
+}
+
 void fastq_destroy(FASTQ_FILE* fd) {
-  fastq_close(fd->fd);
+  unsigned long p;
+  for ( p=0; p<fd->rdlen_ctr.npages; ++p)
+    if ( fd->rdlen_ctr.pages[p]!=NULL ) free(fd->rdlen_ctr.pages[p]);
+  if ( fd->rdlen_ctr.pages!=NULL ) free(fd->rdlen_ctr.pages);
+  fd->rdlen_ctr.pages=NULL;
+  fd->rdlen_ctr.npages=0;
+  if ( fd->ra!=NULL ) {
+    readahead_stop(fd->ra);
+    fd->ra=NULL;
+    fd->buf=NULL;
+  }
+  if ( fd->out!=NULL ) {
+    writer_close(fd->out);
+    fd->out=NULL;
+  }
+  if ( fd->map!=NULL ) {
+    fastq_munmap(fd);
+  } else if ( fd->zf!=NULL ) {
+    zfile_close(fd->zf);
+    fd->zf=NULL;
+  } else if ( fd->bgzf!=NULL ) {
+    int prev=stats_enter(STATS_WRITE);
+    if ( bgzf_mt_close(fd->bgzf) ) {
+      PRINT_ERROR("Error while writing to file %s",fd->filename);
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+    stats_leave(prev);
+    fd->bgzf=NULL;
+  } else {
+    // the data still buffered by zlib is compressed and written
+    int prev=stats_enter(STATS_WRITE);
+    fastq_close(fd->fd);
+    stats_leave(prev);
+  }
+  if ( fd->buf!=NULL ) free(fd->buf);
+  fd->buf=NULL;
 }
 
 static inline void fastq_close(gzFile fd) {
@@ -661,69 +2393,139 @@ gzFile fastq_open(const char* filename,const char *mode) {
 }
 
 
+// open a file for writing using the multi-threaded BGZF compressor
+static BGZF_MT* fastq_bgzf_open(const char* filename,const char *mode) {
+  int level=Z_DEFAULT_COMPRESSION;
+  int fd;
+  BGZF_MT* bz;
+  const char *m;
+
+  // compression level as in gzopen
+  for(m=mode;*m!='\0';++m)
+    if ( *m>='0' && *m<='9' ) level=*m-'0';
+  if ( filename[0]=='-' && filename[1]=='\0' ) 
+    fd=fileno(stdout);
+  else {
+    fd=open(filename,O_WRONLY|O_CREAT|O_TRUNC,0666);
+    if (fd<0) {
+      PRINT_ERROR("Unable to open %s",filename);
+      exit(PARAMS_ERROR_EXIT_STATUS);
+    }
+  }
+  bz=bgzf_mt_wopen(fd,level,fastq_threads);
+  if ( bz==NULL ) {
+    PRINT_ERROR("Unable to start the compression threads for %s",filename);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  return(bz);
+}
+
+// open a file for reading: the compression format is detected from
+// its contents. BGZF files are decompressed by fastq_threads threads.
+static ZFILE* fastq_zfile_open(const char* filename) {
+  ZFILE* zf=zfile_open(filename,fastq_threads);
+  if ( zf==NULL ) {
+    PRINT_ERROR("Unable to open %s",filename);
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  // unsupported format?
+  if ( zfile_error(zf)!=NULL ) {
+    PRINT_ERROR("Error in file %s: %s",filename,zfile_error(zf));
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  return(zf);
+}
+
+int fastq_parse_option(int argc,char **argv,const char *name,int has_value,FASTQ_OPTION_FN set,void *data) {
+  int i,n=1;
+  unsigned long len=strlen(name);
+  for(i=1;i<argc;++i) {
+    if ( !strcmp(argv[i],"--") ) break;
+    if ( !strcmp(argv[i],name) ) {
+      if ( !has_value ) {
+	set(NULL,data);
+	continue;
+      }
+      if ( i+1>=argc ) {
+	PRINT_ERROR("Missing value for %s",name);
+	exit(PARAMS_ERROR_EXIT_STATUS);
+      }
+      set(argv[++i],data);
+    } else if ( has_value && !strncmp(argv[i],name,len) && argv[i][len]=='=' ) {
+      set(&argv[i][len+1],data);
+    } else {
+      argv[n++]=argv[i];
+    }
+  }
+  // copy the remaining arguments
+  for(;i<argc;++i) argv[n++]=argv[i];
+  argv[n]=NULL;
+  return(n);
+}
+
+static void threads_option(const char *val,void *data) {
+  char *end;
+  long t=strtol(val,&end,10);
+  if ( *val=='\0' || *end!='\0' || t<1 || t>1024 ) {
+    PRINT_ERROR("Invalid value for --threads: %s",val);
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  fastq_threads=(int)t;
+}
+
+static void gz_index_option(const char *val,void *data) {
+  fastq_gz_index=TRUE;
+}
+
+// Process the options common to all programs and remove them from argv
+//   --threads N  number of threads used to compress the output files
+//                and to decompress BGZF input files
+// returns the new number of arguments
+int fastq_parse_common_options(int argc,char **argv) {
+  argc=stats_parse_options(argc,argv);
+  argc=fastq_parse_option(argc,argv,"--threads",TRUE,threads_option,NULL);
+  return fastq_parse_option(argc,argv,"--gz_index",FALSE,gz_index_option,NULL);
+}
+
 //  http://support.illumina.com/help/SequencingAnalysisWorkflow/Content/Vault/Informatics/Sequencing_Analysis/CASAVA/swSEQ_mCA_FASTQFiles.htm
 // check if the read name format was generated by casava 1.8
+// relaxed format: the name is followed by " [1234]:[YN]:"
+// (as the regular expression "[A-Z0-9:]* [1234]:[YN]:[0-9]*.*")
 int is_casava_1_8_readname(const char *s) {
-  regex_t regex;
-  int reti;
-  int is_casava_1_8=FALSE;
-  //reti = regcomp(&regex,"[A-Z0-9:]* [1234]:[YN]:[0-9]*:.*",0);
-  // relaxed format
-  reti = regcomp(&regex,"[A-Z0-9:]* [1234]:[YN]:[0-9]*.*",0);  
-  if ( reti ) { 
-    PRINT_ERROR("Internal error: Could not compile regex"); 
-    exit(SYS_INT_ERROR_EXIT_STATUS); 
+  const char *sp=s;
+  while ( (sp=strchr(sp,' '))!=NULL ) {
+    if ( sp[1]>='1' && sp[1]<='4' && sp[2]==':' &&
+	 (sp[3]=='Y' || sp[3]=='N') && sp[4]==':' )
+      return TRUE;
+    ++sp;
   }
-  /* Execute regular expression */
-  //fprintf(stderr,"%s\n",hdr);
-  reti = regexec(&regex, s, 0, NULL, 0);
-  if ( !reti ) {    // match
-    is_casava_1_8=TRUE;
-  } 
-  regfree(&regex);
-  return is_casava_1_8;
+  return FALSE;
 }
 
+#define IS_DIGIT(c) ((c)>='0' && (c)<='9')
+#define IS_EOL_CHAR(c) ((c)=='\n' || (c)=='\r')
+
 // is the read name a plain integer
-// or it doesn't contain a #/ as the second last letter
+// ^[0-9]+[\n\r]?$
 static int is_int_readname(const char *s) {
-  regex_t regex;
-  int reti;
-  int is_int_name=FALSE;
+  unsigned long i=0;
   // @ was alread removed
-  reti = regcomp(&regex,"^[0-9]+[\n\r]?$",REG_EXTENDED);  
-  if ( reti ) { 
-    PRINT_ERROR("Internal error: Could not compile regex"); 
-    exit(SYS_INT_ERROR_EXIT_STATUS); 
-  }
-  /* Execute regular expression */
-  //fprintf(stderr,">%s<\n",s);
-  reti = regexec(&regex, s, 0, NULL, 0);
-  if ( !reti ) {    // match
-    is_int_name=TRUE;
-  } 
-  regfree(&regex);
-  return is_int_name;
+  while ( IS_DIGIT(s[i]) ) ++i;
+  if ( i==0 ) return FALSE;
+  if ( IS_EOL_CHAR(s[i]) ) ++i;
+  return(s[i]=='\0');
 }
 
+// the read name doesn't end with a suffix (#1, /2, :a, ...)
+// [# \t/:][0-9abAB][\n\r]?$
 static int is_nosuffix_readname(const char *s) {
-  regex_t regex;
-  int reti;
-  int is_nosuffix_name=TRUE;
+  unsigned long len=strlen(s);
   // @ was alread removed
-  reti = regcomp(&regex,"[# \t/:][0-9abAB][\n\r]?$",REG_EXTENDED);  
-  if ( reti ) { 
-    PRINT_ERROR("Internal error: Could not compile regex"); 
-    exit(SYS_INT_ERROR_EXIT_STATUS); 
-  }
-  /* Execute regular expression */
-  //fprintf(stderr,">%s<\n",s);
-  reti = regexec(&regex, s, 0, NULL, 0);
-  if ( !reti ) {    // match
-    is_nosuffix_name=FALSE;
-  } 
-  regfree(&regex);
-  return is_nosuffix_name;
+  if ( len>0 && IS_EOL_CHAR(s[len-1]) ) --len;
+  if ( len<2 ) return TRUE;
+  if ( strchr("# \t/:",s[len-2])==NULL ) return TRUE;
+  if ( !IS_DIGIT(s[len-1]) && strchr("abAB",s[len-1])==NULL ) return TRUE;
+  return FALSE;
 }
 
 
@@ -776,3 +2578,120 @@ READ_SPACE is_color_space(char *seq,FASTQ_FILE* f) {
 /*     //} */
 /*   return(replaced); */
 /* } */
+
+// Maps an uncompressed (regular) file in memory
+// The mapping is one byte longer than the file so that, as with the
+// block buffer, there is always a \0 after the data: an anonymous
+// mapping is reserved first and the file is mapped over it.
+// Returns 1 on success, 0 if the file should be read with zfile
+static int fastq_mmap(FASTQ_FILE* fd) {
+  struct stat st;
+  unsigned long size;
+  char *map;
+  int f;
+
+  if ( !strcmp(fd->filename,"-") ) return 0;
+  f=open(fd->filename,O_RDONLY);
+  if ( f<0 ) return 0;
+  if ( fstat(f,&st) || !S_ISREG(st.st_mode) || st.st_size==0 || (unsigned long long)st.st_size>=(size_t)-1 ) {
+    close(f);
+    return 0;
+  }
+  size=st.st_size;
+  map=(char*)mmap(NULL,size+1,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  if ( map==MAP_FAILED ) {
+    close(f);
+    return 0;
+  }
+  if ( mmap(map,size,PROT_READ,MAP_PRIVATE|MAP_FIXED,f,0)==MAP_FAILED ) {
+    munmap(map,size+1);
+    close(f);
+    return 0;
+  }
+  close(f);
+  madvise(map,size,MADV_SEQUENTIAL);
+  fd->map=map;
+  fd->map_size=size+1;
+  fd->buf=map;
+  fd->buf_size=size;
+  fd->buf_pos=0;
+  fd->buf_end=size;
+  fd->buf_offset=0L;
+  fd->buf_eof=TRUE;
+  // the pages are read (and the time counted) while parsing
+  stats_count(STATS_READ,0,size,size);
+  return 1;
+}
+
+// compressed bytes of the input consumed so far (the reads returned
+// may lag behind when the file is read by another thread)
+unsigned long long fastq_input_offset(FASTQ_FILE* fd) {
+  if ( fd->map!=NULL ) return fd->buf_pos;
+  if ( fd->zf!=NULL ) return zfile_tell_compressed(fd->zf);
+  return 0;
+}
+
+unsigned long long fastq_input_size(FASTQ_FILE* fd) {
+  if ( fd->map!=NULL ) return fd->buf_end;
+  if ( fd->zf!=NULL ) return zfile_size(fd->zf);
+  return 0;
+}
+
+static void fastq_munmap(FASTQ_FILE* fd) {
+  munmap(fd->map,fd->map_size);
+  fd->map=NULL;
+  fd->map_size=0;
+  fd->buf=NULL;
+}
+
+/* ******************************************************************************* */
+// Index of gzip files (access points used by fastq_seek)
+// The index is saved in filename.fqi (--gz_index) and loaded instead
+// of being built again if it matches the file.
+
+static void fastq_gz_index_name(FASTQ_FILE* fd,char *name) {
+  snprintf(name,MAX_FILENAME_LENGTH+5,"%s.fqi",fd->filename);
+}
+
+// Starts building the index while the file is read from the beginning
+// (nothing should have been parsed yet)
+// Returns TRUE if a new index is being built
+static int fastq_gz_index_start(FASTQ_FILE* fd) {
+  char name[MAX_FILENAME_LENGTH+5];
+  int readahead=(fd->ra!=NULL);
+  int building=FALSE;
+  ZFILE_FORMAT format;
+
+  if ( fd->zf==NULL || fd->buf_offset+fd->buf_pos>0 ) return FALSE;
+  format=zfile_format(fd->zf);
+  if ( (format!=ZFILE_GZIP && format!=ZFILE_BGZF) || !zfile_seekable(fd->zf) ) return FALSE;
+  // BGZF files read by several threads are indexed by bgzf_mt
+  if ( format==ZFILE_BGZF && fastq_threads>1 ) return FALSE;
+  // the zfile is used by the read-ahead thread
+  if ( readahead ) fastq_readahead_stop(fd);
+  fastq_gz_index_name(fd,name);
+  if ( zfile_index_load(fd->zf,name)==0 ) {
+    if ( zfile_rewind(fd->zf) ) {
+      PRINT_ERROR("Error in file %s: unable to rewind",fd->filename);
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+  } else if ( zfile_index_start(fd->zf,ZFILE_INDEX_SPAN)==0 ) {
+    building=TRUE;
+  } else if ( zfile_rewind(fd->zf) ) {
+    PRINT_ERROR("Error in file %s: unable to rewind",fd->filename);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  fd->buf_pos=fd->buf_end=0;
+  fd->buf_offset=0L;
+  fd->buf_eof=FALSE;
+  if ( readahead ) fastq_readahead_start(fd);
+  return building;
+}
+
+static void fastq_gz_index_save(FASTQ_FILE* fd) {
+  char name[MAX_FILENAME_LENGTH+5];
+  if ( !fastq_gz_index || !zfile_index_complete(fd->zf) ) return;
+  fastq_gz_index_name(fd,name);
+  if ( zfile_index_save(fd->zf,name) )
+    fprintf(stderr,"Warning: unable to save the index of %s to %s\n",fd->filename,name);
+}
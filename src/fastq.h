@@ -28,10 +28,19 @@
 #define NOP 2
 
 #ifndef MAX_READ_LENGTH
-// 500000 bases should cover most of the cases for now :)
+// reads may be longer: only used as the default minimum read length
 #define MAX_READ_LENGTH 2500000
 #endif
 
+// initial size of the buffers of a FASTQ_ENTRY (they grow on demand)
+#ifndef FASTQ_ENTRY_INIT_SIZE
+#define FASTQ_ENTRY_INIT_SIZE 512
+#endif
+
+// read length histogram: number of lengths per page
+#define FASTQ_RDLEN_PAGE_BITS 10
+#define FASTQ_RDLEN_PAGE_SIZE (1UL<<FASTQ_RDLEN_PAGE_BITS)
+
 #ifndef MAX_LABEL_LENGTH
 #define MAX_LABEL_LENGTH 1000
 #endif
@@ -55,9 +64,33 @@ typedef enum  { TRUE=1, FALSE=0 } FASTQ_BOOLEAN;
 #endif
 typedef long FASTQ_READ_OFFSET;
 
-#define DEFAULT_HASHSIZE 39000001
+// initial size of the index of read names (it grows as needed)
+#define FASTQ_INDEX_MIN_SIZE 1024
+// number of shards of the indexes used by several threads
+#define FASTQ_INDEX_SHARDS 64
+// the number of reads of a file is estimated after indexing the first
+// FASTQ_ESTIMATE_READS reads (from the size of the file), to size the
+// index at once. Compressed files are assumed to be
+// FASTQ_COMPRESSION_RATIO times smaller than the data, which usually
+// underestimates the number of reads.
+#define FASTQ_ESTIMATE_READS 1000
+#define FASTQ_COMPRESSION_RATIO 3
+
+// size of the blocks read (uncompressed) from a fastq file
+#ifndef FASTQ_BLOCK_SIZE
+#define FASTQ_BLOCK_SIZE 1048576
+#endif
+// size of the blocks read after a seek (random access)
+#ifndef FASTQ_SEEK_BLOCK_SIZE
+#define FASTQ_SEEK_BLOCK_SIZE 16384
+#endif
 
 #include "hash.h"
+#include "bgzf_mt.h"
+#include "zfile.h"
+#include "readahead.h"
+#include "writer.h"
+#include "progress.h"
 #include <zlib.h> 
 
 
@@ -79,9 +112,16 @@ typedef long FASTQ_READ_OFFSET;
 #define SYS_INT_ERROR_EXIT_STATUS 2
 #define FASTQ_FORMAT_ERROR_EXIT_STATUS 3
 
-#define PRINT_READS_PROCESSED(c,n) { if (c%n==0) { fprintf(stderr,"\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b%lu",c);fflush(stderr); }}
-
 extern unsigned long index_mem;
+// called (if set) before exiting with an error in the format of an
+// input file, e.g. to report first the errors found in the entries
+// read before (see spill.h). It is only called once
+extern void (*fastq_format_error_hook)(void);
+// number of threads used to compress the output files and to
+// decompress BGZF input files (--threads)
+extern int fastq_threads;
+// save the index of gzip files next to them (--gz_index)
+extern int fastq_gz_index;
 extern char* encodings[];
 
 struct index_entry {  
@@ -94,21 +134,100 @@ struct index_entry {
 };
 typedef struct index_entry INDEX_ENTRY;
 
+// a string that is not \0 terminated: e.g., the read name in the
+// header of an entry (s points to the header)
+struct fastq_span {
+  const char *s;
+  unsigned long len;
+};
+typedef struct fastq_span FASTQ_SPAN;
+
 struct fastq_entry {  
   // file offset: start entry
   // file offset: end entry
   // chat hdr(40)
-  char hdr1[MAX_LABEL_LENGTH];
-  char hdr2[MAX_LABEL_LENGTH];
-  char seq[MAX_READ_LENGTH];
-  char qual[MAX_READ_LENGTH];
+  char *hdr1;
+  char *hdr2;
+  char *seq;
+  char *qual;
+  unsigned long hdr_size; // allocated size of hdr1 and hdr2
+  unsigned long seq_size; // allocated size of seq and qual
   unsigned long read_len;
+  unsigned long qual_len; // length of qual (with the newline, as read_len)
   long long offset;
 };
 typedef struct fastq_entry FASTQ_ENTRY;
 
+// view of an entry: the pointers refer to the block buffer of the
+// FASTQ_FILE and are only valid until the next read from the same file.
+// The lengths exclude the newline (lines are not \0 terminated)
+struct fastq_record {
+  char *hdr1;
+  char *seq;
+  char *hdr2;
+  char *qual;
+  unsigned long hdr1_len;
+  unsigned long seq_len;
+  unsigned long hdr2_len;
+  unsigned long qual_len;
+  long long offset;
+};
+typedef struct fastq_record FASTQ_RECORD;
+
+// A batch of entries stored as a struct of arrays
+// The lines (without the newline) of all entries are packed in seq,
+// qual and hdr (hdr1 and hdr2) and entry i is
+//   seq[seq_off[i]..seq_off[i]+seq_len[i]-1], ...
+// All lines end with a newline in the file except, possibly, the
+// quality line of the last entry (last_qual_nl).
+struct fastq_batch {
+  unsigned long n;         // number of entries
+  unsigned long max;       // maximum number of entries
+  char *seq;
+  char *qual;
+  char *hdr;
+  unsigned long seq_size,qual_size,hdr_size; // allocated
+  unsigned long seq_used,qual_used,hdr_used;
+  unsigned long *seq_off,*seq_len;
+  unsigned long *qual_off,*qual_len;
+  unsigned long *hdr1_off,*hdr1_len;
+  unsigned long *hdr2_off,*hdr2_len;
+  long long *offset;       // offset of the entry in the file
+  int last_qual_nl;
+};
+typedef struct fastq_batch FASTQ_BATCH;
+
+// number of reads per length
+// two-level table: pages of FASTQ_RDLEN_PAGE_SIZE counters are only
+// allocated for the lengths observed
+struct fastq_rdlen_hist {
+  unsigned long **pages;
+  unsigned long npages;
+};
+typedef struct fastq_rdlen_hist FASTQ_RDLEN_HIST;
+
 struct fastq_file {
   gzFile fd;
+  // multi-threaded BGZF compression (--threads>1)
+  BGZF_MT *bgzf;
+  // write mode: output buffer (flushed to fd or bgzf)
+  WRITER *out;
+  // read mode: gzip, bzip2, xz, zstd or uncompressed input
+  ZFILE *zf;
+  // read-ahead thread (--threads>1): buf points to its current batch
+  READAHEAD *ra;
+  // uncompressed files are mapped in memory: buf points to the mapping
+  // and holds the whole file (buf_eof is always TRUE)
+  char *map;
+  unsigned long map_size;
+  // block buffer (read mode)
+  char *buf;
+  unsigned long buf_size;
+  unsigned long buf_pos;  // next byte to parse
+  unsigned long buf_end;  // end of the data in buf
+  long long buf_offset;   // offset in the (uncompressed) file of buf[0]
+  int buf_eof;            // no more data to read from fd
+  unsigned long read_size;// bytes read at a time
   long long cur_offset;
   unsigned long cline;
   char filename[MAX_FILENAME_LENGTH];
@@ -119,36 +238,165 @@ struct fastq_file {
   unsigned long min_qual; // minimum quality
   unsigned long max_qual;   // maximum quality
   unsigned long num_rds; // number of reads
-  unsigned long rdlen_ctr[MAX_READ_LENGTH]; // keep a tally on how many reads we observed per length
+  FASTQ_RDLEN_HIST rdlen_ctr; // keep a tally on how many reads we observed per length
   
   int fix_dot;
   int fixed_dot;
   int is_pe;
   int readname_format;
+  // parser of the read names (for readname_format): returns the length
+  // of the read name in a header (without the @)
+  unsigned long (*readname)(struct fastq_file *fd,const char *rn);
   int is_casava_18;
   READ_SPACE space;
 };
 typedef struct fastq_file  FASTQ_FILE;
 
+// progress of a loop that reads fd (see progress.h)
+// reads: number of reads processed so far
+unsigned long long fastq_input_offset(FASTQ_FILE* fd);
+unsigned long long fastq_input_size(FASTQ_FILE* fd);
+// size of the (uncompressed) data: estimated for compressed files
+// (FASTQ_COMPRESSION_RATIO), 0 if not known
+unsigned long long fastq_data_size(FASTQ_FILE* fd);
+static inline void fastq_progress(FASTQ_FILE* fd,unsigned long long reads) {
+  if ( progress_due(reads) ) progress_report("reads",reads,fastq_input_offset(fd),fastq_input_size(fd));
+}
+
+// Parallel processing of the entries of a file (fastq_map)
+// The file is read in chunks of records (groups of entries_per_record
+// consecutive entries) and map is applied to the records of each chunk
+// by fastq_threads threads. done is then called by the calling thread
+// for each record, in the input order, and the entries of the records
+// kept are written (entry j to out[j], or to stdout if out[j] is NULL).
+// map should only read fd (fastq_check_entry can be used to validate
+// an entry) and may change the entries. It returns FASTQ_MAP_KEEP,
+// FASTQ_MAP_DISCARD, FASTQ_MAP_ERROR (the entries should be left
+// unchanged) or another value that is passed to done.
+// done (optional) is called with fd->cline set as if the file had been
+// read up to the end of the record (the first chunk is processed one
+// record at a time, so messages printed by map/done, e.g. when the
+// read name format is detected, appear in the same order as in a
+// sequential program). It returns the final status of the record: only
+// the records with FASTQ_MAP_KEEP are written.
+#define FASTQ_MAP_KEEP 0
+#define FASTQ_MAP_DISCARD 1
+#define FASTQ_MAP_ERROR 2
+// passed to done (map is not called): the file ended in the middle of a record
+#define FASTQ_MAP_TRUNCATED 3
+// number of records per chunk
+#ifndef FASTQ_MAP_CHUNK_SIZE
+#define FASTQ_MAP_CHUNK_SIZE 1024
+#endif
+// no limit on the number of records processed
+#define FASTQ_MAP_ALL ((unsigned long)-1)
+
+typedef int (*FASTQ_MAP_FN)(FASTQ_FILE* fd,FASTQ_ENTRY** e,void *data);
+typedef int (*FASTQ_DONE_FN)(FASTQ_FILE* fd,FASTQ_ENTRY** e,int status,void *data);
+
 void fastq_print_version();
 FASTQ_ENTRY* fastq_new_entry(void);
+void fastq_entry_reserve(FASTQ_ENTRY *e,unsigned long seq_size,unsigned long hdr_size);
+unsigned long fastq_rdlen_count(FASTQ_FILE *fd,unsigned long len);
 void fastq_write_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e);
 
 unsigned long get_elength(FASTQ_ENTRY*);
 void fastq_index_delete(char *rname,hashtable index);
 INDEX_ENTRY* fastq_index_lookup_header(hashtable sn_index,char *hdr);
 char* fastq_get_readname(FASTQ_FILE*, FASTQ_ENTRY *,char* rn,unsigned long*,int is_header1);
+FASTQ_SPAN fastq_readname_span(FASTQ_FILE*, FASTQ_ENTRY *,int is_header1);
+int fastq_span_eq(FASTQ_SPAN a,FASTQ_SPAN b);
+INDEX_ENTRY* fastq_index_lookup_span(hashtable sn_index,FASTQ_SPAN hdr);
+void fastq_index_delete_span(FASTQ_SPAN rname,hashtable index);
+// lookup and delete (in a single probe) the entry of a read name:
+// returns the entry removed (to be freed with free_indexentry) or NULL
+INDEX_ENTRY* fastq_index_remove_span(hashtable index,FASTQ_SPAN rname);
+void free_indexentry(INDEX_ENTRY *e);
+INDEX_ENTRY* new_indexentry(hashtable ht,const char*hdr,int len,long start_pos);
 int fastq_read_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e);
 void fastq_new_entry_stats(FASTQ_FILE *, FASTQ_ENTRY* );
 int fastq_validate_entry(FASTQ_FILE *fd,FASTQ_ENTRY *e);
 int fastq_read_next_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e);
+int fastq_read_record(FASTQ_FILE* fd,FASTQ_RECORD *r);
+int fastq_read_next_record(FASTQ_FILE* fd,FASTQ_RECORD *r);
+int fastq_eof(FASTQ_FILE* fd);
+FASTQ_BATCH* fastq_new_batch(unsigned long max_entries);
+void fastq_free_batch(FASTQ_BATCH* b);
+unsigned long fastq_read_batch(FASTQ_FILE* fd,FASTQ_BATCH* b);
+unsigned long fastq_read_next_batch(FASTQ_FILE* fd,FASTQ_BATCH* b);
+void fastq_batch_entry(FASTQ_BATCH* b,unsigned long i,FASTQ_ENTRY *e);
+void fastq_write_batch_entry(FASTQ_FILE* fd,FASTQ_BATCH* b,unsigned long i);
+void fastq_write_batch_entry2stdout(FASTQ_BATCH* b,unsigned long i);
+int fastq_check_entry(FASTQ_FILE *fd,FASTQ_ENTRY *e);
+unsigned long fastq_map(FASTQ_FILE* fd,int entries_per_record,unsigned long max_records,FASTQ_MAP_FN map,FASTQ_DONE_FN done,FASTQ_FILE** out,void *data);
+void fastq_seek(FASTQ_FILE* fd,long long offset);
 
 FASTQ_FILE* fastq_new(const char* filename, const int fix_dot,const char *mode);
 void fastq_destroy(FASTQ_FILE*);
 void fastq_is_pe(FASTQ_FILE* fd);
 void fastq_index_readnames(FASTQ_FILE *,hashtable,long long,int);
+// Reads the entries of fd (up to the end of the file) and calls fn for
+// each one, as fastq_index_readnames does. stats: update the statistics
+// of fd (fastq_read_next_entry). gz_index: build the index of gzip
+// files for fastq_seek in the same pass
+typedef void (*FASTQ_ENTRY_FN)(FASTQ_FILE* fd,FASTQ_ENTRY *e,void *data);
+void fastq_scan(FASTQ_FILE* fd,FASTQ_ENTRY *e,int stats,int gz_index,FASTQ_ENTRY_FN fn,void *data);
+// Lookups of batches of read names in an index of read names (not in
+// an index of fingerprints): the slots of all the names of a batch are
+// prefetched before any name is looked up (removed), so the cache
+// misses of the batch overlap. The names are looked up in order and the
+// ones with s==NULL are skipped. entries[i]: the entry of names[i] (NULL
+// if not found). No other thread may change the index meanwhile.
+#define FASTQ_INDEX_BATCH 32
+void fastq_index_lookup_batch(hashtable index,FASTQ_SPAN *names,unsigned long n,INDEX_ENTRY **entries);
+void fastq_index_remove_batch(hashtable index,FASTQ_SPAN *names,unsigned long n,INDEX_ENTRY **entries);
+// As fastq_scan, but the entries are read FASTQ_INDEX_BATCH at a time
+// and their read names looked up (removed, if remove is TRUE) in the
+// index with fastq_index_lookup_batch before fn is called for each
+// entry, in order, with its read name and its entry in the index (NULL
+// if not found). fn returns FALSE to stop.
+typedef int (*FASTQ_INDEX_FN)(FASTQ_FILE* fd,FASTQ_ENTRY *e,FASTQ_SPAN rn,INDEX_ENTRY *ie,void *data);
+void fastq_index_scan(FASTQ_FILE* fd,hashtable index,int remove,int stats,FASTQ_INDEX_FN fn,void *data);
+// index of read names (see fastq_index_readnames): the entries are
+// freed, all at once, by fastq_index_free. n_reads: expected number of
+// reads (0 if not known)
+hashtable fastq_index_new(ulong n_reads);
+// index of read names sharded (see hash.h) for fastq_threads threads:
+// fastq_index_readnames and fastq_index_pair then add and look up the
+// read names in parallel (fastq_map)
+hashtable fastq_index_mt_new(ulong n_reads);
+// index of the fingerprints (64 bit hashes) of the read names and the
+// offsets of the entries: two reads with the same fingerprint are
+// compared by reading the first one again from the file, which must be
+// seekable (fastq_fp_index_ok)
+hashtable fastq_fp_index_new(ulong n_reads);
+int fastq_fp_index_ok(FASTQ_FILE *fd);
+void fastq_index_free(hashtable index);
+// memory used by an index (bytes)
+unsigned long fastq_index_mem(hashtable index);
+// removes a read from either type of index: FALSE if not found. fd: the
+// file indexed (with fingerprints, the name of a read indexed with the
+// same fingerprint is read again from fd to confirm the match)
+int fastq_index_remove_read(hashtable index,FASTQ_FILE *fd,FASTQ_SPAN rname);
+// removes from the index the reads of fd2 (read up to the end of the
+// file), which are validated as entries of vfd, the file indexed (the
+// statistics of the reads are added to vfd, not to fd2). Exits with an
+// error at the first read of fd2 not found in the index (unpaired).
+// Returns the number of reads left in the index: a sharded index is then
+// only good for fastq_index_free (the entries found are marked, not
+// removed)
+unsigned long long fastq_index_pair(FASTQ_FILE* fd2,hashtable index,FASTQ_FILE* vfd);
 void fastq_write_entry(FASTQ_FILE* fd,FASTQ_ENTRY *e);
 void fastq_write_entry2stdout(FASTQ_ENTRY *e);
+void fastq_write(FASTQ_FILE* fd,const char *s,unsigned long len);
+void fastq_puts(FASTQ_FILE* fd,const char *s);
+int fastq_parse_common_options(int argc,char **argv);
+// Removes the option name (a long option, e.g. "--threads") from argv
+// and calls set for each occurrence with its value (--name value or
+// --name=value) or, if has_value is FALSE, with NULL. The arguments
+// after "--" are left as they are. Returns the new number of arguments
+typedef void (*FASTQ_OPTION_FN)(const char *val,void *data);
+int fastq_parse_option(int argc,char **argv,const char *name,int has_value,FASTQ_OPTION_FN set,void *data);
 void fastq_seek_copy_read(long offset,FASTQ_FILE* from,FASTQ_FILE *to);
 char* fastq_qualRange2enc(unsigned int min_qual,unsigned int max_qual);
 void fastq_rewind(FASTQ_FILE* fd);
@@ -156,3 +404,4 @@ void fastq_rewind(FASTQ_FILE* fd);
 void fastq_quick_copy_entry(long offset,FASTQ_FILE* from,FASTQ_FILE* to);
 gzFile fastq_open(const char* filename,const char *mode);
 void GZ_WRITE(gzFile fd,char *s);
+void GZ_WRITE_N(gzFile fd,const char *s,unsigned long len);
@@ -29,6 +29,29 @@
 
 #include "fastq.h"
 
+// number of uncalled bases in seq
+// (no early exit so that the loop can be vectorized)
+static inline unsigned long count_n(const char *seq,unsigned long len) {
+  unsigned long k,num_n=0;
+  for (k=0; k<len; ++k)
+    num_n+=(seq[k]=='N' || seq[k]=='n');
+  return(num_n);
+}
+
+// keep the reads with at most max_n% of Ns
+static int filter_n(FASTQ_FILE* fd,FASTQ_ENTRY** e,void *data) {
+  unsigned max_n=*(unsigned*)data;
+  // the read length includes the newline
+  unsigned long max_num_n=e[0]->read_len*max_n/100;
+  if ( count_n(e[0]->seq,e[0]->read_len-1) <= max_num_n )
+    return(FASTQ_MAP_KEEP);
+  return(FASTQ_MAP_DISCARD);
+}
+
+static int filter_n_done(FASTQ_FILE* fd,FASTQ_ENTRY** e,int status,void *data) {
+  fastq_progress(fd,fd->cline/4);
+  return(status);
+}
 
 int main(int argc, char **argv ) {
 
@@ -37,6 +60,7 @@ int main(int argc, char **argv ) {
   opterr = 0;
 
   fastq_print_version();
+  argc=fastq_parse_common_options(argc,argv);
   // add an option -n N
   //if (optopt == 'c')
   char *cvalue = NULL;
@@ -57,7 +81,7 @@ int main(int argc, char **argv ) {
       }
   
   if (argc-nopt<2 || argc-nopt>3) { 
-    PRINT_ERROR("Usage: fastq_filter_n [ -n 0 ] fastq1");
+    PRINT_ERROR("Usage: fastq_filter_n [ -n 0 ] [--threads N] fastq1");
     exit(PARAMS_ERROR_EXIT_STATUS);
   }
 
@@ -68,28 +92,9 @@ int main(int argc, char **argv ) {
   }
   FASTQ_FILE *fd1=fastq_new(argv[nopt+1],FALSE,"r");
 
-  unsigned num_n,max_num_n;
-  FASTQ_ENTRY *m1=fastq_new_entry();
-
-  while(!gzeof(fd1->fd)) {
-    num_n=0;
-    if (fastq_read_entry(fd1,m1)==0) break;
-    
-    int k;
-    max_num_n=m1->read_len*max_n/100;
-    for ( k=0;k<MAX_READ_LENGTH;k++) {
-      if (m1->seq[k]=='\n' || m1->seq[k]=='\0') break;
-      if (m1->seq[k]=='N' || m1->seq[k]=='n'  ) {
-	++num_n;
-	if ( num_n > max_num_n ) break;
-      }
-    }
-    // 
-    if ( num_n <= max_num_n  ) {
-      fastq_write_entry2stdout(m1);
-    }
-    PRINT_READS_PROCESSED(fd1->cline,100000);
-  }
+  // reads are written to stdout
+  fastq_map(fd1,1,FASTQ_MAP_ALL,filter_n,filter_n_done,NULL,&max_n);
+  progress_done();
   fastq_destroy(fd1);
   exit(0);
 }
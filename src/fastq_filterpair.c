@@ -30,22 +30,143 @@
 #include <regex.h> 
 #include <zlib.h> 
 
-#define HASHSIZE 100000001
 
 #include "fastq.h"
+#include "spill.h"
 
+// --max-mem: the readnames of fd1 (spill1) and fd2 are paired one
+// partition at a time (spill_match) and the reads are then written as
+// when the index is kept in memory
+static void filter_spill(FASTQ_FILE* fd1,FASTQ_FILE* fd2,SPILL* spill1,short sorted,FASTQ_FILE* fdw1,FASTQ_FILE* fdw2,FASTQ_FILE* fdw3,unsigned long *paired,unsigned long *up2) {
+  SPILL *spill2=spill_new(spill1->nparts);
+  SPILL *res1=spill_new(spill1->nparts);
+  SPILL *res2=spill_new(spill1->nparts);
+  FASTQ_ENTRY *m=fastq_new_entry();
+  unsigned long long up1;
+  SPILL_RECORD r;
+  unsigned int p;
+
+  if ( sorted ) {
+    fprintf(stderr,"Scanning and indexing all reads from %s\n",fd2->filename);
+    spill_readnames(fd2,spill2,fd2,SPILL_STATS|SPILL_GZ_INDEX|SPILL_DUPLICATES,NULL);
+    fprintf(stderr,"Scanning complete.\n");
+    fprintf(stderr,"Reads indexed: %llu\n",spill2->n);
+    fprintf(stderr,"Memory used in indexing: %ld MB\n",index_mem/1024/1024);
+  } else {
+    fprintf(stderr,"Processing %s\n",fd2->filename);fflush(stderr);
+    spill_readnames(fd2,spill2,NULL,0,NULL);
+  }
+  // res1: unpaired reads of fd1, res2: read of fd1 paired with each read of fd2
+  up1=spill_match(spill1,spill2,res1,res2,&r);
+  spill_free(spill2);
+  fastq_rewind(fd1);
+  fastq_rewind(fd2);
+  if ( sorted ) {
+    fprintf(stderr,"Filtering %s...\n",fd1->filename);
+    while(!fastq_eof(fd1)) {
+      if (fastq_read_next_entry(fd1,m)==0) break;
+      p=spill_part(res1,fastq_readname_span(fd1,m,TRUE));
+      if ( spill_peek(res1,p,&r) && r.offset==m->offset ) {
+	// singleton
+	spill_read(res1,p,&r);
+	++*up2;
+	fastq_write_entry(fdw3,m);
+      } else {
+	++*paired;
+	fastq_write_entry(fdw1,m);
+      }
+      fastq_progress(fd1,fd1->cline/4);
+    }
+    progress_done();
+    fprintf(stderr,"Filtering %s...\n",fd2->filename);
+  }
+  while(!fastq_eof(fd2)) {
+    if (fastq_read_next_entry(fd2,m)==0) break;
+    spill_read(res2,spill_part(res2,fastq_readname_span(fd2,m,TRUE)),&r);
+    if ( r.offset<0 ) {
+      // singleton
+      ++*up2;
+      fastq_write_entry(fdw3,m);
+    } else {
+      fastq_write_entry(fdw2,m);
+      if ( !sorted ) {
+	++*paired;
+	fastq_quick_copy_entry(r.offset,fd1,fdw1);
+      }
+    }
+    fastq_progress(fd2,fd2->cline/4);
+  }
+  progress_done();
+  if ( !sorted ) {
+    unsigned long long remaining=up1;
+    fprintf(stderr,"Recording %llu unpaired reads from %s\n",up1,fd1->filename);fflush(stderr);
+    fastq_rewind(fd1);
+    while(!fastq_eof(fd1) && remaining ) {
+      if (fastq_read_next_entry(fd1,m)==0) break;
+      p=spill_part(res1,fastq_readname_span(fd1,m,TRUE));
+      if ( spill_peek(res1,p,&r) && r.offset==m->offset ) {
+	spill_read(res1,p,&r);
+	fastq_write_entry(fdw3,m);
+	remaining--;
+      }
+      fastq_progress(fd1,fd1->cline/4);
+    }
+    progress_done();
+    fprintf(stderr,"Unpaired from %s: %llu\n",fd1->filename,up1);
+    fprintf(stderr,"Unpaired from %s: %ld\n",fd2->filename,*up2);
+  }
+  spill_free(res1);
+  spill_free(res2);
+}
+
+// outputs of a pass over the reads of a file (fastq_index_scan)
+struct filter_pass {
+  FASTQ_FILE *pairs;   // reads paired
+  FASTQ_FILE *fd1;     // if not NULL, the reads of fd1 paired
+  FASTQ_FILE *pairs1;  // are copied to pairs1
+  FASTQ_FILE *unpaired;
+  unsigned long *paired; // reads paired (if not NULL)
+  unsigned long *up2;    // reads unpaired
+  unsigned long long remaining; // unpaired reads of fd1 to record
+};
+
+// a read looked up (and removed) in the index of the other file
+static int filter_read(FASTQ_FILE* fd,FASTQ_ENTRY *e,FASTQ_SPAN rn,INDEX_ENTRY *ie,void *data) {
+  struct filter_pass *f=(struct filter_pass*)data;
+  if (ie==NULL) {
+    // singleton
+    ++*f->up2;
+    fastq_write_entry(f->unpaired,e);
+  } else {
+    // pair found
+    if ( f->paired!=NULL ) ++*f->paired;
+    fastq_write_entry(f->pairs,e);
+    // assumes that the order is similar to minimize seeks
+    if ( f->fd1!=NULL ) fastq_quick_copy_entry(ie->entry_start,f->fd1,f->pairs1);
+    free_indexentry(ie);
+  }
+  return TRUE;
+}
+
+// a read of fd1 looked up in the index of the reads not paired
+static int filter_unpaired(FASTQ_FILE* fd,FASTQ_ENTRY *e,FASTQ_SPAN rn,INDEX_ENTRY *ie,void *data) {
+  struct filter_pass *f=(struct filter_pass*)data;
+  if (ie!=NULL) {
+    fastq_write_entry(f->unpaired,e);
+    f->remaining--;
+  }
+  return f->remaining>0;
+}
 
 int main(int argc, char **argv) {
   unsigned long paired=0;
-  FASTQ_ENTRY *m1=fastq_new_entry(),
-    *m2=fastq_new_entry();
-
-  char rname[MAX_LABEL_LENGTH];
 
   fastq_print_version();
+  argc=fastq_parse_common_options(argc,argv);
+  argc=spill_parse_options(argc,argv);
   
   if (argc!=6 && argc!=7 ) {
-    fprintf(stderr,"Usage: filterpair fastq1 fastq2 paired1 paired2 unpaired [sorted]\n");
+    fprintf(stderr,"Usage: filterpair [--threads N] [--max-mem N] fastq1 fastq2 paired1 paired2 unpaired [sorted]\n");
     //fprintf(stderr,"%d",argc);
     exit(PARAMS_ERROR_EXIT_STATUS);
   }
@@ -61,20 +182,30 @@ int main(int argc, char **argv) {
       sorted=TRUE;
   
   
-  fprintf(stderr,"HASHSIZE=%u\n",HASHSIZE);
   if ( sorted ) {
     fprintf(stderr,"Assuming sorted fastq files\n");
   }
   //memset(&collisions[0],0,HASHSIZE+1);
-  hashtable index=new_hashtable(HASHSIZE);
-  index_mem+=sizeof(hashtable);
+  hashtable index=NULL;
+  SPILL *spill1=NULL;
+  unsigned int nparts;
+  if ( spill_max_mem>0 && (nparts=spill_nparts(fd1))>1 ) {
+    // the readnames do not fit in --max-mem
+    fprintf(stderr,"Readnames partitioned in %u temporary files (--max-mem)\n",nparts);
+    spill1=spill_new(nparts);
+  } else {
+    index=(fastq_threads>1?fastq_index_mt_new(0):fastq_index_new(0));
+  }
 
   fprintf(stderr,"Scanning and indexing all reads from %s\n",fd1->filename);
-  fastq_index_readnames(fd1,index,0,FALSE);
+  if ( spill1!=NULL )
+    spill_readnames(fd1,spill1,fd1,SPILL_STATS|SPILL_GZ_INDEX|SPILL_DUPLICATES,NULL);
+  else
+    fastq_index_readnames(fd1,index,0,FALSE);
   fprintf(stderr,"Scanning complete.\n");
 
   // print some info
-  fprintf(stderr,"Reads indexed: %llu\n",index->n_entries);
+  fprintf(stderr,"Reads indexed: %llu\n",(spill1!=NULL?spill1->n:index->n_entries));
   fprintf(stderr,"Memory used in indexing: %ld MB\n",index_mem/1024/1024);
   // 
   char *p1=argv[3];
@@ -90,11 +221,14 @@ int main(int argc, char **argv) {
     exit(PARAMS_ERROR_EXIT_STATUS);
   }
   
-  // assumes that the fastq files are sorted
-  if ( sorted == TRUE ) {
+  if ( spill1!=NULL ) {
+    filter_spill(fd1,fd2,spill1,sorted,fdw1,fdw2,fdw3,&paired,&up2);
+    spill_free(spill1);
+  } else if ( sorted == TRUE ) {
+    // assumes that the fastq files are sorted
     // index file2
-    hashtable index2=new_hashtable(HASHSIZE);
-    index_mem+=sizeof(hashtable);
+    // about as many reads as in the first file
+    hashtable index2=(fastq_threads>1?fastq_index_mt_new(index->n_entries):fastq_index_new(index->n_entries));
 
     fprintf(stderr,"Scanning and indexing all reads from %s\n",fd2->filename);
     fastq_index_readnames(fd2,index2,0,FALSE);
@@ -108,75 +242,24 @@ int main(int argc, char **argv) {
     fastq_rewind(fd1);
     fastq_rewind(fd2);
     // fd1
-    unsigned long len=0;
-    char *readname=NULL;
+    struct filter_pass f1={fdw1,NULL,NULL,fdw3,&paired,&up2,0};
     fprintf(stderr,"Filtering %s...\n",fd1->filename);
-    while(!gzeof(fd1->fd)) {
-      if (fastq_read_next_entry(fd1,m2)==0) break;
-      readname=fastq_get_readname(fd1,m2,&rname[0],&len,TRUE);
-      // lookup hdr in index
-      INDEX_ENTRY* e=fastq_index_lookup_header(index2,readname);
-      if (e==NULL) {
-	// singleton
-	++up2;
-	fastq_write_entry(fdw3,m2);
-      } else {
-	// pair found
-	++paired;
-	fastq_write_entry(fdw1,m2);
-	// remove entry from index
-	fastq_index_delete(readname,index2);
-      }
-      PRINT_READS_PROCESSED(fd1->cline/4,10000);
-    }
+    // lookup the readnames in index2 (and remove the entries)
+    fastq_index_scan(fd1,index2,TRUE,TRUE,filter_read,&f1);
     // go through file2
+    struct filter_pass f2={fdw2,NULL,NULL,fdw3,NULL,&up2,0};
     fprintf(stderr,"Filtering %s...\n",fd2->filename);
-    while(!gzeof(fd2->fd)) {
-      if (fastq_read_next_entry(fd2,m2)==0) break;
-      readname=fastq_get_readname(fd2,m2,&rname[0],&len,TRUE);
-      // lookup hdr in index
-      INDEX_ENTRY* e=fastq_index_lookup_header(index,readname);
-      if (e==NULL) {
-	// singleton
-	++up2;
-	fastq_write_entry(fdw3,m2);
-      } else {
-	// pair found
-	fastq_write_entry(fdw2,m2);
-	// remove entry from index
-	fastq_index_delete(readname,index);
-      }
-      PRINT_READS_PROCESSED(fd2->cline/4,10000);
-    }
+    fastq_index_scan(fd2,index,TRUE,TRUE,filter_read,&f2);
+    fastq_index_free(index2);
   } else {
     // go back to the beginning
     fastq_rewind(fd1);
     fprintf(stderr,"Processing %s\n",fd2->filename);fflush(stderr);
     // TODO: this can be considerably improved
     // requirement: the reads in the output files are sorted
-    while(!gzeof(fd2->fd)) {
-      if (fastq_read_next_entry(fd2,m2)==0) break;
-      unsigned long len;
-      char *readname=fastq_get_readname(fd2,m2,&rname[0],&len,TRUE);
-      // lookup hdr in index
-      INDEX_ENTRY* e=fastq_index_lookup_header(index,readname);
-      if (e==NULL) {
-	// singleton
-	++up2;
-	fastq_write_entry(fdw3,m2);
-      } else {
-	// pair found
-	++paired;
-	fastq_write_entry(fdw2,m2);
-	// assumes that the order is similar to minimize seeks
-	fastq_quick_copy_entry(e->entry_start,fd1,fdw1);
-	// remove entry from index
-	fastq_index_delete(readname,index);
-      }
-      //fprintf(stderr,"%d\n",fd2->cline);
-      PRINT_READS_PROCESSED(fd2->cline/4,10000);
-    }
-    fprintf(stderr,"\n");
+    struct filter_pass f2={fdw2,fd1,fdw1,fdw3,&paired,&up2,0};
+    // lookup the readnames in index (and remove the entries)
+    fastq_index_scan(fd2,index,TRUE,TRUE,filter_read,&f2);
     fprintf(stderr,"Recording %llu unpaired reads from %s\n",index->n_entries,argv[1]);fflush(stderr);
     
     
@@ -186,34 +269,27 @@ int main(int argc, char **argv) {
     INDEX_ENTRY* e;
     while((e=(INDEX_ENTRY*)next_hash_object(index))!=NULL) {
       fastq_seek_copy_read(e->entry_start,fd1,fdw3);
-      PRINT_READS_PROCESSED(cline,100000);
+      fastq_progress(fd1,cline);
       ++cline;
     }
+    progress_done();
     //
 #else
-    unsigned long remaining=index->n_entries;
-    //FASTQ_ENTRY *m1=fastq_new_entry();
-    //char rname[MAX_LABEL_LENGTH];
+    struct filter_pass f1={NULL,NULL,NULL,fdw3,NULL,NULL,index->n_entries};
     
-    while(!gzeof(fd1->fd) && remaining ) {
-      if (fastq_read_next_entry(fd1,m1)==0) break;
-      unsigned long len;
-      char *readname=fastq_get_readname(fd1,m1,&rname[0],&len,TRUE);
-      // lookup hdr in index
-      INDEX_ENTRY* e=fastq_index_lookup_header(index,readname);
-      if (e!=NULL) {
-	//fastq_index_delete(readname,index);
-	fastq_write_entry(fdw3,m1);
-	remaining--;
-      }
-      PRINT_READS_PROCESSED(fd1->cline/4,100000);
-    }
+    // the reads paired were copied with seeks
+    fastq_rewind(fd1);
+    if ( f1.remaining )
+      fastq_index_scan(fd1,index,FALSE,TRUE,filter_unpaired,&f1);
+    else
+      progress_done();
     fprintf(stderr,"Unpaired from %s: %llu\n",argv[1],index->n_entries);
     fprintf(stderr,"Unpaired from %s: %ld\n",argv[2],up2);
 #endif
   }
   fprintf(stderr,"\n");
   fprintf(stderr,"Paired: %ld\n",paired);
+  if ( index!=NULL ) fastq_index_free(index);
   // close
   fastq_destroy(fdw1);
   fastq_destroy(fdw2);
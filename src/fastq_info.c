@@ -33,25 +33,30 @@
 
 #include "hash.h"
 #include "fastq.h"
+#include "spill.h"
 
 
 // approx. median read length
-static inline unsigned int median_rl(FASTQ_FILE* fd1,FASTQ_FILE* fd2) {
+static inline unsigned long median_rl(FASTQ_FILE* fd1,FASTQ_FILE* fd2) {
   unsigned long long ctr=0;
-  unsigned int crl=1;
+  unsigned long crl=1;
   unsigned long nreads=fd1->num_rds;
+  unsigned long max_len=fd1->max_rl;
   
   if ( fd1->num_rds==1 && fd2==NULL) return(fd1->min_rl);
-  if ( fd2!=NULL) nreads+=fd2->num_rds;
-  while ( crl < MAX_READ_LENGTH ) {    
-    ctr+=fd1->rdlen_ctr[crl];
-    if (fd2!=NULL) ctr+=fd2->rdlen_ctr[crl];
+  if ( fd2!=NULL) {
+    nreads+=fd2->num_rds;
+    max_len=max(max_len,fd2->max_rl);
+  }
+  while ( crl <= max_len ) {    
+    ctr+=fastq_rdlen_count(fd1,crl);
+    if (fd2!=NULL) ctr+=fastq_rdlen_count(fd2,crl);
     //printf("%d-%lu\n",crl,rdlen_ctr[crl]);
-    if ( fd1->num_rds>1 && ctr>nreads/2) break;
+    if ( fd1->num_rds>1 && ctr>nreads/2) return(crl);
     ++crl;
   }
-
-  return(crl);
+  // not found
+  return(max(crl,MAX_READ_LENGTH));
 }
 
 FASTQ_FILE* validate_interleaved(char *f) {
@@ -64,12 +69,9 @@ FASTQ_FILE* validate_interleaved(char *f) {
   FASTQ_ENTRY *m1=fastq_new_entry(),
     *m2=fastq_new_entry();
 
-  char rname1[MAX_LABEL_LENGTH];
-  char rname2[MAX_LABEL_LENGTH];
   unsigned long nreads1=0;
-  unsigned long len=0;    
 
-  while(!gzeof(fd1->fd)) {
+  while(!fastq_eof(fd1)) {
     // read 1
     if (fastq_read_entry(fd1,m1)==0) break;
     // read 2
@@ -78,15 +80,15 @@ FASTQ_FILE* validate_interleaved(char *f) {
       exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
     }
     // match
-    char *readname1=fastq_get_readname(fd1,m1,&rname1[0],&len,TRUE);
-    char *readname2=fastq_get_readname(fd1,m2,&rname2[0],&len,TRUE);
+    FASTQ_SPAN readname1=fastq_readname_span(fd1,m1,TRUE);
+    FASTQ_SPAN readname2=fastq_readname_span(fd1,m2,TRUE);
 
     // TODO
     // replace_dots(start_pos,seq1,hdr1,hdr1_2,qual1,fdf);    
     // replace_dots(start_pos,seq2,hdr2,hdr2_2,qual2,fdf);    
 
-    if ( strcmp(readname1,readname2) ) {
-      PRINT_ERROR("Error in file %s: line %lu: unpaired read - %s",f,fd1->cline,readname1);
+    if ( !fastq_span_eq(readname1,readname2) ) {
+      PRINT_ERROR("Error in file %s: line %lu: unpaired read - %.*s",f,fd1->cline,(int)readname1.len,readname1.s);
       exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
     } 
 
@@ -96,9 +98,10 @@ FASTQ_FILE* validate_interleaved(char *f) {
     if (fastq_validate_entry(fd1,m2)) {
       exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
     }
-    PRINT_READS_PROCESSED(fd1->cline/4,100000);
+    fastq_progress(fd1,fd1->cline/4);
     nreads1+=2;
   }
+  progress_done();
   printf("\n");
   //close_fastq(fdf); ???
   //fastq_destroy(fd1);
@@ -113,12 +116,8 @@ FASTQ_FILE* validate_paired_sorted_fastq_file(char *f1,char *f2) {
   fastq_is_pe(fd2);
   FASTQ_ENTRY *m1=fastq_new_entry();
   FASTQ_ENTRY *m2=fastq_new_entry();
-  char rname1[MAX_LABEL_LENGTH];
-  char rname2[MAX_LABEL_LENGTH];
-    
   unsigned long nreads1=0;
-  unsigned long len1,len2;
-  while(!gzeof(fd1->fd)) {
+  while(!fastq_eof(fd1)) {
     // read 1
     if (fastq_read_entry(fd1,m1)==0) break;
 
@@ -130,15 +129,14 @@ FASTQ_FILE* validate_paired_sorted_fastq_file(char *f1,char *f2) {
     if (fastq_validate_entry(fd2,m2)) {
       exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
     }
-    fastq_get_readname(fd1,m1,&rname1[0],&len1,TRUE);
-    fastq_get_readname(fd2,m2,&rname2[0],&len2,TRUE);
-    if (strcmp(rname1,rname2) ) {
+    if (!fastq_span_eq(fastq_readname_span(fd1,m1,TRUE),fastq_readname_span(fd2,m2,TRUE)) ) {
       PRINT_ERROR("Readnames do not match across files (read #%ld)",fd1->cline/4+1);
       exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
     }
-    PRINT_READS_PROCESSED(fd1->cline/2,100000);
+    fastq_progress(fd1,fd1->cline/2);
     nreads1+=1;
   }
+  progress_done();
   if ( fastq_read_entry(fd1,m1)!=0) {
       PRINT_ERROR("Premature end of file2");
       exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
@@ -160,16 +158,17 @@ FASTQ_FILE* validate_single_fastq_file(char *f) {
 
   unsigned long nreads1=0;
 
-  while(!gzeof(fd1->fd)) {
+  while(!fastq_eof(fd1)) {
     // read 1
     if (fastq_read_entry(fd1,m1)==0) break;
 
     if (fastq_validate_entry(fd1,m1)) {
       exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
     }
-    PRINT_READS_PROCESSED(fd1->cline/4,100000);
+    fastq_progress(fd1,fd1->cline/4);
     nreads1+=1;
   }
+  progress_done();
   printf("\n");
   //fastq_destroy(fd1);
   return(fd1);
@@ -177,13 +176,16 @@ FASTQ_FILE* validate_single_fastq_file(char *f) {
 
 void print_usage(int verbose_usage) {
 
-  printf("Usage: fastq_info [-r -e -s -q -h] fastq1 [fastq2 file|pe]\n");
+  printf("Usage: fastq_info [-r -m -e -s -q -h --threads N --max-mem N] fastq1 [fastq2 file|pe]\n");
   if ( verbose_usage ) {
     printf(" -h  : print this help message\n");
     printf(" -s  : the reads in the two fastq files have the same ordering\n");
     printf(" -e  : do not fail with empty files\n");
     printf(" -q  : do not fail if quality encoding cannot be determined\n");
     printf(" -r  : skip check for duplicated readnames\n");
+    printf(" -m  : keep only fingerprints of the readnames in memory (fastq1 is read again to confirm duplicates)\n");
+    printf(" --threads N : number of threads used to decompress BGZF files and to index/check the readnames\n");
+    printf(" --max-mem N : maximum memory (e.g., 512M, 4G) used to check the readnames (the readnames are partitioned in temporary files in $TMPDIR)\n");
   }
 }
 
@@ -203,6 +205,7 @@ int main(int argc, char **argv ) {
   int empty_ok=FALSE;
   int no_encoding_ok=FALSE;
   int skip_readname_check=FALSE;
+  int fingerprints=FALSE;
   //int fix_dot=FALSE;
   
   int nopt=0;
@@ -210,10 +213,16 @@ int main(int argc, char **argv ) {
   opterr = 0;
 
   fastq_print_version();
+  argc=fastq_parse_common_options(argc,argv);
+  argc=spill_parse_options(argc,argv);
   
-  while ((c = getopt (argc, argv, "esfrhq")) != -1)
+  while ((c = getopt (argc, argv, "esfrhqm")) != -1)
     switch (c)
       {
+      case 'm':
+	fingerprints=TRUE;
+	++nopt;
+	break;
       case 'q':
 	no_encoding_ok=TRUE;
 	++nopt;
@@ -269,6 +278,8 @@ int main(int argc, char **argv ) {
   FASTQ_FILE* fd1=NULL;
   FASTQ_FILE* fd2=NULL;
   hashtable index=NULL;
+  SPILL *spill1=NULL;
+  unsigned int nparts;
   // ************************************************************
   if ( is_interleaved ) {
     // interleaved    
@@ -288,16 +299,35 @@ int main(int argc, char **argv ) {
     // single or pair of fastq file(s)
     fd1=fastq_new(argv[1+nopt],FALSE,"r");
     if ( is_paired_data) fastq_is_pe(fd1);   
-    fprintf(stderr,"DEFAULT_HASHSIZE=%lu\n",(long unsigned int)DEFAULT_HASHSIZE);
-    index=new_hashtable(DEFAULT_HASHSIZE);
-    index_mem+=sizeof(hashtable);
-    fprintf(stderr,"Scanning and indexing all reads from %s\n",fd1->filename);
-    fastq_index_readnames(fd1,index,0,FALSE);
-    fprintf(stderr,"Scanning complete.\n");    
-    num_reads1=index->n_entries;
+    if ( spill_max_mem>0 && (nparts=spill_nparts(fd1))>1 ) {
+      // the readnames do not fit in --max-mem
+      fprintf(stderr,"Readnames partitioned in %u temporary files (--max-mem)\n",nparts);
+      if ( fingerprints ) {
+	fprintf(stderr,"%s is partitioned: keeping the readnames of each partition in memory (-m ignored)\n",fd1->filename);
+	fingerprints=FALSE;
+      }
+      spill1=spill_new(nparts);
+      fprintf(stderr,"Scanning and indexing all reads from %s\n",fd1->filename);
+      spill_readnames(fd1,spill1,fd1,SPILL_STATS|SPILL_GZ_INDEX|SPILL_DUPLICATES,NULL);
+      fprintf(stderr,"Scanning complete.\n");
+      num_reads1=spill1->n;
+    } else {
+      if ( fingerprints && !fastq_fp_index_ok(fd1) ) {
+	fprintf(stderr,"%s cannot be read again: keeping the readnames in memory (-m ignored)\n",fd1->filename);
+	fingerprints=FALSE;
+      }
+      if ( fingerprints )
+	index=fastq_fp_index_new(0);
+      else
+	index=(fastq_threads>1?fastq_index_mt_new(0):fastq_index_new(0));
+      fprintf(stderr,"Scanning and indexing all reads from %s\n",fd1->filename);
+      fastq_index_readnames(fd1,index,0,FALSE);
+      fprintf(stderr,"Scanning complete.\n");    
+      num_reads1=index->n_entries;
+    }
     fprintf(stderr,"\n");
     // print some info
-    fprintf(stderr,"Reads processed: %llu\n",index->n_entries);    
+    fprintf(stderr,"Reads processed: %lu\n",num_reads1);    
     fprintf(stderr,"Memory used in indexing: ~%ld MB\n",index_mem/1024/1024);
   }
   
@@ -326,32 +356,23 @@ int main(int argc, char **argv ) {
     fd2=fastq_new(argv[2+nopt],FALSE,"r");
     fastq_is_pe(fd2);
     
-    unsigned long len;
-    FASTQ_ENTRY *m2=fastq_new_entry();
-    char rname[MAX_LABEL_LENGTH];
-    // 
-    while(!gzeof(fd2->fd)) {
-      // read entry
-      if (fastq_read_entry(fd2,m2)==0) break;
-      char *readname=fastq_get_readname(fd2,m2,&rname[0],&len,TRUE);
-      INDEX_ENTRY* e=fastq_index_lookup_header(index,readname);
-      if (e==NULL) {
-	// complain and exit if not found
-	PRINT_ERROR("Error in file %s: line %lu: unpaired read - %s",argv[2+nopt],fd2->cline,readname);
-	exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
-      }
-      fastq_index_delete(readname,index);
-      //
-      if (fastq_validate_entry(fd1,m2)) {
-	exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
-      }
-      //replace_dots(start_pos,seq,hdr,hdr2,qual,fdf);
-      PRINT_READS_PROCESSED(fd2->cline/4,100000);
+    unsigned long long unpaired;
+    if ( spill1!=NULL ) {
+      SPILL *spill2=spill_new(spill1->nparts);
+      spill_readnames(fd2,spill2,fd1,0,spill1);
+      unpaired=spill2->unmatched;
+      spill_free(spill2);
+      spill_free(spill1);
+    } else {
+      // the reads of fd2 are validated as reads of fd1 (stats)
+      unpaired=fastq_index_pair(fd2,index,fd1);
+      fastq_index_free(index);
+      index=NULL;
     }
     printf("\n");
     //fastq_destroy(fdf);//???
-    if (index->n_entries>0 ) {
-      PRINT_ERROR("Error in file %s: found %llu unpaired reads",argv[1+nopt],index->n_entries);
+    if (unpaired>0 ) {
+      PRINT_ERROR("Error in file %s: found %llu unpaired reads",argv[1+nopt],unpaired);
       exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
     }
     // stats
@@ -390,7 +411,7 @@ int main(int argc, char **argv ) {
   } else {
     fprintf(out,"Quality encoding: %s\n",enc);
   }
-  fprintf(out,"Read length: %lu %lu %u\n",min_rl-1,max_rl-1,median_rl(fd1,fd2)-1);
+  fprintf(out,"Read length: %lu %lu %lu\n",min_rl-1,max_rl-1,median_rl(fd1,fd2)-1);
   fprintf(out,"OK\n"); 
   exit(0);
 }
@@ -32,16 +32,17 @@
 
 int main(int argc, char **argv ) {
 
+  argc=fastq_parse_common_options(argc,argv);
   if (argc!=2) {
     fprintf(stderr,"Usage: fastq_not_empty fastq_file\nExit status of 0 if it is not empty, 0 otherwise. The fastq file may be compressed with gzip.");
     exit(1);
   }
 
   FASTQ_FILE *fd1=fastq_new(argv[1],FALSE,"r");
-  FASTQ_ENTRY *m1=fastq_new_entry();
+  FASTQ_RECORD r;
   
-  if(gzeof(fd1->fd)) exit(1);
-  if (fastq_read_next_entry(fd1,m1)==0) exit(1);
+  if(fastq_eof(fd1)) exit(1);
+  if (fastq_read_next_record(fd1,&r)==0) exit(1);
   exit(0);
 }
 
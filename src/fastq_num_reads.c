@@ -32,16 +32,17 @@
 int main(int argc, char **argv ) {
 
   fastq_print_version();
+  argc=fastq_parse_common_options(argc,argv);
   if (argc!=2) {
-    fprintf(stderr,"Usage: fastq_num_reads fastq_file\n");
+    fprintf(stderr,"Usage: fastq_num_reads [--threads N] fastq_file\n");
     exit(PARAMS_ERROR_EXIT_STATUS);
   }
 
   FASTQ_FILE *fd1=fastq_new(argv[1],FALSE,"r");
-  FASTQ_ENTRY *m1=fastq_new_entry();
+  FASTQ_RECORD r;
 
-  while(!gzeof(fd1->fd)) {
-    if (fastq_read_next_entry(fd1,m1)==0) break;
+  while(!fastq_eof(fd1)) {
+    if (fastq_read_next_record(fd1,&r)==0) break;
   }
   printf("%lu\n",fd1->num_rds);
   fastq_destroy(fd1);
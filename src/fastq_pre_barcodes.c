@@ -173,16 +173,23 @@ void slice_read(FASTQ_ENTRY* m,const Params* p,READ_IDX cur_read) {
   }
   //
   FASTQ_READ_OFFSET offset=p->read_offset[cur_read];  
+  FASTQ_READ_OFFSET size=p->read_size[cur_read];
+  if ( size==-1 ) {
+    // until the end of the read (read_len includes the newline)
+    size=(FASTQ_READ_OFFSET)m->read_len-1-offset;
+    if ( size<0 ) size=0;
+  }
+  fastq_entry_reserve(m,max(m->read_len,size+offset)+2,0);
   if ( offset > 0 ) { // copy
     FASTQ_READ_OFFSET len=p->read_size[cur_read];
     FASTQ_READ_OFFSET x;
     if ( len==-1 ) len=m->read_len;
-    for (x=0; x<=len;++x) {
+    for (x=0; x<=len && x+offset<m->seq_size;++x) {
       m->seq[x]=m->seq[x+offset];
       m->qual[x]=m->qual[x+offset];
     }
   }
-  offset=p->read_size[cur_read];
+  offset=size;
   m->seq[offset]='\n';
   m->seq[offset+1]='\0';
   m->qual[offset]='\n';
@@ -201,6 +208,7 @@ void add_tags2readname(FASTQ_ENTRY* m,char*cell,char*umi,char*sample) {
 
   //fprintf(stderr,"->%s\n",m->hdr1);
   while(m->hdr1[s]!='\0') ++s;
+  fastq_entry_reserve(m,0,s+offset+1);
   // create a gap
   while (s>=1) {
     m->hdr1[s+offset]=m->hdr1[s];
@@ -289,7 +297,7 @@ FASTQ_BOOLEAN fastq_files_eof(FASTQ_FILE** fdi,int n) {
   int k=1;
   while(k<=n) {
     if ( fdi[k]!=NULL )
-      if (gzeof(fdi[k]->fd))
+      if (fastq_eof(fdi[k]))
 	return TRUE; // do not ensure that all files 
     ++k;
   }
@@ -340,6 +348,7 @@ void print_usage(void) {
   --read2_offset integer   :\n\
   --read2_size integer     :\n\
   --10x     : use 10X UMI tags (UB and UY) instead of the default tags defined in the SAM specification\n\
+  --threads integer        :number of threads used to compress the output files\n\
 ";
   fprintf(stderr,"usage: fastq_pre_barcodes --read1 fastq_file --outfile1 out_file [optional parameters]\n");
   fprintf(stderr,"%s\n",msg);
@@ -356,6 +365,7 @@ int main(int argc, char **argv ) {
   opterr = 0;
 
   fastq_print_version();
+  argc=fastq_parse_common_options(argc,argv);
   
   static struct option long_options[] = {
     /* These options set a flag. */
@@ -561,7 +571,7 @@ int main(int argc, char **argv ) {
 
   FASTQ_FILE* fdw[INDEX3+1]={NULL,NULL,NULL,NULL,NULL}; // out files
 
-  char rnames[INDEX3+1][MAX_LABEL_LENGTH];
+  FASTQ_SPAN rnames[INDEX3+1];
   
   for (x=READ1;x<=INDEX3;++x) {
     if ( p->file[x] != NULL ) {
@@ -604,31 +614,30 @@ int main(int argc, char **argv ) {
     }
     // check if the read names match
     if (p->num_input_files>1) {
-      unsigned long len;
       for (x=READ1;x<=INDEX3;++x)
 	if ( p->file[x] != NULL )
-	  fastq_get_readname(fdi[x],m[x],&rnames[x][0],&len,TRUE);
+	  rnames[x]=fastq_readname_span(fdi[x],m[x],TRUE);
 
       if ( p->file[READ2] != NULL )
-	if (strcmp(rnames[READ1],rnames[READ2]) ) {
+	if (!fastq_span_eq(rnames[READ1],rnames[READ2]) ) {
 	  PRINT_ERROR("Readnames do not match across files (read #%ld)",processed_reads+1);
 	  exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
 	}
 
       if ( p->file[READ3] != NULL )
-	if (strcmp(rnames[READ1],rnames[READ3]) ) {
+	if (!fastq_span_eq(rnames[READ1],rnames[READ3]) ) {
 	  PRINT_ERROR("Readnames do not match across files (read #%ld)",processed_reads+1);
 	  exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
 	}
 
       if ( p->file[READ4] != NULL )
-	if (strcmp(rnames[READ1],rnames[READ4]) ) {
+	if (!fastq_span_eq(rnames[READ1],rnames[READ4]) ) {
 	  PRINT_ERROR("Readnames do not match across files (read #%ld)",processed_reads+1);
 	  exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
 	}
 
       if ( p->file[READ5] != NULL )
-	if (strcmp(rnames[READ1],rnames[READ5]) ) {
+	if (!fastq_span_eq(rnames[READ1],rnames[READ5]) ) {
 	  PRINT_ERROR("Readnames do not match across files (read #%ld)",processed_reads+1);
 	  exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
 	}     
@@ -717,7 +726,7 @@ int main(int argc, char **argv ) {
 	  fastq_write_entry(fdw[x],m[x]);
 	}
     }
-    PRINT_READS_PROCESSED(fdi[READ1]->cline/4,100000);
+    fastq_progress(fdi[READ1],fdi[READ1]->cline/4);
     // handle interleaved
     if (p->has_interleaved_entries) {
       // jump to next read
@@ -726,6 +735,7 @@ int main(int argc, char **argv ) {
 
   }
  end_loop: 
+  progress_done();
   //   extract the info, change read name, trim the read, write
   PRINT_INFO("Reads processed: %ld",processed_reads);
   PRINT_INFO("Reads discarded: %ld",discarded_reads);
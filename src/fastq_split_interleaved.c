@@ -32,6 +32,46 @@
 
 #include "fastq.h"
 
+// checks a pair of reads (prints the error and exits if they are not valid)
+static void check_pair(FASTQ_FILE* fd1,FASTQ_ENTRY *m1,FASTQ_ENTRY *m2) {
+  // match
+  FASTQ_SPAN readname1=fastq_readname_span(fd1,m1,TRUE);
+  FASTQ_SPAN readname2=fastq_readname_span(fd1,m2,TRUE);
+
+  if ( !fastq_span_eq(readname1,readname2) ) {
+    PRINT_ERROR("Error in file %s: line %lu: unpaired read - %.*s",fd1->filename,fd1->cline,(int)readname1.len,readname1.s);
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  } 
+
+  if (fastq_validate_entry(fd1,m1)) {
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  if (fastq_validate_entry(fd1,m2)) {
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+}
+
+// runs in parallel: the errors are only reported by split_done
+static int split(FASTQ_FILE* fd1,FASTQ_ENTRY** m,void *data) {
+  if ( m[0]->hdr1[0]!='@' || m[1]->hdr1[0]!='@' )
+    return(FASTQ_MAP_ERROR);
+  if ( !fastq_span_eq(fastq_readname_span(fd1,m[0],TRUE),fastq_readname_span(fd1,m[1],TRUE)) ||
+       fastq_check_entry(fd1,m[0]) || fastq_check_entry(fd1,m[1]) )
+    return(FASTQ_MAP_ERROR);
+  return(FASTQ_MAP_KEEP);
+}
+
+static int split_done(FASTQ_FILE* fd1,FASTQ_ENTRY** m,int status,void *data) {
+  if ( status==FASTQ_MAP_TRUNCATED ) {
+    PRINT_ERROR("Error in file %s: line %lu: file truncated?",fd1->filename,fd1->cline);
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  if ( status==FASTQ_MAP_ERROR )
+    check_pair(fd1,m[0],m[1]);
+  fastq_progress(fd1,fd1->cline/4);
+  return(status);
+}
+
 FASTQ_FILE* split_interleaved(char *f,char *out_prefix) {
   //unsigned long cline=1;
 
@@ -44,61 +84,26 @@ FASTQ_FILE* split_interleaved(char *f,char *out_prefix) {
   char outfile2[1024];
   sprintf(&outfile1[0],"%s_1.fastq.gz",out_prefix);
   sprintf(&outfile2[0],"%s_2.fastq.gz",out_prefix);
-  FASTQ_FILE* fdw1=fastq_new(&outfile1[0],FALSE,"w4");
-  FASTQ_FILE* fdw2=fastq_new(&outfile2[0],FALSE,"w4"); 
+  FASTQ_FILE* fdw[2];
+  fdw[0]=fastq_new(&outfile1[0],FALSE,"w4");
+  fdw[1]=fastq_new(&outfile2[0],FALSE,"w4"); 
 
-  
-  FASTQ_ENTRY *m1=fastq_new_entry(),
-    *m2=fastq_new_entry();
-
-  char rname1[MAX_LABEL_LENGTH];
-  char rname2[MAX_LABEL_LENGTH];
-  unsigned long nreads1=0;
-  unsigned long len=0;    
-
-  while(!gzeof(fd1->fd)) {
-    // read 1
-    if (fastq_read_entry(fd1,m1)==0) break;
-    // read 2
-    if (fastq_read_entry(fd1,m2)==0) {
-      PRINT_ERROR("Error in file %s: line %lu: file truncated?",f,fd1->cline);
-      exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
-    }
-    // match
-    char *readname1=fastq_get_readname(fd1,m1,&rname1[0],&len,TRUE);
-    char *readname2=fastq_get_readname(fd1,m2,&rname2[0],&len,TRUE);
-
-
-    if ( strcmp(readname1,readname2) ) {
-      PRINT_ERROR("Error in file %s: line %lu: unpaired read - %s",f,fd1->cline,readname1);
-      exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
-    } 
-
-    if (fastq_validate_entry(fd1,m1)) {
-      exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
-    }
-    if (fastq_validate_entry(fd1,m2)) {
-      exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
-    }
-    PRINT_READS_PROCESSED(fd1->cline/4,100000);
-    nreads1+=2;
-    // write to the out files
-    fastq_write_entry(fdw1,m1);
-    fastq_write_entry(fdw2,m2);
-
-  }
+  // read 1 is written to fdw[0] and read 2 to fdw[1]
+  fastq_map(fd1,2,FASTQ_MAP_ALL,split,split_done,fdw,NULL);
+  progress_done();
   printf("\n");
-  fastq_destroy(fdw1);
-  fastq_destroy(fdw2);  
+  fastq_destroy(fdw[0]);
+  fastq_destroy(fdw[1]);  
   return(fd1);
 }
 
 
 int main(int argc, char **argv ) {
   fastq_print_version();
+  argc=fastq_parse_common_options(argc,argv);
     
   if (argc!=3 ) {
-    PRINT_ERROR("Usage: fastq_split_interleaved interleaved_fastq out_prefix");
+    PRINT_ERROR("Usage: fastq_split_interleaved [--threads N] interleaved_fastq out_prefix");
     exit(PARAMS_ERROR_EXIT_STATUS);
   }
   
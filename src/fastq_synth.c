@@ -0,0 +1,517 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <getopt.h>
+#include <bam.h>
+#include <kstring.h>
+
+#include "fastq.h"
+
+// Synthetic datasets for the benchmarks (make bench)
+// The data only depends on the seed and on the parameters, so the
+// same files are produced in every run.
+
+#define SYNTH_SE  0
+#define SYNTH_PE  1
+#define SYNTH_10X 2
+#define SYNTH_ONT 3
+#define SYNTH_BAM 4
+
+static const char* type_names[]={"se","pe","10x","ont","bam",NULL};
+
+// 10x (v3) read 1: cell barcode + UMI
+#define CELL_LEN 16
+#define UMI_LEN 12
+#define SAMPLE_LEN 8
+#define TX_LEN 2000
+#define MAX_READ_LEN 200000
+
+struct params_s {
+  int type;
+  char *out;
+  unsigned long long seed;
+  unsigned long reads;
+  unsigned long len;
+  unsigned long cells;
+  unsigned long genes;
+};
+typedef struct params_s Params;
+
+// Pseudo-random numbers (splitmix64): fast and the sequence does not
+// depend on the libc
+static unsigned long long rng_state;
+
+static inline unsigned long long splitmix64(unsigned long long *s) {
+  unsigned long long z=(*s+=0x9E3779B97F4A7C15ULL);
+  z=(z^(z>>30))*0xBF58476D1CE4E5B9ULL;
+  z=(z^(z>>27))*0x94D049BB133111EBULL;
+  return z^(z>>31);
+}
+
+static inline unsigned long long rng(void) {
+  return splitmix64(&rng_state);
+}
+
+// uniform in [0,n)
+static inline unsigned long rng_n(unsigned long n) {
+  return (unsigned long)(rng()%n);
+}
+
+// uniform in [0,1)
+static inline double rng_u(void) {
+  return (rng()>>11)*(1.0/9007199254740992.0);
+}
+
+static inline double rng_normal(void) {
+  double u1=rng_u(),u2=rng_u();
+  return sqrt(-2.0*log(u1+1e-300))*cos(2*M_PI*u2);
+}
+
+// index in [0,n) with a skewed (Zipf like, s=1) distribution: a few
+// values (cells) are very frequent and most are rare
+static inline unsigned long rng_zipf(unsigned long n) {
+  unsigned long i=(unsigned long)exp(rng_u()*log((double)n+1))-1;
+  return (i>=n?n-1:i);
+}
+
+static void random_seq(char *s,unsigned long len,unsigned long long *state) {
+  unsigned long i;
+  unsigned long long r=0;
+  for(i=0;i<len;++i) {
+    if ( (i&31)==0 ) r=splitmix64(state);
+    s[i]="ACGT"[r&3];
+    r>>=2;
+  }
+  s[len]='\0';
+}
+
+// Illumina like qualities: decreasing along the read, with a few N
+// (quality 2)
+static void short_read(char *seq,char *qual,unsigned long len) {
+  unsigned long i;
+  random_seq(seq,len,&rng_state);
+  for(i=0;i<len;++i) {
+    int q=(int)(38-8.0*i/len+rng_normal()*3);
+    if ( q>41 ) q=41;
+    if ( q<2 ) q=2;
+    if ( rng_n(1000)==0 ) {
+      seq[i]='N';
+      q=2;
+    }
+    qual[i]=(char)(q+33);
+  }
+  qual[len]='\0';
+}
+
+// nanopore like qualities: low and noisy
+static void long_read(char *seq,char *qual,unsigned long len) {
+  unsigned long i;
+  random_seq(seq,len,&rng_state);
+  for(i=0;i<len;++i) {
+    int q=(int)(12+rng_normal()*4);
+    if ( q>40 ) q=40;
+    if ( q<1 ) q=1;
+    qual[i]=(char)(q+33);
+  }
+  qual[len]='\0';
+}
+
+static void write_entry(FASTQ_FILE *fd,const char *hdr,const char *seq,const char *qual) {
+  fastq_puts(fd,hdr);
+  fastq_puts(fd,"\n");
+  fastq_puts(fd,seq);
+  fastq_puts(fd,"\n+\n");
+  fastq_puts(fd,qual);
+  fastq_puts(fd,"\n");
+}
+
+static FASTQ_FILE* synth_open(const char *prefix,const char *suffix) {
+  char fn[MAX_FILENAME_LENGTH];
+  snprintf(fn,MAX_FILENAME_LENGTH,"%s%s",prefix,suffix);
+  return fastq_new(fn,FALSE,"wb");
+}
+
+// casava 1.8 read name: flowcell lane, tile and coordinates (unique
+// for each i)
+static void illumina_name(char *hdr,unsigned long i) {
+  unsigned long k=i/96;
+  sprintf(hdr,"@SYN01:1:HSYNXXBX:%lu:%lu:%lu:%lu",1+i%4,1101+(i/4)%24,1000+k%30000,1000+k/30000);
+}
+
+/* ******************************************************************************* */
+static void gen_short(Params *p) {
+  char hdr[MAX_LABEL_LENGTH],seq[MAX_READ_LEN+1],qual[MAX_READ_LEN+1],sample[SAMPLE_LEN+1];
+  unsigned long long s=p->seed^0xABCDEFULL;
+  FASTQ_FILE *fd1,*fd2=NULL;
+  unsigned long i,l;
+
+  random_seq(sample,SAMPLE_LEN,&s);
+  if ( p->type==SYNTH_SE ) {
+    fd1=synth_open(p->out,".fastq.gz");
+  } else {
+    fd1=synth_open(p->out,"_1.fastq.gz");
+    fd2=synth_open(p->out,"_2.fastq.gz");
+  }
+  for(i=0;i<p->reads;++i) {
+    illumina_name(hdr,i);
+    l=strlen(hdr);
+    sprintf(&hdr[l]," 1:N:0:%s",sample);
+    short_read(seq,qual,p->len);
+    write_entry(fd1,hdr,seq,qual);
+    if ( fd2==NULL ) continue;
+    hdr[l+1]='2';
+    short_read(seq,qual,p->len);
+    write_entry(fd2,hdr,seq,qual);
+  }
+  fastq_destroy(fd1);
+  if ( fd2!=NULL ) fastq_destroy(fd2);
+}
+
+// read lengths follow a log-normal distribution with mean ~len
+static void gen_ont(Params *p) {
+  char hdr[MAX_LABEL_LENGTH];
+  char *seq=malloc(MAX_READ_LEN+1),*qual=malloc(MAX_READ_LEN+1);
+  FASTQ_FILE *fd=synth_open(p->out,".fastq.gz");
+  unsigned long i;
+  double sigma=0.7,mu=log((double)p->len)-sigma*sigma/2;
+
+  if ( seq==NULL || qual==NULL ) {
+    PRINT_ERROR("Unable to allocate memory");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  for(i=0;i<p->reads;++i) {
+    unsigned long len=(unsigned long)exp(mu+sigma*rng_normal());
+    unsigned long long u1=rng(),u2=rng();
+    if ( len<100 ) len=100;
+    if ( len>MAX_READ_LEN ) len=MAX_READ_LEN;
+    sprintf(hdr,"@%08llx-%04llx-%04llx-%04llx-%012llx runid=%016llx read=%lu ch=%lu start_time=2021-01-01T00:00:00Z",
+	    u1>>32,(u1>>16)&0xffff,u1&0xffff,u2>>48,u2&0xffffffffffffULL,p->seed,i,1+rng_n(512));
+    long_read(seq,qual,len);
+    write_entry(fd,hdr,seq,qual);
+  }
+  fastq_destroy(fd);
+  free(seq);
+  free(qual);
+}
+
+// the cell barcodes (whitelist) and sample indexes do not depend on
+// the number of reads
+static char* new_cells(Params *p) {
+  unsigned long long s=p->seed^0x5EEDCE11ULL;
+  unsigned long i;
+  char *cells=malloc(p->cells*(CELL_LEN+1));
+  if ( cells==NULL ) {
+    PRINT_ERROR("Unable to allocate memory");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  for(i=0;i<p->cells;++i)
+    random_seq(&cells[i*(CELL_LEN+1)],CELL_LEN,&s);
+  return cells;
+}
+
+// the reads of the same molecule have the same UMI: there are
+// reads/2 molecules (~50% duplicates)
+static void molecule_umi(Params *p,char *umi) {
+  unsigned long long s=p->seed^(0x1234567ULL*(1+rng_n(p->reads/2+1)));
+  random_seq(umi,UMI_LEN,&s);
+}
+
+// 10x v3: R1 (cell barcode+UMI), R2 (cDNA) and I1 (sample index)
+static void gen_10x(Params *p) {
+  char hdr[MAX_LABEL_LENGTH],seq[MAX_READ_LEN+1],qual[MAX_READ_LEN+1];
+  char r1[CELL_LEN+UMI_LEN+1],sample[4][SAMPLE_LEN+1];
+  unsigned long long s=p->seed^0xABCDEFULL;
+  char *cells=new_cells(p);
+  FASTQ_FILE *fd1=synth_open(p->out,"_R1.fastq.gz");
+  FASTQ_FILE *fd2=synth_open(p->out,"_R2.fastq.gz");
+  FASTQ_FILE *fd3=synth_open(p->out,"_I1.fastq.gz");
+  unsigned long i,l;
+  int k;
+
+  // 10x sample indexes are sets of 4 oligos
+  for(k=0;k<4;++k)
+    random_seq(sample[k],SAMPLE_LEN,&s);
+  for(i=0;i<p->reads;++i) {
+    unsigned long c=rng_zipf(p->cells);
+    k=(int)rng_n(4);
+    illumina_name(hdr,i);
+    l=strlen(hdr);
+    // R1
+    memcpy(r1,&cells[c*(CELL_LEN+1)],CELL_LEN);
+    // sequencing errors in ~1% of the barcodes
+    if ( rng_n(100)==0 ) r1[rng_n(CELL_LEN)]="ACGT"[rng_n(4)];
+    molecule_umi(p,&r1[CELL_LEN]);
+    short_read(seq,qual,CELL_LEN+UMI_LEN);
+    sprintf(&hdr[l]," 1:N:0:%s",sample[k]);
+    write_entry(fd1,hdr,r1,qual);
+    // R2
+    short_read(seq,qual,p->len);
+    hdr[l+1]='2';
+    write_entry(fd2,hdr,seq,qual);
+    // I1
+    short_read(seq,qual,SAMPLE_LEN);
+    hdr[l+1]='1';
+    write_entry(fd3,hdr,sample[k],qual);
+  }
+  fastq_destroy(fd1);
+  fastq_destroy(fd2);
+  fastq_destroy(fd3);
+  free(cells);
+}
+
+/* ******************************************************************************* */
+// BAM file with the reads aligned to the transcriptome, as produced
+// by aligning the output of fastq_pre_barcodes (the barcodes are in
+// the read names), grouped by cell, and the transcript->gene map
+// (two transcripts per gene).
+static void bam_record(bam1_t *b,int32_t tid,const char *qname,unsigned long len) {
+  char seq[MAX_READ_LEN+1],qual[MAX_READ_LEN+1];
+  int l_qname=strlen(qname)+1;
+  int32_t pos=(int32_t)rng_n(TX_LEN-len);
+  int32_t nh=1;
+  uint8_t *d;
+  unsigned long i;
+
+  short_read(seq,qual,len);
+  b->core.tid=tid;
+  b->core.pos=pos;
+  b->core.bin=bam_reg2bin(pos,pos+len);
+  b->core.qual=255;
+  b->core.l_qname=l_qname;
+  b->core.flag=(rng_n(2)?BAM_FREVERSE:0);
+  b->core.n_cigar=1;
+  b->core.l_qseq=len;
+  b->core.mtid=-1;
+  b->core.mpos=-1;
+  b->core.isize=0;
+  b->l_aux=0;
+  b->data_len=l_qname+4+(len+1)/2+len;
+  if ( b->m_data<b->data_len ) {
+    b->m_data=b->data_len;
+    kroundup32(b->m_data);
+    b->data=(uint8_t*)realloc(b->data,b->m_data);
+    if ( b->data==NULL ) {
+      PRINT_ERROR("Unable to allocate memory");
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+  }
+  d=b->data;
+  memcpy(d,qname,l_qname);
+  d+=l_qname;
+  *(uint32_t*)d=(uint32_t)(len<<BAM_CIGAR_SHIFT|BAM_CMATCH);
+  d+=4;
+  memset(d,0,(len+1)/2);
+  for(i=0;i<len;++i)
+    d[i>>1]|=bam_nt16_table[(int)seq[i]]<<((~i&1)<<2);
+  d+=(len+1)/2;
+  for(i=0;i<len;++i)
+    d[i]=qual[i]-33;
+  bam_aux_append(b,"NH",'i',4,(uint8_t*)&nh);
+}
+
+static bam_header_t* bam_tx_header(Params *p,unsigned long ntx) {
+  bam_header_t *h=bam_header_init();
+  unsigned long i;
+  char buf[100];
+  kstring_t text={0,0,NULL};
+
+  h->n_targets=ntx;
+  h->target_name=(char**)malloc(sizeof(char*)*ntx);
+  h->target_len=(uint32_t*)malloc(sizeof(uint32_t)*ntx);
+  if ( h->target_name==NULL || h->target_len==NULL ) {
+    PRINT_ERROR("Unable to allocate memory");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  kputs("@HD\tVN:1.4\tSO:unsorted\n",&text);
+  for(i=0;i<ntx;++i) {
+    sprintf(buf,"SYNT%08lu",i);
+    h->target_name[i]=strdup(buf);
+    h->target_len[i]=TX_LEN;
+    ksprintf(&text,"@SQ\tSN:%s\tLN:%d\n",buf,TX_LEN);
+  }
+  h->text=text.s;
+  h->l_text=text.l;
+  return h;
+}
+
+static void gen_bam(Params *p) {
+  char fn[MAX_FILENAME_LENGTH],qname[MAX_LABEL_LENGTH],umi[UMI_LEN+1],sample[SAMPLE_LEN+1];
+  unsigned long long s=p->seed^0xABCDEFULL;
+  unsigned long ntx=p->genes*2;
+  unsigned long *ncell_reads=calloc(p->cells,sizeof(unsigned long));
+  char *cells=new_cells(p);
+  unsigned long i,c,n=0;
+  bam_header_t *h;
+  bam1_t *b;
+  bamFile out;
+  FILE *map;
+
+  if ( ncell_reads==NULL ) {
+    PRINT_ERROR("Unable to allocate memory");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  // transcript->gene map
+  snprintf(fn,MAX_FILENAME_LENGTH,"%s_tx2gene.tsv",p->out);
+  if ( (map=fopen(fn,"w"))==NULL ) {
+    PRINT_ERROR("Unable to create %s",fn);
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  fprintf(map,"gene_id\ttranscript_id\n");
+  for(i=0;i<ntx;++i)
+    fprintf(map,"SYNG%08lu\tSYNT%08lu\n",i/2,i);
+  fclose(map);
+  // number of reads per cell
+  for(i=0;i<p->reads;++i)
+    ncell_reads[rng_zipf(p->cells)]++;
+  random_seq(sample,SAMPLE_LEN,&s);
+  snprintf(fn,MAX_FILENAME_LENGTH,"%s.bam",p->out);
+  if ( (out=bam_open(fn,"w"))==NULL ) {
+    PRINT_ERROR("Unable to create %s",fn);
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  h=bam_tx_header(p,ntx);
+  bam_header_write(out,h);
+  b=bam_init1();
+  for(c=0;c<p->cells;++c) {
+    for(i=0;i<ncell_reads[c];++i,++n) {
+      molecule_umi(p,umi);
+      sprintf(qname,"STAGS_CELL=%s_UMI=%s_SAMPLE=%s_ETAGS_SYN01:1:HSYNXXBX:%lu",&cells[c*(CELL_LEN+1)],umi,sample,n);
+      // genes are also expressed with a skewed distribution
+      bam_record(b,(int32_t)rng_zipf(ntx),qname,p->len);
+      bam_write1(out,b);
+    }
+  }
+  bam_destroy1(b);
+  bam_header_destroy(h);
+  bam_close(out);
+  free(ncell_reads);
+  free(cells);
+}
+
+/* ******************************************************************************* */
+static void print_usage(int exit_status) {
+  fprintf(stderr,"Usage: fastq_synth --type se|pe|10x|ont|bam --out prefix [--reads N] [--seed N] [--len N] [--cells N] [--genes N]\n\
+  se: prefix.fastq.gz\n\
+  pe: prefix_1.fastq.gz prefix_2.fastq.gz\n\
+  10x: prefix_R1.fastq.gz (cell barcode 16 + UMI 12) prefix_R2.fastq.gz prefix_I1.fastq.gz\n\
+  ont: prefix.fastq.gz (--len is the mean read length)\n\
+  bam: prefix.bam (reads aligned to the transcripts, tags in the read names) prefix_tx2gene.tsv\n");
+  exit(exit_status);
+}
+
+static unsigned long get_number(const char *opt,const char *val,unsigned long min,unsigned long max) {
+  char *end;
+  unsigned long long n=strtoull(val,&end,10);
+  if ( *val=='\0' || *end!='\0' || n<min || n>max ) {
+    PRINT_ERROR("Invalid value for --%s: %s",opt,val);
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  return (unsigned long)n;
+}
+
+int main(int argc, char **argv) {
+  Params p={-1,NULL,1,100000,0,1000,2000};
+  static int help=FALSE;
+  static struct option long_options[] = {
+    {"help",   no_argument, &help, TRUE},
+    {"type",  required_argument, 0, 't'},
+    {"out",  required_argument, 0, 'o'},
+    {"reads",  required_argument, 0, 'n'},
+    {"seed",  required_argument, 0, 's'},
+    {"len",  required_argument, 0, 'l'},
+    {"cells",  required_argument, 0, 'c'},
+    {"genes",  required_argument, 0, 'g'},
+    {0,0,0,0}
+  };
+  int c,i;
+
+  fastq_print_version();
+  argc=fastq_parse_common_options(argc,argv);
+  while (1) {
+    int option_index=0;
+    c=getopt_long(argc,argv,"t:o:n:s:l:c:g:h",long_options,&option_index);
+    if ( c==-1 ) break;
+    switch (c) {
+    case 0:
+      break;
+    case 't':
+      for(i=0;type_names[i]!=NULL && strcmp(type_names[i],optarg);++i);
+      if ( type_names[i]==NULL ) {
+	PRINT_ERROR("Invalid value for --type: %s",optarg);
+	exit(PARAMS_ERROR_EXIT_STATUS);
+      }
+      p.type=i;
+      break;
+    case 'o':
+      p.out=optarg;
+      break;
+    case 'n':
+      p.reads=get_number("reads",optarg,1,ULONG_MAX);
+      break;
+    case 's':
+      p.seed=get_number("seed",optarg,0,ULONG_MAX);
+      break;
+    case 'l':
+      p.len=get_number("len",optarg,1,MAX_READ_LEN);
+      break;
+    case 'c':
+      p.cells=get_number("cells",optarg,1,100000000);
+      break;
+    case 'g':
+      p.genes=get_number("genes",optarg,1,10000000);
+      break;
+    case 'h':
+      help=TRUE;
+      break;
+    default:
+      print_usage(PARAMS_ERROR_EXIT_STATUS);
+    }
+  }
+  if ( help ) print_usage(0);
+  if ( p.type<0 || p.out==NULL || optind!=argc ) print_usage(PARAMS_ERROR_EXIT_STATUS);
+  if ( p.len==0 ) p.len=(p.type==SYNTH_ONT?8000:(p.type==SYNTH_10X||p.type==SYNTH_BAM?90:100));
+  if ( p.type==SYNTH_BAM && p.len>=TX_LEN ) {
+    PRINT_ERROR("--len should be smaller than %d for --type bam",TX_LEN);
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  rng_state=p.seed;
+  switch (p.type) {
+  case SYNTH_SE:
+  case SYNTH_PE:
+    gen_short(&p);
+    break;
+  case SYNTH_10X:
+    gen_10x(&p);
+    break;
+  case SYNTH_ONT:
+    gen_ont(&p);
+    break;
+  default:
+    gen_bam(&p);
+  }
+  return 0;
+}
@@ -31,7 +31,23 @@
 #include "fastq.h"
 #include "hash.h"
 #include "range_list.h"
+#include "arena.h"
+#include "spill.h"
 
+// inserts the keys *arg, *arg+4, *arg+8,... in a sharded table
+static HASH_MT *test_mt;
+static void* hash_mt_worker(void *arg) {
+  ulong k;
+  for(k=*(ulong*)arg;k<40000;k+=4)
+    assert(hash_mt_insere(test_mt,k,(void*)(size_t)(k+1))==1);
+  return NULL;
+}
+
+// counts the values of an option (fastq_parse_option)
+static void count_option(const char *val,void *data) {
+  assert(val==NULL || !strcmp(val,"1") || !strcmp(val,"2"));
+  ++*(int*)data;
+}
 
 int main(int argc, char **argv ) {
 
@@ -114,9 +130,146 @@ int main(int argc, char **argv ) {
   // stats
   hashtable_stats(ht);
   insere(ht,110,&v2);
+  // objects in the first bucket
+  insere(ht,0,&v1);
+  init_hash_traversal(ht);
+  int nobjs=0;
+  while(next_hash_object(ht)!=NULL) ++nobjs;
+  assert(nobjs==5);
+  // the entries are kept (in order) when the table grows
+  assert(hash_reserve(ht,100000)==0);
+  assert(ht->size>100000 && ht->n_entries==5);
+  assert(get_object(ht,100)==&v1 && get_next_object(ht,100)==&v1 && get_next_object(ht,100)==NULL);
+  for(nobjs=0;nobjs<100000;++nobjs) insere(ht,1000+nobjs,&v2);
+  assert(get_object(ht,110)==&v2 && get_object(ht,1000+99999)==&v2);
   //
   free_hashtable(ht);
 
+  // arena
+  ARENA *a=arena_new();
+  assert(a!=NULL);
+  char *s1=arena_strndup(a,"read1/1",5);
+  assert(!strcmp(s1,"read1"));
+  unsigned long k;
+  for ( k=0; k<100000; ++k ) {
+    long *l=(long*)arena_alloc(a,sizeof(long)*3);
+    assert(l!=NULL && ((size_t)l)%8==0);
+    l[2]=k;
+    assert(arena_strndup(a,"x",1)!=NULL);
+  }
+  assert(arena_alloc(a,ARENA_MAX_CHUNK*2)!=NULL);
+  assert(!strcmp(s1,"read1"));
+  assert(a->used==6+100000*(sizeof(long)*3+2)+ARENA_MAX_CHUNK*2);
+  arena_reset(a);
+  assert(a->size==0);
+  assert(arena_alloc(a,10)!=NULL);
+  arena_free(a);
+
+  // lookups and traversals that do not change the table, while the
+  // entries are moved to a larger table
+  ht=new_hashtable(1000);
+  ulong nkeys=ht->max_entries+1;
+  for(k=0;k<nkeys;++k) insere(ht,k,(k==10?&v2:&v1));
+  assert(ht->old_nodes!=NULL);
+  assert(hash_lookup(ht,10,NULL,NULL)==&v2 && hash_lookup(ht,k-1,NULL,NULL)==&v1 && hash_lookup(ht,k,NULL,NULL)==NULL);
+  HASH_ITER it;
+  hash_iter_init(ht,&it);
+  for(nobjs=0;hash_iter_next(ht,&it)!=NULL;++nobjs);
+  assert(nobjs==k && ht->old_nodes!=NULL);
+  free_hashtable(ht);
+
+  // sharded table: 4 threads insert the keys, which are then looked
+  // up, traversed and removed
+  pthread_t th[4];
+  ulong first[4]={0,1,2,3};
+  HASH_MT_ITER mit;
+  hashnode *node;
+  test_mt=new_hash_mt(100,8);
+  assert(test_mt!=NULL);
+  for(k=0;k<4;++k) assert(pthread_create(&th[k],NULL,hash_mt_worker,&first[k])==0);
+  for(k=0;k<4;++k) pthread_join(th[k],NULL);
+  assert(hash_mt_entries(test_mt)==40000);
+  assert(hash_mt_lookup(test_mt,12345,NULL,NULL)==(void*)12346 && hash_mt_lookup(test_mt,40000,NULL,NULL)==NULL);
+  hash_mt_iter_init(test_mt,&mit);
+  for(nobjs=0;(node=hash_mt_iter_next(test_mt,&mit))!=NULL;++nobjs)
+    assert(node->obj==(void*)(size_t)(node->value+1));
+  assert(nobjs==40000);
+  assert(hash_mt_find_delete(test_mt,7,NULL,NULL)==(void*)8 && hash_mt_lookup(test_mt,7,NULL,NULL)==NULL);
+  assert(hash_mt_entries(test_mt)==39999);
+  free_hash_mt(test_mt);
+
+  // read names partitioned in temporary files
+  SPILL *sp1=spill_new(7),*sp2=spill_new(7),*res1=spill_new(7),*res2=spill_new(7);
+  SPILL_RECORD r;
+  char name[32];
+  FASTQ_SPAN sn;
+  for ( k=0; k<1000; ++k ) {
+    sprintf(name,"read%lu",k);
+    sn.s=name;
+    sn.len=strlen(name);
+    spill_write(sp1,spill_part(sp1,sn),sn,k,k*10);
+    // every other read of sp1 (and a read not in sp1)
+    if ( k%2==0 ) spill_write(sp2,spill_part(sp2,sn),sn,k,0);
+    if ( k==501 ) {
+      sn.s="other";
+      sn.len=5;
+      spill_write(sp2,spill_part(sp2,sn),sn,k,0);
+    }
+  }
+  assert(sp1->n==1000 && sp2->n==501);
+  assert(!spill_first_duplicate(sp1,&r));
+  sn.s="read10";
+  sn.len=6;
+  spill_rewind(sp1,spill_part(sp1,sn));
+  assert(spill_read(sp1,spill_part(sp1,sn),&r) && r.id<1000);
+  spill_write(sp2,spill_part(sp2,sn),sn,2000,0);
+  assert(spill_first_duplicate(sp2,&r) && r.id==2000 && fastq_span_eq(r.name,sn));
+  assert(spill_match(sp1,sp2,res1,res2,&r)==500 && r.id==501 && r.name.len==5);
+  assert(res1->n==500 && res2->n==502);
+  for ( nobjs=0,k=0; k<7; ++k ) {
+    while ( spill_read(res1,k,&r) ) {
+      assert(r.id%2==1 && r.offset==r.id*10);
+      ++nobjs;
+    }
+    while ( spill_peek(res2,k,&r) && spill_read(res2,k,&r) )
+      assert(r.offset==(r.id%2==0 && r.id<1000?r.id*10:-1));
+  }
+  assert(nobjs==500);
+  spill_free(sp1);
+  spill_free(sp2);
+  spill_free(res1);
+  spill_free(res2);
+
+  // sharded index of read names
+  hashtable mi=fastq_index_mt_new(0);
+  sn.s="read1";
+  sn.len=5;
+  assert(new_indexentry(mi,"read1/1",5,10)!=NULL && new_indexentry(mi,"read2",5,20)!=NULL);
+  assert(mi->n_entries==2 && fastq_index_lookup_span(mi,sn)->entry_start==10);
+  assert(fastq_index_remove_span(mi,sn)!=NULL && fastq_index_lookup_span(mi,sn)==NULL && mi->n_entries==1);
+  fastq_index_free(mi);
+
+  // batches of lookups (longer than FASTQ_INDEX_BATCH): a name not
+  // indexed, a name skipped and a name removed twice
+  char bnames[40][8];
+  FASTQ_SPAN bn[40];
+  INDEX_ENTRY *be[40];
+  hashtable bi=fastq_index_new(0);
+  for (k=0;k<40;++k) {
+    bn[k].len=sprintf(bnames[k],"r%lu",k);
+    bn[k].s=bnames[k];
+    if ( k!=7 ) new_indexentry(bi,bnames[k],bn[k].len,k);
+  }
+  bn[9].s=NULL;
+  bn[39]=bn[38];
+  fastq_index_lookup_batch(bi,bn,40,be);
+  for (k=0;k<40;++k)
+    assert(k==7 || k==9?be[k]==NULL:be[k]->entry_start==(k==39?38:k));
+  fastq_index_remove_batch(bi,bn,40,be);
+  assert(be[0]->entry_start==0 && be[38]->entry_start==38 && be[39]==NULL && be[7]==NULL && be[9]==NULL);
+  assert(bi->n_entries==2 && fastq_index_lookup_header(bi,"r9")!=NULL && fastq_index_lookup_header(bi,"r39")!=NULL);
+  fastq_index_free(bi);
+
   RL_Tree* t1,*t2,*t3,*t4;
   t1=new_rl(1);
   t2=new_rl(100);
@@ -147,6 +300,7 @@ int main(int argc, char **argv ) {
   t4=minus_rl(t2,t1);
   assert(t4==NULL);
   t4=minus_rl(t2,t3);
+  assert(!in_rl(t4,1) && rl_next_in_bigger(t4,0)==0);
   display_tree(t2);
   rl_next_in_bigger(t2,0);
   rl_next_in_bigger(t4,10);
@@ -159,6 +313,51 @@ int main(int argc, char **argv ) {
   free_rl(t1);
   free_rl(t2);
   free_rl(t3);
+
+  // batches
+  char tmpf[]="/tmp/fastq_tests_XXXXXX";
+  int tfd=mkstemp(tmpf);
+  assert(tfd>=0);
+  const char *fq="@r1\nACGN\n+\nIIII\n@r2\nNN\n+r2\nII\n@r3\nA\n+\nI";
+  assert(write(tfd,fq,strlen(fq))==strlen(fq));
+  close(tfd);
+  FASTQ_FILE *fdb=fastq_new(tmpf,FALSE,"r");
+  FASTQ_BATCH *b=fastq_new_batch(2);
+  FASTQ_ENTRY *e=fastq_new_entry();
+  assert(fastq_read_next_batch(fdb,b)==2);
+  assert(b->seq_len[0]==4 && !strncmp(&b->seq[b->seq_off[0]],"ACGN",4));
+  assert(b->hdr2_len[1]==3 && !strncmp(&b->hdr[b->hdr2_off[1]],"+r2",3));
+  assert(b->offset[1]==16);
+  fastq_batch_entry(b,1,e);
+  assert(!strcmp(e->hdr1,"@r2\n") && !strcmp(e->qual,"II\n") && e->read_len==3 && e->qual_len==3);
+  assert(fastq_read_next_batch(fdb,b)==1);
+  assert(b->last_qual_nl==FALSE);
+  fastq_batch_entry(b,0,e);
+  assert(!strcmp(e->qual,"I") && e->qual_len==1);
+  assert(fastq_read_next_batch(fdb,b)==0);
+  assert(fdb->num_rds==3 && fdb->max_rl==5 && fdb->min_rl==2);
+  // read names (spans of the headers)
+  strcpy(e->hdr1,"@r3/1\n");
+  strcpy(e->hdr2,"+r3/1\n");
+  FASTQ_SPAN rn1=fastq_readname_span(fdb,e,TRUE);
+  FASTQ_SPAN rn2=fastq_readname_span(fdb,e,FALSE);
+  assert(rn1.s==&e->hdr1[1] && rn2.s==&e->hdr2[1]);
+  assert(fastq_span_eq(rn1,rn2));
+  char rname[MAX_LABEL_LENGTH];
+  unsigned long len;
+  fastq_get_readname(fdb,e,rname,&len,TRUE);
+  assert(len==rn1.len && strlen(rname)==len && !strncmp(rname,rn1.s,len));
+  fastq_free_batch(b);
+  fastq_destroy(fdb);
+  unlink(tmpf);
+
+  // long options: the ones after -- are kept
+  char *opts[]={"prog","--x","1","a","--x=2","--xy","--","--x","3",NULL};
+  int nx=0;
+  assert(fastq_parse_option(9,opts,"--x",TRUE,count_option,&nx)==6 && nx==2);
+  assert(!strcmp(opts[1],"a") && !strcmp(opts[2],"--xy") && !strcmp(opts[4],"--x") && opts[6]==NULL);
+  nx=0;
+  assert(fastq_parse_option(6,opts,"--xy",FALSE,count_option,&nx)==5 && nx==1 && !strcmp(opts[2],"--"));
   exit(0);
 }
 
@@ -116,6 +116,42 @@ short trim_poly_at(FASTQ_ENTRY *m1,
   return(0);
 }
 
+// a read was trimmed (passed by trim to trim_done with the status)
+#define TRIMMED 16
+
+struct trim_s {
+  Params *p;
+  unsigned long trimmed_reads;
+  unsigned long discarded_reads;
+  unsigned long processed_reads;
+};
+
+// runs in parallel: the entries are only changed
+static int trim(FASTQ_FILE* fd,FASTQ_ENTRY** e,void *data) {
+  Params *p=((struct trim_s*)data)->p;
+  int status=FASTQ_MAP_KEEP;
+  if (trim_poly_at(e[0],p->min_poly_at_len) )
+    status|=TRIMMED;
+  if ( e[0]->read_len < p->min_len)
+    status|=FASTQ_MAP_DISCARD;
+  return(status);
+}
+
+static int trim_done(FASTQ_FILE* fd,FASTQ_ENTRY** e,int status,void *data) {
+  struct trim_s *t=(struct trim_s*)data;
+  Params *p=t->p;
+  ++t->processed_reads;
+  if ( status&TRIMMED ) {
+    // other errors would have resulted in the exit of the program
+    PRINT_VERBOSE(p,"Trimmed %s\n",e[0]->seq);
+    ++t->trimmed_reads;
+  }
+  if ( status&FASTQ_MAP_DISCARD )
+    ++t->discarded_reads;
+  fastq_progress(fd,fd->cline/4);
+  return(status&FASTQ_MAP_DISCARD);
+}
+
 void print_usage(void) {
 
   char msg[]="\n\
@@ -124,6 +160,7 @@ void print_usage(void) {
   --ofile <filename> : fastq file name where the processed reads will be written \n\
   --min_poly_at_len integer     : minimum length of poly-A|T sequence to remove.\n\
   --min_len integer     : minimum read length.\n\
+  --threads integer     : number of threads used to process the reads and to compress the output file.\n\
 ";
   fprintf(stdout,"usage: fastq_trim_poly_at --file fastq_file --outfile out_file [optional parameters]");
   fprintf(stdout,"%s",msg);
@@ -137,6 +174,7 @@ int main(int argc, char **argv ) {
   opterr = 0;
 
   fastq_print_version();
+  argc=fastq_parse_common_options(argc,argv);
   
   static struct option long_options[] = {
     /* These options set a flag. */
@@ -194,39 +232,20 @@ int main(int argc, char **argv ) {
   // Assumptions:
   // 1) the fastq files have been validated and
   // 2) reads have the same order in the multiple files
-  unsigned long trimmed_reads=0;
-  unsigned long discarded_reads=0;
-  unsigned long processed_reads=0;
-
-  FASTQ_ENTRY* m=NULL;
+  struct trim_s t={p,0,0,0};
   FASTQ_FILE* fdw=NULL;
   FASTQ_FILE* fdi=NULL;
   
   fdi=fastq_new(p->file,FALSE,"r");
-  m=fastq_new_entry();
   fdw=fastq_new(p->outfile,FALSE,"w4"); 
 
   //
-  while(!gzeof(fdi->fd) ) {
-    if (fastq_read_next_entry(fdi,m)==0) break; // EOF
-    //PRINT_ERROR(">%s\n",m->seq);
-    ++processed_reads;
-    // initialize
-    if (trim_poly_at(m,p->min_poly_at_len) ) {
-      	// other errors would have resulted in the exit of the program
-	PRINT_VERBOSE(p,"Trimmed %s\n",m->seq);
-	++trimmed_reads;
-    }
-    if ( m->read_len >= p->min_len) 
-      fastq_write_entry(fdw,m);
-    else
-      ++discarded_reads;
-    PRINT_READS_PROCESSED(fdi->cline/4,100000);
-  }
+  fastq_map(fdi,1,FASTQ_MAP_ALL,trim,trim_done,&fdw,&t);
+  progress_done();
   //   extract the info, change read name, trim the read, write
-  PRINT_INFO("Reads processed: %ld",processed_reads);
-  PRINT_INFO("Reads trimmed: %ld",trimmed_reads);
-  PRINT_INFO("Reads discarded: %ld",discarded_reads);
+  PRINT_INFO("Reads processed: %ld",t.processed_reads);
+  PRINT_INFO("Reads trimmed: %ld",t.trimmed_reads);
+  PRINT_INFO("Reads discarded: %ld",t.discarded_reads);
   fastq_destroy(fdw);  
   exit(0);
 }
@@ -29,26 +29,24 @@
 
 #include "fastq.h"
 
+static int keep(FASTQ_FILE* fd,FASTQ_ENTRY** e,void *data) {
+  return(FASTQ_MAP_KEEP);
+}
 
 int main(int argc, char **argv ) {
 
   fastq_print_version();
+  argc=fastq_parse_common_options(argc,argv);
   
   if (argc!=3) {
-    fprintf(stderr,"Usage: fastq_truncate fastq1 num_reads\n");
+    fprintf(stderr,"Usage: fastq_truncate [--threads N] fastq1 num_reads\n");
     exit(PARAMS_ERROR_EXIT_STATUS);
   }
   long num_reads=atol(argv[2]);
 
   FASTQ_FILE *fd1=fastq_new(argv[1],FALSE,"r");
-  FASTQ_ENTRY *m1=fastq_new_entry();
-
-  while(!gzeof(fd1->fd)) {
-    if (fd1->num_rds>=num_reads) break;
-    if (fastq_read_next_entry(fd1,m1)==0) break;
-    fastq_write_entry2stdout(m1);
-
-  }
+  // the first num_reads reads are written to stdout
+  fastq_map(fd1,1,(unsigned long)num_reads,keep,NULL,NULL,NULL);
   fastq_destroy(fd1);
   exit(0);
 }
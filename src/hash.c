@@ -25,81 +25,180 @@
 #include <string.h>
 
 #include "hash.h"
+#include "stats.h"
 
-#define BUCKET(table,i) table->buckets[i]
-#define LAST_ENTRY(table,i) table->buckets_last[i]
-#ifndef HASHSIZE
-#define HASHSIZE(t) t->size
-#endif
-static ulong mhash(hashtable,ulong);
-static hashnode* hash_lookup(hashtable,ulong);
-
-
-static hashnode* hash_lookup(hashtable table,ulong  key){
-  
-  table->last_node = BUCKET(table,mhash(table,key)); /* set a pointer to the first bucket */
-  while ( table->last_node != NULL ) {
-    if( table->last_node->value==key) return table->last_node;
-    table->last_node = table->last_node->next;
+// Open addressing with linear probing. An entry is stored in the first
+// free slot after the slot of its key (home) and fp[i] keeps 8 bits of
+// the hash of the key in nodes[i] (0 if the slot is free), so most
+// probes only read the fingerprints. Entries are removed by shifting
+// back the following entries of the run (no tombstones): there is never
+// a free slot between the home of an entry and the entry, and the
+// entries with the same key remain in the order they were inserted.
+
+// The table grows (twice the size) when the load goes above 7/8 and
+// the entries are then moved to the new table incrementally: each
+// operation first moves the run of the old table where its key would
+// be, so all the entries with a key are always in the same table and
+// only the new one is searched, and then the runs in the next
+// MOVE_SLOTS slots of the old table. The old table is thus empty well
+// before the new one is full and no operation has to move all the
+// entries at once.
+#define MAX_LOAD(size) ((size)-(size)/8)
+#define MIN_SIZE 8
+#define MOVE_SLOTS 32
+
+// mixes the bits of the key (the keys are often small integers or
+// weak hashes of strings): finalizer of MurmurHash3
+static inline ulong mix(ulong key) {
+  key^=key>>33;
+  key*=0xff51afd7ed558ccdULL;
+  key^=key>>33;
+  key*=0xc4ceb9fe1a85ec53ULL;
+  key^=key>>33;
+  return key;
+}
+
+// slot of a hash (the size does not need to be a power of 2)
+static inline ulong home_in(ulong h,ulong size) {
+  return (ulong)(((unsigned __int128)h*size)>>64);
+}
+
+static inline ulong home(hashtable table,ulong h) {
+  return home_in(h,HASHSIZE(table));
+}
+
+static inline unsigned char fingerprint(ulong h) {
+  unsigned char f=(unsigned char)h;
+  return (f==0?1:f);
+}
+
+static inline ulong next_slot(hashtable table,ulong i) {
+  return (++i==HASHSIZE(table)?0:i);
+}
+
+// slot of the first entry with key (from slot i, included) or size if
+// there is none
+static inline ulong hash_find(hashtable table,ulong key,unsigned char f,ulong i) {
+  while ( table->fp[i]!=0 ) {
+    if ( table->fp[i]==f && table->nodes[i].value==key ) return i;
+    i=next_slot(table,i);
   }
-  return NULL;
+  return HASHSIZE(table);
 }
-__ptr_t get_next_object(hashtable table,ulong key)
-{
-  if(table->last_node==NULL)
-    return NULL; 
-  table->last_node = table->last_node->next;
-  while ( table->last_node != NULL ) {
-     if( table->last_node->value==key) return table->last_node->obj;
-     table->last_node = table->last_node->next;
+
+static int alloc_slots(hashtable table,ulong size) {
+  table->nodes=(hashnode*)malloc(sizeof(hashnode)*size);
+  table->fp=(unsigned char*)calloc(size,1);
+  if ( table->nodes==NULL || table->fp==NULL ) {
+    free(table->nodes);
+    free(table->fp);
+    return -1;
   }
-  return NULL;
+  table->size=size;
+  table->max_entries=MAX_LOAD(size);
+  return 0;
 }
 
+// stores the entry in the first free slot from its home
+static inline ulong hash_put(hashtable table,ulong key,__ptr_t obj) {
+  ulong h=mix(key);
+  ulong i=home(table,h);
+  while ( table->fp[i]!=0 ) i=next_slot(table,i);
+  table->fp[i]=fingerprint(h);
+  table->nodes[i].value=key;
+  table->nodes[i].obj=obj;
+  return i;
+}
 
-/* removes the element with key 'key' and returns the object stored on him */
-__ptr_t delete(hashtable table,ulong key,__ptr_t obj)
-{
-  hashnode *b,*prev=NULL;
-  ulong c=mhash(table,key);
-  b=BUCKET(table,c); /* set a pointer to the first bucket */
-  while( b!=NULL) {
-    if( b->value==key && b->obj==obj){
-      if(prev==NULL) /* first element */
-	BUCKET(table,c)=b->next;
-      else 
-	prev->next=b->next;
-      if (b->next==NULL) // last
-	LAST_ENTRY(table,c)=prev;
-      free(b);
-      table->n_entries--;
-      return obj;
-    }
-    prev = b;
-    b = b->next;
-  };
-  return NULL;
+static void move_end(hashtable table) {
+  free(table->old_nodes);
+  free(table->old_fp);
+  table->old_nodes=NULL;
+  table->old_fp=NULL;
+  table->old_size=0;
+  table->old_entries=0;
 }
 
-/* __ptr_t replace_object(hashtable table,ulong  key,__ptr_t newobj) */
-/* { */
-/*   __ptr_t old; */
-/*   hashnode *b=hash_lookup(table,key);  */
-/*   if(b==NULL)return NULL; */
-/*   old=b->obj; */
-/*   b->obj=newobj; */
-/*   return old;   */
-/* } */
+// moves the run of the old table that starts in slot i. The entries
+// with the same key keep their order.
+static void move_run(hashtable table,ulong i) {
+  while ( table->old_fp[i]!=0 ) {
+    hash_put(table,table->old_nodes[i].value,table->old_nodes[i].obj);
+    table->old_fp[i]=0;
+    table->old_entries--;
+    if ( ++i==table->old_size ) i=0;
+  }
+}
 
-/* looks a 'bucket' in the hashing table whith 'key' and return the
- pointer to the object stored in that bucket or NULL if no bucket is found */ 
-__ptr_t get_object(hashtable table,ulong key){
-  
-   hashnode *b=hash_lookup(table,key); 
-   if(b==NULL)
-       return NULL;
+// moves the entries with the hash h (if not moved yet) and the next
+// MOVE_SLOTS slots of the old table. old_pos is always at a free slot
+// or at the start of a run since runs are moved as a whole.
+static void move_entries(hashtable table,ulong h) {
+  ulong i=home_in(h,table->old_size),n;
+  if ( table->old_fp[i]!=0 ) {
+    ulong prev;
+    while ( table->old_fp[prev=(i==0?table->old_size:i)-1]!=0 ) i=prev;
+    move_run(table,i);
+  }
+  for(n=0;n<MOVE_SLOTS && table->old_entries>0;++n) {
+    move_run(table,table->old_pos);
+    if ( ++table->old_pos==table->old_size ) table->old_pos=0;
+  }
+  if ( table->old_entries==0 ) move_end(table);
+}
+
+static void move_all(hashtable table) {
+  while ( table->old_entries>0 ) {
+    move_run(table,table->old_pos);
+    if ( ++table->old_pos==table->old_size ) table->old_pos=0;
+  }
+  move_end(table);
+}
+
+// starts moving the entries to a new table with size nodes
+static int hash_resize(hashtable table,ulong size) {
+  hashnode *nodes=table->nodes;
+  unsigned char *fp=table->fp;
+  ulong old_size=HASHSIZE(table),start;
 
-   return b->obj; 
+  if ( table->old_nodes!=NULL ) move_all(table);
+  if ( alloc_slots(table,size) ) {
+    table->nodes=nodes;
+    table->fp=fp;
+    return -1;
+  }
+  table->old_nodes=nodes;
+  table->old_fp=fp;
+  table->old_size=old_size;
+  table->old_entries=table->n_entries;
+  // start after a free slot (there is always one)
+  for(start=0;fp[start]!=0;++start);
+  table->old_pos=start;
+  if ( table->old_entries==0 ) move_end(table);
+  return 0;
+}
+
+static inline int hash_grow(hashtable table) {
+  return hash_resize(table,HASHSIZE(table)*2);
+}
+
+// removes the entry in slot i
+static void hash_remove(hashtable table,ulong i) {
+  ulong j=i;
+  while (1) {
+    ulong k;
+    j=next_slot(table,j);
+    if ( table->fp[j]==0 ) break;
+    k=home(table,mix(table->nodes[j].value));
+    // the entry in j can be moved to i if its home is not in (i,j]
+    if ( (i<j)?(k<=i || k>j):(k<=i && k>j) ) {
+      table->nodes[i]=table->nodes[j];
+      table->fp[i]=table->fp[j];
+      i=j;
+    }
+  }
+  table->fp[i]=0;
+  table->n_entries--;
 }
 
 /* Allocates space to a new hash table */
@@ -107,120 +206,207 @@ hashtable new_hashtable(ulong hashsize) {
   hashtable new;
 
   if( (new = (hashtable)malloc(sizeof(struct hashtable_s)))==NULL) return NULL;
-  
-  if( (new->buckets = (hashnode**)malloc(sizeof(hashnode*)*hashsize))==NULL) 
-     return NULL;
-  if( (new->buckets_last = (hashnode**)malloc(sizeof(hashnode*)*hashsize))==NULL) 
-     return NULL;
-  memset(new->buckets,0,sizeof(hashnode*)*hashsize);
-  memset(new->buckets_last,0,sizeof(hashnode*)*hashsize);
-  new->size=hashsize;
+  if ( alloc_slots(new,(hashsize<MIN_SIZE?MIN_SIZE:hashsize)) ) {
+    free(new);
+    return NULL;
+  }
   new->last_bucket=0;
   new->last_node=NULL;
   new->n_entries=0;
-  //for(i=0;i<hashsize;++i) { BUCKET(new,i) = NULL; LAST_ENTRY(new,i) = NULL; }
+  new->data=NULL;
+  new->old_nodes=NULL;
+  new->old_fp=NULL;
+  new->old_size=0;
+  new->old_entries=0;
+  new->old_pos=0;
   return new;
 }
 
-void hashtable_stats(hashtable table) {
-  ulong zbuckets=0;
-  ulong collisions=0;
-  ulong max_col=0;
-  ulong i,ctr;
-  for(i=0;i<HASHSIZE(table);++i) {
-    hashnode *b=BUCKET(table,i);
-    if ( b==NULL ) ++zbuckets;
-    else {
-      ctr=0;
-      while (b!=NULL) {
-	b=b->next;
-	++ctr;
-      }
-      if ( ctr > 1 ) {
-	collisions+=ctr;
-	if ( ctr > max_col ) max_col=ctr;
-	//fprintf(stderr,"%llu %llu\n",i,ctr);
-      }
+int hash_reserve(hashtable table,ulong n_entries) {
+  ulong size=n_entries+n_entries/7+1;
+  if ( n_entries<=table->max_entries ) return 0;
+  while ( MAX_LOAD(size)<n_entries ) ++size;
+  if ( hash_resize(table,size) ) return -1;
+  if ( table->old_nodes!=NULL ) move_all(table);
+  return 0;
+}
+
+/* inserts a new element in the hash table*/
+int insere(hashtable table,ulong key,__ptr_t obj)
+{
+  int prev=stats_enter(STATS_HASH);
+  if ( table->n_entries>=table->max_entries && hash_grow(table) && table->n_entries+1>=HASHSIZE(table) ) {
+    stats_leave(prev);
+    return -1;
+  }
+  if ( table->old_nodes!=NULL ) move_entries(table,mix(key));
+  hash_put(table,key,obj);
+  table->n_entries++;
+  stats_leave(prev);
+  return 1;
+}
+
+/* looks a 'bucket' in the hashing table whith 'key' and return the
+ pointer to the object stored in that bucket or NULL if no bucket is found */ 
+__ptr_t get_object(hashtable table,ulong key){
+  int prev=stats_enter(STATS_HASH);
+  ulong h=mix(key);
+  if ( table->old_nodes!=NULL ) move_entries(table,h);
+  ulong i=hash_find(table,key,fingerprint(h),home(table,h));
+  stats_leave(prev);
+  if ( i==HASHSIZE(table) ) {
+    table->last_node=NULL;
+    return NULL;
+  }
+  table->last_bucket=i;
+  table->last_node=&table->nodes[i];
+  return table->last_node->obj;
+}
+
+/* next object with the same key as the last one returned by get_object/get_next_object */
+__ptr_t get_next_object(hashtable table,ulong key)
+{
+  int prev;
+  ulong i;
+  if(table->last_node==NULL)
+    return NULL; 
+  prev=stats_enter(STATS_HASH);
+  i=hash_find(table,key,fingerprint(mix(key)),next_slot(table,table->last_bucket));
+  stats_leave(prev);
+  if ( i==HASHSIZE(table) ) {
+    table->last_node=NULL;
+    return NULL;
+  }
+  table->last_bucket=i;
+  table->last_node=&table->nodes[i];
+  return table->last_node->obj;
+}
+
+/* removes the element with key 'key' and returns the object stored on him */
+__ptr_t delete(hashtable table,ulong key,__ptr_t obj)
+{
+  int prev=stats_enter(STATS_HASH);
+  ulong h=mix(key);
+  unsigned char f=fingerprint(h);
+  if ( table->old_nodes!=NULL ) move_entries(table,h);
+  ulong i=home(table,h);
+  while ( (i=hash_find(table,key,f,i))!=HASHSIZE(table) ) {
+    if ( table->nodes[i].obj==obj ) {
+      hash_remove(table,i);
+      stats_leave(prev);
+      return obj;
     }
+    i=next_slot(table,i);
   }
-  fprintf(stderr,"size: %llu\n",HASHSIZE(table));
-  fprintf(stderr,"max. col: %llu\n",max_col);
-  fprintf(stderr,"zbuckets: %llu\n",zbuckets);
-  fprintf(stderr,"%% zbuckets: %.2f\n",zbuckets*1.0/HASHSIZE(table));
-  fprintf(stderr,"collisions: %llu\n",collisions);
-  fprintf(stderr,"avg. collisions: %.2f\n",collisions*1.0/(HASHSIZE(table)-zbuckets));
+  stats_leave(prev);
+  return NULL;
 }
 
-/* A very simple hashing function */
-static ulong mhash(hashtable table,ulong key)
+/* removes the first element with key 'key' whose object matches (all
+ match if match is NULL) and returns the object */
+__ptr_t find_delete(hashtable table,ulong key,HASH_MATCH_FN match,void *data)
 {
-  return (ulong)(key%HASHSIZE(table));
+  int prev=stats_enter(STATS_HASH);
+  ulong h=mix(key);
+  unsigned char f=fingerprint(h);
+  if ( table->old_nodes!=NULL ) move_entries(table,h);
+  ulong i=home(table,h);
+  while ( (i=hash_find(table,key,f,i))!=HASHSIZE(table) ) {
+    __ptr_t obj=table->nodes[i].obj;
+    if ( match==NULL || match(obj,data) ) {
+      hash_remove(table,i);
+      stats_leave(prev);
+      return obj;
+    }
+    i=next_slot(table,i);
+  }
+  stats_leave(prev);
+  return NULL;
 }
 
-/* inserts a new element in the hash table*/
-int insere(hashtable table,ulong key,__ptr_t obj)
+/* returns a pointer to the object of the first element with key 'key'
+ whose object matches or, if there is none, of a new element (with a
+ NULL object) added to the table. */
+__ptr_t* upsert(hashtable table,ulong key,HASH_MATCH_FN match,void *data,int *found)
 {
-   ulong ind;
-   hashnode *new;
-   if((new=(hashnode *)malloc(sizeof(hashnode)))==NULL) return -1;
-   ind=mhash(table,key);
-   // add to the end of the list
-   new->value=key;
-   new->obj=obj;
-   if ( LAST_ENTRY(table,ind)==NULL ) {
-     // first element
-     BUCKET(table,ind)=new;
-   } else {
-     LAST_ENTRY(table,ind)->next=new;
-   }
-   new->next=NULL;
-   LAST_ENTRY(table,ind)=new;
-   // add the new entry to the front of the list
-   //new->next = BUCKET(table,ind);
-   //BUCKET(table,ind)=new;   
-   //
-   table->n_entries++;
-   return 1;
+  int prev=stats_enter(STATS_HASH);
+  ulong h=mix(key);
+  unsigned char f=fingerprint(h);
+  if ( table->old_nodes!=NULL ) move_entries(table,h);
+  ulong i=home(table,h);
+  while ( table->fp[i]!=0 ) {
+    if ( table->fp[i]==f && table->nodes[i].value==key && (match==NULL || match(table->nodes[i].obj,data)) ) {
+      *found=1;
+      stats_leave(prev);
+      return &table->nodes[i].obj;
+    }
+    i=next_slot(table,i);
+  }
+  *found=0;
+  if ( table->n_entries>=table->max_entries ) {
+    // the slot found is not valid in the new table
+    if ( hash_grow(table) && table->n_entries+1>=HASHSIZE(table) ) {
+      stats_leave(prev);
+      return NULL;
+    }
+    if ( table->old_nodes!=NULL ) move_entries(table,h);
+    i=hash_put(table,key,NULL);
+  } else {
+    table->fp[i]=f;
+    table->nodes[i].value=key;
+    table->nodes[i].obj=NULL;
+  }
+  table->n_entries++;
+  stats_leave(prev);
+  return &table->nodes[i].obj;
+}
+
+void hashtable_stats(hashtable table) {
+  ulong zbuckets=0;
+  ulong max_probe=0;
+  ulong probes=0;
+  ulong i;
+  if ( table->old_nodes!=NULL ) move_all(table);
+  for(i=0;i<HASHSIZE(table);++i) {
+    if ( table->fp[i]==0 ) ++zbuckets;
+    else {
+      ulong k=home(table,mix(table->nodes[i].value));
+      ulong d=(i>=k?i-k:i+HASHSIZE(table)-k)+1;
+      probes+=d;
+      if ( d > max_probe ) max_probe=d;
+    }
+  }
+  fprintf(stderr,"size: %llu\n",HASHSIZE(table));
+  fprintf(stderr,"entries: %llu\n",table->n_entries);
+  fprintf(stderr,"load: %.2f\n",table->n_entries*1.0/HASHSIZE(table));
+  fprintf(stderr,"max. probes: %llu\n",max_probe);
+  fprintf(stderr,"avg. probes: %.2f\n",(table->n_entries?probes*1.0/table->n_entries:0.0));
 }
 
 void free_hashtable(hashtable table)
 {
-   register ulong i;
-   hashnode *n,*tmp;
-   //fprintf(stderr,"free_hashtable\n");fflush(stderr);
    if (table==NULL) return;
-   for(i=0;i<HASHSIZE(table);++i) {
-      n=BUCKET(table,i);
-      while(n!=NULL) {
-         tmp=n;
-         n=n->next;
-         free(tmp);
-      }      
-   }
-   free(table->buckets);
-   free(table->buckets_last);
+   move_end(table);
+   free(table->nodes);
+   free(table->fp);
    free(table);
 }
+
+/* removes all the elements (the objects are not freed) */
 void reset_hashtable(hashtable table)
 {
-   register ulong i;
-   hashnode *n,*tmp;
-   //fprintf(stderr,"free_hashtable\n");fflush(stderr);
    if (table==NULL) return;
-   for(i=0;i<HASHSIZE(table);++i) {
-      n=BUCKET(table,i);
-      while(n!=NULL) {
-         tmp=n;
-         n=n->next;
-         free(tmp);
-      }      
-   }
+   move_end(table);
+   memset(table->fp,0,HASHSIZE(table));
+   table->n_entries=0;
+   table->last_node=NULL;
 }
 /*********************************************************************************/
 /*
  * Returns all objects stored in a basket by making successive calls
  */
 void init_hash_traversal(hashtable table) {
+  if ( table->old_nodes!=NULL ) move_all(table);
   table->last_bucket=0;
   table->last_node=NULL;
 }
@@ -229,85 +415,219 @@ void init_hash_traversal(hashtable table) {
  */
 __ptr_t next_hash_object(hashtable table)
 {
-  // first time....
-  if( table->last_bucket>=HASHSIZE(table)) 
-    return NULL;
-    
-  if( table->last_node==NULL ) {
-    // find bucket
-    // find next bucket
-    while ( table->last_node == NULL && table->last_bucket+1<HASHSIZE(table)) {
-      ++table->last_bucket;
-      table->last_node = BUCKET(table,table->last_bucket);
-    }
-    if (table->last_node==NULL)
-      return NULL;
-    return table->last_node->obj;
-  } 
-  // Next in bucket
-  table->last_node=table->last_node->next;
-  if (table->last_node==NULL) return next_hash_object(table);
-  return table->last_node->obj;
+  hashnode* node=(hashnode*)next_hashnode(table);
+  if ( node==NULL ) return NULL;
+  return node->obj;
 }
 
 /*
  * Returns all hash nodes stored in a basket by making successive calls
+ * (last_bucket is the next slot to visit)
  */
 __ptr_t next_hashnode(hashtable table)
 {
-  // first time....
-  if( table->last_bucket>=HASHSIZE(table)) 
-    return NULL;
-    
-  if( table->last_node==NULL ) {
-    // find bucket
-    // find next bucket
-    while ( table->last_node == NULL && table->last_bucket+1<HASHSIZE(table)) {
-      ++table->last_bucket;
-      table->last_node = BUCKET(table,table->last_bucket);
+  while ( table->last_bucket<HASHSIZE(table) ) {
+    ulong i=table->last_bucket++;
+    if ( table->fp[i]!=0 ) {
+      table->last_node=&table->nodes[i];
+      return table->last_node;
+    }
+  }
+  table->last_node=NULL;
+  return NULL;
+}
+
+/*********************************************************************************/
+// Lookups and traversals that only read the table: the entries of the
+// old table not moved yet are searched/visited in place
+
+/* returns the object of the first element with key 'key' whose object
+ matches (all match if match is NULL) or NULL */
+__ptr_t hash_lookup(hashtable table,ulong key,HASH_MATCH_FN match,void *data)
+{
+  int prev=stats_enter(STATS_HASH);
+  ulong h=mix(key);
+  unsigned char f=fingerprint(h);
+  ulong i=home(table,h);
+  int found=0;
+  while ( table->fp[i]!=0 ) {
+    if ( table->fp[i]==f && table->nodes[i].value==key ) {
+      found=1;
+      if ( match==NULL || match(table->nodes[i].obj,data) ) {
+	stats_leave(prev);
+	return table->nodes[i].obj;
+      }
+    }
+    i=next_slot(table,i);
+  }
+  // all the entries with the key are in the same table
+  if ( !found && table->old_nodes!=NULL ) {
+    i=home_in(h,table->old_size);
+    while ( table->old_fp[i]!=0 ) {
+      if ( table->old_fp[i]==f && table->old_nodes[i].value==key && (match==NULL || match(table->old_nodes[i].obj,data)) ) {
+	stats_leave(prev);
+	return table->old_nodes[i].obj;
+      }
+      if ( ++i==table->old_size ) i=0;
+    }
+  }
+  stats_leave(prev);
+  return NULL;
+}
+
+void hash_prefetch(hashtable table,ulong key) {
+  ulong h=mix(key);
+  ulong i=home(table,h);
+  __builtin_prefetch(&table->fp[i]);
+  __builtin_prefetch(&table->nodes[i]);
+  if ( table->old_nodes!=NULL ) {
+    i=home_in(h,table->old_size);
+    __builtin_prefetch(&table->old_fp[i]);
+    __builtin_prefetch(&table->old_nodes[i]);
+  }
+}
+
+__ptr_t hash_home_obj(hashtable table,ulong key) {
+  ulong h=mix(key);
+  unsigned char f=fingerprint(h);
+  ulong i=home(table,h);
+  if ( table->fp[i]==f && table->nodes[i].value==key ) return table->nodes[i].obj;
+  if ( table->old_nodes!=NULL ) {
+    i=home_in(h,table->old_size);
+    if ( table->old_fp[i]==f && table->old_nodes[i].value==key ) return table->old_nodes[i].obj;
+  }
+  return NULL;
+}
+
+void hash_iter_init(hashtable table,HASH_ITER *it) {
+  it->pos=0;
+  it->old=0;
+}
+
+/* next node of the traversal (NULL at the end) */
+hashnode* hash_iter_next(hashtable table,HASH_ITER *it) {
+  if ( !it->old ) {
+    while ( it->pos<HASHSIZE(table) ) {
+      ulong i=it->pos++;
+      if ( table->fp[i]!=0 ) return &table->nodes[i];
     }
+    it->old=1;
+    it->pos=0;
+  }
+  if ( table->old_nodes==NULL ) return NULL;
+  while ( it->pos<table->old_size ) {
+    ulong i=it->pos++;
+    if ( table->old_fp[i]!=0 ) return &table->old_nodes[i];
+  }
+  return NULL;
+}
+
+/*********************************************************************************/
+// Sharded table
 
-    if (table->last_node==NULL)
+// the shard is chosen with other bits of the key than the slot and the
+// fingerprint in the table of the shard (mix), so the tables of the
+// shards are as evenly loaded as a single table
+unsigned int hash_mt_shard(HASH_MT* mt,ulong key) {
+  return (unsigned int)(((key*0x9e3779b97f4a7c15ULL)>>32)%mt->nshards);
+}
+
+HASH_MT* new_hash_mt(ulong hashsize,unsigned int nshards) {
+  HASH_MT* mt;
+  unsigned int i;
+
+  if ( nshards==0 ) nshards=1;
+  if ( (mt=(HASH_MT*)malloc(sizeof(HASH_MT)))==NULL ) return NULL;
+  if ( posix_memalign((void**)&mt->shards,sizeof(struct hash_mt_shard),sizeof(struct hash_mt_shard)*nshards) ) {
+    free(mt);
+    return NULL;
+  }
+  for(i=0;i<nshards;++i) {
+    if ( (mt->shards[i].table=new_hashtable(hashsize/nshards))==NULL ) {
+      mt->nshards=i;
+      free_hash_mt(mt);
       return NULL;
-    return table->last_node;
-  } 
-  // Next in bucket
-  table->last_node=table->last_node->next;
-  if (table->last_node==NULL) return next_hashnode(table);
-  return table->last_node;
+    }
+    pthread_mutex_init(&mt->shards[i].lock,NULL);
+  }
+  mt->nshards=nshards;
+  return mt;
+}
+
+void free_hash_mt(HASH_MT* mt) {
+  unsigned int i;
+  if ( mt==NULL ) return;
+  for(i=0;i<mt->nshards;++i) {
+    free_hashtable(mt->shards[i].table);
+    pthread_mutex_destroy(&mt->shards[i].lock);
+  }
+  free(mt->shards);
+  free(mt);
+}
+
+hashtable hash_mt_lock(HASH_MT* mt,ulong key) {
+  struct hash_mt_shard *s=&mt->shards[hash_mt_shard(mt,key)];
+  pthread_mutex_lock(&s->lock);
+  return s->table;
+}
+
+void hash_mt_unlock(HASH_MT* mt,ulong key) {
+  pthread_mutex_unlock(&mt->shards[hash_mt_shard(mt,key)].lock);
+}
+
+int hash_mt_insere(HASH_MT* mt,ulong key,__ptr_t obj) {
+  int r=insere(hash_mt_lock(mt,key),key,obj);
+  hash_mt_unlock(mt,key);
+  return r;
+}
+
+__ptr_t hash_mt_lookup(HASH_MT* mt,ulong key,HASH_MATCH_FN match,void *data) {
+  __ptr_t obj=hash_lookup(hash_mt_lock(mt,key),key,match,data);
+  hash_mt_unlock(mt,key);
+  return obj;
+}
+
+__ptr_t hash_mt_find_delete(HASH_MT* mt,ulong key,HASH_MATCH_FN match,void *data) {
+  __ptr_t obj=find_delete(hash_mt_lock(mt,key),key,match,data);
+  hash_mt_unlock(mt,key);
+  return obj;
+}
+
+int hash_mt_reserve(HASH_MT* mt,ulong n_entries) {
+  unsigned int i;
+  int r=0;
+  // a few more entries than the average per shard
+  ulong n=n_entries/mt->nshards+n_entries/mt->nshards/16+1;
+  for(i=0;i<mt->nshards;++i) {
+    pthread_mutex_lock(&mt->shards[i].lock);
+    if ( hash_reserve(mt->shards[i].table,n) ) r=-1;
+    pthread_mutex_unlock(&mt->shards[i].lock);
+  }
+  return r;
 }
-/*
- * Returns all objects stored in a basket by making successive calls
- * the returned objects are deleted from the hash table
- */
-/* __ptr_t next_delete_hash_object(hashtable table) */
-/* { */
-/*   // first time.... */
-/*   if( table->last_bucket>=HASHSIZE(table))  */
-/*     return NULL; */
-    
-/*   if( table->last_node==NULL ) { */
-/*     // find bucket */
-/*     // find next bucket */
-/*     while ( table->last_node == NULL && table->last_bucket+1<HASHSIZE(table)) { */
-/*       ++table->last_bucket; */
-/*       table->last_node = BUCKET(table,table->last_bucket); */
-/*     } */
-/*     if (table->last_node==NULL) */
-/*       return NULL; */
-/*     // delete */
-/*     void *obj=table->last_node->obj; */
-/*     free(table->last_node); */
-/*     table->last_node=NULL; */
-/*     return obj; */
-/*   }  */
-/*   // Next in bucket */
-/*   table->last_node=table->last_node->next; */
-/*   if (table->last_node==NULL) return next_hash_object(table); */
-/*   void *obj=table->last_node->obj; */
-/*   free(table->last_node); */
-/*   table->last_node=NULL; */
-/*   return obj; */
-/* } */
 
+ulong hash_mt_entries(HASH_MT* mt) {
+  unsigned int i;
+  ulong n=0;
+  for(i=0;i<mt->nshards;++i) {
+    pthread_mutex_lock(&mt->shards[i].lock);
+    n+=mt->shards[i].table->n_entries;
+    pthread_mutex_unlock(&mt->shards[i].lock);
+  }
+  return n;
+}
 
+void hash_mt_iter_init(HASH_MT* mt,HASH_MT_ITER *it) {
+  it->shard=0;
+  hash_iter_init(mt->shards[0].table,&it->it);
+}
+
+hashnode* hash_mt_iter_next(HASH_MT* mt,HASH_MT_ITER *it) {
+  while ( it->shard<mt->nshards ) {
+    hashnode* node=hash_iter_next(mt->shards[it->shard].table,&it->it);
+    if ( node!=NULL ) return node;
+    if ( ++it->shard<mt->nshards )
+      hash_iter_init(mt->shards[it->shard].table,&it->it);
+  }
+  return NULL;
+}
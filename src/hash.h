@@ -22,6 +22,7 @@
 #ifndef HASH
 #define HASH
 #include <stdlib.h>
+#include <pthread.h>
 #if defined (__cplusplus) || (defined (__STDC__) && __STDC__)
 #define __ptr_t         void *
 #else /* Not C++ or ANSI C.  */
@@ -38,20 +39,30 @@
 
 
 struct bucket {
- struct bucket *next;
  ulong value;      /* Value >=0 used as key in the hashing*/ 
  __ptr_t  obj;     /* pointer to a object*/
 };
 typedef struct bucket  hashnode;
 
-
+// Open addressing table (see hash.c): nodes[i] is in use if fp[i]!=0
+// The table grows when it gets full, so pointers to the nodes are only
+// valid until the next insert/upsert/delete/lookup.
 struct hashtable_s {
-  hashnode **buckets; //
-  hashnode **buckets_last; // pointer to the last element of each bucket
-  ulong size;         // number of buckets
+  hashnode *nodes;
+  unsigned char *fp;  // fingerprint of the hash of the key in each node
+  ulong size;         // number of nodes
+  ulong max_entries;  // the table grows when n_entries reaches this value
   ulong last_bucket; // used in searchs/ hash traversals
   ulong n_entries; // number of entries in the hashtable
   hashnode* last_node;
+  void *data;      // owned by the user of the table (e.g., the memory of the objects)
+  // previous (smaller) table while the table grows: its entries are
+  // moved to nodes a few at a time by the following operations
+  hashnode *old_nodes;
+  unsigned char *old_fp;
+  ulong old_size;
+  ulong old_entries;  // entries not moved yet
+  ulong old_pos;      // next slot of the old table to move
 };
 
 #ifndef HASHSIZE
@@ -60,8 +71,15 @@ struct hashtable_s {
 //typedef hashnode **hashtable;
 typedef struct hashtable_s* hashtable;
 
+// returns TRUE if obj is the object searched
+typedef int (*HASH_MATCH_FN)(__ptr_t obj,void *data);
+
 /* functions */
+// hashsize: initial number of nodes (the table grows as needed, so it
+// is only a hint)
 hashtable new_hashtable(ulong hashsize);
+// makes room for n_entries entries (at once, without incremental moves)
+int hash_reserve(hashtable,ulong n_entries);
 __ptr_t get_next_object(hashtable,ulong);
 __ptr_t delete(hashtable,ulong,__ptr_t);
 //__ptr_t replace_object(hashtable,ulong,__ptr_t);
@@ -69,11 +87,75 @@ __ptr_t get_object(hashtable,ulong);
 int insere(hashtable,ulong,__ptr_t);
 void free_hashtable(hashtable);
 void reset_hashtable(hashtable);
+// find and delete in one probe: removes the first object with the key
+// accepted by match (any if match is NULL) and returns it (or NULL)
+__ptr_t find_delete(hashtable,ulong,HASH_MATCH_FN match,void *data);
+// find or insert in one probe: returns a pointer to the first object
+// with the key accepted by match or, if there is none (*found==0), to
+// the object (NULL) of a new entry with the key. NULL if out of memory.
+__ptr_t* upsert(hashtable,ulong,HASH_MATCH_FN match,void *data,int *found);
 
-
+// objects with the same key are returned by get_object/get_next_object
+// in the order they were inserted
 void init_hash_traversal(hashtable table);
 __ptr_t next_hash_object(hashtable table);
 __ptr_t next_hashnode(hashtable table);
-//__ptr_t next_delete_hash_object(hashtable table);
 void hashtable_stats(hashtable table);
+
+// Lookups and traversals that do not change the table: the position of
+// a traversal is kept by the caller (HASH_ITER) and the entries are not
+// moved while the table grows, so several threads may search or traverse
+// a table at the same time (as long as no thread changes it)
+typedef struct {
+  ulong pos;  // next slot to visit
+  int old;    // visiting the entries not moved yet (old table)
+} HASH_ITER;
+// first object with the key accepted by match (any if match is NULL)
+__ptr_t hash_lookup(hashtable,ulong,HASH_MATCH_FN match,void *data);
+void hash_iter_init(hashtable table,HASH_ITER *it);
+hashnode* hash_iter_next(hashtable table,HASH_ITER *it);
+// prefetches the slots of the key: the slots of a batch of keys can be
+// prefetched before the keys are looked up, so the cache misses of the
+// batch overlap instead of happening one after the other
+void hash_prefetch(hashtable table,ulong key);
+// object in the home slot of the key if the slot holds the key (NULL
+// otherwise): only the home slot is read, without probing, so it is a
+// hint to prefetch and not a lookup
+__ptr_t hash_home_obj(hashtable table,ulong key);
+
+// Sharded table for several threads: the keys are spread over nshards
+// tables with a lock each, so threads changing the entries of different
+// shards do not wait for each other. The hash_mt_* operations lock the
+// shard of the key; hash_mt_lock/hash_mt_unlock do several operations
+// in the table of a shard at once (e.g., a lookup and an insert).
+struct hash_mt_shard {
+  pthread_mutex_t lock;
+  hashtable table;
+} __attribute__((aligned(64)));  // a cache line per shard
+
+struct hash_mt_s {
+  unsigned int nshards;
+  struct hash_mt_shard *shards;
+};
+typedef struct hash_mt_s HASH_MT;
+
+typedef struct {
+  unsigned int shard;
+  HASH_ITER it;
+} HASH_MT_ITER;
+
+// hashsize: initial number of nodes of all the shards
+HASH_MT* new_hash_mt(ulong hashsize,unsigned int nshards);
+void free_hash_mt(HASH_MT* mt);
+unsigned int hash_mt_shard(HASH_MT* mt,ulong key);
+hashtable hash_mt_lock(HASH_MT* mt,ulong key);
+void hash_mt_unlock(HASH_MT* mt,ulong key);
+int hash_mt_insere(HASH_MT* mt,ulong key,__ptr_t obj);
+__ptr_t hash_mt_lookup(HASH_MT* mt,ulong key,HASH_MATCH_FN match,void *data);
+__ptr_t hash_mt_find_delete(HASH_MT* mt,ulong key,HASH_MATCH_FN match,void *data);
+int hash_mt_reserve(HASH_MT* mt,ulong n_entries);
+ulong hash_mt_entries(HASH_MT* mt);
+// traversal of all the shards (no thread may change the table)
+void hash_mt_iter_init(HASH_MT* mt,HASH_MT_ITER *it);
+hashnode* hash_mt_iter_next(HASH_MT* mt,HASH_MT_ITER *it);
 #endif
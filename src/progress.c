@@ -0,0 +1,116 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "progress.h"
+
+// seconds between two reports
+#define PROGRESS_TTY_INTERVAL 1.0
+#define PROGRESS_LOG_INTERVAL 30.0
+// seconds between two reads of the clock
+#define PROGRESS_CHECK_INTERVAL 0.1
+// records processed before the first read of the clock
+#define PROGRESS_FIRST_CHECK 1000
+
+unsigned long long progress_next=0;
+unsigned long long progress_last=0;
+
+static int progress_tty=-1;
+static int progress_line=0;      // a line is being updated (tty)
+static double progress_t0=0.0;   // start of the loop
+static double progress_tprint;
+static unsigned long long progress_count0;
+static unsigned long long progress_pos0;
+
+static double progress_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+static void progress_start(double t,unsigned long long count,unsigned long long pos) {
+  progress_done();
+  progress_t0=progress_tprint=t;
+  progress_count0=count;
+  progress_pos0=pos;
+  progress_last=count;
+  progress_next=count+PROGRESS_FIRST_CHECK;
+}
+
+void progress_report(const char *unit,unsigned long long count,unsigned long long pos,unsigned long long size) {
+  double t=progress_now();
+  double elapsed,rate,mbs;
+  unsigned long long step;
+  char line[256];
+  int len;
+
+  if ( progress_tty<0 ) progress_tty=isatty(fileno(stderr));
+  // first report or a new loop
+  if ( progress_t0==0.0 || count<progress_last ) {
+    progress_start(t,count,pos);
+    return;
+  }
+  elapsed=t-progress_t0;
+  rate=(elapsed>0?(count-progress_count0)/elapsed:0);
+  step=rate*PROGRESS_CHECK_INTERVAL;
+  progress_last=count;
+  progress_next=count+(step>0?step:1);
+  if ( t-progress_tprint<(progress_tty?PROGRESS_TTY_INTERVAL:PROGRESS_LOG_INTERVAL) )
+    return;
+  progress_tprint=t;
+  mbs=(pos>progress_pos0?(pos-progress_pos0)/1e6/elapsed:0);
+  len=snprintf(line,sizeof(line),"%llu %s, %.0f %s/s, %.1f MB/s",count,unit,rate,unit,mbs);
+  if ( size>0 && pos<=size ) {
+    len+=snprintf(&line[len],sizeof(line)-len,", %.1f%%",100.0*pos/size);
+    if ( pos>progress_pos0 ) {
+      unsigned long eta=(size-pos)*elapsed/(pos-progress_pos0);
+      snprintf(&line[len],sizeof(line)-len,", ETA %lu:%02lu:%02lu",eta/3600,(eta/60)%60,eta%60);
+    }
+  }
+  if ( progress_tty ) {
+    // \033[K: clear the rest of the line
+    fprintf(stderr,"\r%s\033[K",line);
+    progress_line=1;
+  } else
+    fprintf(stderr,"%s\n",line);
+  fflush(stderr);
+}
+
+void progress_done(void) {
+  if ( progress_line ) {
+    fprintf(stderr,"\n");
+    fflush(stderr);
+  }
+  progress_line=0;
+  progress_t0=0.0;
+  progress_last=progress_next=0;
+}
+
+unsigned long long progress_file_size(const char *filename) {
+  struct stat st;
+  if ( stat(filename,&st) || !S_ISREG(st.st_mode) ) return 0;
+  return st.st_size;
+}
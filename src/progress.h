@@ -0,0 +1,51 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+// Progress of the main loops (reads, alignments, ...) on stderr
+// The loops give the number of records processed so far, which is
+// compared with a threshold: the clock is only read every ~0.1s of
+// work and a report is printed every second when stderr is a
+// terminal (the line is updated in place) or every 30 seconds
+// otherwise (one line per report, for log files). The reports
+// include the records/s, the MB/s of input (compressed bytes) and,
+// when the size of the input is known, the % of the input consumed
+// and the estimated time to finish.
+
+// number of records at which the clock is checked again
+extern unsigned long long progress_next;
+extern unsigned long long progress_last;
+
+// pos: input bytes consumed, size: size of the input (0 if not known)
+void progress_report(const char *unit,unsigned long long count,unsigned long long pos,unsigned long long size);
+// ends the current loop (a new one is started by the next report)
+void progress_done(void);
+// size of a regular file (0 otherwise)
+unsigned long long progress_file_size(const char *filename);
+
+static inline int progress_due(unsigned long long count) {
+  return count>=progress_next || count<progress_last;
+}
+
+#endif
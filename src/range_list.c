@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "range_list.h"
+#include "stats.h"
 
 /*****************************************************************************/
 
@@ -169,8 +170,11 @@ void free_rl(RL_Tree* range) {
 RL_Tree* set_in_rl(RL_Tree* tree,NUM number,STATUS status) {
 
   /* */
-  if ( number >0 && number <=tree->range_max)
+  if ( number >0 && number <=tree->range_max) {
+    int prev=stats_enter(STATS_RANGE);
     set_in(number,ROOT(tree),1,ROOT_INTERVAL(tree),tree->range_max,tree,status);
+    stats_leave(prev);
+  }
 #ifdef DEBUG
   printf("Setting: %d  size=%d\n",number,tree->size);
 #endif
@@ -201,9 +205,12 @@ void rl_all(RL_Tree* tree,STATUS status) {
  *
  */
 BOOLEAN  in_rl(RL_Tree* tree,NUM number) { 
-  if ( number <1 && number >tree->range_max)
+  if ( number <1 || number >tree->range_max)
     return FALSE;
-  return in_tree(number,tree,ROOT(tree),1,ROOT_INTERVAL(tree));
+  int prev=stats_enter(STATS_RANGE);
+  BOOLEAN in=in_tree(number,tree,ROOT(tree),1,ROOT_INTERVAL(tree));
+  stats_leave(prev);
+  return in;
 }
 /*
  *
@@ -224,9 +231,13 @@ BOOLEAN  freeze_rl(RL_Tree* range) {
  * Constraint:range1->max==range2->max
  */
 RL_Tree* minus_rl(RL_Tree* range1,RL_Tree* range2) {
+  NUM n;
   if (range1->range_max!=range2->range_max) 
     return NULL;
   //!!!!tree_minus(range1,range2,ROOT(range1),ROOT(range2),1,ROOT_INTERVAL(range1),range1->range_max);
+  // remove the numbers in range2 one at a time
+  for(n=rl_next_in_bigger(range2,0);n>0;n=rl_next_in_bigger(range2,n))
+    set_in_rl(range1,n,OUT);
   return range1;
 }
 
@@ -291,7 +302,8 @@ void shift_right(RL_Tree *tree,const NUM idx,const long nnodes){
   long n=idx+nnodes;
   RL_Node *s=tree->root;
 
-  if (nnodes<=0) return;
+  // nnodes+1 nodes are moved (idx..idx+nnodes)
+  if (nnodes<0) return;
   //print_nodes(tree);
   while(n>=idx) {
     s[n+1].leaf=s[n].leaf;
@@ -833,6 +845,8 @@ NUM next_min(RL_Tree *tree,NUM node,NUM node_num,NUM interval,NUM max,NUM min) {
     NUM found;
     node_num2=node_num+(quadrant-1)*interval2;
     quadrant_max=QUADRANT_MAX_VALUE(node_num,quadrant,interval2,max);
+    // skip the quadrants with numbers smaller than min
+    if ( quadrant_max<min ) continue;
     //------------------------------------------
     status=quadrant_status(NODE(tree,node),quadrant);
     switch(status) {
@@ -0,0 +1,243 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "readahead.h"
+
+// Single-producer/single-consumer ring of batches
+// head is only written by the producer and tail by the consumer. The
+// ring can hold all batches so a push never blocks. A pop only takes
+// the lock (and sleeps) when the ring is empty.
+struct ra_ring {
+  READAHEAD_BATCH *slot[READAHEAD_NBATCHES];
+  atomic_ulong head;
+  atomic_ulong tail;
+  atomic_int waiting;       // the consumer is (about to be) sleeping
+  pthread_cond_t cond;
+};
+
+struct readahead_s {
+  ZFILE *zf;
+  unsigned long long offset;// offset of the next byte read from zf
+  READAHEAD_BATCH batches[READAHEAD_NBATCHES];
+  struct ra_ring full;      // producer -> consumer
+  struct ra_ring free;      // consumer -> producer
+  READAHEAD_BATCH *cur;     // batch in use by the consumer
+  atomic_int stop;
+  pthread_mutex_t lock;
+  pthread_t thread;
+  int started;
+  // bytes of an incomplete entry read after the end of the last batch
+  char *carry;
+  unsigned long carry_len;
+  unsigned long carry_size;
+};
+
+static void ring_init(struct ra_ring *r) {
+  atomic_init(&r->head,0);
+  atomic_init(&r->tail,0);
+  atomic_init(&r->waiting,0);
+  pthread_cond_init(&r->cond,NULL);
+}
+
+static void ring_push(READAHEAD *ra,struct ra_ring *r,READAHEAD_BATCH *b) {
+  unsigned long h=atomic_load_explicit(&r->head,memory_order_relaxed);
+  r->slot[h%READAHEAD_NBATCHES]=b;
+  atomic_store(&r->head,h+1);
+  if ( atomic_load(&r->waiting) ) {
+    pthread_mutex_lock(&ra->lock);
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&ra->lock);
+  }
+}
+
+// returns NULL if the ring is empty and the reader was stopped
+static READAHEAD_BATCH* ring_pop(READAHEAD *ra,struct ra_ring *r) {
+  unsigned long t=atomic_load_explicit(&r->tail,memory_order_relaxed);
+  READAHEAD_BATCH *b;
+  if ( atomic_load_explicit(&r->head,memory_order_acquire)==t ) {
+    pthread_mutex_lock(&ra->lock);
+    atomic_store(&r->waiting,1);
+    while ( atomic_load(&r->head)==t && !atomic_load(&ra->stop) )
+      pthread_cond_wait(&r->cond,&ra->lock);
+    atomic_store(&r->waiting,0);
+    pthread_mutex_unlock(&ra->lock);
+    if ( atomic_load(&r->head)==t ) return NULL;
+  }
+  b=r->slot[t%READAHEAD_NBATCHES];
+  atomic_store_explicit(&r->tail,t+1,memory_order_release);
+  return b;
+}
+
+static int grow(char **buf,unsigned long *size,unsigned long new_size) {
+  char *n=(char*)realloc(*buf,new_size+1);
+  if ( n==NULL ) return -1;
+  *buf=n;
+  *size=new_size;
+  return 0;
+}
+
+// fill b with complete entries
+static void readahead_fill(READAHEAD *ra,READAHEAD_BATCH *b) {
+  unsigned long scanned=0,cut=0;
+  unsigned int lines=0;
+
+  b->offset=ra->offset-ra->carry_len;
+  b->eof=0;
+  b->errmsg=NULL;
+  if ( ra->carry_len>b->size && grow(&b->data,&b->size,ra->carry_len*2) ) {
+    b->errmsg="unable to allocate memory";
+    b->len=0;
+    b->eof=1;
+    return;
+  }
+  memcpy(b->data,ra->carry,ra->carry_len);
+  b->len=ra->carry_len;
+  ra->carry_len=0;
+  while ( 1 ) {
+    long n;
+    if ( b->len==b->size ) {
+      // the batch is full: stop at the end of the last complete entry
+      if ( cut>0 ) break;
+      // an entry larger than the batch
+      if ( grow(&b->data,&b->size,b->size*2) ) {
+	b->errmsg="unable to allocate memory";
+	b->eof=1;
+	break;
+      }
+    }
+    n=zfile_read(ra->zf,&b->data[b->len],b->size-b->len);
+    if ( n<0 ) b->errmsg=zfile_error(ra->zf);
+    if ( n<=0 ) {
+      b->eof=1;
+      break;
+    }
+    ra->offset+=n;
+    b->len+=n;
+    // count the lines
+    while ( scanned<b->len ) {
+      char *nl=(char*)memchr(&b->data[scanned],'\n',b->len-scanned);
+      if ( nl==NULL ) {
+	scanned=b->len;
+	break;
+      }
+      scanned=nl-b->data+1;
+      if ( ++lines==4 ) {
+	lines=0;
+	cut=scanned;
+      }
+    }
+    if ( atomic_load_explicit(&ra->stop,memory_order_relaxed) ) break;
+  }
+  if ( !b->eof && cut<b->len ) {
+    // keep the incomplete entry for the next batch
+    unsigned long left=b->len-cut;
+    if ( left>ra->carry_size && grow(&ra->carry,&ra->carry_size,left) ) {
+      b->errmsg="unable to allocate memory";
+      b->eof=1;
+    } else {
+      memcpy(ra->carry,&b->data[cut],left);
+      ra->carry_len=left;
+      b->len=cut;
+    }
+  }
+  b->data[b->len]='\0';
+}
+
+static void* readahead_producer(void *arg) {
+  READAHEAD *ra=(READAHEAD*)arg;
+  while ( !atomic_load(&ra->stop) ) {
+    READAHEAD_BATCH *b=ring_pop(ra,&ra->free);
+    if ( b==NULL ) break;
+    readahead_fill(ra,b);
+    ring_push(ra,&ra->full,b);
+    if ( b->eof ) break;
+  }
+  return NULL;
+}
+
+READAHEAD* readahead_start(ZFILE* zf,unsigned long long offset,unsigned long batch_size) {
+  READAHEAD *ra=(READAHEAD*)calloc(1,sizeof(READAHEAD));
+  int i;
+  if ( ra==NULL ) return NULL;
+  ra->zf=zf;
+  ra->offset=offset;
+  atomic_init(&ra->stop,0);
+  pthread_mutex_init(&ra->lock,NULL);
+  ring_init(&ra->full);
+  ring_init(&ra->free);
+  for (i=0;i<READAHEAD_NBATCHES;++i) {
+    READAHEAD_BATCH *b=&ra->batches[i];
+    b->size=batch_size;
+    b->data=(char*)malloc(batch_size+1);
+    if ( b->data==NULL ) {
+      readahead_stop(ra);
+      return NULL;
+    }
+    b->data[0]='\0';
+    ring_push(ra,&ra->free,b);
+  }
+  if ( pthread_create(&ra->thread,NULL,readahead_producer,ra) ) {
+    readahead_stop(ra);
+    return NULL;
+  }
+  ra->started=1;
+  return ra;
+}
+
+READAHEAD_BATCH* readahead_next(READAHEAD* ra) {
+  if ( ra->cur!=NULL ) {
+    // no more batches after the last one
+    if ( ra->cur->eof ) return ra->cur;
+    ring_push(ra,&ra->free,ra->cur);
+  }
+  ra->cur=ring_pop(ra,&ra->full);
+  return ra->cur;
+}
+
+// error found after the data of the current batch
+const char* readahead_error(READAHEAD* ra) {
+  return (ra->cur!=NULL?ra->cur->errmsg:NULL);
+}
+
+void readahead_stop(READAHEAD* ra) {
+  int i;
+  if ( ra->started ) {
+    pthread_mutex_lock(&ra->lock);
+    atomic_store(&ra->stop,1);
+    pthread_cond_broadcast(&ra->free.cond);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->thread,NULL);
+  }
+  for (i=0;i<READAHEAD_NBATCHES;++i)
+    if ( ra->batches[i].data!=NULL ) free(ra->batches[i].data);
+  if ( ra->carry!=NULL ) free(ra->carry);
+  pthread_cond_destroy(&ra->full.cond);
+  pthread_cond_destroy(&ra->free.cond);
+  pthread_mutex_destroy(&ra->lock);
+  free(ra);
+}
@@ -0,0 +1,59 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include "zfile.h"
+
+// Read-ahead of a file by a producer thread
+// The thread reads (and decompresses) the file and splits the data in
+// batches of complete fastq entries (groups of 4 lines). The batches
+// are passed to the consumer through a single-producer/single-consumer
+// ring, so the consumer parses the entries while the next batches are
+// being read.
+
+// number of batches in use (by the producer, the consumer or in the ring)
+#define READAHEAD_NBATCHES 6
+
+typedef struct readahead_batch {
+  char *data;               // a \0 is always kept after the data
+  unsigned long len;
+  unsigned long size;
+  unsigned long long offset;// offset in the (uncompressed) file of data[0]
+  int eof;                  // last batch
+  const char *errmsg;       // not NULL if reading failed after the data
+} READAHEAD_BATCH;
+
+typedef struct readahead_s READAHEAD;
+
+// start reading zf (positioned at offset) in a new thread
+// zf should not be used until readahead_stop is called
+READAHEAD* readahead_start(ZFILE* zf,unsigned long long offset,unsigned long batch_size);
+// returns the next batch (the previous batch is given back to the producer)
+READAHEAD_BATCH* readahead_next(READAHEAD* ra);
+// error found after the data of the current batch (NULL if none)
+const char* readahead_error(READAHEAD* ra);
+// stop the thread and free the batches
+void readahead_stop(READAHEAD* ra);
+
+#endif
@@ -0,0 +1,379 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fastq.h"
+#include "spill.h"
+
+unsigned long long spill_max_mem=0;
+
+struct spill_part {
+  FILE *f;                 // temporary file (NULL if there are no records)
+  char *buf;
+  unsigned long long n;    // number of records
+  int reading;
+  int has_next;            // next was read by spill_peek
+  SPILL_RECORD next;
+};
+
+// record: id, offset, length of the name and the name
+#define SPILL_HDR_SIZE 20
+
+// peak memory used by the index of a partition (included in index_mem)
+static unsigned long part_index_peak=0;
+
+static void max_mem_option(const char *val,void *data) {
+  char *end;
+  unsigned long long m=strtoull(val,&end,10);
+  switch (*end) {
+  case 'k':
+  case 'K': m<<=10; ++end; break;
+  case 'm':
+  case 'M': m<<=20; ++end; break;
+  case 'g':
+  case 'G': m<<=30; ++end; break;
+  }
+  if ( *val<'0' || *val>'9' || *end!='\0' || m==0 ) {
+    PRINT_ERROR("Invalid value for --max-mem: %s",val);
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  spill_max_mem=m;
+}
+
+int spill_parse_options(int argc,char **argv) {
+  return fastq_parse_option(argc,argv,"--max-mem",TRUE,max_mem_option,NULL);
+}
+
+unsigned int spill_nparts(FASTQ_FILE *fd) {
+  unsigned long long size=fastq_data_size(fd);
+  unsigned long long n;
+  if ( size==0 ) return SPILL_DEFAULT_PARTS;
+  // the index of the read names of short reads uses up to 1/2 of the
+  // size of the data and half of spill_max_mem is left for the buffers
+  n=size/2/(spill_max_mem/2+1)+1;
+  return (unsigned int)(n>SPILL_MAX_PARTS?SPILL_MAX_PARTS:n);
+}
+
+SPILL* spill_new(unsigned int nparts) {
+  SPILL *s=(SPILL*)calloc(1,sizeof(SPILL));
+  if ( s!=NULL ) s->parts=(struct spill_part*)calloc(nparts,sizeof(struct spill_part));
+  if ( s==NULL || s->parts==NULL ) {
+    PRINT_ERROR("unable to allocate %lu bytes of memory",(unsigned long)(sizeof(SPILL)+nparts*sizeof(struct spill_part)));
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  s->nparts=nparts;
+  // two sets of partitions use at most 1/2 of spill_max_mem
+  s->buf_size=spill_max_mem/4/nparts;
+  if ( s->buf_size<SPILL_MIN_BUFFER ) s->buf_size=SPILL_MIN_BUFFER;
+  if ( s->buf_size>SPILL_MAX_BUFFER ) s->buf_size=SPILL_MAX_BUFFER;
+  return s;
+}
+
+static void part_close(struct spill_part *p) {
+  if ( p->f!=NULL ) fclose(p->f);
+  free(p->buf);
+  p->f=NULL;
+  p->buf=NULL;
+  p->n=0;
+  p->has_next=FALSE;
+}
+
+void spill_free(SPILL *s) {
+  unsigned int p;
+  for(p=0;p<s->nparts;++p) part_close(&s->parts[p]);
+  free(s->parts);
+  free(s->name);
+  free(s->first);
+  free(s);
+}
+
+// the name is hashed with FNV-1a (and mixed as in hash.c): the
+// partitions do not depend on the hash function of the index
+unsigned int spill_part(SPILL *s,FASTQ_SPAN name) {
+  unsigned long long h=14695981039346656037ULL;
+  unsigned long i;
+  for(i=0;i<name.len;++i) {
+    h^=(unsigned char)name.s[i];
+    h*=1099511628211ULL;
+  }
+  h^=h>>33;
+  h*=0xff51afd7ed558ccdULL;
+  h^=h>>33;
+  return (unsigned int)(((h>>32)*s->nparts)>>32);
+}
+
+static void spill_io_error(const char *what) {
+  PRINT_ERROR("Error while %s a temporary file (--max-mem)",what);
+  exit(SYS_INT_ERROR_EXIT_STATUS);
+}
+
+// temporary files are removed as soon as they are created
+static FILE* spill_tmpfile(char **buf,unsigned long size) {
+  char name[MAX_FILENAME_LENGTH];
+  const char *dir=getenv("TMPDIR");
+  FILE *f;
+  int fd;
+  if ( dir==NULL || *dir=='\0' ) dir="/tmp";
+  snprintf(name,sizeof(name),"%s/fastq_utils.XXXXXX",dir);
+  if ( (fd=mkstemp(name))<0 ) {
+    PRINT_ERROR("Unable to create a temporary file in %s",dir);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  unlink(name);
+  if ( (f=fdopen(fd,"w+"))==NULL ) spill_io_error("opening");
+  if ( (*buf=(char*)malloc(size))==NULL ) {
+    PRINT_ERROR("unable to allocate %lu bytes of memory",size);
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+  setvbuf(f,*buf,_IOFBF,size);
+  return f;
+}
+
+void spill_write(SPILL *s,unsigned int part,FASTQ_SPAN name,unsigned long long id,long long offset) {
+  struct spill_part *p=&s->parts[part];
+  unsigned char h[SPILL_HDR_SIZE];
+  unsigned int len=(unsigned int)name.len;
+
+  if ( p->f==NULL ) {
+    p->f=spill_tmpfile(&p->buf,s->buf_size);
+  } else if ( p->reading ) {
+    if ( fseek(p->f,0,SEEK_END) ) spill_io_error("writing to");
+    p->reading=FALSE;
+    p->has_next=FALSE;
+  }
+  memcpy(h,&id,8);
+  memcpy(&h[8],&offset,8);
+  memcpy(&h[16],&len,4);
+  if ( fwrite(h,1,SPILL_HDR_SIZE,p->f)!=SPILL_HDR_SIZE ||
+       (len>0 && fwrite(name.s,1,len,p->f)!=len) )
+    spill_io_error("writing to");
+  p->n++;
+  s->n++;
+}
+
+void spill_rewind(SPILL *s,unsigned int part) {
+  struct spill_part *p=&s->parts[part];
+  p->has_next=FALSE;
+  if ( p->f==NULL ) return;
+  // also flushes the records written
+  if ( fseek(p->f,0,SEEK_SET) ) spill_io_error("reading");
+  p->reading=TRUE;
+}
+
+int spill_peek(SPILL *s,unsigned int part,SPILL_RECORD *r) {
+  struct spill_part *p=&s->parts[part];
+  unsigned char h[SPILL_HDR_SIZE];
+  unsigned int len;
+  size_t n;
+
+  if ( p->has_next ) {
+    *r=p->next;
+    return TRUE;
+  }
+  if ( p->f==NULL ) return FALSE;
+  if ( !p->reading ) spill_rewind(s,part);
+  n=fread(h,1,SPILL_HDR_SIZE,p->f);
+  if ( n==0 && feof(p->f) ) return FALSE;
+  if ( n!=SPILL_HDR_SIZE ) spill_io_error("reading");
+  memcpy(&p->next.id,h,8);
+  memcpy(&p->next.offset,&h[8],8);
+  memcpy(&len,&h[16],4);
+  if ( len+1>s->name_size ) {
+    s->name_size=len+1;
+    if ( (s->name=(char*)realloc(s->name,s->name_size))==NULL ) {
+      PRINT_ERROR("unable to allocate %lu bytes of memory",s->name_size);
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+  }
+  if ( len>0 && fread(s->name,1,len,p->f)!=len ) spill_io_error("reading");
+  s->name[len]='\0';
+  p->next.name.s=s->name;
+  p->next.name.len=len;
+  p->has_next=TRUE;
+  *r=p->next;
+  return TRUE;
+}
+
+int spill_read(SPILL *s,unsigned int part,SPILL_RECORD *r) {
+  if ( !spill_peek(s,part,r) ) return FALSE;
+  s->parts[part].has_next=FALSE;
+  return TRUE;
+}
+
+// keeps a copy of the name of r
+static void set_first(SPILL *s,SPILL_RECORD *first,SPILL_RECORD *r) {
+  if ( r->name.len+1>s->first_size ) {
+    s->first_size=r->name.len+1;
+    if ( (s->first=(char*)realloc(s->first,s->first_size))==NULL ) {
+      PRINT_ERROR("unable to allocate %lu bytes of memory",s->first_size);
+      exit(SYS_INT_ERROR_EXIT_STATUS);
+    }
+  }
+  memcpy(s->first,r->name.s,r->name.len);
+  s->first[r->name.len]='\0';
+  *first=*r;
+  first->name.s=s->first;
+}
+
+// index of the read names of a partition
+static hashtable part_index(SPILL *s,unsigned int part,unsigned long *mem0) {
+  *mem0=index_mem;
+  return fastq_index_new(s->parts[part].n);
+}
+
+static void part_index_add(hashtable index,SPILL_RECORD *r) {
+  if ( new_indexentry(index,r->name.s,r->name.len,r->offset)==NULL ) {
+    PRINT_ERROR("Unable to allocate memory for the index");
+    exit(SYS_INT_ERROR_EXIT_STATUS);
+  }
+}
+
+// index_mem: only the peak memory of the indexes of the partitions is
+// counted
+static void part_index_free(hashtable index,unsigned long mem0) {
+  unsigned long mem=fastq_index_mem(index);
+  fastq_index_free(index);
+  index_mem=mem0;
+  if ( mem>part_index_peak ) {
+    index_mem+=mem-part_index_peak;
+    part_index_peak=mem;
+  }
+}
+
+int spill_first_duplicate(SPILL *s,SPILL_RECORD *dup) {
+  SPILL_RECORD r;
+  unsigned long mem0;
+  unsigned int p;
+  dup->id=SPILL_NONE;
+  for(p=0;p<s->nparts;++p) {
+    hashtable index=part_index(s,p,&mem0);
+    spill_rewind(s,p);
+    // the first duplicate of the partition (if before dup)
+    while ( spill_read(s,p,&r) && r.id<dup->id ) {
+      if ( fastq_index_lookup_span(index,r.name)!=NULL ) {
+	set_first(s,dup,&r);
+	break;
+      }
+      part_index_add(index,&r);
+    }
+    part_index_free(index,mem0);
+  }
+  return dup->id!=SPILL_NONE;
+}
+
+unsigned long long spill_match(SPILL *s1,SPILL *s2,SPILL *res1,SPILL *res2,SPILL_RECORD *first) {
+  static const FASTQ_SPAN noname={"",0};
+  unsigned long long n1=0;
+  SPILL_RECORD r;
+  unsigned long mem0;
+  unsigned int p;
+
+  first->id=SPILL_NONE;
+  for(p=0;p<s1->nparts;++p) {
+    hashtable index=part_index(s1,p,&mem0);
+    spill_rewind(s1,p);
+    while ( spill_read(s1,p,&r) ) part_index_add(index,&r);
+    spill_rewind(s2,p);
+    while ( spill_read(s2,p,&r) ) {
+      INDEX_ENTRY* e=fastq_index_remove_span(index,r.name);
+      if ( e==NULL && r.id<first->id ) set_first(s2,first,&r);
+      if ( res2!=NULL ) spill_write(res2,p,noname,r.id,(e==NULL?-1:(long long)e->entry_start));
+      if ( e!=NULL ) free_indexentry(e);
+    }
+    n1+=index->n_entries;
+    if ( res1!=NULL && index->n_entries>0 ) {
+      spill_rewind(s1,p);
+      while ( spill_read(s1,p,&r) )
+	if ( fastq_index_lookup_span(index,r.name)!=NULL )
+	  spill_write(res1,p,noname,r.id,r.offset);
+    }
+    part_index_free(index,mem0);
+    part_close(&s1->parts[p]);
+    part_close(&s2->parts[p]);
+  }
+  return n1;
+}
+
+/* ******************************************************************************* */
+struct spill_scan {
+  SPILL *s;
+  FASTQ_FILE *fd;
+  FASTQ_FILE *vfd;
+  int flags;
+  SPILL *paired;
+};
+
+// scan checked by spill_error_hook
+static struct spill_scan *scan_checked=NULL;
+
+static void spill_check(struct spill_scan *sc) {
+  SPILL_RECORD r;
+  if ( (sc->flags&SPILL_DUPLICATES) && spill_first_duplicate(sc->s,&r) ) {
+    PRINT_ERROR("Error in file %s: line %llu: duplicated sequence %.*s",sc->fd->filename,r.id,(int)r.name.len,r.name.s);
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+  }
+  if ( sc->paired!=NULL ) {
+    sc->s->unmatched=spill_match(sc->paired,sc->s,NULL,NULL,&r);
+    if ( r.id!=SPILL_NONE ) {
+      PRINT_ERROR("Error in file %s: line %llu: unpaired read - %.*s",sc->fd->filename,r.id,(int)r.name.len,r.name.s);
+      exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+    }
+  }
+}
+
+// a format error in fd: the errors in the read names found before are
+// reported first
+static void spill_error_hook(void) {
+  spill_check(scan_checked);
+}
+
+static void spill_add(FASTQ_FILE *fd,FASTQ_ENTRY *e,void *data) {
+  struct spill_scan *sc=(struct spill_scan*)data;
+  FASTQ_SPAN rn=fastq_readname_span(fd,e,TRUE);
+  spill_write(sc->s,spill_part(sc->s,rn),rn,fd->cline,e->offset);
+  if ( sc->vfd!=NULL && fastq_validate_entry(sc->vfd,e) )
+    exit(FASTQ_FORMAT_ERROR_EXIT_STATUS);
+}
+
+void spill_readnames(FASTQ_FILE *fd,SPILL *s,FASTQ_FILE *vfd,int flags,SPILL *paired) {
+  struct spill_scan sc={s,fd,vfd,flags,paired};
+  int check=((flags&SPILL_DUPLICATES) || paired!=NULL);
+  FASTQ_ENTRY *e=fastq_new_entry();
+
+  if ( check ) {
+    scan_checked=&sc;
+    fastq_format_error_hook=spill_error_hook;
+  }
+  fastq_scan(fd,e,flags&SPILL_STATS,flags&SPILL_GZ_INDEX,spill_add,&sc);
+  fastq_format_error_hook=NULL;
+  scan_checked=NULL;
+  free(e->hdr1);
+  free(e->hdr2);
+  free(e->seq);
+  free(e->qual);
+  free(e);
+  if ( check ) spill_check(&sc);
+}
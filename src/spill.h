@@ -0,0 +1,125 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#ifndef SPILL_H
+#define SPILL_H
+
+// fastq.h must be included before
+
+// Read names partitioned on disk (--max-mem)
+// The index of all the read names of a file may not fit in memory. The
+// read names are then written to P temporary files (partitions),
+// according to a hash of the names (Grace hash partitioning), and the
+// checks that need all the read names (duplicates, pairing the reads
+// of two files) are done one partition at a time: the same name is
+// always in the same partition, so only the index of the names of a
+// partition is kept in memory.
+// A record (name, id, offset) is written for each read. The id is the
+// line of the entry (fd->cline after reading it), so the first error
+// in the file (the one reported without --max-mem) is the record with
+// the smallest id in all the partitions.
+
+// default number of partitions when the size of the data is not known
+#define SPILL_DEFAULT_PARTS 64
+// at most two sets of partitions are open at the same time
+#define SPILL_MAX_PARTS 256
+// buffer of the temporary files
+#define SPILL_MIN_BUFFER (4*1024)
+#define SPILL_MAX_BUFFER (1024*1024)
+// records without an offset/id
+#define SPILL_NONE ((unsigned long long)-1)
+
+struct spill_record {
+  FASTQ_SPAN name;         // valid until the next spill_read or spill_peek
+  unsigned long long id;
+  long long offset;
+};
+typedef struct spill_record SPILL_RECORD;
+
+struct spill_part;
+struct spill_s {
+  unsigned int nparts;
+  struct spill_part *parts;
+  unsigned long long n;    // number of records
+  unsigned long buf_size;  // buffer of each temporary file
+  unsigned long long unmatched; // see spill_readnames
+  char *name;              // read names of the records read
+  unsigned long name_size;
+  char *first;             // name of the record found by spill_match/spill_first_duplicate
+  unsigned long first_size;
+};
+typedef struct spill_s SPILL;
+
+// --max-mem: maximum memory (bytes) used by the index of the read
+// names (0: no limit, the index is kept in memory)
+extern unsigned long long spill_max_mem;
+// processes --max-mem N[KMG] and removes it from argv: returns the new
+// number of arguments
+int spill_parse_options(int argc,char **argv);
+// number of partitions needed for the read names of fd (1: the index
+// fits in spill_max_mem)
+unsigned int spill_nparts(FASTQ_FILE *fd);
+
+SPILL* spill_new(unsigned int nparts);
+void spill_free(SPILL *s);
+unsigned int spill_part(SPILL *s,FASTQ_SPAN name);
+void spill_write(SPILL *s,unsigned int part,FASTQ_SPAN name,unsigned long long id,long long offset);
+// the records of a partition are read in the order they were written
+// (spill_read returns FALSE at the end of the partition)
+int spill_read(SPILL *s,unsigned int part,SPILL_RECORD *r);
+// next record of the partition (not consumed)
+int spill_peek(SPILL *s,unsigned int part,SPILL_RECORD *r);
+// reads the partition again from its first record
+void spill_rewind(SPILL *s,unsigned int part);
+
+// first record (smallest id) with the same name as a previous record:
+// FALSE if there are no duplicated names
+int spill_first_duplicate(SPILL *s,SPILL_RECORD *dup);
+// Pairs the records of s1 (no duplicated names) with the ones of s2,
+// partition by partition, in the order of s2 (as removing the names of
+// s2 from an index of s1). The partitions of s1 and s2 are removed.
+// For each record of s2, a record with its id and the offset of the
+// s1 record paired (-1 if not paired) is written to res2 and the
+// records of s1 left are written to res1 (res1 and res2 are optional,
+// with the partitions of s1 and s2, and have no names).
+// first: the first (smallest id) record of s2 not paired (id
+// SPILL_NONE if all were paired). Returns the number of records of s1
+// not paired.
+unsigned long long spill_match(SPILL *s1,SPILL *s2,SPILL *res1,SPILL *res2,SPILL_RECORD *first);
+
+// Reads the entries of fd (fastq_scan) and writes the read names to s.
+// The entries are validated with vfd (if not NULL) and the read names
+// of a pair of files are checked as fastq_info does:
+//  - SPILL_DUPLICATES: exits with an error if a name is duplicated
+//  - paired (not NULL): the reads of s are paired with the ones of
+//    paired (spill_match): exits with an error if a read of fd is not
+//    paired and sets s->unmatched to the number of reads of paired not
+//    paired (the partitions of paired and s are removed)
+// These errors are reported before the format errors found in the
+// following entries. SPILL_STATS and SPILL_GZ_INDEX are passed to
+// fastq_scan.
+#define SPILL_STATS 1
+#define SPILL_GZ_INDEX 2
+#define SPILL_DUPLICATES 4
+void spill_readnames(FASTQ_FILE *fd,SPILL *s,FASTQ_FILE *vfd,int flags,SPILL *paired);
+
+#endif
@@ -0,0 +1,220 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "fastq.h"
+#include "stats.h"
+
+int stats_enabled=0;
+
+#define STATS_OTHER STATS_NSTAGES
+
+typedef struct {
+  unsigned long long calls;
+  unsigned long long records;
+  unsigned long long bytes_in;
+  unsigned long long bytes_out;
+  unsigned long long wall_ns;
+  unsigned long long cpu_ns;
+} STATS_COUNTERS;
+
+static STATS_COUNTERS stats[STATS_NSTAGES];
+static const char* stage_names[STATS_NSTAGES]={"read","parse","hash","range","write","bam_read","bam_write"};
+// the thread CPU time is only measured in the stages that do I/O in
+// large blocks (it needs a system call)
+static const int stage_cpu[STATS_NSTAGES]={1,0,0,0,1,0,0};
+
+// stage the thread is in and when it entered it
+static __thread int cur_stage=STATS_OTHER;
+static __thread unsigned long long cur_t0;
+static __thread unsigned long long cur_cpu0;
+
+static FILE* stats_fd=NULL;
+static const char* stats_file=NULL;
+static const char* stats_tool=NULL;
+static unsigned long long stats_t0;
+
+#define HW_COUNTERS 4
+static const char* hw_names[HW_COUNTERS]={"instructions","cycles","cache_misses","branch_misses"};
+static int hw_fd[HW_COUNTERS]={-1,-1,-1,-1};
+
+#define ATOMIC_ADD(x,v) __atomic_fetch_add(&(x),(v),__ATOMIC_RELAXED)
+
+static inline unsigned long long clock_ns(clockid_t clk) {
+  struct timespec ts;
+  clock_gettime(clk,&ts);
+  return (unsigned long long)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+// stop the clock of the current stage and start the clock of stage
+static void stats_switch(int stage) {
+  unsigned long long now=clock_ns(CLOCK_MONOTONIC);
+  if ( cur_stage!=STATS_OTHER ) {
+    ATOMIC_ADD(stats[cur_stage].wall_ns,now-cur_t0);
+    if ( stage_cpu[cur_stage] )
+      ATOMIC_ADD(stats[cur_stage].cpu_ns,clock_ns(CLOCK_THREAD_CPUTIME_ID)-cur_cpu0);
+  }
+  if ( stage!=STATS_OTHER && stage_cpu[stage] )
+    cur_cpu0=clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  cur_stage=stage;
+  cur_t0=now;
+}
+
+int stats_begin(int stage) {
+  int prev=cur_stage;
+  ATOMIC_ADD(stats[stage].calls,1);
+  // nested calls in the same stage
+  if ( prev!=stage ) stats_switch(stage);
+  return prev;
+}
+
+void stats_end(int prev) {
+  if ( prev!=cur_stage ) stats_switch(prev);
+}
+
+void stats_count_slow(int stage,unsigned long long records,unsigned long long bytes_in,unsigned long long bytes_out) {
+  if ( records ) ATOMIC_ADD(stats[stage].records,records);
+  if ( bytes_in ) ATOMIC_ADD(stats[stage].bytes_in,bytes_in);
+  if ( bytes_out ) ATOMIC_ADD(stats[stage].bytes_out,bytes_out);
+}
+
+// Hardware counters (process wide, including the threads started
+// afterwards). They are not available in all systems (permissions,
+// virtual machines, ...) and are reported as null in that case.
+static void hw_counters_start(void) {
+#ifdef __linux__
+  static const unsigned long long config[HW_COUNTERS]={PERF_COUNT_HW_INSTRUCTIONS,PERF_COUNT_HW_CPU_CYCLES,PERF_COUNT_HW_CACHE_MISSES,PERF_COUNT_HW_BRANCH_MISSES};
+  int i;
+  for(i=0;i<HW_COUNTERS;++i) {
+    struct perf_event_attr attr;
+    memset(&attr,0,sizeof(attr));
+    attr.size=sizeof(attr);
+    attr.type=PERF_TYPE_HARDWARE;
+    attr.config=config[i];
+    attr.inherit=1;
+    attr.exclude_kernel=1;
+    attr.exclude_hv=1;
+    hw_fd[i]=(int)syscall(__NR_perf_event_open,&attr,0,-1,-1,0);
+  }
+#endif
+}
+
+static void print_hw_counters(FILE *fd) {
+  int i;
+  fprintf(fd,"  \"hw_counters\": {");
+  for(i=0;i<HW_COUNTERS;++i) {
+    unsigned long long v;
+    fprintf(fd,"%s\n    \"%s\": ",(i?",":""),hw_names[i]);
+    if ( hw_fd[i]>=0 && read(hw_fd[i],&v,sizeof(v))==sizeof(v) )
+      fprintf(fd,"%llu",v);
+    else
+      fprintf(fd,"null");
+  }
+  fprintf(fd,"\n  }\n");
+}
+
+static double ns2s(unsigned long long ns) {
+  return ns/1e9;
+}
+
+static void stats_report(void) {
+  FILE *fd=stats_fd;
+  struct rusage ru;
+  int i;
+  double wall=ns2s(clock_ns(CLOCK_MONOTONIC)-stats_t0);
+  unsigned long long records;
+
+  stats_enabled=0;
+  getrusage(RUSAGE_SELF,&ru);
+  // records processed: fastq entries or BAM alignments
+  records=stats[STATS_PARSE].records+stats[STATS_BAM_READ].records;
+  fprintf(fd,"{\n");
+  fprintf(fd,"  \"tool\": \"%s\",\n",stats_tool);
+  fprintf(fd,"  \"version\": \"%s\",\n",VERSION);
+  fprintf(fd,"  \"wall_s\": %.6f,\n",wall);
+  fprintf(fd,"  \"user_s\": %.6f,\n",ru.ru_utime.tv_sec+ru.ru_utime.tv_usec/1e6);
+  fprintf(fd,"  \"sys_s\": %.6f,\n",ru.ru_stime.tv_sec+ru.ru_stime.tv_usec/1e6);
+  fprintf(fd,"  \"max_rss_kb\": %ld,\n",ru.ru_maxrss);
+  fprintf(fd,"  \"records\": %llu,\n",records);
+  fprintf(fd,"  \"records_per_s\": %.1f,\n",(wall>0?records/wall:0.0));
+  fprintf(fd,"  \"stages\": {");
+  for(i=0;i<STATS_NSTAGES;++i) {
+    STATS_COUNTERS *s=&stats[i];
+    double swall=ns2s(s->wall_ns);
+    fprintf(fd,"%s\n    \"%s\": {",(i?",":""),stage_names[i]);
+    fprintf(fd,"\"calls\": %llu, \"records\": %llu, ",s->calls,s->records);
+    fprintf(fd,"\"bytes_in\": %llu, \"bytes_out\": %llu, ",s->bytes_in,s->bytes_out);
+    fprintf(fd,"\"wall_s\": %.6f, ",swall);
+    if ( stage_cpu[i] ) fprintf(fd,"\"cpu_s\": %.6f, ",ns2s(s->cpu_ns));
+    else fprintf(fd,"\"cpu_s\": null, ");
+    fprintf(fd,"\"records_per_s\": %.1f}",(swall>0?s->records/swall:0.0));
+  }
+  fprintf(fd,"\n  },\n");
+  print_hw_counters(fd);
+  fprintf(fd,"}\n");
+  if ( fclose(fd) ) {
+    PRINT_ERROR("Error while writing %s",stats_file);
+  }
+}
+
+static void stats_start(const char *file,const char *prog) {
+  const char *s=strrchr(prog,'/');
+  if ( stats_enabled ) {
+    PRINT_ERROR("--stats given more than once");
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  if ( (stats_fd=fopen(file,"w"))==NULL ) {
+    PRINT_ERROR("Unable to open %s",file);
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  stats_file=file;
+  stats_tool=(s==NULL?prog:s+1);
+  stats_t0=clock_ns(CLOCK_MONOTONIC);
+  hw_counters_start();
+  stats_enabled=1;
+  atexit(stats_report);
+}
+
+// data: name of the program
+static void stats_option(const char *val,void *data) {
+  if ( *val=='\0' ) {
+    PRINT_ERROR("Invalid value for --stats");
+    exit(PARAMS_ERROR_EXIT_STATUS);
+  }
+  stats_start(val,(const char*)data);
+}
+
+int stats_parse_options(int argc,char **argv) {
+  return fastq_parse_option(argc,argv,"--stats",TRUE,stats_option,argv[0]);
+}
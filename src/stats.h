@@ -0,0 +1,72 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#ifndef STATS_H
+#define STATS_H
+
+// Run time statistics (--stats file.json)
+// The shared layers (file reading, parsing, hashing, range lists,
+// writing and the BAM loops) report the time spent and the amount of
+// data processed in each stage. When the option is not given the cost
+// is a test of stats_enabled per call.
+
+typedef enum {
+  STATS_READ=0,   // reading and decompressing the input files
+  STATS_PARSE,    // splitting the data in records
+  STATS_HASH,     // hash table insert/lookup/delete
+  STATS_RANGE,    // range list set/in
+  STATS_WRITE,    // compressing and writing the output
+  STATS_BAM_READ,
+  STATS_BAM_WRITE,
+  STATS_NSTAGES
+} STATS_STAGE;
+
+extern int stats_enabled;
+
+// time is counted in one stage at a time: entering a stage stops the
+// clock of the stage the thread was in (returned) until stats_leave
+int stats_begin(int stage);
+void stats_end(int prev);
+void stats_count_slow(int stage,unsigned long long records,unsigned long long bytes_in,unsigned long long bytes_out);
+
+static inline int stats_enter(int stage) {
+  if ( !stats_enabled ) return -1;
+  return stats_begin(stage);
+}
+
+static inline void stats_leave(int prev) {
+  if ( prev>=0 ) stats_end(prev);
+}
+
+static inline void stats_count(int stage,unsigned long long records,unsigned long long bytes_in,unsigned long long bytes_out) {
+  if ( stats_enabled ) stats_count_slow(stage,records,bytes_in,bytes_out);
+}
+
+// evaluates f (a read/write function that returns the number of bytes
+// or <0 on EOF/error) as one record of the stage
+#define STATS_RECORD_IO(stage,f) ({ int stats_p_=stats_enter(stage); long stats_r_=(f); stats_leave(stats_p_); if ( stats_r_>=0 ) stats_count(stage,1,0,stats_r_); stats_r_; })
+
+// handles --stats file.json (or --stats=file.json) and removes it from
+// argv: returns the new argc. The report is written when the program exits.
+int stats_parse_options(int argc,char **argv);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "writer.h"
+
+WRITER* writer_new(WRITER_SINK sink,void *dest,unsigned long size) {
+  WRITER *w=(WRITER*)malloc(sizeof(WRITER));
+  if ( w==NULL ) return NULL;
+  w->buf=(char*)malloc(size);
+  if ( w->buf==NULL ) {
+    free(w);
+    return NULL;
+  }
+  w->size=size;
+  w->used=0;
+  w->sink=sink;
+  w->dest=dest;
+  return w;
+}
+
+int writer_flush(WRITER* w) {
+  unsigned long n=w->used;
+  if ( n==0 ) return 0;
+  w->used=0;
+  return w->sink(w->dest,w->buf,n);
+}
+
+// the data does not fit in the free space of the buffer
+int writer_write_slow(WRITER* w,const char *s,unsigned long len) {
+  if ( writer_flush(w) ) return -1;
+  // large strings are not copied
+  if ( len>=w->size ) return w->sink(w->dest,s,len);
+  memcpy(w->buf,s,len);
+  w->used=len;
+  return 0;
+}
+
+int writer_close(WRITER* w) {
+  int r=writer_flush(w);
+  free(w->buf);
+  free(w);
+  return r;
+}
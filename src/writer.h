@@ -0,0 +1,67 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <string.h>
+
+// Buffered writer
+// The data is appended to a buffer (the lengths are given by the
+// caller) and passed to the sink (compressor, file, ...) in large
+// chunks, instead of calling the sink for each string written.
+
+// writes len bytes of data: returns 0 on success
+typedef int (*WRITER_SINK)(void *dest,const char *data,unsigned long len);
+
+typedef struct writer_s {
+  char *buf;
+  unsigned long size;
+  unsigned long used;
+  WRITER_SINK sink;
+  void *dest;
+} WRITER;
+
+#define WRITER_BUFFER_SIZE (256*1024)
+
+WRITER* writer_new(WRITER_SINK sink,void *dest,unsigned long size);
+// pass the buffered data to the sink: returns 0 on success
+int writer_flush(WRITER* w);
+// flush and free the writer: returns 0 on success
+int writer_close(WRITER* w);
+int writer_write_slow(WRITER* w,const char *s,unsigned long len);
+
+// returns 0 on success
+static inline int writer_write(WRITER* w,const char *s,unsigned long len) {
+  if ( len>w->size-w->used ) return writer_write_slow(w,s,len);
+  memcpy(&w->buf[w->used],s,len);
+  w->used+=len;
+  return 0;
+}
+
+static inline int writer_putc(WRITER* w,char c) {
+  if ( w->used==w->size && writer_flush(w) ) return -1;
+  w->buf[w->used++]=c;
+  return 0;
+}
+
+#endif
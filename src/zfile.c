@@ -0,0 +1,857 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <bzlib.h>
+#include <lzma.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "bgzf_mt.h"
+#include "zfile.h"
+#include "stats.h"
+
+// size of the buffer with compressed data
+#define ZFILE_IN_SIZE 131072
+// number of bytes needed to detect the format (BGZF header)
+#define ZFILE_MAGIC_LEN 18
+
+// result of a decompression step
+#define ZSTEP_OK 0       // some input was consumed (or output produced)
+#define ZSTEP_NEED 1     // more input is needed
+#define ZSTEP_END 2      // end of the data
+#define ZSTEP_ERROR -1
+
+// size of the deflate window
+#define ZFILE_WINDOW_SIZE 32768
+#define ZFILE_INDEX_MAGIC "FQGZIDX1"
+
+// gzip access point: state of the decompressor at the end of a deflate
+// block (as in zlib's examples/zran.c)
+typedef struct zfile_point {
+  unsigned long long uoffset; // uncompressed offset
+  unsigned long long coffset; // offset of the first (complete) byte of the next block
+  int bits;                   // bits of the block in the previous byte
+  unsigned int wlen;
+  unsigned int clen;
+  unsigned char *window;      // last wlen bytes of uncompressed data (compressed to clen bytes)
+} ZFILE_POINT;
+
+struct zfile_s {
+  int fd;
+  int close_fd;
+  int seekable;
+  off_t start;                // offset of the file when it was opened
+  unsigned long long size;    // bytes after start (0 if not a regular file)
+  unsigned long long ctell;   // compressed bytes consumed (after each read)
+  ZFILE_FORMAT format;
+  int eof;
+  const char *errmsg;         // not NULL after an error
+  unsigned long long uoffset; // uncompressed offset of the next byte
+  // compressed data
+  unsigned char *in;
+  unsigned long in_pos;
+  unsigned long in_len;
+  unsigned long long in_offset; // offset of in[0] (from start)
+  int in_eof;
+  // decoders
+  int member_end;             // end of a gzip member or bzip2 stream
+  int codec_init;
+  BGZF_MT *bgzf;
+  z_stream zs;
+  bz_stream bzs;
+  lzma_stream xzs;
+#ifdef HAVE_ZSTD
+  ZSTD_DStream *zds;
+  size_t zstd_ret;            // last value returned by ZSTD_decompressStream
+#endif
+  // gzip index
+  int raw;                    // inflating a member from an access point
+  int recording;              // adding access points while reading
+  int index_complete;         // all the file was read while recording
+  unsigned long span;
+  unsigned long long ustep;   // uncompressed offset of the output of a step
+  unsigned char *window;      // circular buffer with the last bytes read
+                              // (followed by a buffer of the same size)
+  unsigned long wpos;
+  unsigned long wlen;
+  ZFILE_POINT *points;
+  unsigned long npoints;
+  unsigned long max_points;
+};
+
+static const char* format_names[]={"plain","gzip","bgzf","bzip2","xz","zstd"};
+
+// read more compressed data (the bytes not consumed are kept)
+static int zfile_fill(ZFILE* zf) {
+  long n;
+  if ( zf->in_pos>0 ) {
+    memmove(zf->in,&zf->in[zf->in_pos],zf->in_len-zf->in_pos);
+    zf->in_offset+=zf->in_pos;
+    zf->in_len-=zf->in_pos;
+    zf->in_pos=0;
+  }
+  if ( zf->in_eof || zf->in_len==ZFILE_IN_SIZE ) return 0;
+  do {
+    n=read(zf->fd,&zf->in[zf->in_len],ZFILE_IN_SIZE-zf->in_len);
+  } while ( n<0 && errno==EINTR );
+  if ( n<0 ) {
+    zf->errmsg=strerror(errno);
+    return -1;
+  }
+  if ( n==0 ) zf->in_eof=1;
+  zf->in_len+=n;
+  return 0;
+}
+
+static ZFILE_FORMAT zfile_detect(const unsigned char *s,unsigned long len) {
+  if ( len>=2 && s[0]==0x1f && s[1]==0x8b ) {
+    if ( bgzf_mt_is_bgzf(s,len) ) return ZFILE_BGZF;
+    return ZFILE_GZIP;
+  }
+  if ( len>=3 && s[0]=='B' && s[1]=='Z' && s[2]=='h' ) return ZFILE_BZIP2;
+  if ( len>=6 && memcmp(s,"\xfd" "7zXZ\0",6)==0 ) return ZFILE_XZ;
+  if ( len>=4 && s[0]==0x28 && s[1]==0xb5 && s[2]==0x2f && s[3]==0xfd ) return ZFILE_ZSTD;
+  return ZFILE_PLAIN;
+}
+
+static int zfile_codec_init(ZFILE* zf) {
+  int err=0;
+  zf->member_end=0;
+  switch(zf->format) {
+  case ZFILE_GZIP:
+  case ZFILE_BGZF:
+    memset(&zf->zs,0,sizeof(z_stream));
+    // 15+16: gzip header and trailer
+    err=(inflateInit2(&zf->zs,15+16)!=Z_OK);
+    break;
+  case ZFILE_BZIP2:
+    memset(&zf->bzs,0,sizeof(bz_stream));
+    err=(BZ2_bzDecompressInit(&zf->bzs,0,0)!=BZ_OK);
+    break;
+  case ZFILE_XZ:
+    memset(&zf->xzs,0,sizeof(lzma_stream));
+    err=(lzma_stream_decoder(&zf->xzs,UINT64_MAX,LZMA_CONCATENATED)!=LZMA_OK);
+    break;
+  case ZFILE_ZSTD:
+#ifdef HAVE_ZSTD
+    zf->zds=ZSTD_createDStream();
+    err=(zf->zds==NULL || ZSTD_isError(ZSTD_initDStream(zf->zds)));
+    zf->zstd_ret=0;
+#else
+    zf->errmsg="zstd compressed files are not supported (fastq_utils was compiled without zstd)";
+    return -1;
+#endif
+    break;
+  default:
+    break;
+  }
+  if ( err ) {
+    zf->errmsg="unable to initialize the decompressor";
+    return -1;
+  }
+  zf->codec_init=1;
+  return 0;
+}
+
+static void zfile_codec_end(ZFILE* zf) {
+  if ( !zf->codec_init ) return;
+  switch(zf->format) {
+  case ZFILE_GZIP:
+  case ZFILE_BGZF:
+    inflateEnd(&zf->zs);
+    break;
+  case ZFILE_BZIP2:
+    BZ2_bzDecompressEnd(&zf->bzs);
+    break;
+  case ZFILE_XZ:
+    lzma_end(&zf->xzs);
+    break;
+  case ZFILE_ZSTD:
+#ifdef HAVE_ZSTD
+    ZSTD_freeDStream(zf->zds);
+#endif
+    break;
+  default:
+    break;
+  }
+  zf->codec_init=0;
+}
+
+/* ******************************************************************************* */
+// decompression steps: decompress the available input into out (at
+// most len bytes) and set *nout with the number of bytes produced
+
+static int zfile_plain_step(ZFILE* zf,char *out,unsigned long len,unsigned long *nout) {
+  unsigned long avail=zf->in_len-zf->in_pos;
+  long n;
+  if ( avail>0 ) {
+    if ( avail>len ) avail=len;
+    memcpy(out,&zf->in[zf->in_pos],avail);
+    zf->in_pos+=avail;
+    *nout=avail;
+    return ZSTEP_OK;
+  }
+  if ( zf->in_eof ) return ZSTEP_END;
+  // no need to copy the data through the input buffer
+  do {
+    n=read(zf->fd,out,len);
+  } while ( n<0 && errno==EINTR );
+  if ( n<0 ) {
+    zf->errmsg=strerror(errno);
+    return ZSTEP_ERROR;
+  }
+  if ( n==0 ) {
+    zf->in_eof=1;
+    return ZSTEP_END;
+  }
+  *nout=n;
+  return ZSTEP_OK;
+}
+
+/* ******************************************************************************* */
+// gzip index
+
+static void zfile_window_add(ZFILE* zf,const unsigned char *s,unsigned long len) {
+  unsigned long first;
+  if ( len>=ZFILE_WINDOW_SIZE ) {
+    memcpy(zf->window,&s[len-ZFILE_WINDOW_SIZE],ZFILE_WINDOW_SIZE);
+    zf->wpos=0;
+    zf->wlen=ZFILE_WINDOW_SIZE;
+    return;
+  }
+  first=ZFILE_WINDOW_SIZE-zf->wpos;
+  if ( first>len ) first=len;
+  memcpy(&zf->window[zf->wpos],s,first);
+  memcpy(zf->window,&s[first],len-first);
+  zf->wpos=(zf->wpos+len)%ZFILE_WINDOW_SIZE;
+  zf->wlen+=len;
+  if ( zf->wlen>ZFILE_WINDOW_SIZE ) zf->wlen=ZFILE_WINDOW_SIZE;
+}
+
+// add an access point at uncompressed offset u (if span bytes were
+// decompressed since the last one)
+// called after a step that ended at the end of a deflate block
+static void zfile_index_add(ZFILE* zf,unsigned long long u) {
+  ZFILE_POINT *p;
+  unsigned char *win;
+  uLongf clen;
+  if ( zf->npoints>0 && u<zf->points[zf->npoints-1].uoffset+zf->span ) return;
+  if ( zf->npoints==zf->max_points ) {
+    unsigned long n=(zf->max_points==0?64:zf->max_points*2);
+    ZFILE_POINT *np=(ZFILE_POINT*)realloc(zf->points,n*sizeof(ZFILE_POINT));
+    if ( np==NULL ) {
+      // the index is not essential
+      zf->recording=0;
+      return;
+    }
+    zf->points=np;
+    zf->max_points=n;
+  }
+  p=&zf->points[zf->npoints];
+  // the window is kept compressed (fastq data compresses well)
+  if ( zf->wlen<ZFILE_WINDOW_SIZE ) {
+    win=zf->window;
+  } else {
+    win=&zf->window[ZFILE_WINDOW_SIZE];
+    memcpy(win,&zf->window[zf->wpos],ZFILE_WINDOW_SIZE-zf->wpos);
+    memcpy(&win[ZFILE_WINDOW_SIZE-zf->wpos],zf->window,zf->wpos);
+  }
+  clen=compressBound(zf->wlen);
+  p->window=(unsigned char*)malloc(clen);
+  if ( p->window==NULL || compress2(p->window,&clen,win,zf->wlen,1)!=Z_OK ) {
+    if ( p->window!=NULL ) free(p->window);
+    zf->recording=0;
+    return;
+  }
+  win=(unsigned char*)realloc(p->window,clen);
+  if ( win!=NULL ) p->window=win;
+  p->uoffset=u;
+  p->coffset=zf->in_offset+zf->in_pos;
+  p->bits=zf->zs.data_type&7;
+  p->wlen=zf->wlen;
+  p->clen=clen;
+  ++zf->npoints;
+}
+
+// restart the decompression at an access point
+static int zfile_index_restore(ZFILE* zf,ZFILE_POINT *p) {
+  unsigned long long c=p->coffset-(p->bits?1:0);
+  uLongf wlen=ZFILE_WINDOW_SIZE;
+  if ( zf->window==NULL ) {
+    zf->window=(unsigned char*)malloc(2*ZFILE_WINDOW_SIZE);
+    if ( zf->window==NULL ) {
+      zf->errmsg="out of memory";
+      return -1;
+    }
+  }
+  if ( uncompress(zf->window,&wlen,p->window,p->clen)!=Z_OK || wlen!=p->wlen ) {
+    zf->errmsg="invalid gzip index";
+    return -1;
+  }
+  if ( lseek(zf->fd,zf->start+c,SEEK_SET)<0 ) return -1;
+  zf->in_pos=zf->in_len=0;
+  zf->in_offset=c;
+  zf->in_eof=0;
+  zf->eof=0;
+  zf->errmsg=NULL;
+  zf->recording=0;
+  zfile_codec_end(zf);
+  memset(&zf->zs,0,sizeof(z_stream));
+  if ( inflateInit2(&zf->zs,-15)!=Z_OK ) {
+    zf->errmsg="unable to initialize the decompressor";
+    return -1;
+  }
+  zf->codec_init=1;
+  zf->member_end=0;
+  zf->raw=1;
+  if ( p->bits ) {
+    if ( zfile_fill(zf) ) return -1;
+    if ( zf->in_len==0 ) {
+      zf->errmsg="unexpected end of file";
+      return -1;
+    }
+    inflatePrime(&zf->zs,p->bits,zf->in[zf->in_pos++]>>(8-p->bits));
+  }
+  if ( inflateSetDictionary(&zf->zs,zf->window,p->wlen)!=Z_OK ) {
+    zf->errmsg="invalid gzip index";
+    return -1;
+  }
+  zf->uoffset=p->uoffset;
+  return 0;
+}
+
+// last access point before offset (NULL if none)
+static ZFILE_POINT* zfile_index_find(ZFILE* zf,unsigned long long offset) {
+  unsigned long lo=0,hi=zf->npoints;
+  if ( zf->npoints==0 || zf->points[0].uoffset>offset ) return NULL;
+  while ( hi-lo>1 ) {
+    unsigned long mid=(lo+hi)/2;
+    if ( zf->points[mid].uoffset<=offset ) lo=mid;
+    else hi=mid;
+  }
+  return &zf->points[lo];
+}
+
+static void zfile_index_free(ZFILE* zf) {
+  unsigned long i;
+  for (i=0;i<zf->npoints;++i) free(zf->points[i].window);
+  if ( zf->points!=NULL ) free(zf->points);
+  zf->points=NULL;
+  zf->npoints=zf->max_points=0;
+  zf->index_complete=0;
+}
+
+static int zfile_gzip_step(ZFILE* zf,char *out,unsigned long len,unsigned long *nout) {
+  unsigned long avail=zf->in_len-zf->in_pos;
+  int ret;
+  if ( zf->member_end && zf->raw ) {
+    // skip the trailer of a member decoded from an access point
+    if ( avail<8+2 && !zf->in_eof ) return ZSTEP_NEED;
+    if ( avail<8 ) return ZSTEP_END;
+    zf->in_pos+=8;
+    avail-=8;
+    zf->raw=0;
+    if ( inflateReset2(&zf->zs,15+16)!=Z_OK ) {
+      zf->errmsg="unable to initialize the decompressor";
+      return ZSTEP_ERROR;
+    }
+  }
+  if ( zf->member_end ) {
+    // another member follows? (trailing garbage is ignored as in gzread)
+    if ( avail<2 && !zf->in_eof ) return ZSTEP_NEED;
+    if ( avail<2 || zf->in[zf->in_pos]!=0x1f || zf->in[zf->in_pos+1]!=0x8b ) return ZSTEP_END;
+    inflateReset(&zf->zs);
+    zf->member_end=0;
+  }
+  if ( avail==0 && !zf->in_eof ) return ZSTEP_NEED;
+  if ( len>UINT_MAX ) len=UINT_MAX;
+  zf->zs.next_in=&zf->in[zf->in_pos];
+  zf->zs.avail_in=avail;
+  zf->zs.next_out=(unsigned char*)out;
+  zf->zs.avail_out=len;
+  // stop at the end of each block while the index is built
+  ret=inflate(&zf->zs,zf->recording?Z_BLOCK:Z_NO_FLUSH);
+  zf->in_pos+=avail-zf->zs.avail_in;
+  *nout=len-zf->zs.avail_out;
+  if ( zf->recording && (ret==Z_OK || ret==Z_STREAM_END) ) {
+    zfile_window_add(zf,(unsigned char*)out,*nout);
+    // end of a block (or header) that is not the last block
+    if ( (zf->zs.data_type&128) && !(zf->zs.data_type&64) && ret==Z_OK )
+      zfile_index_add(zf,zf->ustep+*nout);
+  }
+  switch(ret) {
+  case Z_STREAM_END:
+    zf->member_end=1;
+  case Z_OK:
+    return ZSTEP_OK;
+  case Z_BUF_ERROR:
+    if ( !zf->in_eof ) return ZSTEP_NEED;
+    zf->errmsg="unexpected end of file";
+    return ZSTEP_ERROR;
+  case Z_MEM_ERROR:
+    zf->errmsg="out of memory";
+    return ZSTEP_ERROR;
+  default:
+    zf->errmsg=(zf->zs.msg!=NULL?zf->zs.msg:"invalid gzip data");
+    return ZSTEP_ERROR;
+  }
+}
+
+static int zfile_bzip2_step(ZFILE* zf,char *out,unsigned long len,unsigned long *nout) {
+  unsigned long avail=zf->in_len-zf->in_pos;
+  int ret;
+  if ( zf->member_end ) {
+    // concatenated streams (e.g., pbzip2)
+    if ( avail<3 && !zf->in_eof ) return ZSTEP_NEED;
+    if ( avail<3 || memcmp(&zf->in[zf->in_pos],"BZh",3) ) return ZSTEP_END;
+    zfile_codec_end(zf);
+    if ( zfile_codec_init(zf) ) return ZSTEP_ERROR;
+  }
+  // the decoder may still have data to output when there is no input
+  if ( avail==0 && !zf->in_eof ) return ZSTEP_NEED;
+  if ( len>UINT_MAX ) len=UINT_MAX;
+  if ( avail>UINT_MAX ) avail=UINT_MAX;
+  zf->bzs.next_in=(char*)&zf->in[zf->in_pos];
+  zf->bzs.avail_in=avail;
+  zf->bzs.next_out=out;
+  zf->bzs.avail_out=len;
+  ret=BZ2_bzDecompress(&zf->bzs);
+  zf->in_pos+=avail-zf->bzs.avail_in;
+  *nout=len-zf->bzs.avail_out;
+  switch(ret) {
+  case BZ_STREAM_END:
+    zf->member_end=1;
+  case BZ_OK:
+    if ( *nout==0 && zf->bzs.avail_in==avail ) {
+      // no progress
+      if ( !zf->in_eof ) return ZSTEP_NEED;
+      zf->errmsg="unexpected end of file";
+      return ZSTEP_ERROR;
+    }
+    return ZSTEP_OK;
+  case BZ_MEM_ERROR:
+    zf->errmsg="out of memory";
+    return ZSTEP_ERROR;
+  default:
+    zf->errmsg="invalid bzip2 data";
+    return ZSTEP_ERROR;
+  }
+}
+
+static int zfile_xz_step(ZFILE* zf,char *out,unsigned long len,unsigned long *nout) {
+  unsigned long avail=zf->in_len-zf->in_pos;
+  lzma_ret ret;
+  if ( zf->member_end ) return ZSTEP_END;
+  if ( avail==0 && !zf->in_eof ) return ZSTEP_NEED;
+  zf->xzs.next_in=&zf->in[zf->in_pos];
+  zf->xzs.avail_in=avail;
+  zf->xzs.next_out=(uint8_t*)out;
+  zf->xzs.avail_out=len;
+  ret=lzma_code(&zf->xzs,zf->in_eof?LZMA_FINISH:LZMA_RUN);
+  zf->in_pos+=avail-zf->xzs.avail_in;
+  *nout=len-zf->xzs.avail_out;
+  switch(ret) {
+  case LZMA_STREAM_END:
+    // all the (concatenated) streams were decoded
+    zf->member_end=1;
+    return ZSTEP_OK;
+  case LZMA_OK:
+    if ( *nout==0 && zf->xzs.avail_in==avail ) return ZSTEP_NEED;
+    return ZSTEP_OK;
+  case LZMA_BUF_ERROR:
+    zf->errmsg="unexpected end of file";
+    return ZSTEP_ERROR;
+  case LZMA_MEM_ERROR:
+    zf->errmsg="out of memory";
+    return ZSTEP_ERROR;
+  default:
+    zf->errmsg="invalid xz data";
+    return ZSTEP_ERROR;
+  }
+}
+
+#ifdef HAVE_ZSTD
+static int zfile_zstd_step(ZFILE* zf,char *out,unsigned long len,unsigned long *nout) {
+  ZSTD_inBuffer in;
+  ZSTD_outBuffer o;
+  unsigned long avail=zf->in_len-zf->in_pos;
+  if ( avail==0 ) {
+    if ( !zf->in_eof ) return ZSTEP_NEED;
+    // all frames should be complete
+    if ( zf->zstd_ret==0 ) return ZSTEP_END;
+  }
+  in.src=&zf->in[zf->in_pos];
+  in.size=avail;
+  in.pos=0;
+  o.dst=out;
+  o.size=len;
+  o.pos=0;
+  zf->zstd_ret=ZSTD_decompressStream(zf->zds,&o,&in);
+  if ( ZSTD_isError(zf->zstd_ret) ) {
+    zf->errmsg=ZSTD_getErrorName(zf->zstd_ret);
+    return ZSTEP_ERROR;
+  }
+  zf->in_pos+=in.pos;
+  *nout=o.pos;
+  if ( o.pos==0 && in.pos==0 ) {
+    // no progress
+    if ( !zf->in_eof ) return ZSTEP_NEED;
+    zf->errmsg="unexpected end of file";
+    return ZSTEP_ERROR;
+  }
+  return ZSTEP_OK;
+}
+#endif
+
+/* ******************************************************************************* */
+static ZFILE* zfile_open_(const char *filename,int nthreads) {
+  ZFILE* zf;
+  int is_stdin=(filename[0]=='-' && filename[1]=='\0');
+  int fd;
+  struct stat st;
+
+  fd=(is_stdin?fileno(stdin):open(filename,O_RDONLY));
+  if ( fd<0 ) return NULL;
+  zf=(ZFILE*)calloc(1,sizeof(ZFILE));
+  if ( zf!=NULL ) zf->in=(unsigned char*)malloc(ZFILE_IN_SIZE);
+  if ( zf==NULL || zf->in==NULL ) {
+    if ( zf!=NULL ) free(zf);
+    if ( !is_stdin ) close(fd);
+    return NULL;
+  }
+  zf->fd=fd;
+  zf->close_fd=!is_stdin;
+  zf->start=lseek(fd,0,SEEK_CUR);
+  zf->seekable=(zf->start>=0 && fstat(fd,&st)==0 && S_ISREG(st.st_mode));
+  if ( zf->seekable && st.st_size>zf->start ) zf->size=st.st_size-zf->start;
+  // peek the first bytes
+  while ( zf->in_len<ZFILE_MAGIC_LEN && !zf->in_eof )
+    if ( zfile_fill(zf) ) return zf;
+  zf->format=zfile_detect(zf->in,zf->in_len);
+  if ( zf->format==ZFILE_BGZF && nthreads>1 && zf->seekable ) {
+    // the blocks are read (again) by bgzf_mt
+    if ( lseek(fd,zf->start,SEEK_SET)<0 ||
+	 (zf->bgzf=bgzf_mt_ropen(fd,nthreads))==NULL ) {
+      zf->errmsg="unable to start the decompression threads";
+      return zf;
+    }
+    zf->close_fd=0;
+    zf->in_pos=zf->in_len=0;
+    return zf;
+  }
+  zfile_codec_init(zf);
+  return zf;
+}
+
+ZFILE* zfile_open(const char *filename,int nthreads) {
+  int prev=stats_enter(STATS_READ);
+  ZFILE* zf=zfile_open_(filename,nthreads);
+  stats_leave(prev);
+  return zf;
+}
+
+static long zfile_read_(ZFILE* zf,char *buf,unsigned long len) {
+  unsigned long n=0;
+  if ( zf->errmsg!=NULL ) return -1;
+  if ( zf->bgzf!=NULL ) {
+    long r=bgzf_mt_read(zf->bgzf,buf,len);
+    if ( r<0 ) {
+      zf->errmsg="invalid BGZF block";
+      return -1;
+    }
+    zf->uoffset+=r;
+    return r;
+  }
+  while ( n<len && !zf->eof ) {
+    unsigned long produced=0;
+    int ret;
+    switch(zf->format) {
+    case ZFILE_GZIP:
+    case ZFILE_BGZF:
+      zf->ustep=zf->uoffset+n;
+      ret=zfile_gzip_step(zf,&buf[n],len-n,&produced);
+      break;
+    case ZFILE_BZIP2:
+      ret=zfile_bzip2_step(zf,&buf[n],len-n,&produced);
+      break;
+    case ZFILE_XZ:
+      ret=zfile_xz_step(zf,&buf[n],len-n,&produced);
+      break;
+#ifdef HAVE_ZSTD
+    case ZFILE_ZSTD:
+      ret=zfile_zstd_step(zf,&buf[n],len-n,&produced);
+      break;
+#endif
+    default:
+      ret=zfile_plain_step(zf,&buf[n],len-n,&produced);
+      break;
+    }
+    n+=produced;
+    if ( ret==ZSTEP_END ) {
+      zf->eof=1;
+      if ( zf->recording ) zf->index_complete=1;
+      zf->recording=0;
+    }
+    else if ( ret==ZSTEP_NEED ) {
+      if ( zfile_fill(zf) ) ret=ZSTEP_ERROR;
+    }
+    if ( ret==ZSTEP_ERROR ) {
+      // the data decompressed so far is returned first
+      if ( n>0 ) break;
+      return -1;
+    }
+    // return as soon as there is some data and no input left
+    if ( n>0 && zf->in_pos==zf->in_len && !zf->in_eof ) break;
+  }
+  zf->uoffset+=n;
+  return n;
+}
+
+// plain files are (mostly) read without the input buffer
+static unsigned long long zfile_ctell(ZFILE* zf) {
+  if ( zf->bgzf!=NULL ) return bgzf_mt_coffset(zf->bgzf);
+  if ( zf->format==ZFILE_PLAIN ) return zf->uoffset;
+  return zf->in_offset+zf->in_pos;
+}
+
+// bytes_in: compressed bytes consumed (counted by bgzf_mt when it
+// reads the file), bytes_out: uncompressed bytes
+long zfile_read(ZFILE* zf,char *buf,unsigned long len) {
+  int prev=stats_enter(STATS_READ);
+  unsigned long long in0=zf->in_offset+zf->in_pos;
+  long n=zfile_read_(zf,buf,len);
+  stats_leave(prev);
+  if ( n>0 ) stats_count(STATS_READ,0,(zf->bgzf==NULL?zf->in_offset+zf->in_pos-in0:0),n);
+  __atomic_store_n(&zf->ctell,zfile_ctell(zf),__ATOMIC_RELAXED);
+  return n;
+}
+
+unsigned long long zfile_tell_compressed(ZFILE* zf) {
+  return __atomic_load_n(&zf->ctell,__ATOMIC_RELAXED);
+}
+
+unsigned long long zfile_size(ZFILE* zf) {
+  return zf->size;
+}
+
+int zfile_rewind(ZFILE* zf) {
+  if ( zf->bgzf!=NULL ) {
+    if ( bgzf_mt_seek(zf->bgzf,0) ) return -1;
+    zf->uoffset=0;
+    return 0;
+  }
+  if ( !zf->seekable || lseek(zf->fd,zf->start,SEEK_SET)<0 ) return -1;
+  zf->in_pos=zf->in_len=0;
+  zf->in_offset=0;
+  zf->in_eof=0;
+  zf->raw=0;
+  zf->recording=0;
+  zf->wpos=zf->wlen=0;
+  zf->eof=0;
+  zf->uoffset=0;
+  zf->errmsg=NULL;
+  zfile_codec_end(zf);
+  return zfile_codec_init(zf);
+}
+
+int zfile_seek(ZFILE* zf,unsigned long long offset) {
+  char tmp[16384];
+  if ( zf->bgzf!=NULL ) {
+    if ( bgzf_mt_seek(zf->bgzf,offset) ) return -1;
+    zf->uoffset=offset;
+    return 0;
+  }
+  if ( zf->format==ZFILE_PLAIN && zf->seekable ) {
+    if ( lseek(zf->fd,zf->start+offset,SEEK_SET)<0 ) return -1;
+    zf->in_pos=zf->in_len=0;
+    zf->in_eof=0;
+    zf->eof=0;
+    zf->uoffset=offset;
+    return 0;
+  }
+  if ( zf->npoints>0 ) {
+    // start from the closest access point
+    ZFILE_POINT *p=zfile_index_find(zf,offset);
+    if ( p!=NULL && (offset<zf->uoffset || p->uoffset>zf->uoffset) &&
+	 zfile_index_restore(zf,p) ) return -1;
+  }
+  if ( offset<zf->uoffset && zfile_rewind(zf) ) return -1;
+  // decompress and discard the data up to offset
+  while ( zf->uoffset<offset ) {
+    unsigned long len=sizeof(tmp);
+    if ( offset-zf->uoffset<len ) len=offset-zf->uoffset;
+    if ( zfile_read(zf,tmp,len)<=0 ) return -1;
+  }
+  return 0;
+}
+
+const char* zfile_error(ZFILE* zf) {
+  return zf->errmsg;
+}
+
+int zfile_seekable(ZFILE* zf) {
+  return zf->seekable;
+}
+
+ZFILE_FORMAT zfile_format(ZFILE* zf) {
+  return zf->format;
+}
+
+const char* zfile_format_name(ZFILE_FORMAT format) {
+  return format_names[format];
+}
+
+int zfile_close(ZFILE* zf) {
+  int ret=0;
+  if ( zf->bgzf!=NULL ) ret=bgzf_mt_close(zf->bgzf);
+  zfile_codec_end(zf);
+  zfile_index_free(zf);
+  if ( zf->window!=NULL ) free(zf->window);
+  if ( zf->close_fd && close(zf->fd) ) ret=-1;
+  free(zf->in);
+  free(zf);
+  return ret;
+}
+
+/* ******************************************************************************* */
+// gzip index: public functions
+
+int zfile_index_start(ZFILE* zf,unsigned long span) {
+  if ( zf->bgzf!=NULL || (zf->format!=ZFILE_GZIP && zf->format!=ZFILE_BGZF) ) return -1;
+  if ( zf->window==NULL ) {
+    zf->window=(unsigned char*)malloc(2*ZFILE_WINDOW_SIZE);
+    if ( zf->window==NULL ) return -1;
+  }
+  // the access points are added from the beginning of the file
+  if ( (zf->uoffset>0 || zf->in_offset>0 || zf->in_pos>0) && zfile_rewind(zf) ) return -1;
+  zfile_index_free(zf);
+  zf->span=(span>0?span:ZFILE_INDEX_SPAN);
+  zf->wpos=zf->wlen=0;
+  zf->recording=1;
+  return 0;
+}
+
+int zfile_index_complete(ZFILE* zf) {
+  return zf->index_complete;
+}
+
+// the index is only valid for a file with the same size and
+// modification time
+static int zfile_stat(ZFILE* zf,unsigned long long *size,long long *mtime) {
+  struct stat st;
+  if ( fstat(zf->fd,&st) ) return -1;
+  *size=st.st_size;
+  *mtime=st.st_mtime;
+  return 0;
+}
+
+int zfile_index_save(ZFILE* zf,const char *filename) {
+  unsigned long long size,n=zf->npoints,span=zf->span;
+  long long mtime;
+  unsigned long i;
+  FILE *f;
+  if ( !zf->index_complete || zfile_stat(zf,&size,&mtime) ) return -1;
+  f=fopen(filename,"wb");
+  if ( f==NULL ) return -1;
+  fwrite(ZFILE_INDEX_MAGIC,1,8,f);
+  fwrite(&size,sizeof(size),1,f);
+  fwrite(&mtime,sizeof(mtime),1,f);
+  fwrite(&span,sizeof(span),1,f);
+  fwrite(&n,sizeof(n),1,f);
+  for (i=0;i<zf->npoints;++i) {
+    ZFILE_POINT *p=&zf->points[i];
+    fwrite(&p->uoffset,sizeof(p->uoffset),1,f);
+    fwrite(&p->coffset,sizeof(p->coffset),1,f);
+    fwrite(&p->bits,sizeof(p->bits),1,f);
+    fwrite(&p->wlen,sizeof(p->wlen),1,f);
+    fwrite(&p->clen,sizeof(p->clen),1,f);
+    fwrite(p->window,1,p->clen,f);
+  }
+  if ( ferror(f) ) {
+    fclose(f);
+    unlink(filename);
+    return -1;
+  }
+  if ( fclose(f) ) {
+    unlink(filename);
+    return -1;
+  }
+  return 0;
+}
+
+int zfile_index_load(ZFILE* zf,const char *filename) {
+  unsigned long long size,fsize,n,span,i;
+  long long mtime,fmtime;
+  char magic[8];
+  FILE *f;
+  if ( zf->bgzf!=NULL || (zf->format!=ZFILE_GZIP && zf->format!=ZFILE_BGZF) ) return -1;
+  if ( zfile_stat(zf,&size,&mtime) ) return -1;
+  f=fopen(filename,"rb");
+  if ( f==NULL ) return -1;
+  if ( fread(magic,1,8,f)!=8 || memcmp(magic,ZFILE_INDEX_MAGIC,8) ||
+       fread(&fsize,sizeof(fsize),1,f)!=1 || fread(&fmtime,sizeof(fmtime),1,f)!=1 ||
+       fread(&span,sizeof(span),1,f)!=1 || fread(&n,sizeof(n),1,f)!=1 ||
+       fsize!=size || fmtime!=mtime ) {
+    fclose(f);
+    return -1;
+  }
+  zfile_index_free(zf);
+  zf->points=(ZFILE_POINT*)calloc(n>0?n:1,sizeof(ZFILE_POINT));
+  if ( zf->points==NULL ) {
+    fclose(f);
+    return -1;
+  }
+  zf->max_points=(n>0?n:1);
+  for (i=0;i<n;++i) {
+    ZFILE_POINT *p=&zf->points[i];
+    if ( fread(&p->uoffset,sizeof(p->uoffset),1,f)!=1 ||
+	 fread(&p->coffset,sizeof(p->coffset),1,f)!=1 ||
+	 fread(&p->bits,sizeof(p->bits),1,f)!=1 ||
+	 fread(&p->wlen,sizeof(p->wlen),1,f)!=1 ||
+	 fread(&p->clen,sizeof(p->clen),1,f)!=1 ||
+	 p->bits<0 || p->bits>7 || p->wlen>ZFILE_WINDOW_SIZE || p->clen>compressBound(ZFILE_WINDOW_SIZE) ||
+	 (i>0 && p->uoffset<=zf->points[i-1].uoffset) ||
+	 (p->window=(unsigned char*)malloc(p->clen>0?p->clen:1))==NULL ||
+	 fread(p->window,1,p->clen,f)!=p->clen ) {
+      zf->npoints=i+1;
+      zfile_index_free(zf);
+      fclose(f);
+      return -1;
+    }
+    zf->npoints=i+1;
+  }
+  fclose(f);
+  zf->span=span;
+  zf->index_complete=1;
+  return 0;
+}
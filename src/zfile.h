@@ -0,0 +1,72 @@
+/*
+# =========================================================
+# Copyright 2012-2021,  Nuno A. Fonseca (nuno dot fonseca at gmail dot com)
+#
+# This file is part of fastq_utils.
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# if not, see <http://www.gnu.org/licenses/>.
+#
+#
+# =========================================================
+*/
+#ifndef ZFILE_H
+#define ZFILE_H
+
+// Reading of (possibly) compressed files
+// The compression format is detected from the first bytes of the file
+// (gzip, bzip2, xz, zstd or none) and the data is decompressed in
+// process. Concatenated streams/members are supported for all formats.
+// BGZF files are decompressed by a pool of threads when nthreads>1.
+
+typedef enum { ZFILE_PLAIN=0, ZFILE_GZIP=1, ZFILE_BGZF=2, ZFILE_BZIP2=3, ZFILE_XZ=4, ZFILE_ZSTD=5 } ZFILE_FORMAT;
+
+typedef struct zfile_s ZFILE;
+
+// "-" is the standard input
+ZFILE* zfile_open(const char *filename,int nthreads);
+// returns the number of bytes read, 0 on EOF, -1 on error (see zfile_error)
+long zfile_read(ZFILE* zf,char *buf,unsigned long len);
+// seek to an uncompressed offset
+// non plain files are decompressed from the beginning if offset is
+// before the current position. Returns 0 on success.
+int zfile_seek(ZFILE* zf,unsigned long long offset);
+int zfile_rewind(ZFILE* zf);
+// compressed data consumed so far and size of the file (0 if not
+// known): zfile_tell_compressed can be called from any thread
+unsigned long long zfile_tell_compressed(ZFILE* zf);
+unsigned long long zfile_size(ZFILE* zf);
+const char* zfile_error(ZFILE* zf);
+// TRUE if the file can be rewound
+int zfile_seekable(ZFILE* zf);
+ZFILE_FORMAT zfile_format(ZFILE* zf);
+const char* zfile_format_name(ZFILE_FORMAT format);
+int zfile_close(ZFILE* zf);
+
+// Index of gzip files
+// Access points (the state of the decompressor) are saved every span
+// bytes of uncompressed data while the file is read, so that
+// zfile_seek only decompresses the data after the closest point (as in
+// zlib's examples/zran.c). Only for gzip/BGZF files read by zfile.
+// The 32KB window of each point is stored compressed.
+#define ZFILE_INDEX_SPAN (256*1024)
+// start adding access points (the file is read again from the
+// beginning if needed). Returns 0 on success.
+int zfile_index_start(ZFILE* zf,unsigned long span);
+// TRUE if the index covers the whole file
+int zfile_index_complete(ZFILE* zf);
+// save/load the index to/from a file. Return 0 on success.
+int zfile_index_save(ZFILE* zf,const char *filename);
+int zfile_index_load(ZFILE* zf,const char *filename);
+
+#endif